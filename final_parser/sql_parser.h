@@ -9,7 +9,9 @@ typedef enum {
     OP_SELECT,
     OP_JOIN,
     OP_RENAME,
-    OP_SUBQUERY  // New operation type for nested queries
+    OP_SUBQUERY,  // New operation type for nested queries
+    OP_WITH,      /* Query with common table expressions */
+    OP_CTE_REF    /* Reference to a common table expression */
 } RelOpType;
 
 typedef enum {
@@ -21,12 +23,39 @@ typedef enum {
     COND_NE,
     COND_AND,
     COND_OR,
-    COND_NOT
+    COND_NOT,
+    COND_IN,
+    COND_LIKE  /* Stored as a string comparison against the pattern */
 } CondType;
 
+typedef enum {
+    EXPR_COLUMN,
+    EXPR_INT,
+    EXPR_FLOAT,
+    EXPR_STRING,
+    EXPR_ADD,
+    EXPR_SUB,
+    EXPR_MUL,
+    EXPR_DIV
+} ExprType;
+
+/* Scalar expression tree used in projections and comparisons */
+typedef struct Expr {
+    ExprType type;
+    char *table;          // EXPR_COLUMN: table or alias name
+    char *attr;           // EXPR_COLUMN: attribute name (can include dots)
+    int int_literal;
+    float float_literal;
+    char *str_literal;
+    struct Expr *left;    // Operands of arithmetic nodes
+    struct Expr *right;
+} Expr;
+
 typedef struct Column {
     char *table;     // Table or alias name
     char *attr;      // Attribute name (can include dots for subquery columns)
+    Expr *expr;      // Computed column, NULL for plain column references
+    char *alias;     // Optional output name (AS alias)
     struct Column *next;
 } Column;
 
@@ -36,6 +65,14 @@ typedef struct Table {
     struct Table *next;
 } Table;
 
+typedef struct Literal {
+    int literal_type; /* 0: int, 1: float, 2: string */
+    int int_literal;
+    float float_literal;
+    char *str_literal;
+    struct Literal *next;
+} Literal;
+
 typedef struct Condition {
     CondType type;
     union {
@@ -52,13 +89,30 @@ typedef struct Condition {
             int int_literal;
             float float_literal;
             char *str_literal;
-            int literal_type; /* 0: int, 1: float, 2: string, 3: column */
+            int literal_type; /* 0: int, 1: float, 2: string, 3: column, 4: expression */
             char *cmp_table;  // Right side table or alias (for column comparisons)
             char *cmp_attr;   // Right side attribute (can include dots)
+            Expr *left_expr;  // Both sides when literal_type is 4
+            Expr *right_expr;
         } comparison;
+        struct {
+            char *table;   // Column being tested
+            char *attr;
+            Literal *values; // Deduplicated list of literals
+            int count;
+        } in_list;
     } expr;
 } Condition;
 
+/* Named query of a WITH clause. materialized is 1 for AS MATERIALIZED,
+   0 for AS NOT MATERIALIZED and -1 to leave the choice to the optimizer */
+typedef struct Cte {
+    char *name;
+    struct RelNode *query;
+    int materialized;
+    struct Cte *next;
+} Cte;
+
 typedef struct RelNode {
     RelOpType op_type;
     union {
@@ -84,6 +138,14 @@ typedef struct RelNode {
             struct RelNode *subquery;
             char *alias;  // Required alias for the subquery
         } subquery;
+        struct {
+            struct RelNode *input;
+            struct Cte *ctes;
+        } with;
+        struct {
+            char *name;
+            char *alias;
+        } cte_ref;
     } op;
     Table *tables; /* For base relations only */
 } RelNode;
@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
 
 void yyerror(const char *s);
 int yylex(void);
@@ -13,7 +14,9 @@ typedef enum {
     OP_SELECT,
     OP_JOIN,
     OP_RENAME,
-    OP_SUBQUERY  // New operation type for nested queries
+    OP_SUBQUERY,  // New operation type for nested queries
+    OP_WITH,      /* Query with common table expressions */
+    OP_CTE_REF    /* Reference to a common table expression */
 } RelOpType;
 
 typedef enum {
@@ -25,12 +28,39 @@ typedef enum {
     COND_NE,
     COND_AND,
     COND_OR,
-    COND_NOT
+    COND_NOT,
+    COND_IN,
+    COND_LIKE  /* Stored as a string comparison against the pattern */
 } CondType;
 
+typedef enum {
+    EXPR_COLUMN,
+    EXPR_INT,
+    EXPR_FLOAT,
+    EXPR_STRING,
+    EXPR_ADD,
+    EXPR_SUB,
+    EXPR_MUL,
+    EXPR_DIV
+} ExprType;
+
+/* Scalar expression tree used in projections and comparisons */
+typedef struct Expr {
+    ExprType type;
+    char *table;
+    char *attr;
+    int int_literal;
+    float float_literal;
+    char *str_literal;
+    struct Expr *left;
+    struct Expr *right;
+} Expr;
+
 typedef struct Column {
     char *table;
     char *attr;
+    Expr *expr;
+    char *alias;
     struct Column *next;
 } Column;
 
@@ -40,6 +70,14 @@ typedef struct Table {
     struct Table *next;
 } Table;
 
+typedef struct Literal {
+    int literal_type; /* 0: int, 1: float, 2: string */
+    int int_literal;
+    float float_literal;
+    char *str_literal;
+    struct Literal *next;
+} Literal;
+
 typedef struct Condition {
     CondType type;
     union {
@@ -56,13 +94,30 @@ typedef struct Condition {
             int int_literal;
             float float_literal;
             char *str_literal;
-            int literal_type; /* 0: int, 1: float, 2: string, 3: column */
+            int literal_type; /* 0: int, 1: float, 2: string, 3: column, 4: expression */
             char *cmp_table;
             char *cmp_attr;
+            Expr *left_expr;
+            Expr *right_expr;
         } comparison;
+        struct {
+            char *table;
+            char *attr;
+            Literal *values;
+            int count;
+        } in_list;
     } expr;
 } Condition;
 
+/* Named query of a WITH clause. materialized is 1 for AS MATERIALIZED,
+   0 for AS NOT MATERIALIZED and -1 to leave the choice to the optimizer */
+typedef struct Cte {
+    char *name;
+    struct RelNode *query;
+    int materialized;
+    struct Cte *next;
+} Cte;
+
 typedef struct RelNode {
     RelOpType op_type;
     union {
@@ -88,6 +143,14 @@ typedef struct RelNode {
             struct RelNode *subquery;
             char *alias;  // Required alias for the subquery
         } subquery;
+        struct {
+            struct RelNode *input;
+            struct Cte *ctes;
+        } with;
+        struct {
+            char *name;
+            char *alias;
+        } cte_ref;
     } op;
     Table *tables; /* For base relations only */
 } RelNode;
@@ -95,6 +158,7 @@ typedef struct RelNode {
 /* Helper functions */
 Column *create_column(char *table, char *attr);
 Column *append_column(Column *list, Column *new_col);
+Column *create_expr_column(Expr *expr, char *alias);
 Table *create_table(char *name, char *alias);
 Table *append_table(Table *list, Table *new_table);
 Condition *create_comparison(CondType type, char *table, char *attr, int literal_type, 
@@ -102,19 +166,39 @@ Condition *create_comparison(CondType type, char *table, char *attr, int literal
                             char *cmp_table, char *cmp_attr);
 Condition *create_binary_condition(CondType type, Condition *left, Condition *right);
 Condition *create_unary_condition(CondType type, Condition *cond);
+Literal *create_literal(int literal_type, int int_val, float float_val, char *str_val);
+Literal *append_literal(Literal *list, Literal *new_lit);
+Condition *create_in_condition(char *table, char *attr, Literal *values);
+Condition *create_like_condition(char *table, char *attr, char *pattern);
+Expr *create_column_expr(char *table, char *attr);
+Expr *create_literal_expr(int literal_type, int int_val, float float_val, char *str_val);
+Expr *create_arith_expr(ExprType type, Expr *left, Expr *right);
+Condition *create_expr_comparison(CondType type, Expr *left, Expr *right);
 RelNode *create_project_node(RelNode *input, Column *columns);
 RelNode *create_select_node(RelNode *input, Condition *condition);
 RelNode *create_join_node(RelNode *left, RelNode *right, Condition *condition);
 RelNode *create_rename_node(RelNode *input, char *old_name, char *new_name);
 RelNode *create_base_relation(Table *tables);
 RelNode *create_subquery_node(RelNode *subquery, char *alias);
+Cte *create_cte(char *name, RelNode *query, int materialized);
+Cte *append_cte(Cte *list, Cte *new_cte);
+Cte *find_cte(const char *name);
+RelNode *create_with_node(RelNode *input, Cte *ctes);
+RelNode *create_cte_ref_node(char *name, char *alias);
 void print_ra_tree_json(RelNode *root);
+void fprint_ra_tree_json(FILE *out, RelNode *root);
 void free_columns(Column *cols);
 void free_tables(Table *tables);
+void free_literals(Literal *lits);
+void free_expr(Expr *expr);
 void free_condition(Condition *cond);
 void free_relnode(RelNode *node);
+void free_ctes(Cte *ctes);
 
 RelNode *result = NULL;
+Cte *cte_scope = NULL; /* CTEs defined so far, visible to the FROM clauses that follow */
+char parse_error[256] = ""; /* Message of the last syntax error */
+static FILE *ra_out; /* Stream the JSON printers write to */
 %}
 
 %union {
@@ -123,8 +207,11 @@ RelNode *result = NULL;
     char *strval;
     struct Column *col;
     struct Table *tbl;
+    struct Literal *lit;
+    struct Expr *expr;
     struct Condition *cond;
     struct RelNode *node;
+    struct Cte *cte;
 }
 
 %token <strval> IDENTIFIER
@@ -132,25 +219,70 @@ RelNode *result = NULL;
 %token <floatval> FLOAT_LITERAL
 %token <strval> STRING_LITERAL
 
-%token SELECT FROM WHERE JOIN ON AS AND OR NOT
+%token SELECT FROM WHERE JOIN ON AS AND OR NOT IN LIKE WITH MATERIALIZED
 %token EQ LT GT LE GE NE
 
 %type <col> column_list column
 %type <tbl> table_list table_ref
 %type <cond> where_clause opt_where_clause condition comparison_expr
-%type <cond> join_condition
+%type <cond> join_condition in_expr like_expr
+%type <lit> literal_list literal
 %type <node> query_stmt join_list join_table table_item subquery
-%type <strval> dotted_identifier
+%type <cte> cte_list cte
+%type <expr> expr
+%type <strval> dotted_identifier opt_alias
+
+/* A syntax error aborts the parse; free what the stack holds so far */
+%destructor { free($$); } <strval>
+%destructor { free_columns($$); } <col>
+%destructor { free_tables($$); } <tbl>
+%destructor { free_literals($$); } <lit>
+%destructor { free_expr($$); } <expr>
+%destructor { free_condition($$); } <cond>
+%destructor { free_relnode($$); } <node>
+%destructor { free_ctes($$); cte_scope = NULL; } <cte>
 
 %left OR
 %left AND
 %right NOT
+%left '+' '-'
+%left '*' '/'
+%right UMINUS
 
 %%
 
 start: query_stmt {
     result = $1;
 }
+    | WITH cte_list query_stmt {
+        result = create_with_node($3, $2);
+    }
+;
+
+cte_list:
+    cte {
+        $$ = $1;
+        cte_scope = $$;
+    }
+    | cte_list ',' cte {
+        $$ = append_cte($1, $3);
+        cte_scope = $$;
+    }
+;
+
+cte:
+    IDENTIFIER AS '(' query_stmt ')' {
+        $$ = create_cte($1, $4, -1);
+        free($1);
+    }
+    | IDENTIFIER AS MATERIALIZED '(' query_stmt ')' {
+        $$ = create_cte($1, $5, 1);
+        free($1);
+    }
+    | IDENTIFIER AS NOT MATERIALIZED '(' query_stmt ')' {
+        $$ = create_cte($1, $6, 0);
+        free($1);
+    }
 ;
 
 query_stmt: 
@@ -172,17 +304,30 @@ column_list:
 ;
 
 column:
-    IDENTIFIER '.' dotted_identifier {
-        $$ = create_column($1, $3);
-        free($1);
-        free($3);
+    expr opt_alias {
+        if ($1->type == EXPR_COLUMN && $2 == NULL) {
+            $$ = create_column($1->table, $1->attr);
+            free_expr($1);
+        } else {
+            $$ = create_expr_column($1, $2);
+        }
+        free($2);
     }
     | IDENTIFIER '.' '*' {
-        $$ = create_column($1, strdup("*"));
+        $$ = create_column($1, "*");
         free($1);
     }
 ;
 
+opt_alias:
+    /* empty */ {
+        $$ = NULL;
+    }
+    | AS IDENTIFIER {
+        $$ = $2;
+    }
+;
+
 dotted_identifier:
     IDENTIFIER {
         $$ = strdup($1);
@@ -214,7 +359,13 @@ join_table:
 
 table_item:
     table_ref {
-        $$ = create_base_relation($1);
+        /* Names defined in the WITH clause shadow tables */
+        if (find_cte($1->name) != NULL) {
+            $$ = create_cte_ref_node($1->name, $1->alias);
+            free_tables($1);
+        } else {
+            $$ = create_base_relation($1);
+        }
     }
     | subquery {
         $$ = $1;
@@ -283,6 +434,12 @@ condition:
     comparison_expr {
         $$ = $1;
     }
+    | in_expr {
+        $$ = $1;
+    }
+    | like_expr {
+        $$ = $1;
+    }
     | condition AND condition {
         $$ = create_binary_condition(COND_AND, $1, $3);
     }
@@ -298,143 +455,109 @@ condition:
 ;
 
 comparison_expr:
-    IDENTIFIER '.' dotted_identifier EQ IDENTIFIER '.' dotted_identifier {
-        $$ = create_comparison(COND_EQ, $1, $3, 3, 0, 0.0, NULL, $5, $7);
-        free($1);
-        free($3);
-        free($5);
-        free($7);
+    expr EQ expr {
+        $$ = create_expr_comparison(COND_EQ, $1, $3);
     }
-    | IDENTIFIER '.' dotted_identifier EQ INT_LITERAL {
-        $$ = create_comparison(COND_EQ, $1, $3, 0, $5, 0.0, NULL, NULL, NULL);
-        free($1);
-        free($3);
-    }
-    | IDENTIFIER '.' dotted_identifier EQ FLOAT_LITERAL {
-        $$ = create_comparison(COND_EQ, $1, $3, 1, 0, $5, NULL, NULL, NULL);
-        free($1);
-        free($3);
+    | expr LT expr {
+        $$ = create_expr_comparison(COND_LT, $1, $3);
     }
-    | IDENTIFIER '.' dotted_identifier EQ STRING_LITERAL {
-        $$ = create_comparison(COND_EQ, $1, $3, 2, 0, 0.0, $5, NULL, NULL);
-        free($1);
-        free($3);
-        free($5);
+    | expr GT expr {
+        $$ = create_expr_comparison(COND_GT, $1, $3);
     }
-    | IDENTIFIER '.' dotted_identifier LT IDENTIFIER '.' dotted_identifier {
-        $$ = create_comparison(COND_LT, $1, $3, 3, 0, 0.0, NULL, $5, $7);
-        free($1);
-        free($3);
-        free($5);
-        free($7);
+    | expr LE expr {
+        $$ = create_expr_comparison(COND_LE, $1, $3);
     }
-    | IDENTIFIER '.' dotted_identifier GT IDENTIFIER '.' dotted_identifier {
-        $$ = create_comparison(COND_GT, $1, $3, 3, 0, 0.0, NULL, $5, $7);
-        free($1);
-        free($3);
-        free($5);
-        free($7);
+    | expr GE expr {
+        $$ = create_expr_comparison(COND_GE, $1, $3);
     }
-    | IDENTIFIER '.' dotted_identifier LE IDENTIFIER '.' dotted_identifier {
-        $$ = create_comparison(COND_LE, $1, $3, 3, 0, 0.0, NULL, $5, $7);
-        free($1);
-        free($3);
-        free($5);
-        free($7);
+    | expr NE expr {
+        $$ = create_expr_comparison(COND_NE, $1, $3);
     }
-    | IDENTIFIER '.' dotted_identifier GE IDENTIFIER '.' dotted_identifier {
-        $$ = create_comparison(COND_GE, $1, $3, 3, 0, 0.0, NULL, $5, $7);
+;
+
+expr:
+    IDENTIFIER '.' dotted_identifier {
+        $$ = create_column_expr($1, $3);
         free($1);
         free($3);
-        free($5);
-        free($7);
     }
-    | IDENTIFIER '.' dotted_identifier NE IDENTIFIER '.' dotted_identifier {
-        $$ = create_comparison(COND_NE, $1, $3, 3, 0, 0.0, NULL, $5, $7);
-        free($1);
-        free($3);
-        free($5);
-        free($7);
+    | INT_LITERAL {
+        $$ = create_literal_expr(0, $1, 0.0, NULL);
     }
-    | IDENTIFIER '.' dotted_identifier LT INT_LITERAL {
-        $$ = create_comparison(COND_LT, $1, $3, 0, $5, 0.0, NULL, NULL, NULL);
-        free($1);
-        free($3);
+    | FLOAT_LITERAL {
+        $$ = create_literal_expr(1, 0, $1, NULL);
     }
-    | IDENTIFIER '.' dotted_identifier GT INT_LITERAL {
-        $$ = create_comparison(COND_GT, $1, $3, 0, $5, 0.0, NULL, NULL, NULL);
+    | STRING_LITERAL {
+        $$ = create_literal_expr(2, 0, 0.0, $1);
         free($1);
-        free($3);
     }
-    | IDENTIFIER '.' dotted_identifier LE INT_LITERAL {
-        $$ = create_comparison(COND_LE, $1, $3, 0, $5, 0.0, NULL, NULL, NULL);
-        free($1);
-        free($3);
+    | expr '+' expr {
+        $$ = create_arith_expr(EXPR_ADD, $1, $3);
     }
-    | IDENTIFIER '.' dotted_identifier GE INT_LITERAL {
-        $$ = create_comparison(COND_GE, $1, $3, 0, $5, 0.0, NULL, NULL, NULL);
-        free($1);
-        free($3);
+    | expr '-' expr {
+        $$ = create_arith_expr(EXPR_SUB, $1, $3);
     }
-    | IDENTIFIER '.' dotted_identifier NE INT_LITERAL {
-        $$ = create_comparison(COND_NE, $1, $3, 0, $5, 0.0, NULL, NULL, NULL);
-        free($1);
-        free($3);
+    | expr '*' expr {
+        $$ = create_arith_expr(EXPR_MUL, $1, $3);
     }
-    | IDENTIFIER '.' dotted_identifier LT FLOAT_LITERAL {
-        $$ = create_comparison(COND_LT, $1, $3, 1, 0, $5, NULL, NULL, NULL);
-        free($1);
-        free($3);
+    | expr '/' expr {
+        $$ = create_arith_expr(EXPR_DIV, $1, $3);
     }
-    | IDENTIFIER '.' dotted_identifier GT FLOAT_LITERAL {
-        $$ = create_comparison(COND_GT, $1, $3, 1, 0, $5, NULL, NULL, NULL);
-        free($1);
-        free($3);
+    | '-' expr %prec UMINUS {  /* -x is 0 - x, folded away for literals */
+        $$ = create_arith_expr(EXPR_SUB, create_literal_expr(0, 0, 0.0, NULL), $2);
     }
-    | IDENTIFIER '.' dotted_identifier LE FLOAT_LITERAL {
-        $$ = create_comparison(COND_LE, $1, $3, 1, 0, $5, NULL, NULL, NULL);
-        free($1);
-        free($3);
+    | '(' expr ')' {
+        $$ = $2;
     }
-    | IDENTIFIER '.' dotted_identifier GE FLOAT_LITERAL {
-        $$ = create_comparison(COND_GE, $1, $3, 1, 0, $5, NULL, NULL, NULL);
+;
+
+in_expr:
+    IDENTIFIER '.' dotted_identifier IN '(' literal_list ')' {
+        $$ = create_in_condition($1, $3, $6);
         free($1);
         free($3);
     }
-    | IDENTIFIER '.' dotted_identifier NE FLOAT_LITERAL {
-        $$ = create_comparison(COND_NE, $1, $3, 1, 0, $5, NULL, NULL, NULL);
+    | IDENTIFIER '.' dotted_identifier NOT IN '(' literal_list ')' {
+        $$ = create_unary_condition(COND_NOT, create_in_condition($1, $3, $7));
         free($1);
         free($3);
     }
-    | IDENTIFIER '.' dotted_identifier LT STRING_LITERAL {
-        $$ = create_comparison(COND_LT, $1, $3, 2, 0, 0.0, $5, NULL, NULL);
+;
+
+like_expr:
+    IDENTIFIER '.' dotted_identifier LIKE STRING_LITERAL {
+        $$ = create_like_condition($1, $3, $5);
         free($1);
         free($3);
         free($5);
     }
-    | IDENTIFIER '.' dotted_identifier GT STRING_LITERAL {
-        $$ = create_comparison(COND_GT, $1, $3, 2, 0, 0.0, $5, NULL, NULL);
+    | IDENTIFIER '.' dotted_identifier NOT LIKE STRING_LITERAL {
+        $$ = create_unary_condition(COND_NOT, create_like_condition($1, $3, $6));
         free($1);
         free($3);
-        free($5);
+        free($6);
     }
-    | IDENTIFIER '.' dotted_identifier LE STRING_LITERAL {
-        $$ = create_comparison(COND_LE, $1, $3, 2, 0, 0.0, $5, NULL, NULL);
-        free($1);
-        free($3);
-        free($5);
+;
+
+literal_list:
+    literal {
+        $$ = $1;
     }
-    | IDENTIFIER '.' dotted_identifier GE STRING_LITERAL {
-        $$ = create_comparison(COND_GE, $1, $3, 2, 0, 0.0, $5, NULL, NULL);
-        free($1);
-        free($3);
-        free($5);
+    | literal_list ',' literal {
+        $$ = append_literal($1, $3);
+    }
+;
+
+literal:
+    INT_LITERAL {
+        $$ = create_literal(0, $1, 0.0, NULL);
+    }
+    | FLOAT_LITERAL {
+        $$ = create_literal(1, 0, $1, NULL);
     }
-    | IDENTIFIER '.' dotted_identifier NE STRING_LITERAL {
-        $$ = create_comparison(COND_NE, $1, $3, 2, 0, 0.0, $5, NULL, NULL);
+    | STRING_LITERAL {
+        $$ = create_literal(2, 0, 0.0, $1);
         free($1);
-        free($3);
-        free($5);
     }
 ;
 
@@ -442,6 +565,7 @@ comparison_expr:
 
 void yyerror(const char *s) {
     fprintf(stderr, "Error: %s\n", s);
+    snprintf(parse_error, sizeof(parse_error), "%s", s);
 }
 
 /* Helper functions for handling dotted attribute names */
@@ -473,6 +597,19 @@ Column *create_column(char *table, char *attr) {
     Column *col = (Column *)malloc(sizeof(Column));
     col->table = strdup(table);
     col->attr = strdup(attr);
+    col->expr = NULL;
+    col->alias = NULL;
+    col->next = NULL;
+    return col;
+}
+
+/* Computed projection column such as "L.L_EXTENDEDPRICE * (1 - L.L_DISCOUNT) AS revenue" */
+Column *create_expr_column(Expr *expr, char *alias) {
+    Column *col = (Column *)malloc(sizeof(Column));
+    col->table = NULL;
+    col->attr = NULL;
+    col->expr = expr;
+    col->alias = (alias != NULL) ? strdup(alias) : NULL;
     col->next = NULL;
     return col;
 }
@@ -549,6 +686,438 @@ Condition *create_unary_condition(CondType type, Condition *cond_expr) {
     return cond;
 }
 
+Literal *create_literal(int literal_type, int int_val, float float_val, char *str_val) {
+    Literal *lit = (Literal *)malloc(sizeof(Literal));
+    lit->literal_type = literal_type;
+    lit->int_literal = int_val;
+    lit->float_literal = float_val;
+    lit->str_literal = (str_val != NULL) ? strdup(str_val) : NULL;
+    lit->next = NULL;
+    return lit;
+}
+
+Literal *append_literal(Literal *list, Literal *new_lit) {
+    if (list == NULL) {
+        return new_lit;
+    }
+
+    Literal *current = list;
+    while (current->next != NULL) {
+        current = current->next;
+    }
+    current->next = new_lit;
+    return list;
+}
+
+/* Numeric literals are compared by value whether they were written as
+ * integers or floats, so 1, 1.0 and 1.00 are the same IN-list value */
+double literal_number(Literal *lit) {
+    double value = lit->literal_type == 0 ? (double)lit->int_literal : (double)lit->float_literal;
+    /* -0.0 equals 0.0 and must hash the same */
+    return value == 0.0 ? 0.0 : value;
+}
+
+int literals_equal(Literal *a, Literal *b) {
+    if (a->literal_type != 2 && b->literal_type != 2) {
+        return literal_number(a) == literal_number(b);
+    }
+    if (a->literal_type != b->literal_type) {
+        return 0;
+    }
+    return strcmp(a->str_literal, b->str_literal) == 0;
+}
+
+unsigned int hash_literal(Literal *lit) {
+    /* FNV-1a over the literal's kind and value bytes; numbers hash their
+     * normalized value so that the hash agrees with literals_equal */
+    unsigned int h = 2166136261u;
+    const unsigned char *bytes;
+    size_t len;
+    double number;
+    int numeric = lit->literal_type != 2;
+
+    if (numeric) {
+        number = literal_number(lit);
+        bytes = (const unsigned char *)&number;
+        len = sizeof(number);
+    } else {
+        bytes = (const unsigned char *)lit->str_literal;
+        len = strlen(lit->str_literal);
+    }
+
+    h = (h ^ (unsigned int)numeric) * 16777619u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ bytes[i]) * 16777619u;
+    }
+    return h;
+}
+
+/* Lists up to this length are deduplicated by comparing every new value
+ * against the kept ones; longer lists go through an open-addressing set. */
+#define IN_LIST_LINEAR_MAX 8
+
+Condition *create_in_condition(char *table, char *attr, Literal *values) {
+    Condition *cond = (Condition *)malloc(sizeof(Condition));
+    cond->type = COND_IN;
+    cond->expr.in_list.table = strdup(table);
+    cond->expr.in_list.attr = strdup(attr);
+
+    int total = 0;
+    for (Literal *lit = values; lit != NULL; lit = lit->next) {
+        total++;
+    }
+
+    /* Drop duplicate values, keeping the first occurrence of each */
+    Literal *kept_head = NULL;
+    Literal *kept_tail = NULL;
+    int count = 0;
+
+    Literal **slots = NULL;
+    unsigned int mask = 0;
+    if (total > IN_LIST_LINEAR_MAX) {
+        unsigned int capacity = 16;
+        while (capacity < (unsigned int)total * 2) {
+            capacity <<= 1;
+        }
+        slots = (Literal **)calloc(capacity, sizeof(Literal *));
+        mask = capacity - 1;
+    }
+
+    Literal *lit = values;
+    while (lit != NULL) {
+        Literal *next = lit->next;
+        int duplicate = 0;
+
+        if (slots != NULL) {
+            unsigned int pos = hash_literal(lit) & mask;
+            while (slots[pos] != NULL) {
+                if (literals_equal(slots[pos], lit)) {
+                    duplicate = 1;
+                    break;
+                }
+                pos = (pos + 1) & mask;
+            }
+            if (!duplicate) {
+                slots[pos] = lit;
+            }
+        } else {
+            for (Literal *k = kept_head; k != NULL; k = k->next) {
+                if (literals_equal(k, lit)) {
+                    duplicate = 1;
+                    break;
+                }
+            }
+        }
+
+        if (duplicate) {
+            lit->next = NULL;
+            free_literals(lit);
+        } else {
+            lit->next = NULL;
+            if (kept_tail == NULL) {
+                kept_head = lit;
+            } else {
+                kept_tail->next = lit;
+            }
+            kept_tail = lit;
+            count++;
+        }
+        lit = next;
+    }
+
+    free(slots);
+
+    cond->expr.in_list.values = kept_head;
+    cond->expr.in_list.count = count;
+    return cond;
+}
+
+/* Shape of a LIKE pattern, used to pick an evaluation and estimation strategy:
+ *   "exact"   no wildcards              'abc'
+ *   "prefix"  literal then one %        'abc%'
+ *   "suffix"  one % then literal        '%abc'
+ *   "infix"   literal between two %     '%abc%'
+ *   "pattern" anything else (_ or inner %)
+ */
+const char *like_pattern_kind(const char *pattern) {
+    size_t len = strlen(pattern);
+    size_t wildcards = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        if (pattern[i] == '_') {
+            return "pattern";
+        }
+        if (pattern[i] == '%') {
+            wildcards++;
+        }
+    }
+
+    if (wildcards == 0) {
+        return "exact";
+    }
+    if (wildcards == 1 && len > 1 && pattern[len - 1] == '%') {
+        return "prefix";
+    }
+    if (wildcards == 1 && len > 1 && pattern[0] == '%') {
+        return "suffix";
+    }
+    if (wildcards == 2 && len > 2 && pattern[0] == '%' && pattern[len - 1] == '%') {
+        return "infix";
+    }
+    return "pattern";
+}
+
+/* Decode the UTF-8 character of width bytes at s into *cp; 0 if malformed */
+int utf8_decode(const char *s, size_t width, unsigned int *cp) {
+    const unsigned char *b = (const unsigned char *)s;
+    size_t expected;
+
+    if (b[0] < 0x80) {
+        expected = 1;
+        *cp = b[0];
+    } else if (b[0] >= 0xC0 && b[0] < 0xE0) {
+        expected = 2;
+        *cp = b[0] & 0x1F;
+    } else if (b[0] >= 0xE0 && b[0] < 0xF0) {
+        expected = 3;
+        *cp = b[0] & 0x0F;
+    } else if (b[0] >= 0xF0 && b[0] < 0xF8) {
+        expected = 4;
+        *cp = b[0] & 0x07;
+    } else {
+        return 0;
+    }
+    if (width != expected) {
+        return 0;
+    }
+    for (size_t i = 1; i < width; i++) {
+        *cp = (*cp << 6) | (b[i] & 0x3F);
+    }
+    return 1;
+}
+
+/* Encode code point cp as UTF-8 at s; returns the number of bytes written */
+size_t utf8_encode(unsigned int cp, char *s) {
+    if (cp < 0x80) {
+        s[0] = (char)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        s[0] = (char)(0xC0 | (cp >> 6));
+        s[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        s[0] = (char)(0xE0 | (cp >> 12));
+        s[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        s[2] = (char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    s[0] = (char)(0xF0 | (cp >> 18));
+    s[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+    s[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    s[3] = (char)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+/* For a prefix pattern 'abc%', the matching strings are exactly those in
+ * ['abc', 'abd') under code point ordering, which is also the byte ordering
+ * of UTF-8 and the order of PostgreSQL's "C" collation. The last character
+ * that has a successor is incremented, dropping the U+10FFFF ones after it;
+ * predicate_pushdown.like_prefix_upper_bound computes the same bound.
+ * Returns NULL when no character has a successor or the prefix is not
+ * valid UTF-8, leaving the range open above. */
+char *like_prefix_upper_bound(const char *pattern) {
+    size_t len = strlen(pattern) - 1; /* drop the trailing % */
+    /* The successor may need one byte more than the character it replaces */
+    char *upper = (char *)malloc(len + 2);
+    memcpy(upper, pattern, len);
+    upper[len] = '\0';
+
+    while (len > 0) {
+        size_t start = len - 1;
+        while (start > 0 && ((unsigned char)upper[start] & 0xC0) == 0x80) {
+            start--;
+        }
+
+        unsigned int cp;
+        if (!utf8_decode(upper + start, len - start, &cp)) {
+            break;
+        }
+        if (cp < 0x10FFFF) {
+            /* Surrogates are not characters; skip over them */
+            cp = (cp + 1 == 0xD800) ? 0xE000 : cp + 1;
+            upper[start + utf8_encode(cp, upper + start)] = '\0';
+            return upper;
+        }
+        len = start;
+        upper[len] = '\0';
+    }
+
+    free(upper);
+    return NULL;
+}
+
+Condition *create_like_condition(char *table, char *attr, char *pattern) {
+    /* A pattern without wildcards is a plain equality */
+    if (strcmp(like_pattern_kind(pattern), "exact") == 0) {
+        return create_comparison(COND_EQ, table, attr, 2, 0, 0.0, pattern, NULL, NULL);
+    }
+    return create_comparison(COND_LIKE, table, attr, 2, 0, 0.0, pattern, NULL, NULL);
+}
+
+Expr *create_column_expr(char *table, char *attr) {
+    Expr *expr = (Expr *)calloc(1, sizeof(Expr));
+    expr->type = EXPR_COLUMN;
+    expr->table = strdup(table);
+    expr->attr = strdup(attr);
+    return expr;
+}
+
+Expr *create_literal_expr(int literal_type, int int_val, float float_val, char *str_val) {
+    Expr *expr = (Expr *)calloc(1, sizeof(Expr));
+    if (literal_type == 0) { /* int */
+        expr->type = EXPR_INT;
+        expr->int_literal = int_val;
+    } else if (literal_type == 1) { /* float */
+        expr->type = EXPR_FLOAT;
+        expr->float_literal = float_val;
+    } else { /* string */
+        expr->type = EXPR_STRING;
+        expr->str_literal = strdup(str_val);
+    }
+    return expr;
+}
+
+int is_numeric_expr(Expr *expr) {
+    return expr->type == EXPR_INT || expr->type == EXPR_FLOAT;
+}
+
+double numeric_expr_value(Expr *expr) {
+    return (expr->type == EXPR_INT) ? (double)expr->int_literal : (double)expr->float_literal;
+}
+
+/* Builds an arithmetic node, folding it into a literal when both operands
+ * are numeric constants. Integer arithmetic stays integral (like SQL's
+ * int / int), and division by a zero constant is left for run time. */
+/* Fold an operation on two integer literals into *value; 0 when the result
+ * does not fit in an int, in which case the operation is left unfolded */
+int fold_int_arith(ExprType type, int a, int b, int *value) {
+    switch (type) {
+        case EXPR_ADD: return !__builtin_add_overflow(a, b, value);
+        case EXPR_SUB: return !__builtin_sub_overflow(a, b, value);
+        case EXPR_MUL: return !__builtin_mul_overflow(a, b, value);
+        default:
+            /* INT_MIN / -1 is the one quotient that does not fit */
+            if (a == INT_MIN && b == -1) {
+                return 0;
+            }
+            *value = a / b;
+            return 1;
+    }
+}
+
+Expr *create_arith_expr(ExprType type, Expr *left, Expr *right) {
+    if (is_numeric_expr(left) && is_numeric_expr(right) &&
+        !(type == EXPR_DIV && numeric_expr_value(right) == 0.0)) {
+        Expr *folded = NULL;
+
+        if (left->type == EXPR_INT && right->type == EXPR_INT) {
+            int value;
+            if (fold_int_arith(type, left->int_literal, right->int_literal, &value)) {
+                folded = (Expr *)calloc(1, sizeof(Expr));
+                folded->type = EXPR_INT;
+                folded->int_literal = value;
+            }
+        } else {
+            double a = numeric_expr_value(left);
+            double b = numeric_expr_value(right);
+            folded = (Expr *)calloc(1, sizeof(Expr));
+            folded->type = EXPR_FLOAT;
+            switch (type) {
+                case EXPR_ADD: folded->float_literal = (float)(a + b); break;
+                case EXPR_SUB: folded->float_literal = (float)(a - b); break;
+                case EXPR_MUL: folded->float_literal = (float)(a * b); break;
+                default:       folded->float_literal = (float)(a / b); break;
+            }
+        }
+
+        if (folded != NULL) {
+            free_expr(left);
+            free_expr(right);
+            return folded;
+        }
+    }
+
+    Expr *expr = (Expr *)calloc(1, sizeof(Expr));
+    expr->type = type;
+    expr->left = left;
+    expr->right = right;
+    return expr;
+}
+
+/* Operator to use when the two sides of a comparison are swapped */
+CondType mirror_comparison(CondType type) {
+    switch (type) {
+        case COND_LT: return COND_GT;
+        case COND_GT: return COND_LT;
+        case COND_LE: return COND_GE;
+        case COND_GE: return COND_LE;
+        default:      return type; /* EQ and NE are symmetric */
+    }
+}
+
+/* Comparisons between a column and a literal or another column keep the
+ * classic column-op-value form (with the column moved to the left when
+ * needed); anything involving arithmetic keeps both expression trees. */
+Condition *create_expr_comparison(CondType type, Expr *left, Expr *right) {
+    if (left->type != EXPR_COLUMN && right->type == EXPR_COLUMN) {
+        Expr *tmp = left;
+        left = right;
+        right = tmp;
+        type = mirror_comparison(type);
+    }
+
+    Condition *cond = NULL;
+    if (left->type == EXPR_COLUMN) {
+        switch (right->type) {
+            case EXPR_COLUMN:
+                cond = create_comparison(type, left->table, left->attr, 3, 0, 0.0, NULL,
+                                         right->table, right->attr);
+                break;
+            case EXPR_INT:
+                cond = create_comparison(type, left->table, left->attr, 0,
+                                         right->int_literal, 0.0, NULL, NULL, NULL);
+                break;
+            case EXPR_FLOAT:
+                cond = create_comparison(type, left->table, left->attr, 1,
+                                         0, right->float_literal, NULL, NULL, NULL);
+                break;
+            case EXPR_STRING:
+                cond = create_comparison(type, left->table, left->attr, 2,
+                                         0, 0.0, right->str_literal, NULL, NULL);
+                break;
+            default:
+                break;
+        }
+    }
+
+    if (cond != NULL) {
+        free_expr(left);
+        free_expr(right);
+        return cond;
+    }
+
+    cond = (Condition *)malloc(sizeof(Condition));
+    cond->type = type;
+    cond->expr.comparison.table = NULL;
+    cond->expr.comparison.attr = NULL;
+    cond->expr.comparison.literal_type = 4;
+    cond->expr.comparison.left_expr = left;
+    cond->expr.comparison.right_expr = right;
+    return cond;
+}
+
 RelNode *create_project_node(RelNode *input, Column *columns) {
     RelNode *node = (RelNode *)malloc(sizeof(RelNode));
     node->op_type = OP_PROJECT;
@@ -604,160 +1173,377 @@ RelNode *create_subquery_node(RelNode *subquery, char *alias) {
     return node;
 }
 
+Cte *create_cte(char *name, RelNode *query, int materialized) {
+    Cte *cte = (Cte *)malloc(sizeof(Cte));
+    cte->name = strdup(name);
+    cte->query = query;
+    cte->materialized = materialized;
+    cte->next = NULL;
+    return cte;
+}
+
+Cte *append_cte(Cte *list, Cte *new_cte) {
+    if (list == NULL) {
+        return new_cte;
+    }
+    
+    Cte *current = list;
+    while (current->next != NULL) {
+        current = current->next;
+    }
+    current->next = new_cte;
+    return list;
+}
+
+Cte *find_cte(const char *name) {
+    for (Cte *cte = cte_scope; cte != NULL; cte = cte->next) {
+        if (strcmp(cte->name, name) == 0) {
+            return cte;
+        }
+    }
+    return NULL;
+}
+
+RelNode *create_with_node(RelNode *input, Cte *ctes) {
+    RelNode *node = (RelNode *)malloc(sizeof(RelNode));
+    node->op_type = OP_WITH;
+    node->op.with.input = input;
+    node->op.with.ctes = ctes;
+    node->tables = NULL;
+    cte_scope = NULL;
+    return node;
+}
+
+RelNode *create_cte_ref_node(char *name, char *alias) {
+    RelNode *node = (RelNode *)malloc(sizeof(RelNode));
+    node->op_type = OP_CTE_REF;
+    node->op.cte_ref.name = strdup(name);
+    node->op.cte_ref.alias = strdup(alias != NULL ? alias : name);
+    node->tables = NULL;
+    return node;
+}
+
+/* Print a string literal as a JSON string, escaping quotes, backslashes
+   and control characters; identifiers cannot contain any of them */
+void print_json_string(const char *s) {
+    fputc('"', ra_out);
+    for (const unsigned char *p = (const unsigned char *)s; *p != '\0'; p++) {
+        switch (*p) {
+            case '"':  fputs("\\\"", ra_out); break;
+            case '\\': fputs("\\\\", ra_out); break;
+            case '\n': fputs("\\n", ra_out); break;
+            case '\r': fputs("\\r", ra_out); break;
+            case '\t': fputs("\\t", ra_out); break;
+            default:
+                if (*p < 0x20) {
+                    fprintf(ra_out, "\\u%04x", *p);
+                } else {
+                    fputc(*p, ra_out);
+                }
+                break;
+        }
+    }
+    fputc('"', ra_out);
+}
+
+void print_expr_json(Expr *expr) {
+    switch (expr->type) {
+        case EXPR_COLUMN:
+            fprintf(ra_out, "{\"type\": \"column\", \"table\": \"%s\", \"attr\": \"%s\"}", 
+                   expr->table, expr->attr);
+            break;
+        case EXPR_INT:
+            fprintf(ra_out, "{\"type\": \"int\", \"value\": %d}", expr->int_literal);
+            break;
+        case EXPR_FLOAT:
+            fprintf(ra_out, "{\"type\": \"float\", \"value\": %f}", expr->float_literal);
+            break;
+        case EXPR_STRING:
+            fprintf(ra_out, "{\"type\": \"string\", \"value\": ");
+            print_json_string(expr->str_literal);
+            fprintf(ra_out, "}");
+            break;
+        default:
+            fprintf(ra_out, "{\"type\": \"arith\", \"op\": ");
+            switch (expr->type) {
+                case EXPR_ADD: fprintf(ra_out, "\"ADD\""); break;
+                case EXPR_SUB: fprintf(ra_out, "\"SUB\""); break;
+                case EXPR_MUL: fprintf(ra_out, "\"MUL\""); break;
+                default:       fprintf(ra_out, "\"DIV\""); break;
+            }
+            fprintf(ra_out, ", \"left\": ");
+            print_expr_json(expr->left);
+            fprintf(ra_out, ", \"right\": ");
+            print_expr_json(expr->right);
+            fprintf(ra_out, "}");
+            break;
+    }
+}
+
 void print_column_json(Column *col) {
-    printf("[");
+    fprintf(ra_out, "[");
     while (col != NULL) {
-        printf("{\"table\": \"%s\", \"attr\": \"%s\"}", 
-               col->table, col->attr);
+        if (col->expr == NULL) {
+            fprintf(ra_out, "{\"table\": \"%s\", \"attr\": \"%s\"}", 
+                   col->table, col->attr);
+        } else if (col->expr->type == EXPR_COLUMN) { /* Renamed plain column */
+            fprintf(ra_out, "{\"table\": \"%s\", \"attr\": \"%s\", \"alias\": \"%s\"}", 
+                   col->expr->table, col->expr->attr, col->alias);
+        } else {
+            fprintf(ra_out, "{\"expr\": ");
+            print_expr_json(col->expr);
+            if (col->alias != NULL) {
+                fprintf(ra_out, ", \"alias\": \"%s\"", col->alias);
+            }
+            fprintf(ra_out, "}");
+        }
         col = col->next;
         if (col != NULL) {
-            printf(", ");
+            fprintf(ra_out, ", ");
         }
     }
-    printf("]");
+    fprintf(ra_out, "]");
 }
 
 void print_table_json(Table *tbl) {
-    printf("[");
+    fprintf(ra_out, "[");
     while (tbl != NULL) {
-        printf("{\"name\": \"%s\"", tbl->name);
+        fprintf(ra_out, "{\"name\": \"%s\"", tbl->name);
         if (tbl->alias != NULL) {
-            printf(", \"alias\": \"%s\"", tbl->alias);
+            fprintf(ra_out, ", \"alias\": \"%s\"", tbl->alias);
         }
-        printf("}");
+        fprintf(ra_out, "}");
         tbl = tbl->next;
         if (tbl != NULL) {
-            printf(", ");
+            fprintf(ra_out, ", ");
         }
     }
-    printf("]");
+    fprintf(ra_out, "]");
+}
+
+void print_literal_json(Literal *lit) {
+    if (lit->literal_type == 0) { /* int */
+        fprintf(ra_out, "{\"type\": \"int\", \"value\": %d}", lit->int_literal);
+    } else if (lit->literal_type == 1) { /* float */
+        fprintf(ra_out, "{\"type\": \"float\", \"value\": %f}", lit->float_literal);
+    } else { /* string */
+        fprintf(ra_out, "{\"type\": \"string\", \"value\": ");
+        print_json_string(lit->str_literal);
+        fprintf(ra_out, "}");
+    }
 }
 
 void print_condition_json(Condition *cond) {
     if (cond == NULL) {
-        printf("null");
+        fprintf(ra_out, "null");
         return;
     }
     
-    printf("{\"type\": ");
+    fprintf(ra_out, "{\"type\": ");
     
     switch (cond->type) {
         case COND_EQ:
-            printf("\"EQ\"");
+            fprintf(ra_out, "\"EQ\"");
             break;
         case COND_LT:
-            printf("\"LT\"");
+            fprintf(ra_out, "\"LT\"");
             break;
         case COND_GT:
-            printf("\"GT\"");
+            fprintf(ra_out, "\"GT\"");
             break;
         case COND_LE:
-            printf("\"LE\"");
+            fprintf(ra_out, "\"LE\"");
             break;
         case COND_GE:
-            printf("\"GE\"");
+            fprintf(ra_out, "\"GE\"");
             break;
         case COND_NE:
-            printf("\"NE\"");
+            fprintf(ra_out, "\"NE\"");
             break;
         case COND_AND:
-            printf("\"AND\", \"left\": ");
+            fprintf(ra_out, "\"AND\", \"left\": ");
             print_condition_json(cond->expr.binary.left);
-            printf(", \"right\": ");
+            fprintf(ra_out, ", \"right\": ");
             print_condition_json(cond->expr.binary.right);
             break;
         case COND_OR:
-            printf("\"OR\", \"left\": ");
+            fprintf(ra_out, "\"OR\", \"left\": ");
             print_condition_json(cond->expr.binary.left);
-            printf(", \"right\": ");
+            fprintf(ra_out, ", \"right\": ");
             print_condition_json(cond->expr.binary.right);
             break;
         case COND_NOT:
-            printf("\"NOT\", \"cond\": ");
+            fprintf(ra_out, "\"NOT\", \"cond\": ");
             print_condition_json(cond->expr.unary.cond);
             break;
+        case COND_IN:
+            fprintf(ra_out, "\"IN\", \"left\": {\"table\": \"%s\", \"attr\": \"%s\"}", 
+                   cond->expr.in_list.table, cond->expr.in_list.attr);
+            fprintf(ra_out, ", \"right\": {\"type\": \"list\", \"values\": [");
+            for (Literal *lit = cond->expr.in_list.values; lit != NULL; lit = lit->next) {
+                print_literal_json(lit);
+                if (lit->next != NULL) {
+                    fprintf(ra_out, ", ");
+                }
+            }
+            fprintf(ra_out, "]}");
+            break;
+        case COND_LIKE:
+            fprintf(ra_out, "\"LIKE\"");
+            break;
     }
     
-    if (cond->type <= COND_NE) { /* Comparison operation */
-        printf(", \"left\": {\"table\": \"%s\", \"attr\": \"%s\"}", 
+    if (cond->type <= COND_NE && cond->expr.comparison.literal_type == 4) { /* expression */
+        Expr *left = cond->expr.comparison.left_expr;
+        fprintf(ra_out, ", \"left\": ");
+        if (left->type == EXPR_COLUMN) {
+            fprintf(ra_out, "{\"table\": \"%s\", \"attr\": \"%s\"}", left->table, left->attr);
+        } else {
+            print_expr_json(left);
+        }
+        fprintf(ra_out, ", \"right\": ");
+        print_expr_json(cond->expr.comparison.right_expr);
+    } else if (cond->type <= COND_NE || cond->type == COND_LIKE) { /* Comparison operation */
+        fprintf(ra_out, ", \"left\": {\"table\": \"%s\", \"attr\": \"%s\"}", 
                cond->expr.comparison.table, cond->expr.comparison.attr);
         
-        printf(", \"right\": ");
+        fprintf(ra_out, ", \"right\": ");
         
         if (cond->expr.comparison.literal_type == 0) { /* int */
-            printf("{\"type\": \"int\", \"value\": %d}", 
+            fprintf(ra_out, "{\"type\": \"int\", \"value\": %d}", 
                    cond->expr.comparison.int_literal);
         } else if (cond->expr.comparison.literal_type == 1) { /* float */
-            printf("{\"type\": \"float\", \"value\": %f}", 
+            fprintf(ra_out, "{\"type\": \"float\", \"value\": %f}", 
                    cond->expr.comparison.float_literal);
         } else if (cond->expr.comparison.literal_type == 2) { /* string */
-            printf("{\"type\": \"string\", \"value\": \"%s\"}", 
-                   cond->expr.comparison.str_literal);
+            fprintf(ra_out, "{\"type\": \"string\", \"value\": ");
+            print_json_string(cond->expr.comparison.str_literal);
+            fprintf(ra_out, "}");
         } else if (cond->expr.comparison.literal_type == 3) { /* column */
-            printf("{\"type\": \"column\", \"table\": \"%s\", \"attr\": \"%s\"}", 
+            fprintf(ra_out, "{\"type\": \"column\", \"table\": \"%s\", \"attr\": \"%s\"}", 
                    cond->expr.comparison.cmp_table, cond->expr.comparison.cmp_attr);
         }
     }
     
-    printf("}");
+    if (cond->type == COND_LIKE) {
+        const char *kind = like_pattern_kind(cond->expr.comparison.str_literal);
+        fprintf(ra_out, ", \"match\": \"%s\"", kind);
+        
+        /* Prefix patterns become a range scan on the ordered column */
+        if (strcmp(kind, "prefix") == 0) {
+            char *low = strdup(cond->expr.comparison.str_literal);
+            low[strlen(low) - 1] = '\0';
+            char *high = like_prefix_upper_bound(cond->expr.comparison.str_literal);
+            
+            fprintf(ra_out, ", \"range\": {\"low\": ");
+            print_json_string(low);
+            if (high != NULL) {
+                fprintf(ra_out, ", \"high\": ");
+                print_json_string(high);
+                free(high);
+            }
+            fprintf(ra_out, "}");
+            free(low);
+        }
+    }
+    
+    fprintf(ra_out, "}");
 }
 
 void print_ra_tree_json_rec(RelNode *node) {
     if (node == NULL) {
-        printf("null");
+        fprintf(ra_out, "null");
         return;
     }
     
-    printf("{");
+    fprintf(ra_out, "{");
     
     if (node->tables != NULL) { /* Base relation */
-        printf("\"type\": \"base_relation\", \"tables\": ");
+        fprintf(ra_out, "\"type\": \"base_relation\", \"tables\": ");
         print_table_json(node->tables);
     } else {
         switch (node->op_type) {
             case OP_PROJECT:
-                printf("\"type\": \"project\", \"columns\": ");
+                fprintf(ra_out, "\"type\": \"project\", \"columns\": ");
                 print_column_json(node->op.project.columns);
-                printf(", \"input\": ");
+                fprintf(ra_out, ", \"input\": ");
                 print_ra_tree_json_rec(node->op.project.input);
                 break;
                 
             case OP_SELECT:
-                printf("\"type\": \"select\", \"condition\": ");
+                fprintf(ra_out, "\"type\": \"select\", \"condition\": ");
                 print_condition_json(node->op.select.condition);
-                printf(", \"input\": ");
+                fprintf(ra_out, ", \"input\": ");
                 print_ra_tree_json_rec(node->op.select.input);
                 break;
                 
             case OP_JOIN:
-                printf("\"type\": \"join\", \"condition\": ");
+                fprintf(ra_out, "\"type\": \"join\", \"condition\": ");
                 print_condition_json(node->op.join.condition);
-                printf(", \"left\": ");
+                fprintf(ra_out, ", \"left\": ");
                 print_ra_tree_json_rec(node->op.join.left);
-                printf(", \"right\": ");
+                fprintf(ra_out, ", \"right\": ");
                 print_ra_tree_json_rec(node->op.join.right);
                 break;
                 
             case OP_RENAME:
-                printf("\"type\": \"rename\", \"old_name\": \"%s\", \"new_name\": \"%s\", \"input\": ", 
+                fprintf(ra_out, "\"type\": \"rename\", \"old_name\": \"%s\", \"new_name\": \"%s\", \"input\": ", 
                        node->op.rename.old_name, node->op.rename.new_name);
                 print_ra_tree_json_rec(node->op.rename.input);
                 break;
                 
             case OP_SUBQUERY:
-                printf("\"type\": \"subquery\", \"alias\": \"%s\", \"query\": ", 
+                fprintf(ra_out, "\"type\": \"subquery\", \"alias\": \"%s\", \"query\": ", 
                        node->op.subquery.alias);
                 print_ra_tree_json_rec(node->op.subquery.subquery);
                 break;
+                
+            case OP_WITH:
+                fprintf(ra_out, "\"type\": \"with\", \"ctes\": [");
+                for (Cte *cte = node->op.with.ctes; cte != NULL; cte = cte->next) {
+                    fprintf(ra_out, "{\"name\": \"%s\"", cte->name);
+                    if (cte->materialized >= 0) {
+                        fprintf(ra_out, ", \"materialized\": %s", cte->materialized ? "true" : "false");
+                    }
+                    fprintf(ra_out, ", \"query\": ");
+                    print_ra_tree_json_rec(cte->query);
+                    fprintf(ra_out, "}%s", cte->next != NULL ? ", " : "");
+                }
+                fprintf(ra_out, "], \"input\": ");
+                print_ra_tree_json_rec(node->op.with.input);
+                break;
+                
+            case OP_CTE_REF:
+                fprintf(ra_out, "\"type\": \"cte_ref\", \"name\": \"%s\", \"alias\": \"%s\"", 
+                       node->op.cte_ref.name, node->op.cte_ref.alias);
+                break;
         }
     }
     
-    printf("}");
+    fprintf(ra_out, "}");
 }
 
-void print_ra_tree_json(RelNode *root) {
+void fprint_ra_tree_json(FILE *out, RelNode *root) {
+    ra_out = out;
     print_ra_tree_json_rec(root);
-    printf("\n");
+    fprintf(ra_out, "\n");
+}
+
+void print_ra_tree_json(RelNode *root) {
+    fprint_ra_tree_json(stdout, root);
+}
+
+void free_expr(Expr *expr) {
+    if (expr == NULL) {
+        return;
+    }
+    
+    free(expr->table);
+    free(expr->attr);
+    free(expr->str_literal);
+    free_expr(expr->left);
+    free_expr(expr->right);
+    free(expr);
 }
 
 void free_columns(Column *cols) {
@@ -765,6 +1551,8 @@ void free_columns(Column *cols) {
         Column *next = cols->next;
         free(cols->table);
         free(cols->attr);
+        free_expr(cols->expr);
+        free(cols->alias);
         free(cols);
         cols = next;
     }
@@ -782,6 +1570,17 @@ void free_tables(Table *tables) {
     }
 }
 
+void free_literals(Literal *lits) {
+    while (lits != NULL) {
+        Literal *next = lits->next;
+        if (lits->str_literal != NULL) {
+            free(lits->str_literal);
+        }
+        free(lits);
+        lits = next;
+    }
+}
+
 void free_condition(Condition *cond) {
     if (cond == NULL) {
         return;
@@ -796,11 +1595,19 @@ void free_condition(Condition *cond) {
         case COND_NOT:
             free_condition(cond->expr.unary.cond);
             break;
+        case COND_IN:
+            free(cond->expr.in_list.table);
+            free(cond->expr.in_list.attr);
+            free_literals(cond->expr.in_list.values);
+            break;
         default: /* Comparison operations */
             free(cond->expr.comparison.table);
             free(cond->expr.comparison.attr);
             
-            if (cond->expr.comparison.literal_type == 2) { /* string */
+            if (cond->expr.comparison.literal_type == 4) { /* expression */
+                free_expr(cond->expr.comparison.left_expr);
+                free_expr(cond->expr.comparison.right_expr);
+            } else if (cond->expr.comparison.literal_type == 2) { /* string */
                 free(cond->expr.comparison.str_literal);
             } else if (cond->expr.comparison.literal_type == 3) { /* column */
                 free(cond->expr.comparison.cmp_table);
@@ -847,8 +1654,28 @@ void free_relnode(RelNode *node) {
                 free(node->op.subquery.alias);
                 free_relnode(node->op.subquery.subquery);
                 break;
+                
+            case OP_WITH:
+                free_ctes(node->op.with.ctes);
+                free_relnode(node->op.with.input);
+                break;
+                
+            case OP_CTE_REF:
+                free(node->op.cte_ref.name);
+                free(node->op.cte_ref.alias);
+                break;
         }
     }
     
     free(node);
-}
\ No newline at end of file
+}
+
+void free_ctes(Cte *ctes) {
+    while (ctes != NULL) {
+        Cte *next = ctes->next;
+        free(ctes->name);
+        free_relnode(ctes->query);
+        free(ctes);
+        ctes = next;
+    }
+}
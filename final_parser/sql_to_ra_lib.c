@@ -0,0 +1,71 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "y.tab.h"
+#include "sql_parser.h"
+#include "sql_to_ra_lib.h"
+
+extern FILE *yyin;
+extern int yyparse(void);
+extern void yyrestart(FILE *input_file);
+extern RelNode *result;
+extern Cte *cte_scope;
+extern char parse_error[256];
+extern void fprint_ra_tree_json(FILE *out, RelNode *root);
+extern void free_relnode(RelNode *node);
+
+static pthread_mutex_t parser_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void set_error(char **error, const char *message) {
+    if (error != NULL) {
+        *error = strdup(message);
+    }
+}
+
+char *sql_to_ra_json(const char *sql, char **error) {
+    char *json = NULL;
+    size_t length = 0;
+
+    if (error != NULL) {
+        *error = NULL;
+    }
+    FILE *input = fmemopen((void *)sql, strlen(sql), "r");
+    if (input == NULL) {
+        set_error(error, "Could not open the query for reading");
+        return NULL;
+    }
+
+    pthread_mutex_lock(&parser_lock);
+    /* Start from a clean parser: a failed parse may leave any of these set */
+    yyin = input;
+    yyrestart(input);
+    result = NULL;
+    cte_scope = NULL;
+    parse_error[0] = '\0';
+
+    if (yyparse() == 0 && result != NULL) {
+        FILE *output = open_memstream(&json, &length);
+        if (output != NULL) {
+            fprint_ra_tree_json(output, result);
+            fclose(output);
+        } else {
+            set_error(error, "Could not allocate the output");
+        }
+        free_relnode(result);
+    } else if (parse_error[0] != '\0') {
+        set_error(error, parse_error);
+    } else {
+        set_error(error, "No relational algebra tree was generated");
+    }
+    result = NULL;
+    pthread_mutex_unlock(&parser_lock);
+
+    fclose(input);
+    return json;
+}
+
+void sql_to_ra_free(char *text) {
+    free(text);
+}
@@ -0,0 +1,18 @@
+#ifndef SQL_TO_RA_LIB_H
+#define SQL_TO_RA_LIB_H
+
+/*
+ * In-process entry point of the parser, built into libsql_to_ra.so, for
+ * programs that parse many queries without running sql_to_ra each time.
+ * Calls are serialized internally, since the generated parser keeps its
+ * state in globals.
+ */
+
+/* Parse one SQL query and return its relational algebra as a JSON string,
+ * to be released with sql_to_ra_free. Returns NULL on failure, with a
+ * message in *error (also released with sql_to_ra_free) if error is not NULL. */
+char *sql_to_ra_json(const char *sql, char **error);
+
+void sql_to_ra_free(char *text);
+
+#endif /* SQL_TO_RA_LIB_H */
@@ -97,4 +97,10 @@ WHERE PS.AVAILQTY > 10 AND S.ACCTBAL > 1000
   SELECT P.PARTKEY, P.SUPPKEY
   FROM PARTSUPP P
   JOIN SUPPLIER S ON P.SUPPKEY = S.SUPPKEY
-  WHERE P.AVAILQTY > 10 OR P.SUPPLYCOST < 500 AND S.ACCTBAL > 1000
\ No newline at end of file
+  WHERE P.AVAILQTY > 10 OR P.SUPPLYCOST < 500 AND S.ACCTBAL > 1000
+
+-- CTE read twice (materialized once)
+WITH SN AS (SELECT S.S_SUPPKEY, S.S_NAME FROM SUPPLIER S JOIN NATION N ON S.S_NATIONKEY = N.N_NATIONKEY WHERE N.N_NAME = 'GERMANY')
+SELECT A.S_NAME, B.S_NAME
+FROM SN A
+JOIN SN B ON A.S_SUPPKEY = B.S_SUPPKEY
\ No newline at end of file
@@ -11,6 +11,12 @@ PSQL="psql -U $DB_USER -d $DB_NAME"
 echo "Loading schema..."
 sudo -u postgres $PSQL -f "$DATA_DIR/dss.ddl"
 
+# LINEITEM and ORDERS are hash partitioned on the order key and range
+# partitioned by month below that, PART and PARTSUPP hash partitioned on the
+# part key. The partitions are generated from the catalog the optimizer reads.
+echo "Creating partitions..."
+python3 ../web_interface/catalog.py partitions | sudo -u postgres $PSQL
+
 # Load data into each table
 for file in "$DATA_DIR"/*.tbl; do
     # Extract table name from filename
@@ -28,3 +34,7 @@ for file in "$DATA_DIR"/*.tbl; do
         echo "Failed to load $file into $table"
     fi
 done
+
+# Build bitmap indexes on the low-cardinality columns from the same files
+echo "Building bitmap indexes..."
+python3 ../web_interface/bitmap_index.py "$DATA_DIR"
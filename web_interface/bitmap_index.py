@@ -0,0 +1,309 @@
+import os
+import pickle
+import sys
+
+from catalog import TPCH_DIR, read_table_rows
+
+# Low-cardinality columns that get a bitmap per distinct value at load time
+BITMAP_INDEX_COLUMNS = {
+    'customer': ['c_mktsegment'],
+    'orders': ['o_orderstatus', 'o_orderpriority'],
+    'lineitem': ['l_shipmode', 'l_returnflag', 'l_linestatus', 'l_shipinstruct'],
+    'part': ['p_mfgr', 'p_container'],
+}
+
+# Columns with more distinct values than this are not worth a bitmap each
+MAX_BITMAP_NDV = 256
+
+BITMAP_INDEX_FILE = os.path.join(TPCH_DIR, 'bitmap_indexes.pkl')
+
+# A container holds the low 16 bits of the row ids sharing the same high
+# 16 bits. Up to ARRAY_MAX entries it is a sorted list, above that a
+# 65536-bit integer (the Roaring layout).
+CHUNK_BITS = 16
+CHUNK_SIZE = 1 << CHUNK_BITS
+ARRAY_MAX = 4096
+
+
+def _popcount(bits):
+    return bin(bits).count('1')
+
+
+def _to_bits(container):
+    if isinstance(container, int):
+        return container
+    bits = 0
+    for low in container:
+        bits |= 1 << low
+    return bits
+
+
+def _to_array(bits):
+    result = []
+    while bits:
+        lowest = bits & -bits
+        result.append(lowest.bit_length() - 1)
+        bits ^= lowest
+    return result
+
+
+def _normalize(container):
+    """Pick the representation for a container, or None if it is empty."""
+    if isinstance(container, int):
+        count = _popcount(container)
+        if count == 0:
+            return None
+        return _to_array(container) if count <= ARRAY_MAX else container
+    if not container:
+        return None
+    return container if len(container) <= ARRAY_MAX else _to_bits(container)
+
+
+def _container_len(container):
+    return _popcount(container) if isinstance(container, int) else len(container)
+
+
+def _container_and(a, b):
+    if isinstance(a, int) and isinstance(b, int):
+        return _normalize(a & b)
+    if isinstance(a, int):
+        a, b = b, a
+    if isinstance(b, int):
+        return _normalize([low for low in a if (b >> low) & 1])
+    return _normalize(sorted(set(a).intersection(b)))
+
+
+def _container_or(a, b):
+    if isinstance(a, int) or isinstance(b, int):
+        return _normalize(_to_bits(a) | _to_bits(b))
+    return _normalize(sorted(set(a).union(b)))
+
+
+def _container_andnot(a, b):
+    if isinstance(a, int):
+        return _normalize(a & ~_to_bits(b))
+    if isinstance(b, int):
+        return _normalize([low for low in a if not (b >> low) & 1])
+    b = set(b)
+    return _normalize([low for low in a if low not in b])
+
+
+class RoaringBitmap:
+    """
+    Compressed set of row ids split into 2^16-wide chunks, each stored as a
+    sorted array when sparse and as a bitmap when dense.
+    """
+
+    def __init__(self, containers=None):
+        self.containers = containers or {}
+
+    @classmethod
+    def from_sorted(cls, row_ids):
+        """Build a bitmap from row ids in ascending order."""
+        containers = {}
+        for row_id in row_ids:
+            containers.setdefault(row_id >> CHUNK_BITS, []).append(row_id & (CHUNK_SIZE - 1))
+        return cls({high: _normalize(lows) for high, lows in containers.items()})
+
+    def __len__(self):
+        return sum(_container_len(c) for c in self.containers.values())
+
+    def __contains__(self, row_id):
+        container = self.containers.get(row_id >> CHUNK_BITS)
+        if container is None:
+            return False
+        low = row_id & (CHUNK_SIZE - 1)
+        if isinstance(container, int):
+            return bool((container >> low) & 1)
+        return low in container
+
+    def __iter__(self):
+        for high in sorted(self.containers):
+            container = self.containers[high]
+            lows = _to_array(container) if isinstance(container, int) else container
+            for low in lows:
+                yield (high << CHUNK_BITS) | low
+
+    def _combine(self, other, op, keep_left, keep_right):
+        containers = {}
+        for high in set(self.containers) | set(other.containers):
+            a = self.containers.get(high)
+            b = other.containers.get(high)
+            if a is not None and b is not None:
+                result = op(a, b)
+            elif a is not None:
+                result = a if keep_left else None
+            else:
+                result = b if keep_right else None
+            if result is not None:
+                containers[high] = result
+        return RoaringBitmap(containers)
+
+    def __and__(self, other):
+        return self._combine(other, _container_and, False, False)
+
+    def __or__(self, other):
+        return self._combine(other, _container_or, True, True)
+
+    def __sub__(self, other):
+        return self._combine(other, _container_andnot, True, False)
+
+    def complement(self, row_count):
+        """Return the row ids in [0, row_count) that are not in this bitmap."""
+        containers = {}
+        for high in range((row_count + CHUNK_SIZE - 1) >> CHUNK_BITS):
+            width = min(CHUNK_SIZE, row_count - (high << CHUNK_BITS))
+            full = (1 << width) - 1
+            container = self.containers.get(high)
+            result = _normalize(full if container is None else full & ~_to_bits(container))
+            if result is not None:
+                containers[high] = result
+        return RoaringBitmap(containers)
+
+    def container_count(self):
+        return len(self.containers)
+
+
+class BitmapIndex:
+    """One bitmap of matching row ids per distinct value of a column."""
+
+    def __init__(self, table, column, row_count, bitmaps):
+        self.table = table
+        self.column = column
+        self.row_count = row_count
+        self.bitmaps = bitmaps
+
+    def lookup(self, value):
+        """Bitmap of the rows equal to value; empty if the value never occurs."""
+        return self.bitmaps.get(str(value), RoaringBitmap())
+
+    def ndv(self):
+        return len(self.bitmaps)
+
+
+def build_bitmap_indexes(data_dir, index_columns=BITMAP_INDEX_COLUMNS, max_ndv=MAX_BITMAP_NDV):
+    """
+    Build bitmap indexes from the .tbl files in a single pass per table.
+
+    Args:
+        data_dir (str): Directory containing the .tbl files
+        index_columns (dict): Table name -> columns to index
+        max_ndv (int): Columns with more distinct values are skipped
+
+    Returns:
+        dict: table -> {column -> BitmapIndex}
+    """
+    indexes = {}
+    for table, columns in index_columns.items():
+        if not os.path.exists(os.path.join(data_dir, f"{table}.tbl")):
+            print(f"Skipping bitmap indexes on {table}: no {table}.tbl in {data_dir}")
+            continue
+
+        row_ids = [{} for _ in columns]
+        row_count = 0
+        for row_id, values in read_table_rows(data_dir, table, columns):
+            for i, value in enumerate(values):
+                if row_ids[i] is not None:
+                    row_ids[i].setdefault(value, []).append(row_id)
+                    if len(row_ids[i]) > max_ndv:
+                        print(f"Not indexing {table}.{columns[i]}: more than {max_ndv} distinct values")
+                        row_ids[i] = None
+            row_count = row_id + 1
+
+        indexes[table] = {}
+        for column, values in zip(columns, row_ids):
+            if values is None:
+                continue
+            bitmaps = {value: RoaringBitmap.from_sorted(ids) for value, ids in values.items()}
+            indexes[table][column] = BitmapIndex(table, column, row_count, bitmaps)
+            print(f"Built bitmap index on {table}.{column}: {len(bitmaps)} values, {row_count} rows")
+    return indexes
+
+
+def save_bitmap_indexes(indexes, path=BITMAP_INDEX_FILE):
+    with open(path, 'wb') as f:
+        pickle.dump(indexes, f)
+
+
+def load_bitmap_indexes(path=BITMAP_INDEX_FILE):
+    """Load the indexes built by pop.sh, or return {} if none were built."""
+    if not os.path.exists(path):
+        return {}
+    with open(path, 'rb') as f:
+        return pickle.load(f)
+
+
+def evaluate_bitmap_condition(condition, table_indexes, row_count):
+    """
+    Answer a filter over one table by bitmap algebra.
+
+    EQ/NE/IN on indexed columns become bitmap lookups, AND/OR/NOT become
+    intersection, union and complement. Under an AND, a side that cannot be
+    answered is left for a recheck on the fetched rows.
+
+    Args:
+        condition (dict): Condition JSON of a select over a base relation
+        table_indexes (dict): column -> BitmapIndex for that table
+        row_count (int): Number of rows in the table
+
+    Returns:
+        tuple: (bitmap of candidate rows, exact flag, set of indexed columns used),
+               or None if no part of the condition can use an index
+    """
+    cond_type = condition.get("type")
+
+    if cond_type == "AND":
+        left = evaluate_bitmap_condition(condition["left"], table_indexes, row_count)
+        right = evaluate_bitmap_condition(condition["right"], table_indexes, row_count)
+        if left is not None and right is not None:
+            return left[0] & right[0], left[1] and right[1], left[2] | right[2]
+        if left is not None or right is not None:
+            bitmap, _, columns = left if left is not None else right
+            return bitmap, False, columns
+        return None
+
+    if cond_type == "OR":
+        left = evaluate_bitmap_condition(condition["left"], table_indexes, row_count)
+        right = evaluate_bitmap_condition(condition["right"], table_indexes, row_count)
+        if left is None or right is None:
+            return None
+        return left[0] | right[0], left[1] and right[1], left[2] | right[2]
+
+    if cond_type == "NOT":
+        inner = evaluate_bitmap_condition(condition["cond"], table_indexes, row_count)
+        # The complement of a candidate superset says nothing
+        if inner is None or not inner[1]:
+            return None
+        return inner[0].complement(row_count), True, inner[2]
+
+    if cond_type in ("EQ", "NE", "IN"):
+        left = condition["left"]
+        index = table_indexes.get(str(left.get("attr", "")).lower())
+        if index is None or left.get("type", "column") != "column":
+            return None
+
+        if cond_type == "IN":
+            values = condition["right"]["values"]
+        else:
+            values = [condition["right"]]
+        if any(v.get("type") not in ("int", "string") for v in values):
+            return None
+
+        bitmap = RoaringBitmap()
+        for value in values:
+            bitmap = bitmap | index.lookup(value["value"])
+        if cond_type == "NE":
+            bitmap = bitmap.complement(row_count)
+        return bitmap, True, {index.column}
+
+    return None
+
+
+if __name__ == "__main__":
+    # Usage: python3 bitmap_index.py [data_dir]
+    # Import through the module so that the pickled classes resolve to
+    # bitmap_index rather than __main__ when the optimizer loads them
+    from bitmap_index import build_bitmap_indexes, save_bitmap_indexes
+    data_dir = sys.argv[1] if len(sys.argv) > 1 else TPCH_DIR
+    indexes = build_bitmap_indexes(data_dir)
+    save_bitmap_indexes(indexes, os.path.join(data_dir, 'bitmap_indexes.pkl'))
@@ -0,0 +1,232 @@
+"""
+Buffer Pool
+
+Caches fixed-size pages of the .tbl files in a bounded set of frames, for
+data that no longer fits in memory. Replacement follows 2Q: a page read for
+the first time enters a FIFO queue (A1in) and is only promoted to the main
+LRU queue (Am) if it is read again after leaving A1in, which a remembered
+list of recently evicted pages (A1out) detects. A single pass over a table
+therefore cannot push out pages that are read over and over.
+
+Sequential scans of tables larger than a quarter of the pool go further,
+as in PostgreSQL's bulk-read strategy: they read through a small ring of
+their own frames and leave the shared queues alone, so a LINEITEM scan never
+flushes NATION or SUPPLIER.
+
+Frames are pinned while their page is being read and are never evicted
+while pinned. The fraction of each table resident in the pool is exported
+for the cost model, together with hit rates.
+"""
+
+import argparse
+import json
+import os
+import threading
+from collections import OrderedDict
+
+from catalog import TPCH_DIR
+
+PAGE_SIZE = 8192
+DEFAULT_FRAMES = 1024
+RING_FRAMES = 32  # 256kB, the size of PostgreSQL's bulk-read ring
+CACHE_RESIDENCY_FILE = os.path.join(TPCH_DIR, 'cache_residency.json')
+
+
+def load_cache_residency(path=CACHE_RESIDENCY_FILE):
+    """Load the residency saved by buffer_pool.py, or return {} if there is none."""
+    if not os.path.exists(path):
+        return {}
+    with open(path) as f:
+        return json.load(f)
+
+
+class Frame:
+    def __init__(self, key, data):
+        self.key = key
+        self.data = data
+        self.pins = 0
+
+
+class BufferRing:
+    """Frames private to one sequential scan, reused in turn."""
+
+    def __init__(self, size=RING_FRAMES):
+        self.frames = [None] * size
+        self.next = 0
+
+    def load(self, frame):
+        victim = self.frames[self.next]
+        if victim is not None and victim.pins:
+            raise RuntimeError("Buffer ring frame still pinned")
+        self.frames[self.next] = frame
+        self.next = (self.next + 1) % len(self.frames)
+
+
+class BufferPool:
+    """
+    Args:
+        frames (int): Pages the pool holds
+        policy (str): "2q", or "lru" to compare against a plain LRU pool
+                      without rings
+    """
+
+    def __init__(self, frames=DEFAULT_FRAMES, policy="2q"):
+        self.capacity = frames
+        self.policy = policy
+        self.a1in = OrderedDict()   # key -> Frame, FIFO of pages read once
+        self.am = OrderedDict()     # key -> Frame, LRU of pages read again
+        self.a1out = OrderedDict()  # keys of pages recently evicted from A1in
+        self.kin = max(1, frames // 4)
+        self.kout = max(1, frames // 2)
+        self.lock = threading.Lock()
+        self.table_pages = {}
+        self.versions = {}
+        self.stats = {}
+
+    def frame_count(self):
+        return len(self.a1in) + len(self.am)
+
+    def count(self, table, hit):
+        table_stats = self.stats.setdefault(table, {"hits": 0, "misses": 0})
+        table_stats["hits" if hit else "misses"] += 1
+
+    def pin(self, table, path, block, ring=None):
+        """
+        Return the frame holding a page, reading it from disk on a miss.
+        The frame stays pinned until unpin is called.
+        """
+        key = (table, block)
+        with self.lock:
+            frame = self.am.get(key) or self.a1in.get(key)
+            if frame is not None:
+                if key in self.am:
+                    self.am.move_to_end(key)
+                elif self.policy == "lru":
+                    self.a1in.move_to_end(key)
+                frame.pins += 1
+                self.count(table, True)
+                return frame
+
+        with open(path, 'rb') as f:
+            f.seek(block * PAGE_SIZE)
+            frame = Frame(key, f.read(PAGE_SIZE))
+        frame.pins = 1
+
+        with self.lock:
+            self.count(table, False)
+            loaded = self.am.get(key) or self.a1in.get(key)
+            if loaded is not None:
+                # Another reader loaded it meanwhile
+                loaded.pins += 1
+                return loaded
+            if ring is not None:
+                ring.load(frame)
+                return frame
+            if self.frame_count() >= self.capacity:
+                self.evict()
+            if self.policy == "2q" and key in self.a1out:
+                del self.a1out[key]
+                self.am[key] = frame
+            else:
+                self.a1in[key] = frame
+            return frame
+
+    def unpin(self, frame):
+        with self.lock:
+            frame.pins -= 1
+
+    def evict(self):
+        # 2Q reclaims from A1in while it is over its share, remembering the
+        # page in A1out; otherwise from the cold end of Am
+        queues = [self.a1in, self.am] if len(self.a1in) > self.kin or not self.am else [self.am, self.a1in]
+        for queue in queues:
+            for key, frame in queue.items():
+                if frame.pins == 0:
+                    del queue[key]
+                    if queue is self.a1in and self.policy == "2q":
+                        self.a1out[key] = None
+                        if len(self.a1out) > self.kout:
+                            self.a1out.popitem(last=False)
+                    return
+        raise RuntimeError("All buffer pool frames are pinned")
+
+    def check_version(self, table, version):
+        """Drop the pages of a table whose file changed since they were read, such as by an append."""
+        with self.lock:
+            if self.versions.get(table, version) != version:
+                for queue in (self.a1in, self.am, self.a1out):
+                    for key in [key for key in queue if key[0] == table]:
+                        # A reader still holding a frame keeps it until it unpins
+                        del queue[key]
+            self.versions[table] = version
+
+    def read_lines(self, table, path):
+        """
+        Iterate over the lines of a table's file through the pool. Tables
+        larger than a quarter of the pool are read through a ring.
+        """
+        stat = os.stat(path)
+        self.check_version(table, (stat.st_mtime_ns, stat.st_size))
+        pages = max(1, -(-stat.st_size // PAGE_SIZE))
+        self.table_pages[table] = pages
+        ring = BufferRing() if self.policy == "2q" and pages > self.capacity // 4 else None
+
+        carry = b""
+        for block in range(pages):
+            frame = self.pin(table, path, block, ring)
+            try:
+                data = carry + frame.data
+            finally:
+                self.unpin(frame)
+            lines = data.split(b"\n")
+            carry = lines.pop()
+            for line in lines:
+                yield line.decode() + "\n"
+        if carry:
+            yield carry.decode()
+
+    def residency(self):
+        """Fraction of each table's pages currently in the pool."""
+        with self.lock:
+            resident = {}
+            for table, _ in list(self.a1in) + list(self.am):
+                resident[table] = resident.get(table, 0) + 1
+            return {table: min(1.0, resident.get(table, 0) / pages) for table, pages in self.table_pages.items()}
+
+    def metrics(self):
+        with self.lock:
+            tables = {table: {**counts, "hit_rate": counts["hits"] / max(1, counts["hits"] + counts["misses"])}
+                      for table, counts in self.stats.items()}
+            hits = sum(counts["hits"] for counts in self.stats.values())
+            total = hits + sum(counts["misses"] for counts in self.stats.values())
+            return {"policy": self.policy, "frames": self.capacity, "used_frames": self.frame_count(),
+                    "hit_rate": hits / max(1, total), "tables": tables}
+
+
+if __name__ == "__main__":
+    # Replays dashboard lookups on the dimension tables interleaved with
+    # full LINEITEM scans, under 2Q with rings and under plain LRU
+    parser = argparse.ArgumentParser(description="Compare buffer pool policies on a mixed workload")
+    parser.add_argument("data_dir", nargs="?", default=TPCH_DIR, help="Directory containing the .tbl files")
+    parser.add_argument("--frames", type=int, default=256, help="Pages the pool holds")
+    parser.add_argument("--rounds", type=int, default=10, help="Rounds of lookups and scans")
+    parser.add_argument("--save-residency", action="store_true",
+                        help="Save the 2Q pool's residency for the cost model")
+    args = parser.parse_args()
+
+    hot = ["nation", "region", "supplier", "customer"]
+    report = {}
+    for policy in ("2q", "lru"):
+        pool = BufferPool(args.frames, policy)
+        for _ in range(args.rounds):
+            for table in hot:
+                for _ in range(5):
+                    for _ in pool.read_lines(table, os.path.join(args.data_dir, f"{table}.tbl")):
+                        pass
+            for _ in pool.read_lines("lineitem", os.path.join(args.data_dir, "lineitem.tbl")):
+                pass
+        report[policy] = {**pool.metrics(), "residency": pool.residency()}
+        if policy == "2q" and args.save_residency:
+            with open(os.path.join(args.data_dir, 'cache_residency.json'), 'w') as f:
+                json.dump(pool.residency(), f, indent=2)
+    print(json.dumps(report, indent=2))
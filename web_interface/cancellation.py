@@ -0,0 +1,103 @@
+"""
+Query Cancellation
+
+A CancellationToken is handed to the parser, the join optimizer and the
+executor working on one query. It is cancelled explicitly, by its deadline
+or by a flag raised in another process, and the long-running loops check it
+at their natural boundaries:
+every join order enumerated or costed, and every morsel of rows scanned or
+joined. A check on a cancelled token raises QueryCancelled, carrying the
+progress the components reported so far, so that a timed out query answers
+with diagnostics instead of pinning its worker.
+"""
+
+import subprocess
+import threading
+import time
+
+DEFAULT_TIMEOUT_SECONDS = 30
+MORSEL_ROWS = 4096
+PARSER_POLL_SECONDS = 0.05
+
+
+class QueryCancelled(Exception):
+    def __init__(self, reason, stage, diagnostics):
+        super().__init__(f"Query {reason} during {stage}")
+        self.reason = reason
+        self.stage = stage
+        self.diagnostics = diagnostics
+
+
+class CancellationToken:
+    """
+    Args:
+        timeout (float): Seconds from now until the token cancels itself,
+                         or None for no deadline
+        flag (function): Returns True once the query is cancelled from
+                         elsewhere, such as a job's flag in shared memory;
+                         called at every check, so it must be cheap
+    """
+
+    def __init__(self, timeout=None, flag=None):
+        self.started = time.monotonic()
+        self.deadline = self.started + timeout if timeout is not None else None
+        self.flag = flag
+        self.reason = None
+        self.progress = {}
+        self.lock = threading.Lock()
+
+    def cancel(self, reason="cancelled"):
+        with self.lock:
+            if self.reason is None:
+                self.reason = reason
+
+    def is_cancelled(self):
+        if self.reason is None and self.flag is not None and self.flag():
+            self.cancel()
+        if self.reason is None and self.deadline is not None and time.monotonic() >= self.deadline:
+            self.cancel("timed out")
+        return self.reason is not None
+
+    def remaining(self):
+        """Seconds left until the deadline, or None without one."""
+        if self.deadline is None:
+            return None
+        return max(0.0, self.deadline - time.monotonic())
+
+    def report(self, **progress):
+        """Record progress, returned in the diagnostics if the query is cancelled."""
+        with self.lock:
+            self.progress.update(progress)
+
+    def check(self, stage):
+        if self.is_cancelled():
+            with self.lock:
+                diagnostics = {**self.progress, "elapsed_seconds": time.monotonic() - self.started}
+            raise QueryCancelled(self.reason, stage, diagnostics)
+
+    def checked(self, items, stage, every=MORSEL_ROWS):
+        """Iterate over items, checking the token every `every` items."""
+        for i, item in enumerate(items):
+            if i % every == 0:
+                self.check(stage)
+            yield item
+
+    def run(self, args, stage):
+        """
+        subprocess.run for a child such as the SQL parser, killing it once
+        the token is cancelled.
+        """
+        process = subprocess.Popen(args, stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True)
+        while True:
+            try:
+                stdout, stderr = process.communicate(timeout=PARSER_POLL_SECONDS)
+                break
+            except subprocess.TimeoutExpired:
+                if self.is_cancelled():
+                    process.kill()
+                    process.communicate()
+                    self.report(**{f"{stage}_killed": True})
+                    self.check(stage)
+        if process.returncode:
+            raise subprocess.CalledProcessError(process.returncode, args, stdout, stderr)
+        return subprocess.CompletedProcess(args, process.returncode, stdout, stderr)
@@ -0,0 +1,229 @@
+import os
+import re
+import sys
+
+# Location of the TPC-H schema and the .tbl files loaded by tpch/pop.sh
+TPCH_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'tpch')
+DDL_FILE = os.path.join(TPCH_DIR, 'dss.ddl')
+
+COLUMN_TYPES = r'INTEGER|CHAR|VARCHAR|DECIMAL|DATE'
+
+# Declarative range partitioning: one partition per month of the column
+# between start and end. The first and last partitions are open-ended so
+# that every row has a home. Tables that are hash partitioned as well hold
+# these ranges below each hash partition, so a range partition is stored as
+# one leaf per hash partition.
+RANGE_PARTITIONS = {
+    'lineitem': {'column': 'l_shipdate', 'start': '1992-01-01', 'end': '1999-01-01'},
+    'orders': {'column': 'o_orderdate', 'start': '1992-01-01', 'end': '1999-01-01'},
+}
+
+# Hash partitioning on join keys. Tables in the same colocation group are
+# split with the same modulus on equal keys, so partition i of one only
+# joins with partition i of the other. The hash level is the top one, also
+# for range partitioned tables, since PostgreSQL only joins partition by
+# partition when both sides share their top level partition bounds.
+HASH_PARTITIONS = {
+    'orders': {'column': 'o_orderkey', 'modulus': 8, 'colocation': 'orderkey'},
+    'lineitem': {'column': 'l_orderkey', 'modulus': 8, 'colocation': 'orderkey'},
+    'part': {'column': 'p_partkey', 'modulus': 8, 'colocation': 'partkey'},
+    'partsupp': {'column': 'ps_partkey', 'modulus': 8, 'colocation': 'partkey'},
+}
+
+# Physical order of the rows inside every stored table (or leaf partition):
+# dbgen writes the .tbl files in primary key order and COPY appends them in
+# that order, so a sequential scan of one leaf returns rows sorted on these.
+SORT_ORDERS = {
+    'lineitem': ['l_orderkey', 'l_linenumber'],
+    'orders': ['o_orderkey'],
+    'customer': ['c_custkey'],
+    'part': ['p_partkey'],
+    'partsupp': ['ps_partkey', 'ps_suppkey'],
+    'supplier': ['s_suppkey'],
+    'nation': ['n_nationkey'],
+    'region': ['r_regionkey'],
+}
+
+
+def load_column_types(ddl_path=DDL_FILE):
+    """
+    Read the columns of every table from the schema file, in declaration
+    order, which is also the field order of the .tbl files.
+
+    Args:
+        ddl_path (str): Path to the CREATE TABLE script
+
+    Returns:
+        dict: Lowercase table name -> {lowercase column name -> SQL type}
+    """
+    with open(ddl_path) as f:
+        ddl = f.read()
+
+    tables = {}
+    for name, body in re.findall(r'CREATE TABLE\s+(\w+)\s*\((.*?)\);', ddl, re.DOTALL | re.IGNORECASE):
+        columns = re.findall(rf'(\w+)\s+({COLUMN_TYPES})\b', body, re.IGNORECASE)
+        tables[name.lower()] = {column.lower(): sql_type.upper() for column, sql_type in columns}
+    return tables
+
+
+def load_table_columns(ddl_path=DDL_FILE):
+    """
+    Read the column order of every table from the schema file. The .tbl
+    files store fields in the same order, separated by '|'.
+
+    Args:
+        ddl_path (str): Path to the CREATE TABLE script
+
+    Returns:
+        dict: Lowercase table name -> list of lowercase column names
+    """
+    return {table: list(columns) for table, columns in load_column_types(ddl_path).items()}
+
+
+def read_table_rows(data_dir, table, columns, layout=None, path=None):
+    """
+    Iterate over the rows of a .tbl file, yielding (row_id, values) where
+    values holds the requested columns. Row ids follow the load order,
+    which is also the heap order after COPY.
+
+    Args:
+        data_dir (str): Directory containing <table>.tbl
+        table (str): Lowercase table name
+        columns (list): Column names to extract
+        layout (list): Columns of the file in order, if not a table of the DDL
+        path (str): File to read instead of <table>.tbl, e.g. a refresh set
+
+    Returns:
+        generator: (row_id, list of string values)
+    """
+    layout = layout or load_table_columns()[table]
+    positions = [layout.index(column) for column in columns]
+
+    with open(path or os.path.join(data_dir, f"{table}.tbl")) as f:
+        for row_id, line in enumerate(f):
+            fields = line.rstrip('\n').split('|')
+            yield row_id, [fields[pos] for pos in positions]
+
+
+def list_partitions(table):
+    """
+    List the range partitions of a table in key order.
+
+    Args:
+        table (str): Table name
+
+    Returns:
+        list: dicts with the partition name and its [low, high) bounds, where
+              None stands for an unbounded side; empty if not partitioned
+    """
+    spec = RANGE_PARTITIONS.get(table.lower())
+    if spec is None:
+        return []
+
+    year, month = int(spec['start'][:4]), int(spec['start'][5:7])
+    partitions = []
+    low = None
+    while True:
+        month += 1
+        if month > 12:
+            year, month = year + 1, 1
+        high = f"{year:04d}-{month:02d}-01"
+        if high >= spec['end']:
+            high = None
+        # Named after the month the partition starts in
+        start = low or spec['start']
+        partitions.append({
+            'name': f"{table.lower()}_{start[:4]}_{start[5:7]}",
+            'low': low,
+            'high': high
+        })
+        if high is None:
+            return partitions
+        low = high
+
+
+def colocation(table1, attr1, table2, attr2):
+    """
+    Check whether an equi-join of table1.attr1 = table2.attr2 can run
+    partition by partition.
+
+    Returns:
+        dict: The shared hash partitioning spec, or None if the inputs are
+              not co-partitioned on these keys
+    """
+    spec1 = HASH_PARTITIONS.get(table1.lower())
+    spec2 = HASH_PARTITIONS.get(table2.lower())
+    if spec1 is None or spec2 is None:
+        return None
+    if spec1['column'] != attr1.lower() or spec2['column'] != attr2.lower():
+        return None
+    if spec1['colocation'] != spec2['colocation'] or spec1['modulus'] != spec2['modulus']:
+        return None
+    return spec1
+
+
+def scan_order(table):
+    """
+    Describe the order a full scan of a table returns its rows in.
+
+    Returns:
+        tuple: (sort keys of every leaf, number of leaves). With more than one
+               leaf the scan is only sorted after merging the leaves.
+    """
+    keys = SORT_ORDERS.get(table.lower(), [])
+    runs = max(1, len(list_partitions(table)))
+    if table.lower() in HASH_PARTITIONS:
+        runs *= HASH_PARTITIONS[table.lower()]['modulus']
+    return keys, runs
+
+
+def partition_leaves(table, partition):
+    """
+    Names of the stored tables holding the rows of a range partition: the
+    partition itself, or its leaf below every hash partition of the table.
+    """
+    spec = HASH_PARTITIONS.get(table.lower())
+    if spec is None:
+        return [partition]
+    suffix = partition[len(table) + 1:]
+    return [f"{table.lower()}_h{remainder}_{suffix}" for remainder in range(spec['modulus'])]
+
+
+def range_partition_ddl(parent, table):
+    """Statements creating the monthly range partitions of parent, named after table's."""
+    statements = []
+    for partition in list_partitions(table):
+        low = f"'{partition['low']}'" if partition['low'] else 'MINVALUE'
+        high = f"'{partition['high']}'" if partition['high'] else 'MAXVALUE'
+        name = f"{parent}{partition['name'][len(table):]}"
+        statements.append(f"CREATE TABLE {name} PARTITION OF {parent} "
+                          f"FOR VALUES FROM ({low}) TO ({high});")
+    return statements
+
+
+def partition_ddl(table):
+    """
+    PostgreSQL statements creating the partitions of a table declared
+    PARTITION BY RANGE or PARTITION BY HASH in dss.ddl.
+    """
+    table = table.lower()
+    spec = HASH_PARTITIONS.get(table)
+    if spec is None:
+        return '\n'.join(range_partition_ddl(table, table))
+
+    statements = []
+    ranged = table in RANGE_PARTITIONS
+    for remainder in range(spec['modulus']):
+        sub = f" PARTITION BY RANGE ({RANGE_PARTITIONS[table]['column'].upper()})" if ranged else ""
+        statements.append(f"CREATE TABLE {table}_h{remainder} PARTITION OF {table.upper()} "
+                          f"FOR VALUES WITH (MODULUS {spec['modulus']}, REMAINDER {remainder}){sub};")
+        if ranged:
+            statements.extend(range_partition_ddl(f"{table}_h{remainder}", table))
+    return '\n'.join(statements)
+
+
+if __name__ == "__main__":
+    # Usage: python3 catalog.py partitions  (prints the partition DDL for psql)
+    if len(sys.argv) > 1 and sys.argv[1] == 'partitions':
+        for table in sorted(set(RANGE_PARTITIONS) | set(HASH_PARTITIONS)):
+            print(partition_ddl(table))
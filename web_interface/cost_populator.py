@@ -1,5 +1,13 @@
+import bisect
+import datetime
 import json
+import math
+import re
 import psycopg2
+from bitmap_index import load_bitmap_indexes, evaluate_bitmap_condition
+from buffer_pool import load_cache_residency
+from catalog import RANGE_PARTITIONS, list_partitions, partition_leaves
+from materialized_views import view_statistics
 
 predicate_selectivity = {
     'GT': 0.5,  # e.g., id > 1
@@ -9,6 +17,48 @@ predicate_selectivity = {
 
 tuple_io_cost = 1
 
+# Per-character factors for LIKE patterns that cannot use the histogram,
+# following PostgreSQL's like_selectivity heuristics
+FIXED_CHAR_SEL = 0.2
+ANY_CHAR_SEL = 0.9
+FULL_WILDCARD_SEL = 5.0
+
+
+def like_pattern_selectivity(pattern):
+    """Heuristic selectivity of a LIKE pattern from its literal characters."""
+    selectivity = 1.0
+    for i, ch in enumerate(pattern):
+        if ch == '%':
+            # A leading % does not restrict anything
+            if i > 0:
+                selectivity *= FULL_WILDCARD_SEL
+        elif ch == '_':
+            selectivity *= ANY_CHAR_SEL
+        else:
+            selectivity *= FIXED_CHAR_SEL
+    return min(1.0, selectivity)
+
+
+def count_arith_operators(expr):
+    """Count the arithmetic operations in a condition or column expression."""
+    if not isinstance(expr, dict):
+        return 0
+    count = 1 if expr.get("type") == "arith" else 0
+    return count + sum(count_arith_operators(value) for value in expr.values())
+
+
+def like_to_regex(pattern):
+    """Translate a LIKE pattern into an anchored regular expression."""
+    parts = []
+    for ch in pattern:
+        if ch == '%':
+            parts.append('.*')
+        elif ch == '_':
+            parts.append('.')
+        else:
+            parts.append(re.escape(ch))
+    return re.compile(''.join(parts) + r'\Z', re.DOTALL)
+
 
 
 class CostCalculator:
@@ -30,6 +80,7 @@ class CostCalculator:
         self.cpu_operator_cost = 0.0025
         self.seq_page_cost = 1.0
         self.random_page_cost = 4.0
+        self.cached_page_cost = 0.1  # a page found in the buffer pool
         
         # Join strategies
         self.join_strategies = ["hash", "nested", "block"]
@@ -37,6 +88,18 @@ class CostCalculator:
         # Selectivity methods
         self.selectivity_methods = ["fixed", "ndv", "mcv"]
 
+        # Bitmap indexes built by tpch/pop.sh, if any
+        self.bitmap_indexes = load_bitmap_indexes()
+
+        # Materialized CTEs of the plan being costed, by name
+        self.ctes = {}
+
+        # Expected fraction of each table in the buffer pool, saved by buffer_pool.py
+        self.cache_residency = load_cache_residency()
+
+        # Table statistics kept in memory by long-running servers, by lowercase name
+        self.statistics_cache = {}
+
     def connect(self):
         """Establish a connection to the PostgreSQL database."""
         try:
@@ -57,6 +120,14 @@ class CostCalculator:
             self.conn.close()
             print("Disconnected from PostgreSQL database.")
 
+    def page_cost(self, table_name, disk_page_cost):
+        """
+        Expected cost of reading a page of a table, when a fraction of it is
+        expected to be resident in the buffer pool.
+        """
+        residency = self.cache_residency.get(table_name.lower(), 0.0)
+        return residency * self.cached_page_cost + (1 - residency) * disk_page_cost
+
     def get_table_statistics(self, table_name: str):
         """
         Retrieve statistics for a given table.
@@ -69,6 +140,8 @@ class CostCalculator:
         """
         # Check if we're dealing with a subquery alias
         table_name = table_name.lower()
+        if table_name in self.statistics_cache:
+            return self.statistics_cache[table_name]
         is_subquery = table_name.startswith('tmp')
         
         if is_subquery and hasattr(self, 'subquery_base_tables') and table_name in self.subquery_base_tables:
@@ -83,25 +156,34 @@ class CostCalculator:
                 actual_table = parts[-1]
                 print(f"Extracting base table '{actual_table}' from subquery reference '{table_name}'")
                 return self.get_table_statistics(actual_table)
+
+        # Materialized views are not in the database; their registry has the statistics
+        view_stats = view_statistics(table_name)
+        if view_stats is not None:
+            return view_stats
         
         # Create a fresh cursor for each query to avoid transaction issues
         with self.conn.cursor() as stats_cursor:
             try:
+                # Partitioned tables keep their rows in the leaf partitions;
+                # a plain table is its own single leaf
                 query = """
                 SELECT
-                    reltuples as row_count,
-                    relpages as page_count,
-                    pg_table_size(%s) as table_size
+                    sum(GREATEST(c.reltuples, 0)) as row_count,
+                    sum(c.relpages)::bigint as page_count,
+                    sum(pg_table_size(c.oid))::bigint as table_size
                 FROM
-                    pg_class
+                    pg_partition_tree(%s::regclass) p
+                JOIN
+                    pg_class c ON c.oid = p.relid
                 WHERE
-                    relname = %s;
+                    p.isleaf;
                 """
                 
-                stats_cursor.execute(query, (table_name, table_name))
+                stats_cursor.execute(query, (table_name,))
                 result = stats_cursor.fetchone()
                 
-                if not result:
+                if not result or result[0] is None:
                     raise ValueError(f"Table {table_name} not found in the database.")
                 
                 row_count, page_count, table_size = result
@@ -130,7 +212,8 @@ class CostCalculator:
                     s.null_frac as nullfrac,
                     s.avg_width as avg_width,
                     array_to_string(s.most_common_vals, ',') as mcv_values,
-                    array_to_string(s.most_common_freqs, ',') as mcv_freqs
+                    array_to_string(s.most_common_freqs, ',') as mcv_freqs,
+                    array_to_string(s.histogram_bounds, '|') as histogram_bounds
                 FROM
                     pg_stats s
                 JOIN
@@ -145,7 +228,7 @@ class CostCalculator:
                 
                 column_stats = {}
                 for col in columns:
-                    col_name, ndv, nullfrac, avg_width, mcv_vals, mcv_freqs = col
+                    col_name, ndv, nullfrac, avg_width, mcv_vals, mcv_freqs, hist_bounds = col
                     
                     mcv_dict = {}
                     if mcv_vals and mcv_freqs:
@@ -157,7 +240,9 @@ class CostCalculator:
                         'ndv': ndv if ndv > 0 else abs(ndv) * row_count,
                         'nullfrac': nullfrac,
                         'avg_width': avg_width,
-                        'mcv': mcv_dict
+                        'mcv': mcv_dict,
+                        # '|' never occurs in the .tbl data, unlike ','
+                        'histogram': hist_bounds.split('|') if hist_bounds else []
                     }
                     
             except Exception as e:
@@ -171,6 +256,288 @@ class CostCalculator:
             'columns': column_stats
         }
     
+    def get_partition_statistics(self, table_name, partitions):
+        """
+        Retrieve the statistics of a subset of a table's range partitions.
+        If the partitions are not in the database (e.g. the data was loaded
+        with an unpartitioned schema), the table statistics are scaled by
+        the share of the partitioning column's histogram they cover.
+        
+        Args:
+            table_name (str): Name of the partitioned table
+            partitions (list): Names of the partitions that will be read
+                
+        Returns:
+            dict: Table statistics restricted to those partitions
+        """
+        stats = dict(self.get_table_statistics(table_name))
+        if not partitions:
+            stats.update(row_count=0, page_count=0, table_size=0)
+            return stats
+        
+        # A hash partitioned table stores each range partition as one leaf
+        # below every hash partition, so sum the leaves of each of them
+        leaves = [leaf for partition in partitions for leaf in partition_leaves(table_name, partition)]
+        try:
+            with self.conn.cursor() as part_cursor:
+                part_cursor.execute("""
+                SELECT
+                    count(*),
+                    sum(GREATEST(c.reltuples, 0)),
+                    sum(c.relpages)::bigint,
+                    sum(pg_table_size(c.oid))::bigint
+                FROM
+                    pg_class c
+                WHERE
+                    c.relname = ANY(%s::text[]);
+                """, (leaves,))
+                found, row_count, page_count, table_size = part_cursor.fetchone()
+            if found == len(leaves):
+                stats.update(row_count=row_count, page_count=page_count, table_size=table_size)
+                return stats
+        except Exception as e:
+            print(f"Error getting partition statistics for {table_name}: {e}")
+        
+        all_partitions = list_partitions(table_name)
+        column = RANGE_PARTITIONS[table_name.lower()]['column']
+        histogram = stats["columns"].get(column, {}).get('histogram', [])
+        if len(histogram) > 1:
+            fraction = 0.0
+            for partition in all_partitions:
+                if partition['name'] in partitions:
+                    high = self.histogram_fraction_below(histogram, partition['high']) \
+                        if partition['high'] else 1.0
+                    low = self.histogram_fraction_below(histogram, partition['low']) \
+                        if partition['low'] else 0.0
+                    fraction += max(0.0, high - low)
+        else:
+            fraction = len(partitions) / len(all_partitions)
+        
+        stats.update(row_count=stats["row_count"] * fraction,
+                     page_count=math.ceil(stats["page_count"] * fraction),
+                     table_size=stats["table_size"] * fraction)
+        return stats
+
+    def estimate_predicate_selectivity(self, condition, input_node):
+        """
+        Estimate the fraction of input rows that satisfy a filter condition.
+        
+        Args:
+            condition (dict): Condition JSON of the select node
+            input_node (dict): Input of the select node, used to find column statistics
+            
+        Returns:
+            float: Estimated selectivity factor
+        """
+        pred_type = condition["type"]
+
+        if pred_type == "IN":
+            return self.estimate_in_selectivity(condition, input_node)
+        if pred_type == "NOT" and condition["cond"].get("type") == "IN":
+            return 1.0 - self.estimate_in_selectivity(condition["cond"], input_node)
+        if pred_type == "LIKE":
+            return self.estimate_like_selectivity(condition, input_node)
+        if pred_type == "NOT" and condition["cond"].get("type") == "LIKE":
+            return 1.0 - self.estimate_like_selectivity(condition["cond"], input_node)
+
+        return predicate_selectivity.get(pred_type, 0.5)
+
+    def estimate_bitmap_scan(self, node):
+        """
+        Cost answering a select over a base relation with bitmap indexes.
+        The candidate rows come from bitmap algebra over the indexed
+        predicates; heap pages are then fetched in physical order, so the
+        per-page cost moves from random to sequential as more of the table
+        is read (as in PostgreSQL's bitmap heap scan). When partition pruning
+        left only some partitions of the table, only their pages are fetched.
+        
+        Args:
+            node (dict): Select node
+            
+        Returns:
+            dict: cost, estimated rows and the access_path annotation,
+                  or None if no bitmap index applies
+        """
+        # Predicate pushdown leaves one select per conjunct, so the bitmap
+        # answers the conjunction of the whole chain down to the scan
+        condition = node["condition"]
+        input_node = node["input"]
+        covers = 1
+        while input_node["type"] == "select":
+            condition = {"type": "AND", "left": condition, "right": input_node["condition"]}
+            input_node = input_node["input"]
+            covers += 1
+        if input_node["type"] != "base_relation" or len(input_node["tables"]) != 1:
+            return None
+        
+        table_name = input_node["tables"][0]["name"].lower()
+        table_indexes = self.bitmap_indexes.get(table_name)
+        if not table_indexes:
+            return None
+        
+        stats = self.get_table_statistics(table_name)
+        row_count = next(iter(table_indexes.values())).row_count
+        result = evaluate_bitmap_condition(condition, table_indexes, row_count)
+        if result is None:
+            return None
+        
+        bitmap, exact, columns = result
+        # The index was built on the loaded data; scale to the current table size
+        rows = len(bitmap) * stats["row_count"] / row_count if row_count else 0
+        if "partitions" in input_node:
+            # The bitmaps span every partition, while the heap is only read in
+            # the surviving ones; their share of the candidates is taken to be
+            # their share of the table, the indexed columns not being the
+            # partitioning ones
+            partition_stats = self.get_partition_statistics(table_name, input_node["partitions"])
+            share = partition_stats["row_count"] / stats["row_count"] if stats["row_count"] else 0
+            rows *= min(1.0, share)
+            stats = partition_stats
+        pages = max(1, stats["page_count"])
+        
+        # Bitmap algebra touches every container of every bitmap involved
+        containers = sum(value_bitmap.container_count() for column in columns
+                         for value_bitmap in table_indexes[column].bitmaps.values())
+        index_cost = (containers + rows) * self.cpu_operator_cost
+        
+        pages_fetched = min(pages, 2.0 * pages * rows / (2.0 * pages + rows)) if rows else 0
+        cost_per_page = self.page_cost(table_name, self.random_page_cost - \
+            (self.random_page_cost - self.seq_page_cost) * math.sqrt(pages_fetched / pages))
+        operators = covers + count_arith_operators(condition)
+        recheck_cost = 0 if exact else rows * self.cpu_operator_cost * operators
+        heap_cost = pages_fetched * cost_per_page + rows * self.cpu_tuple_cost + recheck_cost
+        
+        return {
+            "cost": index_cost + heap_cost,
+            "rows": rows,
+            "access_path": {
+                "type": "bitmap_scan",
+                "columns": sorted(columns),
+                "exact": exact,
+                "selects": covers,
+                "pages_fetched": pages_fetched
+            }
+        }
+
+    def get_column_statistics(self, input_node, attr):
+        """
+        Look up the statistics of a column when the input is a base relation.
+        Returns None if the input is not a base table or no statistics exist.
+        """
+        if input_node.get("type") != "base_relation":
+            return None
+        try:
+            stats = self.get_table_statistics(input_node["tables"][0]["name"])
+        except Exception as e:
+            print(f"Error getting statistics for selectivity estimation: {e}")
+            return None
+        return stats["columns"].get(attr.lower())
+
+    def estimate_in_selectivity(self, condition, input_node):
+        """
+        Selectivity of "col IN (v1, ..., vn)" as the sum of the per-value
+        equality selectivities. Values that are in the MCV list contribute
+        their MCV frequency; every other value gets an equal share of the
+        rows not covered by the MCVs (the histogram part of the column).
+        """
+        values = condition["right"].get("values", [])
+        col_stats = self.get_column_statistics(input_node, condition["left"]["attr"])
+
+        if not col_stats:
+            return min(1.0, len(values) * predicate_selectivity['EQ'])
+
+        mcv = {str(k).strip(): f for k, f in col_stats['mcv'].items()}
+        mcv_total = sum(mcv.values())
+        other_ndv = max(col_stats['ndv'] - len(mcv), 1)
+        other_freq = max(0.0, 1.0 - mcv_total - col_stats['nullfrac']) / other_ndv
+
+        selectivity = 0.0
+        for value in values:
+            selectivity += self._lookup_mcv_freq(mcv, value, other_freq)
+
+        return min(1.0, selectivity)
+
+    def estimate_like_selectivity(self, condition, input_node):
+        """
+        Selectivity of "col LIKE pattern". MCVs are matched against the
+        pattern directly. For the remaining rows, prefix patterns are
+        estimated as the [low, high) range over the histogram; other
+        patterns fall back to a per-character heuristic.
+        """
+        pattern = condition["right"]["value"]
+        col_stats = self.get_column_statistics(input_node, condition["left"]["attr"])
+        heuristic = like_pattern_selectivity(pattern)
+
+        if not col_stats:
+            return heuristic
+
+        regex = like_to_regex(pattern)
+        mcv_total = sum(col_stats['mcv'].values())
+        mcv_selectivity = sum(freq for value, freq in col_stats['mcv'].items()
+                              if regex.match(str(value).rstrip()))
+
+        other_fraction = heuristic
+        value_range = condition.get("range")
+        if value_range and col_stats.get('histogram'):
+            low = self.histogram_fraction_below(col_stats['histogram'], value_range["low"])
+            high = 1.0
+            if "high" in value_range:
+                high = self.histogram_fraction_below(col_stats['histogram'], value_range["high"])
+            other_fraction = max(0.0, high - low)
+
+        other_rows = max(0.0, 1.0 - mcv_total - col_stats['nullfrac'])
+        return min(1.0, mcv_selectivity + other_fraction * other_rows)
+
+    def histogram_fraction_below(self, bounds, value):
+        """
+        Fraction of the histogram population that is less than value.
+        Bounds are equi-depth, so each bucket holds the same share of rows;
+        numeric and date values are interpolated within their bucket.
+        Strings are compared by code point, as LIKE prefix ranges are built;
+        PostgreSQL sorts the bounds in the column's collation, so under a
+        collation other than "C" the position found is an approximation.
+        """
+        buckets = len(bounds) - 1
+        if buckets < 1:
+            return 0.5
+
+        try:
+            keys = [float(b) for b in bounds]
+            probe = float(value)
+        except (TypeError, ValueError):
+            try:
+                keys = [float(datetime.date.fromisoformat(str(b)).toordinal()) for b in bounds]
+                probe = float(datetime.date.fromisoformat(str(value)).toordinal())
+            except (TypeError, ValueError):
+                keys = [str(b).rstrip() for b in bounds]
+                probe = str(value)
+
+        pos = bisect.bisect_left(keys, probe)
+        if pos == 0:
+            return 0.0
+        if pos > buckets:
+            return 1.0
+
+        lo, hi = keys[pos - 1], keys[pos]
+        if isinstance(probe, float) and hi > lo:
+            within = (probe - lo) / (hi - lo)
+        else:
+            within = 0.5
+        return (pos - 1 + within) / buckets
+
+    def _lookup_mcv_freq(self, mcv, value, default):
+        """Find the MCV frequency of a literal, comparing numbers numerically."""
+        raw = value["value"]
+        if value["type"] == "string":
+            return mcv.get(raw.strip(), default)
+        for key, freq in mcv.items():
+            try:
+                if float(key) == float(raw):
+                    return freq
+            except ValueError:
+                continue
+        return default
+
     def calculate_cost(self, node):
 
         node_type = node["type"]
@@ -178,10 +545,14 @@ class CostCalculator:
         if node_type == "base_relation":
             table = node["tables"][0]
             table_name = table["name"]
-            stats = self.get_table_statistics(table_name)
+            if "partitions" in node:
+                # Only the partitions that survived pruning are read
+                stats = self.get_partition_statistics(table_name, node["partitions"])
+            else:
+                stats = self.get_table_statistics(table_name)
             row_size = stats["row_count"]
             page_size = stats["page_count"]
-            cost = row_size * self.cpu_tuple_cost + page_size * self.seq_page_cost
+            cost = row_size * self.cpu_tuple_cost + page_size * self.page_cost(table_name, self.seq_page_cost)
 
             node["cost"] = cost
             node["cardinality"] = row_size
@@ -190,22 +561,37 @@ class CostCalculator:
 
         elif node_type == "select":
             input_cost, input_size = self.calculate_cost(node["input"])
-            pred_type = node["condition"]["type"]
-            selectivity = predicate_selectivity.get(pred_type, 0.5)
+            selectivity = self.estimate_predicate_selectivity(node["condition"], node["input"])
             output_size = input_size * selectivity  
 
-            node["cost"] = input_cost + (input_size * self.cpu_operator_cost)
-            node["cardinality"] = output_size
+            # One operator per comparison plus one per arithmetic operation
+            operators = 1 + count_arith_operators(node["condition"])
+            seq_cost = input_cost + (input_size * self.cpu_operator_cost * operators)
+
+            # A bitmap scan replaces this select and any selects below it
+            bitmap_scan = self.estimate_bitmap_scan(node)
+            if bitmap_scan is not None and bitmap_scan["cost"] < seq_cost:
+                node["access_path"] = bitmap_scan["access_path"]
+                node["cost"] = bitmap_scan["cost"]
+                node["cardinality"] = min(output_size, bitmap_scan["rows"]) \
+                    if not bitmap_scan["access_path"]["exact"] else bitmap_scan["rows"]
+            else:
+                node.pop("access_path", None)
+                node["cost"] = seq_cost
+                node["cardinality"] = output_size
 
-            return input_cost + input_size, output_size
+            # Whichever path won, its cost is the one the parent builds on
+            return node["cost"], node["cardinality"]
 
         elif node_type == "project":
             input_cost, input_size = self.calculate_cost(node["input"])
 
-            node["cost"] = input_cost
+            # Plain columns are free, computed columns are charged per operation
+            operators = sum(count_arith_operators(col.get("expr")) for col in node["columns"])
+            node["cost"] = input_cost + (input_size * self.cpu_operator_cost * operators)
             node["cardinality"] = input_size
 
-            return input_cost, input_size
+            return node["cost"], node["cardinality"]
 
         elif node_type == "join":
             left_cost, left_size = self.calculate_cost(node["left"])
@@ -241,6 +627,45 @@ class CostCalculator:
             else:
                 raise ValueError(f"Expression ID {expr_id} not found in common expressions.")
 
+        elif node_type == "with":
+            # Each materialized CTE is computed once and written to a spool
+            spool_cost = 0
+            for cte in node["ctes"]:
+                query_cost, rows = self.calculate_cost(cte["query"])
+                cte["cost"] = query_cost + rows * self.cpu_tuple_cost
+                cte["cardinality"] = rows
+                self.ctes[cte["name"]] = cte
+                spool_cost += cte["cost"]
+
+            input_cost, input_size = self.calculate_cost(node["input"])
+            node["cost"] = spool_cost + input_cost
+            node["cardinality"] = input_size
+
+            return node["cost"], input_size
+
+        elif node_type == "batch":
+            # Queries optimized together; each still pays for its own result
+            total_cost = 0
+            total_size = 0
+            for query in node["queries"]:
+                query_cost, query_size = self.calculate_cost(query)
+                total_cost += query_cost
+                total_size += query_size
+            node["cost"] = total_cost
+            node["cardinality"] = total_size
+
+            return total_cost, total_size
+
+        elif node_type == "cte_ref":
+            # Readers only pay for going through the spooled rows
+            if node["name"] not in self.ctes:
+                raise ValueError(f"CTE {node['name']} not found in the enclosing WITH.")
+            rows = self.ctes[node["name"]]["cardinality"]
+            node["cost"] = rows * self.cpu_tuple_cost
+            node["cardinality"] = rows
+
+            return node["cost"], rows
+
         else:
             raise ValueError(f"Unsupported node type: {node_type}")
         
@@ -267,9 +692,13 @@ class CostCalculator:
         # Calculate the cost of the main query
         cost, cardinality = self.calculate_cost(query)
 
+        # Each shared expression is computed once into a spool, which costs a
+        # write per row plus a read per row for every occurrence
         total_cost = cost
         for expr_id, expr in self.expr_occ.items():
             total_cost -= common_expressions[expr_id]["cost"] * (self.expr_occ[expr_id] - 1)
+            total_cost += common_expressions[expr_id]["cardinality"] * self.cpu_tuple_cost * \
+                (self.expr_occ[expr_id] + 1)
 
         print("Net benefit: ", cost - total_cost, cost, total_cost)
         return total_cost, cardinality
@@ -0,0 +1,113 @@
+import copy
+
+
+def count_cte_references(node, name):
+    """Count the cte_ref nodes reading the CTE called name below node."""
+    if isinstance(node, list):
+        return sum(count_cte_references(item, name) for item in node)
+    if not isinstance(node, dict):
+        return 0
+    if node.get("type") == "cte_ref":
+        return 1 if node["name"] == name else 0
+    return sum(count_cte_references(value, name) for value in node.values())
+
+
+def inline_cte(node, name, query):
+    """
+    Replace every reference to the CTE called name below node by its own
+    copy of the query, as a subquery under the reference's alias.
+    """
+    if isinstance(node, list):
+        return [inline_cte(item, name, query) for item in node]
+    if not isinstance(node, dict):
+        return node
+    if node.get("type") == "cte_ref" and node["name"] == name:
+        return {"type": "subquery", "alias": node["alias"], "query": copy.deepcopy(query)}
+    return {key: inline_cte(value, name, query) for key, value in node.items()}
+
+
+def should_materialize(cte, query, references, cost_calculator=None):
+    """
+    Decide whether a CTE is computed once into a spool or inlined into
+    each of its readers.
+
+    An explicit AS [NOT] MATERIALIZED wins. A CTE read once is inlined so
+    that predicates can still be pushed into it. Otherwise the spool is
+    chosen when computing the query once, writing its rows and reading
+    them back per reference is cheaper than computing it per reference.
+    Without a cost calculator, shared CTEs are always materialized.
+
+    Args:
+        cte (dict): CTE entry of the with node
+        query (dict): Its query with the CTEs it reads expanded, for costing
+        references (int): Number of cte_ref nodes reading it
+        cost_calculator (CostCalculator): Optional
+    """
+    if "materialized" in cte:
+        return cte["materialized"]
+    if references <= 1:
+        return False
+    if cost_calculator is None:
+        return True
+
+    query_cost, rows = cost_calculator.calculate_cost(copy.deepcopy(query))
+    spool_cost = query_cost + rows * cost_calculator.cpu_tuple_cost * (1 + references)
+    inline_cost = query_cost * references
+    print(f"CTE {cte['name']}: {references} references, inline cost = {inline_cost}, "
+          f"materialized cost = {spool_cost}")
+    return spool_cost < inline_cost
+
+
+def plan_ctes(plan, cost_calculator=None):
+    """
+    Resolve the WITH clause of a plan. Inlined CTEs become subqueries at
+    every reference; materialized ones stay in the with node, annotated
+    with their number of readers, and are read through cte_ref nodes.
+    Unreferenced CTEs are dropped.
+
+    Args:
+        plan (dict): Plan JSON from the parser
+        cost_calculator (CostCalculator): Used to cost the alternatives, optional
+
+    Returns:
+        dict: The plan, without a with node if nothing is materialized
+    """
+    if plan.get("type") != "with":
+        return plan
+
+    query = plan["input"]
+    ctes = [dict(cte) for cte in plan["ctes"]]
+    materialized = []
+
+    # A CTE can only be read by the CTEs after it, so deciding from the last
+    # one backwards sees every reference once the later CTEs are inlined
+    for i in range(len(ctes) - 1, -1, -1):
+        cte = ctes[i]
+        later = [other for other in ctes[i + 1:] if other is not None]
+        references = count_cte_references([query] + [other["query"] for other in later], cte["name"])
+
+        if references == 0:
+            print(f"CTE {cte['name']} is never read, dropping it")
+            ctes[i] = None
+            continue
+
+        # Cost the query with the CTEs it reads expanded, as they are not decided yet
+        expanded = cte["query"]
+        for earlier in reversed(ctes[:i]):
+            expanded = inline_cte(expanded, earlier["name"], earlier["query"])
+
+        if should_materialize(cte, expanded, references, cost_calculator):
+            cte["materialized"] = True
+            cte["references"] = references
+            materialized.insert(0, cte)
+            continue
+
+        # Substitute the query into every reader
+        query = inline_cte(query, cte["name"], cte["query"])
+        for other in later:
+            other["query"] = inline_cte(other["query"], cte["name"], cte["query"])
+        ctes[i] = None
+
+    if not materialized:
+        return query
+    return {"type": "with", "ctes": materialized, "input": query}
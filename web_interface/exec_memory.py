@@ -0,0 +1,234 @@
+"""
+Execution Memory
+
+Allocates the executor's long-lived numeric buffers, such as the column
+vectors of spools, from arenas of anonymous memory instead of Python lists.
+Arenas are sized in 2MB steps and advised with MADV_HUGEPAGE, so transparent
+huge pages can back them and a scan over a large spool touches a handful of
+TLB entries instead of one per 4kB page.
+
+On machines with several NUMA nodes, each arena is placed on a node by
+first touch: its pages are faulted in by a thread bound to that node's
+CPUs. Allocations are either interleaved over the nodes or kept on the node
+of the worker that asks for them.
+
+Each buffer handed out counts against its arena until the last view of it
+is freed. An arena with no live buffers left is reused from its start if it
+is the one being allocated from, and unmapped otherwise, so the memory of a
+dropped spool goes back to the system and not only out of the query's
+accounting.
+
+Per-query statistics cover page faults, the bytes allocated and how many of
+them huge pages actually back.
+"""
+
+import ctypes
+import mmap
+import os
+import re
+import resource
+import threading
+import weakref
+from array import array
+from concurrent.futures import ThreadPoolExecutor
+
+HUGE_PAGE_SIZE = 2 * 1024 * 1024
+SMALL_PAGE_SIZE = mmap.PAGESIZE
+ARENA_SIZE = 16 * HUGE_PAGE_SIZE
+ALIGNMENT = 64
+
+
+def numa_nodes():
+    """NUMA node -> set of CPUs, with every CPU on node 0 without NUMA information."""
+    nodes = {}
+    base = "/sys/devices/system/node"
+    if os.path.isdir(base):
+        for entry in os.listdir(base):
+            match = re.fullmatch(r"node(\d+)", entry)
+            if not match:
+                continue
+            with open(os.path.join(base, entry, "cpulist")) as f:
+                cpus = set()
+                for part in f.read().strip().split(","):
+                    if part:
+                        low, _, high = part.partition("-")
+                        cpus.update(range(int(low), int(high or low) + 1))
+            if cpus:
+                nodes[int(match.group(1))] = cpus
+    return nodes or {0: set(os.sched_getaffinity(0))}
+
+
+def fault_counts():
+    usage = resource.getrusage(resource.RUSAGE_SELF)
+    return usage.ru_minflt, usage.ru_majflt
+
+
+class Arena:
+    """A huge-page-advised anonymous mapping handed out by bumping an offset."""
+
+    def __init__(self, size, toucher=None):
+        self.size = -(-size // HUGE_PAGE_SIZE) * HUGE_PAGE_SIZE
+        # Map one huge page more, so that the usable range can start on a
+        # 2MB boundary, which huge pages need. Only private anonymous memory
+        # is eligible for transparent huge pages, not mmap's default shared map
+        self.memory = mmap.mmap(-1, self.size + HUGE_PAGE_SIZE, flags=mmap.MAP_PRIVATE | mmap.MAP_ANONYMOUS)
+        if hasattr(mmap, "MADV_HUGEPAGE"):
+            self.memory.madvise(mmap.MADV_HUGEPAGE)
+        self.address = ctypes.addressof(ctypes.c_char.from_buffer(self.memory))
+        self.base = -self.address % HUGE_PAGE_SIZE
+        self.offset = 0
+        self.live = 0
+        self.live_bytes = 0
+        if toucher is not None:
+            # Fault the pages in from the node they should live on
+            toucher.submit(self.touch).result()
+
+    def touch(self):
+        for offset in range(self.base, self.base + self.size, SMALL_PAGE_SIZE):
+            self.memory[offset] = 0
+
+    def allocate(self, nbytes):
+        """A ctypes block over the next nbytes, or None if they do not fit."""
+        start = -(-self.offset // ALIGNMENT) * ALIGNMENT
+        if start + nbytes > self.size:
+            return None
+        self.offset = start + nbytes
+        # Counted live before the block exists, so that a collection run
+        # while creating it cannot find the arena empty and rewind it
+        self.live += 1
+        self.live_bytes += nbytes
+        return (ctypes.c_char * nbytes).from_buffer(self.memory, self.base + start)
+
+    def free(self, nbytes):
+        """Forget a block whose last view is gone; True once none are left."""
+        self.live -= 1
+        self.live_bytes -= nbytes
+        return self.live == 0
+
+    def huge_page_bytes(self):
+        """Bytes of this arena backed by transparent huge pages, from /proc/self/smaps."""
+        try:
+            with open("/proc/self/smaps") as f:
+                inside = False
+                for line in f:
+                    header = re.match(r"([0-9a-f]+)-([0-9a-f]+) ", line)
+                    if header:
+                        inside = int(header.group(1), 16) <= self.address < int(header.group(2), 16)
+                    elif inside and line.startswith("AnonHugePages:"):
+                        return int(line.split()[1]) * 1024
+        except OSError:
+            pass
+        return 0
+
+
+class ExecutionMemory:
+    """
+    Arenas per NUMA node for the buffers of one executor.
+
+    Args:
+        policy (str): "interleave" spreads allocations over the nodes,
+                      "local" keeps them on the node of the calling thread
+        arena_size (int): Bytes per arena, rounded up to huge pages
+    """
+
+    def __init__(self, policy="interleave", arena_size=ARENA_SIZE):
+        self.policy = policy
+        self.arena_size = arena_size
+        self.nodes = numa_nodes()
+        self.arenas = {node: [] for node in self.nodes}
+        self.next_node = 0
+        # Reentrant, since a buffer may be collected, and freed, while an
+        # allocation holds the lock
+        self.lock = threading.RLock()
+        self.stats = {"allocations": 0, "allocated_bytes": 0, "arenas": 0,
+                      "freed_bytes": 0, "arenas_reused": 0, "arenas_unmapped": 0}
+        # One thread bound to each node's CPUs faults in that node's arenas
+        self.touchers = {}
+        if len(self.nodes) > 1:
+            for node, cpus in self.nodes.items():
+                self.touchers[node] = ThreadPoolExecutor(
+                    max_workers=1, initializer=os.sched_setaffinity, initargs=(0, cpus))
+
+    def current_node(self):
+        cpus = os.sched_getaffinity(0)
+        for node, node_cpus in self.nodes.items():
+            if cpus <= node_cpus:
+                return node
+        return min(self.nodes)
+
+    def allocate(self, nbytes, node=None):
+        """
+        Allocate nbytes on a node and return them as a byte memoryview. The
+        bytes stay allocated until every view derived from it is freed.
+        """
+        with self.lock:
+            if node is None:
+                if self.policy == "local":
+                    node = self.current_node()
+                else:
+                    nodes = sorted(self.nodes)
+                    node = nodes[self.next_node % len(nodes)]
+                    self.next_node += 1
+            arenas = self.arenas[node]
+            arena = arenas[-1] if arenas else None
+            block = arena.allocate(nbytes) if arena else None
+            if block is None:
+                arena = Arena(max(self.arena_size, nbytes), self.touchers.get(node))
+                arenas.append(arena)
+                self.stats["arenas"] += 1
+                block = arena.allocate(nbytes)
+            self.stats["allocations"] += 1
+            self.stats["allocated_bytes"] += nbytes
+            # Views and casts of the memoryview all keep the block alive
+            weakref.finalize(block, self.free, node, arena, nbytes)
+            return memoryview(block).cast("B")
+
+    def free(self, node, arena, nbytes):
+        with self.lock:
+            self.stats["freed_bytes"] += nbytes
+            if not arena.free(nbytes):
+                return
+            arenas = self.arenas[node]
+            if arena is arenas[-1]:
+                arena.offset = 0
+                self.stats["arenas_reused"] += 1
+            elif arena in arenas:
+                # The block being freed still exports the mapping, so it
+                # cannot be closed here; unlinked, the mapping is unmapped
+                # as soon as that last export lets go of it
+                arenas.remove(arena)
+                self.stats["arenas_unmapped"] += 1
+
+    def column_buffer(self, values, node=None):
+        """
+        Copy a column vector into arena memory if it is all integers or all
+        floats, returning a typed memoryview; other vectors are returned as is.
+        """
+        if not values:
+            return values
+        if all(type(value) is int for value in values):
+            typecode = "q"
+            if not all(-2 ** 63 <= value < 2 ** 63 for value in values):
+                return values
+        elif all(type(value) is float for value in values):
+            typecode = "d"
+        else:
+            return values
+        packed = array(typecode, values)
+        view = self.allocate(len(packed) * packed.itemsize, node)
+        view[:] = memoryview(packed).cast("B")
+        return view.cast(typecode)
+
+    def summary(self):
+        with self.lock:
+            arenas = [arena for node_arenas in self.arenas.values() for arena in node_arenas]
+            mapped = sum(arena.size for arena in arenas)
+            used = sum(-(-arena.offset // SMALL_PAGE_SIZE) * SMALL_PAGE_SIZE for arena in arenas)
+            huge = sum(arena.huge_page_bytes() for arena in arenas)
+            return {**self.stats, "nodes": len(self.nodes), "policy": self.policy,
+                    "mapped_bytes": mapped, "live_bytes": sum(arena.live_bytes for arena in arenas),
+                    "huge_page_bytes": huge,
+                    # Translations needed to cover the used memory, with the
+                    # huge pages the kernel granted and with 4kB pages only
+                    "tlb_entries": huge // HUGE_PAGE_SIZE + max(0, used - huge) // SMALL_PAGE_SIZE,
+                    "tlb_entries_small_pages": used // SMALL_PAGE_SIZE}
@@ -0,0 +1,742 @@
+"""
+Plan Executor
+
+Runs relational algebra plans in memory over the TPC-H .tbl files, so that
+optimized plans can be checked against the original query and timed.
+Materialized CTEs and the common expressions found by QueryTreeOptimizer
+are evaluated once into a spool shared by their readers.
+"""
+
+import argparse
+import itertools
+import json
+import os
+import pickle
+import sys
+import tempfile
+import threading
+import time
+import weakref
+from concurrent.futures import ThreadPoolExecutor
+
+from cancellation import MORSEL_ROWS
+from catalog import TPCH_DIR, load_column_types, read_table_rows
+from materialized_views import view_column_types
+from exec_memory import fault_counts
+from memory_accounting import estimate_peak_memory, hash_table_bytes, rows_bytes
+from cost_populator import like_to_regex
+from cte_planner import count_cte_references
+from subsequence_elim import QueryTreeOptimizer
+
+COMPARISONS = {
+    "EQ": lambda a, b: a == b,
+    "NE": lambda a, b: a != b,
+    "LT": lambda a, b: a < b,
+    "GT": lambda a, b: a > b,
+    "LE": lambda a, b: a <= b,
+    "GE": lambda a, b: a >= b,
+}
+
+ARITHMETIC = {
+    "ADD": lambda a, b: a + b,
+    "SUB": lambda a, b: a - b,
+    "MUL": lambda a, b: a * b,
+    # Integer division truncates toward zero, as in SQL
+    "DIV": lambda a, b: int(a / b) if isinstance(a, int) and isinstance(b, int) else a / b,
+}
+
+# Grace hash join fan-out and recursion before falling back to a block join,
+# and the rows a partition buffers before they are written to its file
+SPILL_PARTITIONS_MAX = 64
+SPILL_DEPTH_MAX = 3
+SPILL_BUFFER_ROWS = 1024
+
+# How the .tbl text of each SQL type is turned into a Python value
+TYPE_CONVERTERS = {
+    "INTEGER": int,
+    "DECIMAL": float,
+}
+
+
+def is_column(operand):
+    return isinstance(operand, dict) and "attr" in operand and operand.get("type", "column") == "column"
+
+
+def count_expr_references(node, expr_id):
+    """Count the expr_ref nodes reading the common expression expr_id below node."""
+    if isinstance(node, list):
+        return sum(count_expr_references(item, expr_id) for item in node)
+    if not isinstance(node, dict):
+        return 0
+    if node.get("type") == "expr_ref":
+        return 1 if node["id"] == expr_id else 0
+    return sum(count_expr_references(value, expr_id) for value in node.values())
+
+
+class ColumnarRows:
+    """Rows over a set of column vectors, built one tuple at a time while iterating."""
+
+    def __init__(self, vectors, length):
+        self.vectors = vectors
+        self.length = length
+
+    def __len__(self):
+        return self.length
+
+    def __iter__(self):
+        if not self.vectors:
+            return iter([()] * self.length)
+        return zip(*self.vectors)
+
+
+class Relation:
+    """Rows of an operator's result, with a (qualifier, name) pair per column."""
+
+    def __init__(self, columns, rows):
+        self.columns = columns
+        self.rows = rows
+
+    def column_index(self, table, attr):
+        """Position of table.attr; an unqualified attr must be unambiguous."""
+        attr = attr.upper()
+        matches = [i for i, (qualifier, name) in enumerate(self.columns)
+                   if name.upper() == attr and (table is None or (qualifier or "").upper() == table.upper())]
+        if len(matches) != 1:
+            name = f"{table}.{attr}" if table else attr
+            raise KeyError(f"{'Ambiguous' if matches else 'Unknown'} column {name}")
+        return matches[0]
+
+    def requalify(self, qualifier):
+        """The same rows, with every column now belonging to qualifier."""
+        return Relation([(qualifier, name) for _, name in self.columns], self.rows)
+
+
+class SpoolVectors(list):
+    """The column vectors of a spool, in a list that can be weakly referenced."""
+
+
+class Spool:
+    """
+    Shared result of a materialized CTE or common expression, stored column
+    by column. The first reader evaluates the query while later readers wait
+    for it; every reader then gets a view over the same column vectors. The
+    spool expects a known number of readers and drops its vectors after the
+    last one, so they are freed once that reader is done with them; their
+    memory charge is released only then, when the vectors are really gone.
+    """
+
+    def __init__(self, name, query, references):
+        self.name = name
+        self.query = query
+        self.references = references
+        self.pending = references
+        self.columns = None
+        self.vectors = None
+        self.length = 0
+        self.reads = 0
+        self.charged = 0
+        self.lock = threading.Lock()
+
+    def read(self, executor):
+        with self.lock:
+            if self.vectors is None:
+                if self.reads > 0:
+                    raise RuntimeError(f"Spool {self.name} read more than its {self.references} references")
+                relation = executor.run(self.query)
+                rows = list(relation.rows)
+                self.columns = relation.columns
+                vectors = [list(vector) for vector in zip(*rows)] if rows else [[] for _ in relation.columns]
+                if executor.memory is not None:
+                    vectors = [executor.memory.column_buffer(vector) for vector in vectors]
+                self.vectors = SpoolVectors(vectors)
+                self.length = len(rows)
+                if executor.memory_tracker is not None:
+                    self.charged = rows_bytes(rows)
+                    executor.memory_tracker.charge("spool", self.charged)
+                    weakref.finalize(self.vectors, executor.memory_tracker.release, "spool", self.charged)
+                executor.count("spools_built")
+                executor.count("spooled_rows", self.length)
+
+            view = Relation(self.columns, ColumnarRows(self.vectors, self.length))
+            self.reads += 1
+            self.pending -= 1
+            if self.pending == 0:
+                # Last reader: the view keeps the vectors alive until it is done
+                self.vectors = None
+                executor.count("spools_released")
+
+        executor.count("spool_reads")
+        return view
+
+
+class Executor:
+    """
+    Evaluates plan JSON bottom-up, one fully materialized operator at a time.
+    With parallel set, the two inputs of a join are evaluated concurrently,
+    so spools can have several readers at once. sources maps lowercase
+    table names to files read in place of their .tbl, such as the rows
+    appended by a refresh set. With shared_scans, a SharedScanManager,
+    tables are read through scans shared with concurrent executors, and
+    otherwise through buffer_pool, a BufferPool, or io_reader, an
+    async_io.AsyncReader doing read-ahead, when one is given. With memory,
+    an exec_memory.ExecutionMemory, numeric spool columns are kept in its
+    huge-page arenas. With memory_tracker, a memory_accounting.MemoryTracker,
+    the rows each operator materializes, hash tables and spools are charged
+    to the query, and hash joins whose table does not fit in its grant are
+    partitioned and spilled to disk. The inputs of a join are read as a
+    stream when they are scans, or selects and projections over scans, so
+    a hash table is charged block by block while it is built and spills as
+    soon as the grant is used up. With admission, a
+    memory_accounting.AdmissionController, every execution first waits for
+    the plan's estimated peak memory and runs with the tracker it grants.
+    With cancellation, a cancellation.CancellationToken, scans and joins
+    check the token every morsel of rows and stop with QueryCancelled.
+    With query_share, a query_scheduler.QueryShare, every morsel waits for
+    its turn from the fair-share scheduler of concurrent queries.
+    """
+
+    def __init__(self, data_dir=TPCH_DIR, parallel=False, sources=None, shared_scans=None, buffer_pool=None,
+                 io_reader=None, memory=None, memory_tracker=None, cancellation=None,
+                 query_share=None, admission=None):
+        self.data_dir = data_dir
+        self.parallel = parallel
+        self.sources = sources or {}
+        self.shared_scans = shared_scans
+        self.buffer_pool = buffer_pool
+        self.io_reader = io_reader
+        self.memory = memory
+        self.memory_tracker = memory_tracker
+        self.cancellation = cancellation
+        self.query_share = query_share
+        self.admission = admission
+        self.column_types = {**load_column_types(), **view_column_types()}
+        self.spools = {}
+        self.stats = {}
+        self.stats_lock = threading.Lock()
+
+    def execute(self, plan):
+        """
+        Run a plan and return its result.
+
+        Args:
+            plan (dict): Plan JSON as produced by the parser or the optimizers,
+                         or the common_expressions/query output of QueryTreeOptimizer
+
+        Returns:
+            Relation: Result columns and rows
+        """
+        if "common_expressions" in plan:
+            self.prepare(plan["common_expressions"], plan["query"])
+            return self.admitted(plan, self.run, plan["query"])
+        self.prepare({}, plan)
+        return self.admitted(plan, self.run, plan)
+
+    def execute_batch(self, plan):
+        """
+        Run the queries of a batch plan from multi_query.optimize_batch,
+        computing the expressions they share once.
+
+        Returns:
+            list: Relation of each query
+        """
+        queries = plan["query"]["queries"]
+        self.prepare(plan["common_expressions"], queries)
+        return self.admitted(plan, lambda: [self.run(query) for query in queries])
+
+    def admitted(self, plan, function, *args):
+        """
+        Run function measured, under admission control when there is an
+        AdmissionController. A plan without the optimizer's cardinalities
+        is admitted with the whole per-query budget.
+        """
+        if self.admission is None:
+            return self.measured(function, *args)
+        estimate = estimate_peak_memory(plan)
+        previous = self.memory_tracker
+        with self.admission.admit(self.admission.query_budget_bytes if estimate is None else estimate) as tracker:
+            self.memory_tracker = tracker
+            try:
+                return self.measured(function, *args)
+            finally:
+                self.memory_tracker = previous
+
+    def measured(self, function, *args):
+        """Run function, adding the page faults it caused to the statistics."""
+        minor, major = fault_counts()
+        result = function(*args)
+        end_minor, end_major = fault_counts()
+        self.stats["minor_faults"] = end_minor - minor
+        self.stats["major_faults"] = end_major - major
+        if self.memory is not None:
+            self.stats["memory"] = self.memory.summary()
+        if self.memory_tracker is not None:
+            self.stats["memory_tracker"] = self.memory_tracker.summary()
+        return result
+
+    def prepare(self, common_expressions, query):
+        self.spools = {}
+        self.stats = {"rows_scanned": 0, "spools_built": 0, "spool_reads": 0,
+                      "spools_released": 0, "spooled_rows": 0, "spilled_joins": 0}
+        readers = [query] + list(common_expressions.values())
+        for expr_id, expr in common_expressions.items():
+            self.spools[expr_id] = Spool(expr_id, expr, count_expr_references(readers, expr_id))
+
+    def morsels(self, items, stage, every=MORSEL_ROWS):
+        """
+        items, checking for cancellation every morsel when there is a token
+        and taking a turn from the scheduler every morsel when there is one.
+        """
+        if self.cancellation is not None:
+            with self.stats_lock:
+                self.cancellation.report(executor=dict(self.stats))
+            items = self.cancellation.checked(items, stage, every)
+        if self.query_share is not None:
+            items = self.query_share.scheduled(items, every)
+        return items
+
+    def count(self, key, amount=1):
+        with self.stats_lock:
+            self.stats[key] += amount
+
+    def run(self, node):
+        relation = self.evaluate(node)
+        if self.memory_tracker is not None and isinstance(relation.rows, list):
+            self.charge_output(relation)
+        return relation
+
+    def charge_output(self, relation):
+        """
+        Charge the rows an operator materialized to the query until its
+        Relation is freed, once the operator above is done with it.
+        """
+        nbytes = rows_bytes(relation.rows)
+        self.memory_tracker.charge("operator_output", nbytes)
+        weakref.finalize(relation, self.memory_tracker.release, "operator_output", nbytes)
+
+    def evaluate(self, node):
+        node_type = node["type"]
+
+        if node_type == "base_relation":
+            return self.scan(node["tables"][0])
+
+        elif node_type == "select":
+            child = node["input"]
+            # The parser puts the WHERE clause above the projection; filter
+            # first when the condition only needs columns below it
+            if child["type"] == "project":
+                below = self.run(child["input"])
+                try:
+                    keep = self.compile_condition(node["condition"], below)
+                except KeyError:
+                    projected = self.project(child["columns"], below)
+                    keep = self.compile_condition(node["condition"], projected)
+                    return Relation(projected.columns, [row for row in projected.rows if keep(row)])
+                filtered = Relation(below.columns, [row for row in below.rows if keep(row)])
+                return self.project(child["columns"], filtered)
+
+            if child["type"] == "base_relation":
+                # Pushed-down filter: applied while the table is read
+                return self.scan(child["tables"][0], node["condition"])
+
+            relation = self.run(child)
+            keep = self.compile_condition(node["condition"], relation)
+            return Relation(relation.columns, [row for row in relation.rows if keep(row)])
+
+        elif node_type == "project":
+            return self.project(node["columns"], self.run(node["input"]))
+
+        elif node_type == "join":
+            if self.parallel:
+                with ThreadPoolExecutor(max_workers=1) as pool:
+                    left = pool.submit(self.run, node["left"])
+                    right = self.run(node["right"])
+                    return self.join(node["condition"], left.result(), right)
+            return self.join(node["condition"], self.stream(node["left"]), self.stream(node["right"]))
+
+        elif node_type == "subquery":
+            return self.run(node["query"]).requalify(node["alias"])
+
+        elif node_type == "with":
+            readers = [node["input"]] + [cte["query"] for cte in node["ctes"]]
+            for cte in node["ctes"]:
+                self.spools[cte["name"]] = Spool(cte["name"], cte["query"],
+                                                 count_cte_references(readers, cte["name"]))
+            return self.run(node["input"])
+
+        elif node_type == "cte_ref":
+            if node["name"] not in self.spools:
+                raise ValueError(f"CTE {node['name']} not found in the enclosing WITH.")
+            return self.spools[node["name"]].read(self).requalify(node.get("alias", node["name"]))
+
+        elif node_type == "expr_ref":
+            if node["id"] not in self.spools:
+                raise ValueError(f"Expression ID {node['id']} not found in common expressions.")
+            return self.spools[node["id"]].read(self)
+
+        else:
+            raise ValueError(f"Unsupported node type: {node_type}")
+
+    def stream(self, node):
+        """
+        The result of node as a Relation whose rows are produced while they
+        are iterated, for scans and the selects and projections over them;
+        other operators are materialized by run.
+        """
+        node_type = node["type"]
+        if node_type == "base_relation":
+            return Relation(*self.scan_rows(node["tables"][0]))
+        if node_type == "select" and node["input"]["type"] == "base_relation":
+            return Relation(*self.scan_rows(node["input"]["tables"][0], node["condition"]))
+        if node_type == "select" and node["input"]["type"] != "project":
+            relation = self.stream(node["input"])
+            keep = self.compile_condition(node["condition"], relation)
+            return Relation(relation.columns, (row for row in relation.rows if keep(row)))
+        if node_type == "project":
+            relation = self.stream(node["input"])
+            output, getters = self.projection(node["columns"], relation)
+            return Relation(output, (tuple(get(row) for get in getters) for row in relation.rows))
+        return self.run(node)
+
+    def scan(self, table, condition=None):
+        """
+        Read a whole table, converting each field to its column's type and
+        keeping only the rows that satisfy condition, if given.
+        """
+        output, rows = self.scan_rows(table, condition)
+        return Relation(output, list(rows))
+
+    def scan_rows(self, table, condition=None):
+        """The columns of a table and an iterator reading its rows as they are consumed."""
+        name = table["name"].lower()
+        types = self.column_types[name]
+        columns = list(types)
+        converters = [TYPE_CONVERTERS.get(types[column], str) for column in columns]
+
+        qualifier = table.get("alias", table["name"])
+        output = [(qualifier, column.upper()) for column in columns]
+        keep = self.compile_condition(condition, Relation(output, [])) if condition else None
+
+        def parse(line):
+            return tuple(convert(value) for convert, value in zip(converters, line.rstrip('\n').split('|')))
+
+        path = self.sources.get(name) or os.path.join(self.data_dir, f"{name}.tbl")
+        if self.shared_scans is not None:
+            rows, rows_seen = self.shared_scans.scan(path, parse, keep)
+            self.count("rows_scanned", rows_seen)
+            return output, iter(rows)
+
+        if self.buffer_pool is not None and name not in self.sources:
+            rows = (parse(line) for line in self.morsels(self.buffer_pool.read_lines(name, path), f"scan of {name}"))
+        elif self.io_reader is not None:
+            rows = (parse(line) for batch in self.morsels(self.io_reader.batches(path), f"scan of {name}", 1)
+                    for line in batch)
+        else:
+            rows = (tuple(convert(value) for convert, value in zip(converters, values))
+                    for _, values in self.morsels(read_table_rows(self.data_dir, name, columns, layout=columns,
+                                                                  path=path), f"scan of {name}"))
+        return output, self.filtered(rows, keep)
+
+    def filtered(self, rows, keep):
+        """The rows satisfying keep, if given, counting every row read."""
+        scanned = 0
+        try:
+            for row in rows:
+                scanned += 1
+                if keep is None or keep(row):
+                    yield row
+        finally:
+            self.count("rows_scanned", scanned)
+
+    def project(self, columns, relation):
+        output, getters = self.projection(columns, relation)
+        return Relation(output, [tuple(get(row) for get in getters) for row in relation.rows])
+
+    def projection(self, columns, relation):
+        """The output columns of a projection and a getter of each from an input row."""
+        getters = []
+        output = []
+        for i, column in enumerate(columns):
+            if "expr" in column:
+                getters.append(self.compile_operand(column["expr"], relation))
+                output.append((None, column.get("alias", f"EXPR{i}")))
+            elif column["attr"] == "*":
+                for j, (qualifier, name) in enumerate(relation.columns):
+                    if column.get("table") is None or (qualifier or "").upper() == column["table"].upper():
+                        getters.append(lambda row, j=j: row[j])
+                        output.append((qualifier, name))
+            else:
+                index = relation.column_index(column.get("table"), column["attr"])
+                getters.append(lambda row, index=index: row[index])
+                if "alias" in column:
+                    output.append((None, column["alias"]))
+                else:
+                    output.append(relation.columns[index])
+        return output, getters
+
+    def join(self, condition, left, right):
+        """Hash join on the equality conjuncts, checking the rest per match."""
+        combined = Relation(left.columns + right.columns, [])
+        left_keys, right_keys, residual = [], [], []
+        for conjunct in self.split_conjuncts(condition):
+            keys = self.equi_join_keys(conjunct, left, right)
+            if keys is None:
+                residual.append(self.compile_condition(conjunct, combined))
+            else:
+                left_keys.append(keys[0])
+                right_keys.append(keys[1])
+
+        rows = []
+        if not left_keys:
+            # No equality to hash on; a morsel is MORSEL_ROWS row pairs
+            right_rows = right.rows if isinstance(right.rows, list) else list(right.rows)
+            every = max(1, MORSEL_ROWS // max(1, len(right_rows)))
+            for l in self.morsels(left.rows, "nested loop join", every):
+                for r in right_rows:
+                    row = l + r
+                    if all(check(row) for check in residual):
+                        rows.append(row)
+            return Relation(combined.columns, rows)
+
+        if self.memory_tracker is None:
+            table = self.build(self.morsels(right.rows, "hash join build"), right_keys)
+            self.probe(left.rows, table, left_keys, residual, rows)
+        else:
+            self.tracked_join(left.rows, right.rows, left_keys, right_keys, residual, rows)
+        return Relation(combined.columns, rows)
+
+    def build(self, right_rows, right_keys, table=None):
+        table = {} if table is None else table
+        for r in right_rows:
+            table.setdefault(tuple(r[k] for k in right_keys), []).append(r)
+        return table
+
+    def probe(self, left_rows, table, left_keys, residual, rows):
+        for l in self.morsels(left_rows, "hash join"):
+            for r in table.get(tuple(l[k] for k in left_keys), ()):
+                row = l + r
+                if all(check(row) for check in residual):
+                    rows.append(row)
+
+    def tracked_join(self, left_rows, right_rows, left_keys, right_keys, residual, rows):
+        """
+        Hash join whose table is charged to the query a block of
+        SPILL_BUFFER_ROWS rows at a time while the build side is read. When
+        a block does not fit in the grant, the rows hashed so far and the
+        rest of the build side go to a grace hash join instead, so the table
+        never holds more than the grant.
+        """
+        tracker = self.memory_tracker
+        table, charged = {}, 0
+        right_rows = iter(self.morsels(right_rows, "hash join build"))
+        for block in iter(lambda: list(itertools.islice(right_rows, SPILL_BUFFER_ROWS)), []):
+            nbytes = hash_table_bytes(block)
+            if not tracker.try_charge("hash_join", nbytes):
+                def drain():
+                    # Hand the table's rows over, giving its memory back once it is empty
+                    while table:
+                        yield from table.popitem()[1]
+                    if charged:
+                        tracker.release("hash_join", charged)
+                    yield from block
+                    yield from right_rows
+                self.spilled_join(left_rows, drain(), left_keys, right_keys, residual, rows, charged + nbytes)
+                return
+            charged += nbytes
+            self.build(block, right_keys, table)
+        try:
+            self.probe(left_rows, table, left_keys, residual, rows)
+        finally:
+            if charged:
+                tracker.release("hash_join", charged)
+
+    def spilled_join(self, left_rows, right_rows, left_keys, right_keys, residual, rows, expected, depth=0):
+        """
+        Grace hash join: both inputs are streamed into partitions on a hash of
+        the join keys, each partition buffering at most SPILL_BUFFER_ROWS rows
+        before they are appended to its temporary file, and the partitions are
+        joined one at a time. expected, the size of the build side's table as
+        far as it is known, sets the fan-out; the size measured for each
+        partition while writing it decides how it is joined. A partition whose
+        table still does not fit in what is left of the grant is partitioned
+        again with another hash, and one that cannot be split further is
+        joined block by block.
+        """
+        tracker = self.memory_tracker
+        partitions = min(SPILL_PARTITIONS_MAX, max(2, -(-expected * 2 // max(1, tracker.available()))))
+        with tempfile.TemporaryDirectory(prefix="spill_") as spill_dir:
+            def path(side, i):
+                return os.path.join(spill_dir, f"{side}{i}")
+
+            def write(side, source, keys):
+                counts = [0] * partitions
+                sizes = [0] * partitions
+                buffers = [[] for _ in range(partitions)]
+
+                def flush(i):
+                    sizes[i] += hash_table_bytes(buffers[i])
+                    with open(path(side, i), 'ab') as f:
+                        pickle.dump(buffers[i], f, pickle.HIGHEST_PROTOCOL)
+                    buffers[i] = []
+
+                for row in self.morsels(source, "hash join partitioning"):
+                    i = hash((depth,) + tuple(row[k] for k in keys)) % partitions
+                    buffers[i].append(row)
+                    counts[i] += 1
+                    if len(buffers[i]) >= SPILL_BUFFER_ROWS:
+                        flush(i)
+                for i in range(partitions):
+                    if buffers[i]:
+                        flush(i)
+                return counts, sizes
+
+            def chunks(side, i):
+                if not os.path.exists(path(side, i)):
+                    return
+                with open(path(side, i), 'rb') as f:
+                    while True:
+                        try:
+                            yield pickle.load(f)
+                        except EOFError:
+                            return
+
+            def read(side, i):
+                for chunk in chunks(side, i):
+                    yield from chunk
+
+            right_counts, right_sizes = write("right", right_rows, right_keys)
+            write("left", left_rows, left_keys)
+            tracker.count_spill(sum(os.path.getsize(os.path.join(spill_dir, name))
+                                    for name in os.listdir(spill_dir)))
+            self.count("spilled_joins")
+
+            total = sum(right_counts)
+            for i, count in enumerate(right_counts):
+                if count == 0:
+                    continue
+                if tracker.try_charge("hash_join", right_sizes[i]):
+                    try:
+                        self.probe(read("left", i), self.build(read("right", i), right_keys),
+                                   left_keys, residual, rows)
+                    finally:
+                        tracker.release("hash_join", right_sizes[i])
+                elif depth < SPILL_DEPTH_MAX and count < total:
+                    self.spilled_join(read("left", i), read("right", i), left_keys, right_keys, residual, rows,
+                                      right_sizes[i], depth + 1)
+                else:
+                    # All of the partition shares few keys: hash one buffered
+                    # block of it at a time and stream the other side past it
+                    for block in chunks("right", i):
+                        charged = hash_table_bytes(block)
+                        tracker.charge("hash_join", charged)
+                        try:
+                            self.probe(read("left", i), self.build(block, right_keys), left_keys, residual, rows)
+                        finally:
+                            tracker.release("hash_join", charged)
+
+    def split_conjuncts(self, condition):
+        if condition.get("type") == "AND":
+            return self.split_conjuncts(condition["left"]) + self.split_conjuncts(condition["right"])
+        return [condition]
+
+    def equi_join_keys(self, condition, left, right):
+        """(left index, right index) if condition equates a column of each side."""
+        if condition.get("type") != "EQ" or not is_column(condition["left"]) or not is_column(condition["right"]):
+            return None
+        for a, b in ((condition["left"], condition["right"]), (condition["right"], condition["left"])):
+            try:
+                return left.column_index(a.get("table"), a["attr"]), right.column_index(b.get("table"), b["attr"])
+            except KeyError:
+                continue
+        return None
+
+    def compile_operand(self, operand, relation):
+        """Turn a column, literal or arithmetic expression into a function of a row."""
+        if is_column(operand):
+            index = relation.column_index(operand.get("table"), operand["attr"])
+            return lambda row: row[index]
+        if operand["type"] in ("int", "float", "string"):
+            value = operand["value"]
+            return lambda row: value
+        if operand["type"] == "arith":
+            op = ARITHMETIC[operand["op"]]
+            left = self.compile_operand(operand["left"], relation)
+            right = self.compile_operand(operand["right"], relation)
+            return lambda row: op(left(row), right(row))
+        raise ValueError(f"Unsupported operand: {operand}")
+
+    def compile_condition(self, condition, relation):
+        """Turn a condition into a predicate over the rows of relation."""
+        cond_type = condition["type"]
+
+        if cond_type in ("AND", "OR"):
+            left = self.compile_condition(condition["left"], relation)
+            right = self.compile_condition(condition["right"], relation)
+            if cond_type == "AND":
+                return lambda row: left(row) and right(row)
+            return lambda row: left(row) or right(row)
+
+        if cond_type == "NOT":
+            inner = self.compile_condition(condition["cond"], relation)
+            return lambda row: not inner(row)
+
+        operand = self.compile_operand(condition["left"], relation)
+
+        if cond_type == "IN":
+            values = {value["value"] for value in condition["right"]["values"]}
+            return lambda row: operand(row) in values
+
+        if cond_type == "LIKE":
+            pattern = like_to_regex(condition["right"]["value"])
+            return lambda row: pattern.match(operand(row)) is not None
+
+        compare = COMPARISONS[cond_type]
+        other = self.compile_operand(condition["right"], relation)
+        return lambda row: compare(operand(row), other(row))
+
+
+def measure_cse(plan, data_dir=TPCH_DIR, parallel=False):
+    """
+    Run a plan as is and after common subexpression elimination, to compare
+    the savings QueryTreeOptimizer promises with what the spools deliver.
+
+    Returns:
+        dict: Timing and executor statistics for both runs
+    """
+    optimized = QueryTreeOptimizer().optimize_and_cleanup(plan)
+    results = {"common_expressions": len(optimized["common_expressions"])}
+    outputs = {}
+    for name, runnable in (("original", plan), ("cse", optimized)):
+        executor = Executor(data_dir, parallel)
+        start = time.perf_counter()
+        result = executor.execute(runnable)
+        results[name] = {"seconds": time.perf_counter() - start, "rows": len(result.rows), **executor.stats}
+        outputs[name] = sorted(result.rows)
+    results["same_result"] = outputs["original"] == outputs["cse"]
+    return results
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Run a relational algebra plan over the .tbl files")
+    parser.add_argument("plan", help="Plan JSON file")
+    parser.add_argument("data_dir", nargs="?", default=TPCH_DIR, help="Directory containing the .tbl files")
+    parser.add_argument("--parallel", action="store_true", help="Evaluate join inputs concurrently")
+    parser.add_argument("--measure-cse", action="store_true",
+                        help="Compare the plan with its common subexpression eliminated version")
+    args = parser.parse_args()
+
+    with open(args.plan) as f:
+        plan = json.load(f)
+
+    if args.measure_cse:
+        print(json.dumps(measure_cse(plan, args.data_dir, args.parallel), indent=2))
+        sys.exit(0)
+
+    executor = Executor(args.data_dir, args.parallel)
+    start = time.perf_counter()
+    result = executor.execute(plan)
+    elapsed = time.perf_counter() - start
+
+    print(' | '.join(f"{q}.{n}" if q else n for q, n in result.columns))
+    for row in itertools.islice(result.rows, 20):
+        print(' | '.join(str(value) for value in row))
+    print(f"{len(result.rows)} rows in {elapsed:.3f}s, {executor.stats}")
@@ -9,7 +9,8 @@ def visualize_query_plan(query_plan):
 
     node_counter = [0]
     visited_exprs = {}
-    
+    ctes = {}
+
     def new_node_id():
         node_counter[0] += 1
         return f"node_{node_counter[0]}"
@@ -30,6 +31,14 @@ def visualize_query_plan(query_plan):
             # Literal integer value.
             elif cond.get('type') == 'int':
                 return str(cond.get('value'))
+            elif cond.get('type') == 'float':
+                return str(cond.get('value'))
+            elif cond.get('type') == 'string':
+                return f"'{cond.get('value')}'"
+            # Arithmetic expression.
+            elif cond.get('type') == 'arith':
+                op = {'ADD': '+', 'SUB': '-', 'MUL': '*', 'DIV': '/'}[cond['op']]
+                return f"({render_condition(cond['left'])} {op} {render_condition(cond['right'])})"
             # Otherwise, if the condition has both left and right children, assume it's a composite condition.
             elif 'left' in cond and 'right' in cond:
                 left_str = render_condition(cond['left'])
@@ -38,6 +47,15 @@ def visualize_query_plan(query_plan):
                 return f"({left_str} {cond['type']} {right_str})"
         return str(cond)
 
+    def render_column(col):
+        if 'expr' in col:
+            col_str = render_condition(col['expr'])
+        else:
+            col_str = f"{col['table']}.{col['attr']}"
+        if 'alias' in col:
+            col_str += f" AS {col['alias']}"
+        return col_str
+
     def render_expr(expr, label=None):
         if expr.get('type') == 'expr_ref':
             expr_id = expr['id']
@@ -49,13 +67,31 @@ def visualize_query_plan(query_plan):
                 visited_exprs[expr_id] = node_id
                 return node_id
 
+        if expr.get('type') == 'with':
+            # Materialized CTEs are drawn once, where they are first read
+            for cte in expr['ctes']:
+                ctes[cte['name']] = cte
+            return render_expr(expr['input'], label)
+
+        if expr.get('type') == 'cte_ref':
+            # All readers point at the same spool
+            spool_key = f"cte:{expr['name']}"
+            if spool_key not in visited_exprs:
+                cte = ctes[expr['name']]
+                spool_id = new_node_id()
+                graph.node(spool_id, wrap_label(f"Spool\n[{cte['name']}, {cte.get('references', 1)} readers]"),
+                           shape='cylinder', fillcolor='#FAD7A0')
+                graph.edge(spool_id, render_expr(cte['query']))
+                visited_exprs[spool_key] = spool_id
+            return visited_exprs[spool_key]
+
         node_id = new_node_id()
         node_label = label or expr['type']
         shape = 'box'
         color = 'lightgray'
 
         if expr['type'] == 'project':
-            cols = ', '.join(f"{col['table']}.{col['attr']}" for col in expr['columns'])
+            cols = ', '.join(render_column(col) for col in expr['columns'])
             node_label = f"Project\n[{cols}]"
             color = "#D5F5E3"
             graph.node(node_id, wrap_label(node_label), shape=shape, fillcolor=color)
@@ -65,6 +101,8 @@ def visualize_query_plan(query_plan):
         elif expr['type'] == 'select':
             cond_str = render_condition(expr['condition'])
             node_label = f"Select\n({cond_str})"
+            if expr.get('access_path', {}).get('type') == 'bitmap_scan':
+                node_label += f"\n[bitmap scan on {', '.join(expr['access_path']['columns'])}]"
             shape = 'ellipse'
             color = '#F5B7B1'
             graph.node(node_id, wrap_label(node_label), shape=shape, fillcolor=color)
@@ -85,10 +123,20 @@ def visualize_query_plan(query_plan):
         elif expr['type'] == 'base_relation':
             tables = ', '.join(t['name'] for t in expr['tables'])
             node_label = f"Base Relation\n[{tables}]"
+            if 'partitions' in expr:
+                node_label += f"\n{len(expr['partitions'])} partitions"
             shape = 'oval'
             color = '#F9E79F'
             graph.node(node_id, wrap_label(node_label), shape=shape, fillcolor=color)
 
+        elif expr['type'] == 'batch':
+            node_label = f"Batch\n[{len(expr['queries'])} queries]"
+            shape = 'doubleoctagon'
+            color = '#FDEBD0'
+            graph.node(node_id, wrap_label(node_label), shape=shape, fillcolor=color)
+            for i, query in enumerate(expr['queries']):
+                graph.edge(node_id, render_expr(query), label=f"Q{i + 1}")
+
         elif expr['type'] == 'subquery':
             node_label = f"Subquery\n[{expr['alias']}]"
             shape = 'parallelogram'
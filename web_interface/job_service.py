@@ -0,0 +1,449 @@
+"""
+Optimization Job Service
+
+Runs the optimization pipeline of a query (parsing, predicate pushdown,
+join ordering and common subexpression elimination) as a job on a pool of
+worker processes. Each worker keeps its database connections, its
+QueryOptimizer and a warm statistics cache for its whole life, and all the
+state of a query travels with its job, so concurrent users neither wait on
+each other nor see each other's plans.
+
+The stages of a job are submitted one after the other as the previous one
+completes, and the result of each is available to poll or stream as soon
+as it is done. Cancelling a job raises its flag in memory shared with the
+workers, which the CancellationToken of the running stage checks, so the
+parser or the join order search stops at its next check. The web interface's stage endpoints run single stages on the
+same pool with the state of the user's session, and batch optimization
+runs on it as a single stage.
+"""
+
+import copy
+import json
+import multiprocessing
+import os
+import subprocess
+import threading
+import time
+import traceback
+import uuid
+from collections import OrderedDict
+from concurrent.futures import ProcessPoolExecutor
+from concurrent.futures.process import BrokenProcessPool
+
+from cancellation import CancellationToken, QueryCancelled
+
+DB_PARAMS = {
+    'dbname': 'temp',
+    'user': 'postgres',
+    'password': 'postgres',
+    'host': 'localhost',
+    'port': '5432'
+}
+
+STAGES = ["parse", "pred_push", "join", "common_subexpr"]
+JOB_WORKERS = max(2, os.cpu_count() or 1)
+MAX_JOBS = 1000
+# Jobs running at once that can be cancelled within a stage; the others
+# are cancelled between stages
+CANCEL_SLOTS = 1024
+
+# Deadline of each stage
+QUERY_TIMEOUT_SECONDS = 30
+
+# Planning time of the interactive join order search, after which the best
+# order found so far is used
+JOIN_SEARCH_SECONDS = 0.5
+
+# Processes of the join order search of each worker; above one, the full
+# dynamic programming search over table sets runs in parallel, on a pool
+# the worker keeps, instead of the time-budgeted one
+JOIN_SEARCH_WORKERS = int(os.environ.get('JOIN_SEARCH_WORKERS', '1'))
+
+
+# ------------------ Worker processes ------------------ #
+# Connections and caches of the worker process, set up once by init_worker
+_WORKER = {}
+
+
+def init_worker(db_params, cancel_flags):
+    from catalog import load_column_types
+    from cost_populator import CostCalculator
+    from join_optimization import QueryOptimizer
+
+    cost_calculator = CostCalculator(db_params)
+    cost_calculator.connect()
+    optimizer = QueryOptimizer(db_params)
+    optimizer.connect()
+    # Statistics of the base tables are read once per worker, not per query
+    for table in load_column_types():
+        optimizer.statistics_cache[table] = optimizer.get_table_statistics(table)
+    _WORKER.update(cost_calculator=cost_calculator, optimizer=optimizer, cancel_flags=cancel_flags)
+
+
+def stage_token(state):
+    """Deadline of a stage, which JobService.cancel also trips through the job's flag."""
+    slot = state.get("cancel_slot")
+    if slot is None:
+        return CancellationToken(QUERY_TIMEOUT_SECONDS)
+    flags = _WORKER["cancel_flags"]
+    return CancellationToken(QUERY_TIMEOUT_SECONDS, lambda: flags[slot] != 0)
+
+
+def stage_parse(state):
+    from materialized_views import parse_sql
+
+    relational_algebra = parse_sql(state["sql"], stage_token(state))
+    return {"relational_algebra": relational_algebra}, {'success': True, 'result': relational_algebra}
+
+
+def stage_pred_push(state):
+    from predicate_pushdown import optimize_query_plan
+
+    cost_calculator = _WORKER["cost_calculator"]
+    relational_algebra = state["relational_algebra"]
+    result = optimize_query_plan(json.dumps(relational_algebra), cost_calculator)
+    optimized_plan = result["optimized_plan_json"]
+    optimized_cost, _ = cost_calculator.calculate_cost(copy.deepcopy(optimized_plan))
+
+    updates = {
+        "original_plan_json": relational_algebra,
+        "pred_plan_json": optimized_plan,
+        "pred_cost": optimized_cost,
+    }
+    return updates, {
+        'success': True,
+        'original_plan_json': relational_algebra,
+        'optimized_plan_json': optimized_plan,
+        'original_plan_str': result["original_plan_str"],
+        'optimized_plan_str': result["optimized_plan_str"]
+    }
+
+
+def stage_join(state):
+    from join_optimization import SearchBudget
+
+    optimizer = _WORKER["optimizer"]
+    optimizer.cancellation = stage_token(state)
+    if JOIN_SEARCH_WORKERS > 1:
+        optimizer.search_workers = JOIN_SEARCH_WORKERS
+        optimizer.search_budget = None
+    else:
+        optimizer.search_budget = SearchBudget(seconds=JOIN_SEARCH_SECONDS)
+    res = optimizer.get_costs_and_plans(state["pred_plan_json"])
+
+    updates = {
+        "join_plan_json": res["best_plan"],
+        "join_cost": res["best_cost"],
+        "pred_cost": res["naive_cost"],
+        "scale": res["scale"],
+    }
+    return updates, {
+        'success': True,
+        'original_plan_json': res["naive_plan"],
+        'optimized_plan_json': res["best_plan"],
+        'original_cost': res["naive_cost"],
+        'optimized_cost': res["best_cost"],
+    }
+
+
+def stage_common_subexpr(state):
+    from graph_visualizer import visualize_query_plan
+    from subsequence_elim import QueryTreeOptimizer
+
+    cost_calculator = _WORKER["cost_calculator"]
+    scale = state.get("scale", 1.0)
+    original_cost = None
+    if "pred_plan_json" in state:
+        # Use the predicate pushdown plan JSON if available
+        relational_algebra = state["pred_plan_json"]
+        original_cost = state["pred_cost"]
+    else:
+        relational_algebra = state["original_plan_json"]
+    optimize_input_json = state.get("join_plan_json", relational_algebra)
+
+    optimized_tree = QueryTreeOptimizer().optimize_and_cleanup(optimize_input_json)
+    original_plan_svg = visualize_query_plan({"query": relational_algebra})
+    optimized_plan_svg = visualize_query_plan(optimized_tree)
+
+    if not original_cost:
+        original_cost, _ = cost_calculator.calculate_cost(copy.deepcopy(relational_algebra))
+
+    optimized_tree_with_cost = copy.deepcopy(optimized_tree)
+    optimized_cost, _ = cost_calculator.calc_subseq_cost(optimized_tree_with_cost)
+    cost_calculator.scale_costs(optimized_tree_with_cost, scale)
+
+    if len(optimized_tree["common_expressions"]) == 0:
+        optimized_cost = original_cost
+        print("No common subexpressions found. Using original cost.")
+    optimized_cost *= scale
+
+    updates = {"subseq_plan_json": optimized_tree, "subseq_cost": optimized_cost}
+    return updates, {
+        'success': True,
+        'original_plan_json': relational_algebra,
+        'optimized_plan_json': optimized_tree,
+        'optimized_plan_svg': optimized_plan_svg,
+        'original_plan_svg': original_plan_svg,
+        'original_cost': original_cost,
+        'optimized_cost': optimized_cost,
+    }
+
+
+def stage_batch(state):
+    from graph_visualizer import visualize_query_plan
+    from multi_query import optimize_batch
+
+    result = optimize_batch(state["statements"], _WORKER["cost_calculator"])
+    return {}, {
+        'success': True,
+        'plans': result["plans"],
+        'global_plan_json': result["global_plan"],
+        'global_plan_svg': visualize_query_plan(result["global_plan"]),
+        'shared_expressions': result["shared_expressions"],
+        'query_costs': result["query_costs"],
+        'independent_cost': result["independent_cost"],
+        'batch_cost': result["batch_cost"],
+    }
+
+
+STAGE_FUNCTIONS = {
+    "parse": stage_parse,
+    "pred_push": stage_pred_push,
+    "join": stage_join,
+    "common_subexpr": stage_common_subexpr,
+    "batch": stage_batch,
+}
+
+STAGE_NAMES = {
+    "parse": "Parsing",
+    "pred_push": "Optimization",
+    "join": "Join optimization",
+    "common_subexpr": "Common subexpression elimination",
+    "batch": "Batch optimization",
+}
+
+
+def run_stage(stage, state):
+    """
+    Run one stage in a worker. Returns the updates to the query's state and
+    the stage's response; failures become an unsuccessful response, since
+    not every exception survives the trip back to the parent process.
+    """
+    try:
+        return STAGE_FUNCTIONS[stage](state)
+    except QueryCancelled as e:
+        return {}, {'success': False, 'error': f'{STAGE_NAMES[stage]} stopped: {e}',
+                    'diagnostics': e.diagnostics}
+    except subprocess.CalledProcessError as e:
+        return {}, {'success': False, 'error': f'Parser execution failed: {e}', 'stderr': e.stderr}
+    except json.JSONDecodeError as e:
+        return {}, {'success': False, 'error': f'Failed to parse JSON output: {e}'}
+    except Exception as e:
+        traceback.print_exc()
+        return {}, {'success': False, 'error': f'{STAGE_NAMES[stage]} failed: {str(e)}'}
+
+
+# ------------------ Jobs ------------------ #
+class Job:
+    def __init__(self, job_id, sql, stages):
+        self.id = job_id
+        self.stages = stages
+        self.state = {"sql": sql, "scale": 1.0}
+        self.results = OrderedDict()  # stage -> response, in completion order
+        self.status = "queued"        # queued, running, done, failed or cancelled
+        self.current = None
+        self.future = None
+        self.pool = None  # the pool running the current stage
+        self.slot = None  # index of the job's cancel flag, if it has one
+        self.submitted = time.time()
+        self.finished = None
+
+    def summary(self):
+        return {"job_id": self.id, "status": self.status, "stages": self.stages, "current_stage": self.current,
+                "results": dict(self.results), "submitted": self.submitted, "finished": self.finished}
+
+
+class JobService:
+    """
+    Args:
+        workers (int): Worker processes
+        db_params (dict): Database connection parameters for the workers
+    """
+
+    def __init__(self, workers=JOB_WORKERS, db_params=DB_PARAMS):
+        self.workers = workers
+        self.db_params = db_params
+        self.pool = None
+        self.closed = False
+        self.jobs = OrderedDict()
+        self.condition = threading.Condition()
+        # One flag per running job, shared with every worker
+        self.cancel_flags = multiprocessing.get_context("spawn").RawArray('b', CANCEL_SLOTS)
+        self.free_slots = list(range(CANCEL_SLOTS))
+
+    def executor(self):
+        # Started on first use, and by spawning, so that the web server's
+        # threads and reloader are not forked into the workers
+        with self.condition:
+            if self.pool is None:
+                self.pool = ProcessPoolExecutor(self.workers, mp_context=multiprocessing.get_context("spawn"),
+                                                initializer=init_worker,
+                                                initargs=(self.db_params, self.cancel_flags))
+            return self.pool
+
+    def restart(self, broken, error):
+        """
+        Replace a pool whose worker died, such as from a crash in a stage.
+        Every future of the pool fails at once, so only the first of them to
+        get here replaces it; the others find a new pool already in place.
+        """
+        with self.condition:
+            if self.pool is not broken:
+                return
+            print(f"Restarting job workers: {error}")
+            broken.shutdown(wait=False, cancel_futures=True)
+            self.pool = None
+
+    def run_stage(self, stage, state):
+        """Run one stage on the pool and wait for it, updating state in place."""
+        pool = self.executor()
+        try:
+            updates, response = pool.submit(run_stage, stage, state).result()
+        except BrokenProcessPool as e:
+            self.restart(pool, e)
+            return {'success': False, 'error': f'Worker failed: {e}'}
+        state.update(updates)
+        return response
+
+    def submit(self, sql, stages=None):
+        """
+        Start a job running the given stages, in pipeline order, on a query.
+
+        Returns:
+            str: Job id
+        """
+        stages = [stage for stage in STAGES if stage in (stages or STAGES)]
+        job = Job(uuid.uuid4().hex, sql, stages)
+        with self.condition:
+            if self.free_slots:
+                job.slot = job.state["cancel_slot"] = self.free_slots.pop()
+            self.jobs[job.id] = job
+            self.evict()
+            self.start_next(job)
+        return job.id
+
+    def evict(self):
+        finished = [job_id for job_id, job in self.jobs.items() if job.finished is not None]
+        for job_id in finished[:max(0, len(self.jobs) - MAX_JOBS)]:
+            del self.jobs[job_id]
+
+    def release_slot(self, job):
+        # Called with the condition held, once no stage of the job is running
+        if job.slot is not None:
+            self.cancel_flags[job.slot] = 0
+            self.free_slots.append(job.slot)
+            job.slot = None
+
+    def start_next(self, job):
+        # Called with the condition held
+        remaining = [stage for stage in job.stages if stage not in job.results]
+        if not remaining or job.status in ("failed", "cancelled"):
+            if job.status not in ("failed", "cancelled"):
+                job.status = "done"
+            job.current = None
+            job.finished = time.time()
+            self.release_slot(job)
+            self.condition.notify_all()
+            return
+        job.status = "running"
+        job.current = remaining[0]
+        job.pool = self.executor()
+        job.future = job.pool.submit(run_stage, job.current, job.state)
+        job.future.add_done_callback(lambda future, job=job: self.stage_done(job, future))
+
+    def stage_done(self, job, future):
+        with self.condition:
+            if future is not job.future:
+                return
+            if job.status == "cancelled":
+                # The stage stopped on the job's flag, or finished before
+                # seeing it; either way the flag is no longer read
+                self.release_slot(job)
+                return
+            if future.cancelled():
+                # Dropped with its pool rather than by the user
+                if self.closed:
+                    job.results[job.current] = {'success': False, 'error': 'Job service shut down'}
+                    job.status = "failed"
+                self.start_next(job)
+                return
+            try:
+                updates, response = future.result()
+            except Exception as e:
+                if isinstance(e, BrokenProcessPool):
+                    self.restart(job.pool, e)
+                updates, response = {}, {'success': False, 'error': f'Worker failed: {e}'}
+            job.state.update(updates)
+            job.results[job.current] = response
+            if not response.get('success'):
+                job.status = "failed"
+            self.start_next(job)
+            self.condition.notify_all()
+
+    def status(self, job_id):
+        with self.condition:
+            job = self.jobs.get(job_id)
+            return job.summary() if job else None
+
+    def cancel(self, job_id):
+        """
+        Cancel a job. No further stage starts, and a stage already running
+        stops at its next cancellation check.
+        """
+        with self.condition:
+            job = self.jobs.get(job_id)
+            if job is None:
+                return False
+            if job.finished is None:
+                job.status = "cancelled"
+                job.current = None
+                job.finished = time.time()
+                if job.slot is not None:
+                    self.cancel_flags[job.slot] = 1
+                if job.future is None or job.future.done():
+                    self.release_slot(job)
+                else:
+                    # A queued stage is dropped here; a running one releases
+                    # the flag in stage_done once its worker is past it
+                    job.future.cancel()
+                self.condition.notify_all()
+            return True
+
+    def stream(self, job_id, timeout=QUERY_TIMEOUT_SECONDS * len(STAGES)):
+        """
+        Yield (stage, response) as the stages of a job complete, and finally
+        (None, summary) once the job has finished.
+        """
+        sent = 0
+        deadline = time.monotonic() + timeout
+        while True:
+            with self.condition:
+                job = self.jobs.get(job_id)
+                if job is None:
+                    return
+                while len(job.results) == sent and job.finished is None and time.monotonic() < deadline:
+                    self.condition.wait(max(0.0, deadline - time.monotonic()))
+                new = list(job.results.items())[sent:]
+                summary = job.summary() if job.finished is not None or time.monotonic() >= deadline else None
+            for stage, response in new:
+                yield stage, response
+            sent += len(new)
+            if summary is not None:
+                yield None, summary
+                return
+
+    def shutdown(self):
+        with self.condition:
+            self.closed = True
+            if self.pool is not None:
+                self.pool.shutdown(wait=False, cancel_futures=True)
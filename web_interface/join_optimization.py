@@ -1,11 +1,105 @@
 import json
+import io
 import itertools
+import contextlib
+import multiprocessing
+import threading
 from collections import defaultdict, deque
+from concurrent.futures import ProcessPoolExecutor
+from concurrent.futures.process import BrokenProcessPool
 import psycopg2
 import copy
+import math
+import time
+from catalog import HASH_PARTITIONS, colocation, scan_order
 from cost_populator import CostCalculator
 from selector import add_selects
 
+def is_plain_column(operand):
+    """Check whether a condition operand is a bare table.attr reference"""
+    return isinstance(operand, dict) and "table" in operand and "attr" in operand \
+        and operand.get("type", "column") == "column"
+
+# Cost settings of the optimizer that the workers of a parallel join order
+# search are sent with every query
+SEARCH_SETTINGS = ("page_size", "cpu_tuple_cost", "cpu_index_tuple_cost", "cpu_operator_cost", "seq_page_cost",
+                   "random_page_cost", "work_mem", "hash_mem", "merge_order")
+
+# Optimizer of a worker process of a parallel join order search, set by the
+# pool's initializer in the worker only
+_SEARCH_OPTIMIZER = None
+
+# Worker pools of parallel join order searches, by number of workers,
+# started once and shared by every optimizer of the process
+_SEARCH_POOLS = {}
+_SEARCH_POOLS_LOCK = threading.Lock()
+
+def _init_search_worker():
+    global _SEARCH_OPTIMIZER
+    # Without a database: the statistics come with each query
+    _SEARCH_OPTIMIZER = QueryOptimizer(None)
+    # The step traces of concurrent workers would only interleave
+    _SEARCH_OPTIMIZER.trace = False
+
+def _extend_subsets(context, tasks):
+    """Worker: one DP step for each (method, strategy preference, plans of a table set, table) of a query."""
+    optimizer = _SEARCH_OPTIMIZER
+    for name, value in context["settings"].items():
+        setattr(optimizer, name, value)
+    optimizer.statistics_cache = context["statistics"]
+    optimizer.cost_calculator.cache_residency = context["cache_residency"]
+    with contextlib.redirect_stdout(io.StringIO()):
+        return [optimizer.extend_subset_plans(plans, table, context["join_conditions"], method, preference)
+                for method, preference, plans, table in tasks]
+
+def search_pool(workers):
+    """
+    The worker pool of parallel join order searches over this many workers.
+    Its processes are started by a fork server, or spawned where there is
+    none, so that a server's threads and connections are never forked into
+    them, and live as long as the process.
+    """
+    with _SEARCH_POOLS_LOCK:
+        pool = _SEARCH_POOLS.get(workers)
+        if pool is None:
+            method = "forkserver" if "forkserver" in multiprocessing.get_all_start_methods() else "spawn"
+            pool = _SEARCH_POOLS[workers] = ProcessPoolExecutor(
+                workers, mp_context=multiprocessing.get_context(method), initializer=_init_search_worker)
+        return pool
+
+def discard_search_pool(workers, pool):
+    """Forget a pool whose worker died, so that the next search starts a new one."""
+    with _SEARCH_POOLS_LOCK:
+        if _SEARCH_POOLS.get(workers) is pool:
+            del _SEARCH_POOLS[workers]
+    pool.shutdown(wait=False, cancel_futures=True)
+
+# Largest query whose join orders a budgeted search counts, to report how
+# much of the search space it explored; counting takes 2^n steps
+SEARCH_SPACE_MAX_TABLES = 12
+
+def order_key(table, attr):
+    """
+    Name of the interesting order on table.attr. Plans spell tables and
+    columns in upper case and the catalog in lower case, so every key is
+    built here, lowercased, for orders to compare equal.
+    """
+    return f"{table.lower()}.{attr.lower()}"
+
+class SearchBudget:
+    """
+    Limits of a budgeted join order search, shared evenly by the selectivity
+    methods. Either limit may be None.
+
+    Args:
+        seconds (float): Planning time
+        evaluations (int): Join orders costed
+    """
+
+    def __init__(self, seconds=None, evaluations=None):
+        self.seconds = seconds
+        self.evaluations = evaluations
+
 class QueryOptimizer:
     def __init__(self, db_params):
         """
@@ -25,16 +119,37 @@ class QueryOptimizer:
         self.cpu_operator_cost = 0.0025
         self.seq_page_cost = 1.0
         self.random_page_cost = 4.0
+        self.work_mem = 4 * 1024 * 1024  # memory for one sort before it spills
+        self.hash_mem = 8 * 1024 * 1024  # work_mem * hash_mem_multiplier
+        self.merge_order = 6  # sorted runs merged per external sort pass
         
-        # Join strategies
+        # Join strategies; "merge" is tried alongside them in the DP and
+        # "partition_wise" is added for co-partitioned inputs
         self.join_strategies = ["hash", "nested", "block"]
         
         # Selectivity methods
         self.selectivity_methods = ["fixed", "ndv", "mcv"]
 
-        # Cost calculator instance
+        # Cost calculator instance; without db_params, as in the workers of
+        # a parallel search, statistics come from statistics_cache only
         self.cost_calculator = CostCalculator(db_params)
-        self.cost_calculator.connect()
+        if db_params is not None:
+            self.cost_calculator.connect()
+
+        # CancellationToken checked by the join enumeration loops, if set
+        self.cancellation = None
+
+        # SearchBudget capping the join order search, if set; otherwise
+        # every valid join order is costed, by search_workers processes
+        self.search_budget = None
+        self.search_workers = 1
+
+        # Print every DP step; worker processes of a parallel search turn it off
+        self.trace = True
+
+        # Table statistics kept in memory, such as by servers reading them
+        # once at startup
+        self.statistics_cache = {}
         
     def connect(self):
         """Establish a connection to the PostgreSQL database."""
@@ -117,7 +232,8 @@ class QueryOptimizer:
             first_table = original_order[0]
             try:
                 stats = self.get_table_statistics(first_table)
-                total_cost += stats['page_count'] * self.seq_page_cost + stats['row_count'] * self.cpu_tuple_cost
+                total_cost += stats['page_count'] * self.cost_calculator.page_cost(first_table, self.seq_page_cost) + \
+                    stats['row_count'] * self.cpu_tuple_cost
             except:
                 # Default if stats not available
                 total_cost += 100
@@ -213,10 +329,14 @@ class QueryOptimizer:
         for table in best_order:
             try:
                 stats = self.get_table_statistics(table)
-                tables_costs[table] = stats['page_count'] * self.seq_page_cost + stats['row_count'] * self.cpu_tuple_cost
+                tables_costs[table] = stats['page_count'] * self.cost_calculator.page_cost(table, self.seq_page_cost) + \
+                    stats['row_count'] * self.cpu_tuple_cost
             except:
                 tables_costs[table] = 100  # Default
         
+        # Sort order of the result after each join, as chosen by the DP
+        sort_orders = best_plans[best_method].get('sort_orders', [])
+        
         # Calculate join costs and accumulated costs at each step
         running_tables = [best_order[0]]
         running_cost = tables_costs[best_order[0]]
@@ -227,13 +347,16 @@ class QueryOptimizer:
             
             # Find join attributes
             join_attrs = None
+            join_table = None
             for prev_table in running_tables:
                 if (prev_table, current_table) in self.join_conditions:
                     join_attrs = self.join_conditions[(prev_table, current_table)]
+                    join_table = prev_table
                     break
                 elif (current_table, prev_table) in self.join_conditions:
                     join_attrs = self.join_conditions[(current_table, prev_table)]
                     join_attrs = (join_attrs[1], join_attrs[0])
+                    join_table = prev_table
                     break
             
             if join_attrs is None:
@@ -253,8 +376,12 @@ class QueryOptimizer:
                 join_cost = self.estimate_join_cost(
                     running_tables[0], current_table, join_attrs, strategy, selectivity)
             else:
+                prev_order = sort_orders[i-2] if i-2 < len(sort_orders) else None
+                intermediate_sorted = join_attrs is not None and prev_order is not None and \
+                    order_key(join_table, join_attrs[0]) in prev_order
                 join_cost = self.estimate_join_cost_with_intermediate(
-                    intermediate_rows, current_table, join_attrs, strategy, selectivity)
+                    intermediate_rows, current_table, join_attrs, strategy, selectivity,
+                    intermediate_sorted=intermediate_sorted)
             
             # Store join cost and update running total
             join_costs[(tuple(running_tables), current_table)] = join_cost
@@ -321,6 +448,12 @@ class QueryOptimizer:
                 "left": current,
                 "right": joined_table
             }
+            if strategy == "partition_wise":
+                # N independent joins of co-located partitions, no repartitioning
+                join_node["partitions"] = HASH_PARTITIONS[table_name.lower()]['modulus']
+            if i-1 < len(sort_orders) and sort_orders[i-1]:
+                # Output is sorted on these keys, which a later merge join can use
+                join_node["order"] = sorted(sort_orders[i-1])
             
             current = join_node
         
@@ -379,10 +512,14 @@ class QueryOptimizer:
                 extract_info(node["left"])
                 extract_info(node["right"])
                 
-                # Extract join condition
-                if node["condition"]["type"] == "EQ":
-                    left_side = node["condition"]["left"]
-                    right_side = node["condition"]["right"]
+                # Extract join condition; only column = column equalities form
+                # join edges, conditions over arithmetic expressions are left
+                # in place as filters
+                condition = node["condition"]
+                if condition["type"] == "EQ" and is_plain_column(condition["left"]) \
+                        and is_plain_column(condition["right"]):
+                    left_side = condition["left"]
+                    right_side = condition["right"]
                     
                     # Get table names, handling aliases
                     left_table = left_side["table"]
@@ -513,12 +650,17 @@ class QueryOptimizer:
             return [tuple(tables)]
         
         valid_orders = []
+        expansions = 0
         
         # Start with each possible table as the first table
         for first_table in tables:
             # Use BFS to build valid join orders
             queue = deque([(first_table,)])
             while queue:
+                expansions += 1
+                if self.cancellation is not None and expansions % 1024 == 0:
+                    self.cancellation.report(join_orders_generated=len(valid_orders))
+                    self.cancellation.check("join order enumeration")
                 current_order = queue.popleft()
                 
                 # If we've included all tables, this is a valid order
@@ -539,6 +681,9 @@ class QueryOptimizer:
                 for next_table in joinable_tables:
                     queue.append(current_order + (next_table,))
         
+        if self.cancellation is not None:
+            self.cancellation.report(join_orders_generated=len(valid_orders))
+
         # For debugging
         print(f"Generated {len(valid_orders)} valid join orders")
 
@@ -556,7 +701,10 @@ class QueryOptimizer:
 
     def get_table_statistics(self, table_name):
         """
-        Retrieve statistics for a given table.
+        Retrieve statistics for a given table. Subquery aliases are mapped
+        to the base table they read; the statistics themselves come from the
+        cost calculator, which knows how to read partitioned tables and
+        materialized views.
         
         Args:
             table_name (str): Name of the table
@@ -564,109 +712,17 @@ class QueryOptimizer:
         Returns:
             dict: Table statistics including row count, page count, etc.
         """
-        # Check if we're dealing with a subquery alias
         table_name = table_name.lower()
-        is_subquery = table_name.startswith('tmp')
+        if table_name in self.statistics_cache:
+            return self.statistics_cache[table_name]
         
-        if is_subquery and hasattr(self, 'subquery_base_tables') and table_name in self.subquery_base_tables:
+        if table_name.startswith('tmp') and table_name in getattr(self, 'subquery_base_tables', {}):
             # Use the base table for the subquery
             base_table = self.subquery_base_tables[table_name]
             print(f"Using base table '{base_table}' for subquery '{table_name}'")
             return self.get_table_statistics(base_table)
-        elif is_subquery:
-            # If we don't have a mapping, we check if it has a pattern like "tmp.table_name"
-            parts = table_name.split('.')
-            if len(parts) > 1 and not parts[-1].startswith('tmp'):
-                actual_table = parts[-1]
-                print(f"Extracting base table '{actual_table}' from subquery reference '{table_name}'")
-                return self.get_table_statistics(actual_table)
-        
-        # Create a fresh cursor for each query to avoid transaction issues
-        with self.conn.cursor() as stats_cursor:
-            try:
-                query = """
-                SELECT
-                    reltuples as row_count,
-                    relpages as page_count,
-                    pg_table_size(%s) as table_size
-                FROM
-                    pg_class
-                WHERE
-                    relname = %s;
-                """
-                
-                stats_cursor.execute(query, (table_name, table_name))
-                result = stats_cursor.fetchone()
-                
-                if not result:
-                    raise ValueError(f"Table {table_name} not found in the database.")
-                
-                row_count, page_count, table_size = result
-                
-            except Exception as e:
-                print(f"Error getting basic statistics for {table_name}: {e}")
-                # For subqueries or tables that don't exist, return default statistics
-                if is_subquery:
-                    print(f"Using default statistics for subquery {table_name}")
-                    return {
-                        'row_count': 1000,
-                        'page_count': 10,
-                        'table_size': 81920,
-                        'columns': {}
-                    }
-                else:
-                    raise  # Re-raise for regular tables
-        
-        # Use a separate cursor for column stats to isolate potential errors
-        with self.conn.cursor() as col_cursor:
-            try:
-                column_query = """
-                SELECT
-                    a.attname as column_name,
-                    s.n_distinct as ndv,
-                    s.null_frac as nullfrac,
-                    s.avg_width as avg_width,
-                    array_to_string(s.most_common_vals, ',') as mcv_values,
-                    array_to_string(s.most_common_freqs, ',') as mcv_freqs
-                FROM
-                    pg_stats s
-                JOIN
-                    pg_attribute a ON s.attname = a.attname AND a.attrelid = %s::regclass
-                WHERE
-                    s.schemaname = 'public'
-                    AND s.tablename = %s;
-                """
-                
-                col_cursor.execute(column_query, (table_name, table_name))
-                columns = col_cursor.fetchall()
-                
-                column_stats = {}
-                for col in columns:
-                    col_name, ndv, nullfrac, avg_width, mcv_vals, mcv_freqs = col
-                    
-                    mcv_dict = {}
-                    if mcv_vals and mcv_freqs:
-                        mcv_values = mcv_vals.split(',')
-                        mcv_frequencies = [float(f) for f in mcv_freqs.split(',')]
-                        mcv_dict = dict(zip(mcv_values, mcv_frequencies))
-                    
-                    column_stats[col_name] = {
-                        'ndv': ndv if ndv > 0 else abs(ndv) * row_count,
-                        'nullfrac': nullfrac,
-                        'avg_width': avg_width,
-                        'mcv': mcv_dict
-                    }
-                    
-            except Exception as e:
-                print(f"Error getting column statistics for {table_name}: {e}")
-                column_stats = {}  # Use empty column stats on error
         
-        return {
-            'row_count': row_count,
-            'page_count': page_count,
-            'table_size': table_size,
-            'columns': column_stats
-        }
+        return self.cost_calculator.get_table_statistics(table_name)
             
     def estimate_selectivity(self, table1, table2, join_attrs, method):
         """
@@ -755,7 +811,7 @@ class QueryOptimizer:
             table1 (str): First table name
             table2 (str): Second table name
             join_attrs (tuple): Join attributes (attr1, attr2)
-            strategy (str): Join strategy (hash, nested, block)
+            strategy (str): Join strategy (hash, nested, block, merge)
             selectivity (float): Estimated selectivity factor
             
         Returns:
@@ -776,12 +832,16 @@ class QueryOptimizer:
         output_rows = row_count1 * row_count2 * selectivity
         
         if strategy == "hash":
-            build_cost = page_count1 * self.seq_page_cost + row_count1 * self.cpu_tuple_cost
-            probe_cost = page_count2 * self.seq_page_cost + row_count2 * self.cpu_tuple_cost
-            
-            hash_cpu_cost = (row_count1 + output_rows) * self.cpu_operator_cost
-            
-            return build_cost + probe_cost + hash_cpu_cost
+            return self.hash_join_cost(row_count1, page_count1, row_count2, page_count2, output_rows)
+        
+        elif strategy == "partition_wise":
+            partitions = HASH_PARTITIONS[table2.lower()]['modulus']
+            return self.hash_join_cost(row_count1, page_count1, row_count2, page_count2, output_rows, partitions)
+        
+        elif strategy == "merge":
+            sort_cost = (self.ordered_input_cost(table1, join_attrs[0], row_count1, page_count1) +
+                         self.ordered_input_cost(table2, join_attrs[1], row_count2, page_count2))
+            return sort_cost + self.merge_join_cost(row_count1, page_count1, row_count2, page_count2, output_rows)
         
         elif strategy == "nested":
             return page_count1 * self.seq_page_cost + row_count1 * page_count2 * self.random_page_cost
@@ -798,6 +858,99 @@ class QueryOptimizer:
         
         return float('inf')  # Unknown strategy
     
+    def hash_join_cost(self, build_rows, build_pages, probe_rows, probe_pages, output_rows, partitions=1):
+        """
+        Estimate the cost of a hash join, optionally run as independent joins
+        over co-located partitions.
+        
+        Args:
+            build_rows (float): Rows on the build side
+            build_pages (float): Pages on the build side
+            probe_rows (float): Rows on the probe side
+            probe_pages (float): Pages on the probe side
+            output_rows (float): Estimated join output
+            partitions (int): Number of partition pairs joined separately
+            
+        Returns:
+            float: Estimated cost
+        """
+        build_cost = build_pages * self.seq_page_cost + build_rows * self.cpu_tuple_cost
+        probe_cost = probe_pages * self.seq_page_cost + probe_rows * self.cpu_tuple_cost
+        hash_cpu_cost = (build_rows + output_rows) * self.cpu_operator_cost
+        
+        # A hash table that does not fit in hash memory is split into batches;
+        # every batch but the first is written out and read back on both sides.
+        # Partition-wise joins only need one partition's table at a time.
+        batches = max(1, math.ceil(build_pages * self.page_size / partitions / self.hash_mem))
+        spill_cost = 2 * (build_pages + probe_pages) * self.seq_page_cost * (1 - 1 / batches)
+        
+        return build_cost + probe_cost + hash_cpu_cost + spill_cost
+    
+    def merge_join_cost(self, left_rows, left_pages, right_rows, right_pages, output_rows):
+        """
+        Estimate the cost of merging two inputs that are already sorted on the
+        join keys: one pass over each and a comparison per input or output row.
+        """
+        scan_cost = (left_pages + right_pages) * self.seq_page_cost + \
+            (left_rows + right_rows) * self.cpu_tuple_cost
+        merge_cpu_cost = (left_rows + right_rows + output_rows) * self.cpu_operator_cost
+        return scan_cost + merge_cpu_cost
+    
+    def sort_cost(self, rows, pages):
+        """
+        Estimate the cost of sorting an input, as PostgreSQL does: about
+        N log2 N comparisons, plus writing and reading every page once per
+        merge pass when the input does not fit in work_mem.
+        """
+        if rows <= 1:
+            return 0
+        cpu_cost = 2 * self.cpu_operator_cost * rows * math.log2(rows)
+        
+        runs = math.ceil(pages * self.page_size / self.work_mem)
+        if runs <= 1:
+            return cpu_cost
+        passes = math.ceil(math.log(runs, self.merge_order))
+        return cpu_cost + 2 * pages * self.seq_page_cost * max(1, passes)
+    
+    def scan_order(self, table):
+        """
+        Interesting order produced by scanning a table: the set of
+        order_key keys its rows come sorted on, or None if unordered.
+        Tables stored as several leaves only come sorted after a merge;
+        lineitem and orders are range and hash partitioned, so they always
+        have more than one and this only gives an order to unpartitioned
+        tables.
+        """
+        keys, runs = scan_order(table)
+        if not keys or runs > 1:
+            return None
+        return frozenset([order_key(table, keys[0])])
+    
+    def ordered_input_cost(self, table, attr, rows, pages):
+        """
+        Extra cost of reading a table in attr order for a merge join: nothing
+        if its rows are stored in that order, a merge of the sorted leaves if
+        it is partitioned, and a full sort otherwise.
+        """
+        keys, runs = scan_order(table)
+        if keys and keys[0] == attr.lower():
+            if runs == 1:
+                return 0
+            return rows * math.log2(runs) * self.cpu_operator_cost
+        return self.sort_cost(rows, pages)
+    
+    def join_output_order(self, strategy, order, join_table, table, join_attrs):
+        """
+        Order of a join result given the order of its left (outer) input.
+        A merge join emits rows sorted on both join keys, a nested loop keeps
+        the order of its outer input and hash or block joins lose it.
+        """
+        if strategy == "merge":
+            return frozenset([order_key(join_table, join_attrs[0]), order_key(table, join_attrs[1])])
+        if strategy == "nested":
+            return order
+        return None
+    
     def get_intermediate_result_size(self, tables, join_conditions, method):
         """
         Estimate the size of the intermediate result after joining a set of tables.
@@ -844,7 +997,8 @@ class QueryOptimizer:
         
         return estimated_rows
     
-    def estimate_join_cost_with_intermediate(self, intermediate_rows, table, join_attrs, strategy, selectivity):
+    def estimate_join_cost_with_intermediate(self, intermediate_rows, table, join_attrs, strategy, selectivity,
+                                             intermediate_sorted=False):
         """
         Estimate the cost of joining an intermediate result with a table.
         
@@ -852,8 +1006,10 @@ class QueryOptimizer:
             intermediate_rows (float): Estimated rows in the intermediate result
             table (str): Table name to join with
             join_attrs (tuple): Join attributes (attr1, attr2)
-            strategy (str): Join strategy (hash, nested, block)
+            strategy (str): Join strategy (hash, nested, block, merge)
             selectivity (float): Estimated selectivity factor
+            intermediate_sorted (bool): Whether the intermediate result already
+                                        arrives sorted on its join attribute
             
         Returns:
             float: Estimated cost
@@ -878,11 +1034,21 @@ class QueryOptimizer:
         
         if strategy == "hash":
             # Hash Join Cost Estimation
-            build_cost = intermediate_pages * self.seq_page_cost + intermediate_rows * self.cpu_tuple_cost
-            probe_cost = page_count * self.seq_page_cost + row_count * self.cpu_tuple_cost
-            hash_cpu_cost = (intermediate_rows + output_rows) * self.cpu_operator_cost
-            
-            return build_cost + probe_cost + hash_cpu_cost
+            return self.hash_join_cost(intermediate_rows, intermediate_pages, row_count, page_count, output_rows)
+        
+        elif strategy == "partition_wise":
+            # The intermediate result is still partitioned like the table
+            partitions = HASH_PARTITIONS[table.lower()]['modulus']
+            return self.hash_join_cost(intermediate_rows, intermediate_pages, row_count, page_count,
+                                       output_rows, partitions)
+        
+        elif strategy == "merge":
+            # Merge Join, sorting whichever input is not already in join key order
+            sort_cost = self.ordered_input_cost(table, join_attrs[1], row_count, page_count)
+            if not intermediate_sorted:
+                sort_cost += self.sort_cost(intermediate_rows, intermediate_pages)
+            return sort_cost + self.merge_join_cost(intermediate_rows, intermediate_pages,
+                                                    row_count, page_count, output_rows)
         
         elif strategy == "nested":
             # Nested Loop Join
@@ -901,6 +1067,384 @@ class QueryOptimizer:
         
         return float('inf')  # Unknown strategy
     
+    def is_connected(self, tables, join_graph):
+        """Check whether the join graph connects all tables, so that a valid join order exists."""
+        reached = {tables[0]}
+        queue = deque([tables[0]])
+        while queue:
+            for neighbor in join_graph.get(queue.popleft(), ()):
+                if neighbor in tables and neighbor not in reached:
+                    reached.add(neighbor)
+                    queue.append(neighbor)
+        return len(reached) == len(tables)
+
+    def count_join_orders(self, tables, join_graph, limit=SEARCH_SPACE_MAX_TABLES):
+        """
+        Count the valid left-deep join orders without enumerating them: the
+        orders of a set of tables are those of each connected subset one
+        table smaller, followed by a table joinable with it.
+
+        Returns:
+            int: Number of valid join orders, or None past limit tables
+        """
+        if len(tables) > limit:
+            return None
+        index = {table: i for i, table in enumerate(tables)}
+        neighbors = [sum(1 << index[other] for other in join_graph.get(table, ()) if other in index)
+                     for table in tables]
+        orders = [0] * (1 << len(tables))
+        for i in range(len(tables)):
+            orders[1 << i] = 1
+        for subset in range(1, 1 << len(tables)):
+            if not orders[subset]:
+                continue
+            for i in range(len(tables)):
+                if not subset & (1 << i) and neighbors[i] & subset:
+                    orders[subset | (1 << i)] += orders[subset]
+        return orders[-1]
+
+    def iter_join_orders(self, tables, join_graph, method):
+        """
+        Lazily generate valid left-deep join orders, depth first, trying the
+        smallest tables first and then the joinable tables that keep the
+        intermediate result smallest. The first order generated is therefore
+        the greedy one, and later ones vary it from the last join backwards.
+        """
+        join_conditions = self.join_conditions
+        sizes = {}
+
+        def size(prefix):
+            if prefix not in sizes:
+                sizes[prefix] = self.get_intermediate_result_size(prefix, join_conditions, method)
+            return sizes[prefix]
+
+        def extend(prefix):
+            if len(prefix) == len(tables):
+                yield prefix
+                return
+            joinable = set()
+            for table in prefix:
+                joinable.update(join_graph.get(table, ()))
+            joinable = [table for table in tables if table in joinable and table not in prefix]
+            for table in sorted(joinable, key=lambda table: size(prefix + (table,))):
+                yield from extend(prefix + (table,))
+
+        for first_table in sorted(tables, key=lambda table: size((table,))):
+            yield from extend((first_table,))
+
+    def budgeted_join_search(self, tables, join_graph, join_conditions, method, strategy_preference, best_plans,
+                             search_space=None, seconds=None):
+        """
+        Anytime join order search. The greedy order is costed first, so a
+        valid plan is always at hand, and further orders are costed until
+        this method's share of the search budget runs out.
+
+        Args:
+            search_space (int): Number of valid join orders, if counted
+            seconds (float): Planning time left of the budget, for all
+                             methods, if less than the budget's
+
+        Returns:
+            tuple: (cost, order, strategies, sort orders, search), where search
+                   reports how much of the search space was explored
+        """
+        shares = len(self.selectivity_methods)
+        budget = self.search_budget
+        started = time.monotonic()
+        if seconds is None:
+            seconds = budget.seconds
+        deadline = started + seconds / shares if seconds is not None else None
+        max_evaluations = max(1, budget.evaluations // shares) if budget.evaluations is not None else None
+
+        best = (float('inf'), None, [], [])
+        evaluated = 0
+        exhaustive = True
+        for join_order in self.iter_join_orders(tables, join_graph, method):
+            if evaluated and ((max_evaluations is not None and evaluated >= max_evaluations) or
+                              (deadline is not None and time.monotonic() >= deadline)):
+                exhaustive = False
+                break
+            if self.cancellation is not None:
+                self.cancellation.report(
+                    selectivity_method=method, join_orders_costed=evaluated,
+                    best_plans={**best_plans, method: {'order': best[1], 'strategies': best[2],
+                                                       'cost': best[0] if best[1] else None}})
+                self.cancellation.check("join order search")
+
+            print(f"\nJoin order #{evaluated+1}: {join_order}")
+            cost, strategies, sort_orders = self.cost_join_order(
+                join_order, join_conditions, method, strategy_preference)
+            evaluated += 1
+            if cost < best[0]:
+                best = (cost, join_order, strategies, sort_orders)
+                print(f"  --> New best order with cost {cost}")
+
+        if exhaustive and search_space is None:
+            search_space = evaluated
+        search = {
+            'evaluated': evaluated,
+            'search_space': search_space,
+            'explored_fraction': 1.0 if exhaustive else (evaluated / search_space if search_space else None),
+            'exhaustive': exhaustive,
+            'seconds': time.monotonic() - started,
+        }
+        return best + (search,)
+
+    def base_join_plans(self, table):
+        """DP entry of a single table: its scan, keyed by its physical properties."""
+        stats = self.get_table_statistics(table)
+        base_cost = stats['page_count'] * self.cost_calculator.page_cost(table, self.seq_page_cost)
+        base_partitioning = HASH_PARTITIONS.get(table.lower(), {}).get('colocation')
+        if self.trace:
+            print(f"  Base case - Single table {table}: cost = {base_cost}")
+        return {(self.scan_order(table), base_partitioning): (base_cost, [], [])}
+
+    def extend_join_plans(self, prefix_plans, prefix, current_table, join_conditions, method, strategy_preference):
+        """
+        One DP step: join current_table to each plan of prefix with every strategy.
+
+        Args:
+            prefix_plans (dict): {(order, partitioned_by): (cost, strategies, orders)} of prefix
+            prefix (tuple): Tables joined so far
+
+        Returns:
+            dict: Plans of prefix + (current_table,), or None without a join condition
+        """
+        if self.trace:
+            print(f"\n  Step {len(prefix)}: Joining table {current_table} with prefix {prefix}")
+        
+        # Find the join condition between the current table and any table in the prefix
+        join_attrs = None
+        join_table = None
+        
+        for prev_table in prefix:
+            if (prev_table, current_table) in join_conditions:
+                join_table = prev_table
+                join_attrs = join_conditions[(prev_table, current_table)]
+                if self.trace:
+                    print(f"    Found join condition: {prev_table}.{join_attrs[0]} = {current_table}.{join_attrs[1]}")
+                break
+            elif (current_table, prev_table) in join_conditions:
+                join_table = prev_table
+                join_attrs = join_conditions[(current_table, prev_table)]
+                join_attrs = (join_attrs[1], join_attrs[0])  # Swap attributes
+                if self.trace:
+                    print(f"    Found join condition (swapped): {prev_table}.{join_attrs[0]} = {current_table}.{join_attrs[1]}")
+                break
+        
+        if not join_attrs:
+            # No direct join condition found, try to find a transitive one
+            if self.trace:
+                print(f"    No join condition found for {current_table} with any table in {prefix}")
+            # Skip for now, as transitive edges should be already added
+            return None
+        
+        # Calculate selectivity
+        selectivity = self.estimate_selectivity(join_table, current_table, join_attrs, method)
+        if self.trace:
+            print(f"    Estimated selectivity: {selectivity}")
+        
+        left_key = order_key(join_table, join_attrs[0])
+        partitioning = colocation(join_table, join_attrs[0], current_table, join_attrs[1])
+        if len(prefix) > 1:
+            intermediate_rows = self.get_intermediate_result_size(prefix, join_conditions, method)
+        
+        next_plans = {}
+        for (order, partitioned_by), (prev_cost, prev_strategies, prev_orders) in prefix_plans.items():
+            # A partition-wise join needs both inputs hash partitioned on the
+            # join keys; an intermediate result only stays partitioned while
+            # every join before it ran partition-wise on the same keys
+            strategies = list(strategy_preference) + ["merge"]
+            if partitioning is not None and partitioned_by == partitioning['colocation']:
+                strategies.append("partition_wise")
+            
+            # Try each join strategy, but favor the preferred strategy for this method
+            for strategy in strategies:
+                if len(prefix) == 1:
+                    # Direct join between first two tables
+                    join_cost = self.estimate_join_cost(prefix[0], current_table, join_attrs, strategy, selectivity)
+                    
+                    # Adjust cost slightly to favor preferred strategies
+                    original_cost = join_cost
+                    if strategy == strategy_preference[0]:
+                        join_cost *= 0.9  # 10% discount for preferred strategy
+                    elif strategy == strategy_preference[1]:
+                        join_cost *= 0.95  # 5% discount for second preference
+                        
+                    if self.trace:
+                        print(f"    Strategy {strategy}: original cost = {original_cost}, adjusted cost = {join_cost}")
+                else:
+                    # Cost of joining the result of previous joins with the current table
+                    strategy_cost = self.estimate_join_cost_with_intermediate(
+                        intermediate_rows, current_table, join_attrs, strategy, selectivity,
+                        intermediate_sorted=order is not None and left_key in order)
+                    join_cost = prev_cost + strategy_cost
+                    
+                    # Adjust cost slightly to favor preferred strategies
+                    original_cost = join_cost
+                    if strategy == strategy_preference[0]:
+                        join_cost *= 0.9  # 10% discount for preferred strategy
+                    elif strategy == strategy_preference[1]:
+                        join_cost *= 0.95  # 5% discount for second preference
+                    
+                    if self.trace:
+                        print(f"    Strategy {strategy}: prev_cost = {prev_cost}, strategy_cost = {strategy_cost}, original total = {original_cost}, adjusted total = {join_cost}")
+                
+                properties = (
+                    self.join_output_order(strategy, order, join_table, current_table, join_attrs),
+                    partitioning['colocation'] if strategy == "partition_wise" else None
+                )
+                if properties not in next_plans or join_cost < next_plans[properties][0]:
+                    next_plans[properties] = (join_cost, prev_strategies + [strategy],
+                                              prev_orders + [properties[0]])
+                    if self.trace:
+                        print(f"    --> New best strategy for order {properties[0]}: {strategy} with cost {join_cost}")
+
+        next_prefix = prefix + (current_table,)
+        for properties, (cost, strategies_so_far, _) in next_plans.items():
+            if self.trace:
+                print(f"    DP entry: {next_prefix} {properties} = {cost}, strategies = {strategies_so_far}")
+        return next_plans
+
+    def extend_subset_plans(self, subset_plans, current_table, join_conditions, method, strategy_preference):
+        """
+        One step of the DP over table sets: join current_table to each plan
+        of a set of tables. The join order of a plan is kept with it, since
+        the cost model looks up join conditions and intermediate sizes along
+        the order.
+
+        Args:
+            subset_plans (dict): {(order, partitioned_by): (cost, strategies, orders, join order)}
+
+        Returns:
+            dict: Plans of the set with current_table in the same form, or
+                  None if no plan of the set has a join condition with it
+        """
+        by_prefix = defaultdict(dict)
+        for properties, (cost, strategies, orders, join_order) in subset_plans.items():
+            by_prefix[join_order][properties] = (cost, strategies, orders)
+
+        next_plans = {}
+        for prefix, prefix_plans in by_prefix.items():
+            extended = self.extend_join_plans(prefix_plans, prefix, current_table, join_conditions,
+                                              method, strategy_preference)
+            for properties, (cost, strategies, orders) in (extended or {}).items():
+                if properties not in next_plans or cost < next_plans[properties][0]:
+                    next_plans[properties] = (cost, strategies, orders, prefix + (current_table,))
+        return next_plans or None
+
+    def parallel_join_search(self, tables, join_graph, join_conditions, strategy_preferences):
+        """
+        Join order search over the search_workers processes of search_pool
+        by dynamic programming over table sets. Level k holds, for every
+        connected set of k tables, the cheapest plan per combination of
+        physical properties (sort order and partitioning) of its result, and
+        each set of level k+1 is reached by joining one more table to a set
+        of level k. The extensions of a level, for all selectivity methods at
+        once, are split into chunks costed in parallel, and the plans
+        reaching the same set are merged keeping the cheapest per physical
+        property.
+
+        Args:
+            strategy_preferences (dict): Join strategies of each method, most preferred first
+
+        Returns:
+            dict: method -> (cost, order, strategies, sort orders)
+        """
+        # All the workers need of this optimizer, as plain data: they serve
+        # every query of the process
+        context = {
+            "settings": {name: getattr(self, name) for name in SEARCH_SETTINGS},
+            "statistics": {table.lower(): self.get_table_statistics(table) for table in tables},
+            "cache_residency": dict(self.cost_calculator.cache_residency),
+            "join_conditions": join_conditions,
+        }
+
+        methods = self.selectivity_methods
+        level = {}
+        for method in methods:
+            for table in tables:
+                level[(method, frozenset([table]))] = {
+                    properties: plan + ((table,),) for properties, plan in self.base_join_plans(table).items()}
+
+        pool = search_pool(self.search_workers)
+        try:
+            for size in range(1, len(tables)):
+                if self.cancellation is not None:
+                    self.cancellation.report(join_levels_done=size, table_sets_in_level=len(level))
+                    self.cancellation.check("parallel join order search")
+                tasks = []
+                for (method, subset), plans in level.items():
+                    joinable = set().union(*(join_graph.get(table, ()) for table in subset))
+                    for table in tables:
+                        if table in joinable and table not in subset:
+                            tasks.append((method, strategy_preferences[method], plans, table))
+                chunk_size = max(1, -(-len(tasks) // (self.search_workers * 4)))
+                chunks = [tasks[i:i + chunk_size] for i in range(0, len(tasks), chunk_size)]
+                level = {}
+                for chunk, results in zip(chunks, pool.map(_extend_subsets, [context] * len(chunks), chunks)):
+                    for (method, _, plans, table), next_plans in zip(chunk, results):
+                        if next_plans is None:
+                            continue
+                        subset = frozenset(next(iter(plans.values()))[3]) | {table}
+                        merged = level.setdefault((method, subset), {})
+                        for properties, plan in next_plans.items():
+                            if properties not in merged or plan[0] < merged[properties][0]:
+                                merged[properties] = plan
+                print(f"Join level {size + 1}: {len(level)} table sets over {len(chunks)} chunks")
+        except BrokenProcessPool:
+            discard_search_pool(self.search_workers, pool)
+            raise
+
+        best = {method: (float('inf'), None, [], []) for method in methods}
+        for (method, subset), plans in level.items():
+            if len(subset) != len(tables):
+                continue
+            cost, strategies, sort_orders, order = min(plans.values(), key=lambda plan: plan[0])
+            if cost < best[method][0]:
+                best[method] = (cost, order, strategies, sort_orders)
+        return best
+
+    def cost_join_order(self, join_order, join_conditions, method, strategy_preference):
+        """
+        Find the cheapest join strategies for one left-deep join order.
+
+        Args:
+            join_order (tuple): Tables in join order
+            join_conditions (dict): Dictionary mapping table pairs to join attributes
+            method (str): Selectivity estimation method
+            strategy_preference (list): Join strategies, most preferred first
+
+        Returns:
+            tuple: (cost, strategies, sort orders), with an infinite cost if
+                   the order cannot be joined
+        """
+        # For each join order, find the best combination of join strategies.
+        # Each prefix keeps the cheapest plan per combination of physical
+        # properties of its result: the sort order (interesting orders) and
+        # the colocation group it is still hash partitioned by. A more
+        # expensive plan survives when a later join may use its properties
+        # to skip a sort or a repartition.
+        dp_plans = {}  # prefix -> {(order, partitioned_by): (cost, strategies, orders)}
+        
+        # Base case: single table (no joins)
+        dp_plans[(join_order[0],)] = self.base_join_plans(join_order[0])
+        
+        # Build left-deep tree
+        for i in range(1, len(join_order)):
+            prefix = tuple(join_order[:i])  # Ensure prefix is a tuple for dp_plans key
+            next_plans = self.extend_join_plans(dp_plans[prefix], prefix, join_order[i], join_conditions,
+                                                method, strategy_preference)
+            if next_plans is None:
+                break
+            dp_plans[tuple(join_order[:i+1])] = next_plans
+        
+        final_plans = dp_plans.get(tuple(join_order), {})
+        final_cost, final_strategies, final_orders = min(
+            final_plans.values(), key=lambda plan: plan[0], default=(float('inf'), [], []))
+        print(f"\n  Final cost for join order {join_order}: {final_cost}")
+        return final_cost, final_strategies, final_orders
+
     def optimize_join_query(self, rel_algebra_json):
         """
         Find the optimal join order and strategy for a query.
@@ -925,10 +1469,15 @@ class QueryOptimizer:
         if not tables:
             return {"error": "No tables found in the relational algebra"}
             
-        # Generate valid join orders
-        join_orders = self.generate_valid_join_orders(tables, join_graph)
+        # Generate valid join orders; a budgeted search enumerates them lazily
+        # and a parallel one level by level instead
+        sequential = self.search_budget is None and self.search_workers <= 1
+        if sequential:
+            join_orders = self.generate_valid_join_orders(tables, join_graph)
+        else:
+            join_orders = []
         
-        if not join_orders:
+        if not join_orders and not (not sequential and self.is_connected(tables, join_graph)):
             return {"error": "No valid join orders found"}
             
         # For debugging
@@ -944,10 +1493,26 @@ class QueryOptimizer:
             "mcv": ["block", "hash", "nested"]
         }
         
+        search_space = search_seconds = None
+        if self.search_budget is not None:
+            # Counted once per query, and charged to the planning time
+            started = time.monotonic()
+            search_space = self.count_join_orders(tables, join_graph)
+            if self.search_budget.seconds is not None:
+                search_seconds = max(0.0, self.search_budget.seconds - (time.monotonic() - started))
+
+        parallel_plans = None
+        if self.search_budget is None and self.search_workers > 1:
+            parallel_plans = self.parallel_join_search(
+                tables, join_graph, join_conditions,
+                {method: method_to_strategy_preference.get(method, self.join_strategies)
+                 for method in self.selectivity_methods})
+
         for method in self.selectivity_methods:
             best_cost = float('inf')
             best_order = None
             best_strategies = None
+            best_sort_orders = []
             
             # Get strategy preference for this method
             strategy_preference = method_to_strategy_preference.get(method, self.join_strategies)
@@ -957,108 +1522,34 @@ class QueryOptimizer:
             print(f"Strategy preference: {strategy_preference}")
             print(f"{'='*50}")
             
+            if parallel_plans is not None:
+                best_cost, best_order, best_strategies, best_sort_orders = parallel_plans[method]
+
+            if self.search_budget is not None:
+                best_cost, best_order, best_strategies, best_sort_orders, search = self.budgeted_join_search(
+                    tables, join_graph, join_conditions, method, strategy_preference, best_plans,
+                    search_space, search_seconds)
+                print(f"Searched {search['evaluated']} of {search['search_space']} join orders")
+
             for join_order_idx, join_order in enumerate(join_orders):
-                # For each join order, find the best combination of join strategies
-                dp_table = {}  # Dynamic programming table
-                dp_strategies = {}  # Store best strategies
-                
+                if self.cancellation is not None:
+                    # Best plans so far are the partial result of a timed out search
+                    self.cancellation.report(
+                        selectivity_method=method, join_orders_costed=join_order_idx,
+                        join_orders_total=len(join_orders),
+                        best_plans={**best_plans, method: {'order': best_order, 'strategies': best_strategies,
+                                                           'cost': best_cost if best_order else None}})
+                    self.cancellation.check("join order search")
+
                 print(f"\nJoin order #{join_order_idx+1}: {join_order}")
-                
-                # Base case: single table (no joins)
-                stats = self.get_table_statistics(join_order[0])                    
-                dp_table[(join_order[0],)] = stats['page_count'] * self.seq_page_cost
-                dp_strategies[(join_order[0],)] = []
-                
-                print(f"  Base case - Single table {join_order[0]}: cost = {dp_table[(join_order[0],)]}")
-                
-                # Build left-deep tree
-                for i in range(1, len(join_order)):
-                    current_table = join_order[i]
-                    prefix = tuple(join_order[:i])  # Ensure prefix is a tuple for dp_table key
-                    
-                    print(f"\n  Step {i}: Joining table {current_table} with prefix {prefix}")
-                    
-                    best_prefix_cost = float('inf')
-                    best_strategy = None
-                    
-                    # Find the join condition between the current table and any table in the prefix
-                    join_attrs = None
-                    join_table = None
-                    
-                    for prev_table in prefix:
-                        if (prev_table, current_table) in join_conditions:
-                            join_table = prev_table
-                            join_attrs = join_conditions[(prev_table, current_table)]
-                            print(f"    Found join condition: {prev_table}.{join_attrs[0]} = {current_table}.{join_attrs[1]}")
-                            break
-                        elif (current_table, prev_table) in join_conditions:
-                            join_table = prev_table
-                            join_attrs = join_conditions[(current_table, prev_table)]
-                            join_attrs = (join_attrs[1], join_attrs[0])  # Swap attributes
-                            print(f"    Found join condition (swapped): {prev_table}.{join_attrs[0]} = {current_table}.{join_attrs[1]}")
-                            break
-                    
-                    if not join_attrs:
-                        # No direct join condition found, try to find a transitive one
-                        print(f"    No join condition found for {current_table} with any table in {prefix}")
-                        # Skip for now, as transitive edges should be already added
-                        continue
-                    
-                    # Calculate selectivity
-                    selectivity = self.estimate_selectivity(join_table, current_table, join_attrs, method)
-                    print(f"    Estimated selectivity: {selectivity}")
-                    
-                    # Try each join strategy, but favor the preferred strategy for this method
-                    for strategy in strategy_preference:
-                        if i == 1:
-                            # Direct join between first two tables
-                            join_cost = self.estimate_join_cost(prefix[0], current_table, join_attrs, strategy, selectivity)
-                            
-                            # Adjust cost slightly to favor preferred strategies
-                            original_cost = join_cost
-                            if strategy == strategy_preference[0]:
-                                join_cost *= 0.9  # 10% discount for preferred strategy
-                            elif strategy == strategy_preference[1]:
-                                join_cost *= 0.95  # 5% discount for second preference
-                                
-                            print(f"    Strategy {strategy}: original cost = {original_cost}, adjusted cost = {join_cost}")
-                        else:
-                            # Cost of joining the result of previous joins with the current table
-                            prev_cost = dp_table[prefix]
-                            intermediate_rows = self.get_intermediate_result_size(prefix, join_conditions, method)
-                            
-                            strategy_cost = self.estimate_join_cost_with_intermediate(intermediate_rows, current_table, join_attrs, strategy, selectivity)
-                            join_cost = prev_cost + strategy_cost
-                            
-                            # Adjust cost slightly to favor preferred strategies
-                            original_cost = join_cost
-                            if strategy == strategy_preference[0]:
-                                join_cost *= 0.9  # 10% discount for preferred strategy
-                            elif strategy == strategy_preference[1]:
-                                join_cost *= 0.95  # 5% discount for second preference
-                            
-                            print(f"    Strategy {strategy}: prev_cost = {prev_cost}, strategy_cost = {strategy_cost}, original total = {original_cost}, adjusted total = {join_cost}")
-                        
-                        if join_cost < best_prefix_cost:
-                            best_prefix_cost = join_cost
-                            best_strategy = strategy
-                            print(f"    --> New best strategy: {best_strategy} with cost {best_prefix_cost}")
-                    
-                    next_prefix = tuple(join_order[:i+1])  # Ensure next_prefix is a tuple
-                    dp_table[next_prefix] = best_prefix_cost
-                    dp_strategies[next_prefix] = dp_strategies.get(prefix, []) + [best_strategy]
-                    
-                    print(f"    DP table entry: {next_prefix} = {best_prefix_cost}")
-                    print(f"    DP strategies entry: {next_prefix} = {dp_strategies[next_prefix]}")
-                
-                # Check if this join order is better than previous best
-                final_cost = dp_table.get(tuple(join_order), float('inf'))
-                print(f"\n  Final cost for join order {join_order}: {final_cost}")
+                final_cost, final_strategies, final_orders = self.cost_join_order(
+                    join_order, join_conditions, method, strategy_preference)
                 
                 if final_cost < best_cost:
                     best_cost = final_cost
                     best_order = join_order
-                    best_strategies = dp_strategies.get(tuple(join_order), [])
+                    best_strategies = final_strategies
+                    best_sort_orders = final_orders
                     print(f"  --> New best order with cost {best_cost}")
                 
             # Print final DP table summary for this method
@@ -1081,8 +1572,11 @@ class QueryOptimizer:
             best_plans[method] = {
                 'order': best_order,
                 'strategies': best_strategies,
+                'sort_orders': best_sort_orders,
                 'cost': best_cost
             }
+            if self.search_budget is not None:
+                best_plans[method]['search'] = search
         
         # Additional summary of all best plans
         print("\nFINAL BEST PLANS SUMMARY:")
@@ -1128,7 +1622,8 @@ class QueryOptimizer:
         for table in naive_order:
             try:
                 stats = self.get_table_statistics(table)
-                tables_costs[table] = stats['page_count'] * self.seq_page_cost + stats['row_count'] * self.cpu_tuple_cost
+                tables_costs[table] = stats['page_count'] * self.cost_calculator.page_cost(table, self.seq_page_cost) + \
+                    stats['row_count'] * self.cpu_tuple_cost
             except:
                 tables_costs[table] = 100  # Default
         
@@ -1265,7 +1760,21 @@ class QueryOptimizer:
         if not isinstance(rel_algebra_json, dict):
             print("[ERROR] Invalid relational algebra JSON format")
             return None
-        
+
+        if rel_algebra_json.get("type") == "with":
+            # There are no statistics for spools to order joins against, so a
+            # query over materialized CTEs keeps the join order it was written in
+            print("[INFO] Query reads materialized CTEs, keeping its join order")
+            plan_with_cost = copy.deepcopy(rel_algebra_json)
+            cost, _ = self.cost_calculator.calculate_cost(plan_with_cost)
+            return {
+                "naive_plan": rel_algebra_json,
+                "naive_cost": cost,
+                "best_plan": rel_algebra_json,
+                "best_cost": cost,
+                "scale": 1.0
+            }
+
         rel_algebra_json = self.alter_rel_json(rel_algebra_json)
         naive_order = copy.deepcopy(self.calculate_naive_cost(json.dumps(rel_algebra_json)))
         best_order = copy.deepcopy(self.optimize_join_query(json.dumps(rel_algebra_json)))
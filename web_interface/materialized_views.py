@@ -0,0 +1,563 @@
+import copy
+import json
+import math
+import os
+import subprocess
+import sys
+import tempfile
+
+from catalog import TPCH_DIR
+
+# Views are kept as <name>.tbl next to the data, described in this registry
+VIEW_REGISTRY_FILE = os.path.join(TPCH_DIR, 'materialized_views.json')
+PARSER = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'final_parser', 'sql_to_ra')
+PAGE_SIZE = 8192
+
+LITERAL_TYPES = ("int", "float", "string")
+
+
+def load_views(path=VIEW_REGISTRY_FILE):
+    """Load the view registry, or return {} if no view was created."""
+    if not os.path.exists(path):
+        return {}
+    with open(path) as f:
+        return json.load(f)
+
+
+def save_views(views, path=VIEW_REGISTRY_FILE):
+    with open(path, 'w') as f:
+        json.dump(views, f, indent=2)
+
+
+def view_statistics(name, path=VIEW_REGISTRY_FILE):
+    """Table statistics of a view, shaped like CostCalculator.get_table_statistics, or None."""
+    view = load_views(path).get(name.lower())
+    if view is None:
+        return None
+    return {
+        'row_count': view['row_count'],
+        'page_count': view['page_count'],
+        'table_size': view['page_count'] * PAGE_SIZE,
+        'columns': {}
+    }
+
+
+def view_column_types(path=VIEW_REGISTRY_FILE):
+    """Lowercase view name -> {lowercase column -> SQL type}, like catalog.load_column_types."""
+    return {name: {column.lower(): sql_type for column, sql_type in view['columns']}
+            for name, view in load_views(path).items()}
+
+
+def parse_sql(sql, cancellation=None):
+    """
+    Run the SQL parser on a query and return its relational algebra JSON.
+    With cancellation, a CancellationToken, the parser is killed once it is cancelled.
+    """
+    with tempfile.NamedTemporaryFile(mode='w', suffix='.sql', delete=False) as temp_file:
+        temp_file.write(sql)
+    try:
+        if cancellation is not None:
+            result = cancellation.run([PARSER, temp_file.name], "parsing")
+        else:
+            result = subprocess.run([PARSER, temp_file.name], capture_output=True, text=True, check=True)
+        return json.loads(result.stdout)
+    finally:
+        os.unlink(temp_file.name)
+
+
+# ------------------ Plan decomposition ------------------ #
+def split_conjuncts(condition):
+    if condition.get("type") == "AND":
+        return split_conjuncts(condition["left"]) + split_conjuncts(condition["right"])
+    return [condition]
+
+
+def is_column(operand):
+    return isinstance(operand, dict) and "attr" in operand and operand.get("type", "column") == "column"
+
+
+def referenced_columns(node):
+    """All (qualifier, ATTR) pairs referenced by a condition or column list."""
+    if isinstance(node, list):
+        return set().union(*[referenced_columns(item) for item in node]) if node else set()
+    if not isinstance(node, dict):
+        return set()
+    if is_column(node):
+        return {(node.get("table"), node["attr"].upper())}
+    return set().union(*[referenced_columns(value) for value in node.values()]) if node else set()
+
+
+def requalify(node, mapping):
+    """
+    Copy of a condition or column with every column reference passed
+    through mapping, a function from (qualifier, ATTR) to a new column dict.
+    """
+    if isinstance(node, list):
+        return [requalify(item, mapping) for item in node]
+    if not isinstance(node, dict):
+        return node
+    if is_column(node):
+        return {**node, **mapping((node.get("table"), node["attr"].upper()))}
+    return {key: requalify(value, mapping) for key, value in node.items()}
+
+
+def describe_spj(plan):
+    """
+    Break a select-project-join plan into its tables, conjuncts and output
+    columns, with every column qualified by its table's name instead of its
+    alias so that two plans can be compared.
+
+    Returns:
+        dict: tables (alias -> TABLE), aliases (TABLE -> alias), conjuncts,
+              columns, or None for other plans, self-joins and T.* outputs
+    """
+    tables = {}
+    conjuncts = []
+    columns = []
+
+    def visit(node):
+        node_type = node.get("type")
+        if node_type == "select":
+            conjuncts.extend(split_conjuncts(node["condition"]))
+            return visit(node["input"])
+        if node_type == "project":
+            if columns or any(column.get("attr") == "*" for column in node["columns"]):
+                return False
+            columns.extend(node["columns"])
+            return visit(node["input"])
+        if node_type == "join":
+            conjuncts.extend(split_conjuncts(node["condition"]))
+            return visit(node["left"]) and visit(node["right"])
+        if node_type == "base_relation" and len(node["tables"]) == 1:
+            table = node["tables"][0]
+            alias = table.get("alias", table["name"])
+            if alias in tables or table["name"].upper() in tables.values():
+                return False
+            tables[alias] = table["name"].upper()
+            return True
+        return False
+
+    if not visit(plan) or not columns:
+        return None
+
+    def by_table(column):
+        qualifier, attr = column
+        return {"table": tables.get(qualifier, qualifier), "attr": attr}
+
+    return {
+        "tables": tables,
+        "aliases": {name: alias for alias, name in tables.items()},
+        "conjuncts": conjuncts,
+        "normalized": [requalify(conjunct, by_table) for conjunct in conjuncts],
+        "columns": columns,
+    }
+
+
+def join_edge(conjunct):
+    """The two (TABLE, ATTR) columns an equi-join conjunct equates, or None."""
+    if conjunct.get("type") != "EQ" or not is_column(conjunct["left"]) or not is_column(conjunct["right"]):
+        return None
+    left = (conjunct["left"]["table"], conjunct["left"]["attr"].upper())
+    right = (conjunct["right"]["table"], conjunct["right"]["attr"].upper())
+    return (left, right) if left[0] != right[0] else None
+
+
+class ColumnClasses:
+    """Union-find over columns known to be equal through join conjuncts."""
+
+    def __init__(self, edges):
+        self.parent = {}
+        for a, b in edges:
+            self.parent[self.find(a)] = self.find(b)
+
+    def find(self, column):
+        self.parent.setdefault(column, column)
+        while self.parent[column] != column:
+            column = self.parent[column]
+        return column
+
+    def same(self, a, b):
+        return self.find(a) == self.find(b)
+
+
+# ------------------ Predicate subsumption ------------------ #
+def comparison_range(conjunct):
+    """
+    The values a comparison of a column with a literal lets through, as
+    (column, low, low_inclusive, high, high_inclusive, kind), or None.
+    """
+    cond_type = conjunct.get("type")
+    right = conjunct.get("right")
+    if cond_type not in ("EQ", "LT", "LE", "GT", "GE") or not is_column(conjunct.get("left")) \
+            or not isinstance(right, dict) or right.get("type") not in LITERAL_TYPES:
+        return None
+    column = (conjunct["left"]["table"], conjunct["left"]["attr"].upper())
+    kind = "string" if right["type"] == "string" else "number"
+    value = right["value"]
+    return {
+        "EQ": (column, value, True, value, True, kind),
+        "LT": (column, None, False, value, False, kind),
+        "LE": (column, None, False, value, True, kind),
+        "GT": (column, value, False, None, False, kind),
+        "GE": (column, value, True, None, False, kind),
+    }[cond_type]
+
+
+def implies(query_conjunct, view_conjunct):
+    """Check whether every row passing query_conjunct also passes view_conjunct."""
+    if query_conjunct == view_conjunct:
+        return True
+
+    if view_conjunct.get("type") == "IN" and is_column(view_conjunct["left"]):
+        allowed = {json.dumps(value, sort_keys=True) for value in view_conjunct["right"]["values"]}
+        column = view_conjunct["left"]
+        if query_conjunct.get("type") == "EQ" and query_conjunct.get("left") == column:
+            return json.dumps(query_conjunct["right"], sort_keys=True) in allowed
+        if query_conjunct.get("type") == "IN" and query_conjunct.get("left") == column:
+            return all(json.dumps(value, sort_keys=True) in allowed
+                       for value in query_conjunct["right"]["values"])
+        return False
+
+    q = comparison_range(query_conjunct)
+    v = comparison_range(view_conjunct)
+    if q is None or v is None or q[0] != v[0] or q[5] != v[5]:
+        return False
+
+    _, q_low, q_low_inc, q_high, q_high_inc, _ = q
+    _, v_low, v_low_inc, v_high, v_high_inc, _ = v
+    if v_low is not None:
+        if q_low is None or q_low < v_low or (q_low == v_low and q_low_inc and not v_low_inc):
+            return False
+    if v_high is not None:
+        if q_high is None or q_high > v_high or (q_high == v_high and q_high_inc and not v_high_inc):
+            return False
+    return True
+
+
+# ------------------ View matching ------------------ #
+def view_outputs(view_spj, view_name):
+    """
+    Map the columns a view makes available to the view's output columns.
+
+    Returns:
+        tuple: ({(TABLE, ATTR) -> output name}, {serialized expression -> output name})
+    """
+    columns = {}
+    expressions = {}
+    for i, column in enumerate(view_spj["columns"]):
+        output = column.get("alias", column.get("attr", f"EXPR{i}")).upper()
+        if "expr" in column:
+            qualified = requalify(column["expr"], lambda c: {"table": view_spj["tables"].get(c[0], c[0]),
+                                                             "attr": c[1]})
+            expressions[json.dumps(qualified, sort_keys=True)] = output
+        else:
+            columns[(view_spj["tables"][column["table"]], column["attr"].upper())] = output
+    return columns, expressions
+
+
+def match_view(query_spj, view_name, view):
+    """
+    Rewrite a query to read a materialized view instead of some of its
+    tables, if the view holds every row and column the query needs from them.
+
+    The view's tables must all appear in the query, each of the view's join
+    equalities must follow from the query's, and each of its filters must be
+    implied by a filter of the query. Query joins and filters over the view's
+    tables that the view does not already apply are kept as a compensating
+    select over the view.
+
+    Returns:
+        dict: Rewritten plan JSON, or None if the view cannot answer the query
+    """
+    view_spj = describe_spj(view["plan"])
+    if view_spj is None:
+        return None
+    view_tables = set(view_spj["tables"].values())
+    query_tables = query_spj["aliases"]
+    if not view_tables <= set(query_tables):
+        return None
+
+    query_edges = [edge for edge in map(join_edge, query_spj["normalized"]) if edge]
+    view_edges = [edge for edge in map(join_edge, view_spj["normalized"]) if edge]
+    query_classes = ColumnClasses(query_edges)
+    view_classes = ColumnClasses(view_edges)
+    if not all(query_classes.same(a, b) for a, b in view_edges):
+        return None
+
+    # Every filter of the view must be implied by one of the query
+    view_filters = [c for c in view_spj["normalized"] if join_edge(c) is None]
+    query_filters = [c for c in query_spj["normalized"] if join_edge(c) is None]
+    for view_filter in view_filters:
+        if not any(implies(query_filter, view_filter) for query_filter in query_filters):
+            return None
+
+    kept = []
+    for original, normalized in zip(query_spj["conjuncts"], query_spj["normalized"]):
+        tables = {table for table, _ in referenced_columns(normalized)}
+        if not tables <= view_tables:
+            kept.append(original)
+            continue
+        edge = join_edge(normalized)
+        if edge is not None and view_classes.same(*edge):
+            continue  # The view joined on it already
+        if edge is None and normalized in view_filters:
+            continue  # The view filtered on it already
+        kept.append(original)
+
+    # Every reference to a view table must resolve to one of its outputs,
+    # directly or through a column the view joined it with
+    outputs, expressions = view_outputs(view_spj, view_name)
+    view_alias = view_name.upper()
+
+    def output_for(column):
+        if column in outputs:
+            return outputs[column]
+        for available, output in outputs.items():
+            if view_classes.same(available, column):
+                return output
+        return None
+
+    def to_view(column):
+        qualifier, attr = column
+        table = query_spj["tables"].get(qualifier, qualifier)
+        if table not in view_tables:
+            return {"table": qualifier, "attr": attr}
+        return {"table": view_alias, "attr": output_for((table, attr))}
+
+    needed = referenced_columns(kept) | referenced_columns(query_spj["columns"])
+    for qualifier, attr in needed:
+        table = query_spj["tables"].get(qualifier, qualifier)
+        if table in view_tables and output_for((table, attr)) is None:
+            return None
+
+    columns = []
+    for column in query_spj["columns"]:
+        if "expr" in column:
+            qualified = requalify(column["expr"], lambda c: {"table": query_spj["tables"].get(c[0], c[0]),
+                                                             "attr": c[1]})
+            key = json.dumps(qualified, sort_keys=True)
+            if key in expressions:
+                # The view computed it already
+                columns.append({"table": view_alias, "attr": expressions[key],
+                                "alias": column.get("alias", expressions[key])})
+            else:
+                columns.append(requalify(column, to_view))
+            continue
+        mapped = requalify(column, to_view)
+        if mapped["attr"] != column["attr"].upper() and "alias" not in mapped:
+            mapped["alias"] = column["attr"]
+        columns.append(mapped)
+
+    # Join the view with the remaining tables in their original order
+    current = {"type": "base_relation", "tables": [{"name": view_alias, "alias": view_alias}]}
+    joined = {view_alias}
+    pending = [requalify(conjunct, to_view) for conjunct in kept]
+    remaining = [alias for alias, table in query_spj["tables"].items() if table not in view_tables]
+    while remaining:
+        for alias in remaining:
+            condition = next((c for c in pending if join_edge(c) and
+                              {c["left"]["table"], c["right"]["table"]} <= joined | {alias} and
+                              alias in (c["left"]["table"], c["right"]["table"])), None)
+            if condition is not None:
+                break
+        else:
+            return None  # Would need a cross join
+        pending.remove(condition)
+        right = {"type": "base_relation", "tables": [{"name": query_spj["tables"][alias], "alias": alias}]}
+        current = {"type": "join", "condition": condition, "left": current, "right": right}
+        joined.add(alias)
+        remaining.remove(alias)
+
+    plan = {"type": "project", "columns": columns, "input": current}
+    if pending:
+        condition = pending[0]
+        for conjunct in pending[1:]:
+            condition = {"type": "AND", "left": condition, "right": conjunct}
+        plan = {"type": "select", "condition": condition, "input": plan}
+    return plan
+
+
+def rewrite_with_views(plan, cost_calculator=None, path=VIEW_REGISTRY_FILE):
+    """
+    Substitute materialized views into a plan wherever one can answer part
+    of it. With a cost calculator, a rewrite is only kept if it is cheaper
+    than the plan it replaces, and the cheapest of several candidates wins;
+    otherwise the first matching view is used. Views are substituted until
+    none applies, so a query can read several of them.
+
+    Args:
+        plan (dict): Plan JSON from the parser
+        cost_calculator (CostCalculator): Used to compare the rewrites, optional
+        path (str): View registry
+
+    Returns:
+        dict: The rewritten plan, or the plan itself
+    """
+    views = load_views(path)
+    if not views:
+        return plan
+
+    if plan.get("type") == "with":
+        return {**plan,
+                "ctes": [{**cte, "query": rewrite_with_views(cte["query"], cost_calculator, path)}
+                         for cte in plan["ctes"]],
+                "input": rewrite_with_views(plan["input"], cost_calculator, path)}
+
+    def cost(candidate):
+        return cost_calculator.calculate_cost(copy.deepcopy(candidate))[0]
+
+    best_cost = cost(plan) if cost_calculator is not None else None
+    while True:
+        query_spj = describe_spj(plan)
+        if query_spj is None:
+            return plan
+
+        best = None
+        for name, view in views.items():
+            rewritten = match_view(query_spj, name, view)
+            if rewritten is None:
+                continue
+            if cost_calculator is None:
+                best = rewritten
+                print(f"Answering the query from materialized view {name}")
+                break
+            rewritten_cost = cost(rewritten)
+            print(f"Materialized view {name}: cost {rewritten_cost} against {best_cost}")
+            if rewritten_cost < best_cost:
+                best, best_cost = rewritten, rewritten_cost
+
+        if best is None:
+            return plan
+        plan = best
+
+
+# ------------------ Registry maintenance ------------------ #
+def infer_type(values):
+    if all(isinstance(value, int) for value in values):
+        return "INTEGER"
+    if all(isinstance(value, (int, float)) for value in values):
+        return "DECIMAL"
+    return "VARCHAR"
+
+
+def write_rows(data_file, rows, mode):
+    with open(data_file, mode) as f:
+        for row in rows:
+            f.write('|'.join(str(value) for value in row) + '|\n')
+
+
+def file_pages(data_file):
+    return max(1, math.ceil(os.path.getsize(data_file) / PAGE_SIZE))
+
+
+def create_view(name, sql, data_dir=TPCH_DIR, path=VIEW_REGISTRY_FILE):
+    """
+    Define a materialized view from a select-project-join query, compute it
+    over the .tbl files and store its rows as <name>.tbl in data_dir.
+    """
+    from executor import Executor
+
+    name = name.lower()
+    plan = parse_sql(sql)
+    if describe_spj(plan) is None:
+        raise ValueError("Materialized views must be select-project-join queries without self-joins or T.*")
+
+    result = Executor(data_dir).execute(plan)
+    names = [column_name.upper() for _, column_name in result.columns]
+    if len(set(names)) != len(names):
+        raise ValueError(f"Output columns of view {name} must have distinct names: {names}")
+
+    rows = list(result.rows)
+    data_file = os.path.join(data_dir, f"{name}.tbl")
+    write_rows(data_file, rows, 'w')
+
+    vectors = list(zip(*rows)) if rows else [[] for _ in names]
+    views = load_views(path)
+    views[name] = {
+        "sql": sql,
+        "plan": plan,
+        "columns": [[column, infer_type(vector)] for column, vector in zip(names, vectors)],
+        "row_count": len(rows),
+        "page_count": file_pages(data_file),
+    }
+    save_views(views, path)
+    print(f"Created materialized view {name}: {len(rows)} rows")
+    return views[name]
+
+
+def append_rows(table, delta_file, data_dir=TPCH_DIR, path=VIEW_REGISTRY_FILE):
+    """
+    Append new rows, such as a TPC-H refresh set, to a base table and bring
+    the views over it up to date without recomputing them.
+
+    Since views have no self-joins, each reads the table once, and the rows
+    a view gains are its own query with the table replaced by just the new
+    rows (the delta rule dV = V(R1..dRi..Rn)). The other inputs are read as
+    they are, so appending to several tables one after the other also
+    picks up the matches between their new rows.
+
+    Args:
+        table (str): Table the rows belong to
+        delta_file (str): New rows in .tbl format
+        data_dir (str): Directory with the table and view .tbl files
+        path (str): View registry
+
+    Returns:
+        dict: View name -> number of rows it gained
+    """
+    from executor import Executor
+
+    table = table.lower()
+    views = load_views(path)
+    dependents = [name for name, view in views.items()
+                  if table.upper() in describe_spj(view["plan"])["tables"].values()]
+
+    executor = Executor(data_dir, sources={table: delta_file})
+    view_deltas = {name: list(executor.execute(views[name]["plan"]).rows) for name in dependents}
+
+    # Extend the table only once every delta is known, so that a failure
+    # leaves the table and its views consistent
+    with open(delta_file) as f:
+        new_rows = f.read()
+    with open(os.path.join(data_dir, f"{table}.tbl"), 'a') as f:
+        f.write(new_rows)
+
+    for name, rows in view_deltas.items():
+        data_file = os.path.join(data_dir, f"{name}.tbl")
+        write_rows(data_file, rows, 'a')
+        views[name]["row_count"] += len(rows)
+        views[name]["page_count"] = file_pages(data_file)
+        print(f"Materialized view {name}: {len(rows)} new rows")
+    save_views(views, path)
+    return {name: len(rows) for name, rows in view_deltas.items()}
+
+
+def drop_view(name, data_dir=TPCH_DIR, path=VIEW_REGISTRY_FILE):
+    views = load_views(path)
+    if views.pop(name.lower(), None) is None:
+        raise ValueError(f"No materialized view named {name}")
+    save_views(views, path)
+    data_file = os.path.join(data_dir, f"{name.lower()}.tbl")
+    if os.path.exists(data_file):
+        os.unlink(data_file)
+
+
+if __name__ == "__main__":
+    # Usage: python3 materialized_views.py create <name> "<select ...>" [data_dir]
+    #        python3 materialized_views.py refresh <name> [data_dir]
+    #        python3 materialized_views.py append <table> <rows.tbl> [data_dir]
+    #        python3 materialized_views.py drop <name> [data_dir]
+    #        python3 materialized_views.py list
+    command = sys.argv[1] if len(sys.argv) > 1 else 'list'
+    if command == 'create':
+        create_view(sys.argv[2], sys.argv[3], sys.argv[4] if len(sys.argv) > 4 else TPCH_DIR)
+    elif command == 'refresh':
+        create_view(sys.argv[2], load_views()[sys.argv[2].lower()]["sql"],
+                    sys.argv[3] if len(sys.argv) > 3 else TPCH_DIR)
+    elif command == 'append':
+        append_rows(sys.argv[2], sys.argv[3], sys.argv[4] if len(sys.argv) > 4 else TPCH_DIR)
+    elif command == 'drop':
+        drop_view(sys.argv[2], sys.argv[3] if len(sys.argv) > 3 else TPCH_DIR)
+    else:
+        for name, view in load_views().items():
+            print(f"{name}: {view['row_count']} rows, {view['page_count']} pages -- {view['sql']}")
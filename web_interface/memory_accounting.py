@@ -0,0 +1,322 @@
+"""
+Memory Accounting and Admission Control
+
+Every query run by the executor can carry a MemoryTracker that its
+operators charge: the rows each operator materializes, hash join tables and
+spools (materialized CTEs and common expressions). A tracker has two limits.
+Its grant is what admission control reserved for the query; a hash join
+whose table would not fit in it switches to a partitioned join that spills
+to disk. Its hard limit is the per-query budget, past which operators that
+cannot spill fail the query.
+
+The AdmissionController reserves memory for queries from a global pool
+based on the optimizer's estimate of their peak memory. Queries queue in
+arrival order while their estimate does not fit, and queries estimated above
+the per-query budget are admitted with the budget and run spilling. An
+operator that cannot spill and needs more than its query's grant reserves
+the difference from the pool, and fails the query when the pool has none
+left, so that concurrent queries together never exceed the pool.
+"""
+
+import argparse
+import copy
+import itertools
+import json
+import sys
+import threading
+import time
+from contextlib import contextmanager
+
+from catalog import TPCH_DIR
+
+DEFAULT_POOL_BYTES = 1024 * 1024 * 1024
+DEFAULT_QUERY_BUDGET_BYTES = 256 * 1024 * 1024
+
+# Memory of a TPC-H tuple held in Python, and of a hash table entry on top of it
+ESTIMATED_ROW_BYTES = 500
+HASH_ENTRY_BYTES = 120
+
+# Plan nodes whose output the executor materializes
+OPERATOR_TYPES = ("base_relation", "select", "project", "join", "subquery")
+
+
+class MemoryBudgetExceeded(Exception):
+    pass
+
+
+def rows_bytes(rows, sample=64):
+    """Estimate the memory held by a list of row tuples from a sample of them."""
+    if not rows:
+        return sys.getsizeof(rows)
+    step = max(1, len(rows) // sample)
+    sampled = rows[::step][:sample]
+    per_row = sum(sys.getsizeof(row) + sum(sys.getsizeof(value) for value in row) for row in sampled) / len(sampled)
+    return int(sys.getsizeof(rows) + per_row * len(rows))
+
+
+def hash_table_bytes(rows):
+    return rows_bytes(rows) + HASH_ENTRY_BYTES * len(rows)
+
+
+class MemoryTracker:
+    """
+    Memory charged by the operators of one query.
+
+    Args:
+        grant (int): Bytes reserved for the query; spillable operators stay within it
+        hard_limit (int): Bytes the query may never exceed
+        pool (AdmissionController): Pool the grant was reserved from, which
+                                    charges past the grant reserve from too
+    """
+
+    def __init__(self, grant, hard_limit, pool=None):
+        self.grant = grant
+        self.hard_limit = hard_limit
+        self.pool = pool
+        self.reserved = grant
+        self.current = 0
+        self.peak = 0
+        self.by_operator = {}
+        self.lock = threading.Lock()
+        self.stats = {"spills": 0, "spilled_bytes": 0}
+
+    def _add(self, operator, nbytes):
+        self.current += nbytes
+        self.peak = max(self.peak, self.current)
+        self.by_operator[operator] = self.by_operator.get(operator, 0) + nbytes
+
+    def try_charge(self, operator, nbytes):
+        """Charge a spillable operator, or return False if it would exceed the grant."""
+        with self.lock:
+            if self.current + nbytes > self.reserved:
+                return False
+            self._add(operator, nbytes)
+            return True
+
+    def charge(self, operator, nbytes):
+        """Charge an operator that cannot spill; fails the query past the hard limit."""
+        with self.lock:
+            if self.current + nbytes > self.hard_limit:
+                raise MemoryBudgetExceeded(
+                    f"{operator} needs {nbytes} bytes with {self.current} in use, "
+                    f"over the query's {self.hard_limit} byte budget")
+            extra = self.current + nbytes - self.reserved
+            if extra > 0:
+                if self.pool is not None and not self.pool.reserve_extra(extra):
+                    raise MemoryBudgetExceeded(
+                        f"{operator} needs {nbytes} bytes with {self.current} in use, "
+                        f"over the query's {self.reserved} byte reservation and the pool has no room left")
+                self.reserved += extra
+            self._add(operator, nbytes)
+
+    def release(self, operator, nbytes):
+        with self.lock:
+            self.current -= nbytes
+            self.by_operator[operator] -= nbytes
+            # Memory reserved past the grant goes back to the pool once freed
+            surplus = self.reserved - max(self.current, self.grant)
+            if surplus > 0:
+                self.reserved -= surplus
+                if self.pool is not None:
+                    self.pool.return_extra(surplus)
+
+    def available(self):
+        with self.lock:
+            return max(0, self.reserved - self.current)
+
+    def count_spill(self, nbytes):
+        with self.lock:
+            self.stats["spills"] += 1
+            self.stats["spilled_bytes"] += nbytes
+
+    def summary(self):
+        with self.lock:
+            return {"grant": self.grant, "hard_limit": self.hard_limit, "reserved": self.reserved,
+                    "current": self.current, "peak": self.peak, **self.stats}
+
+
+def estimate_peak_memory(plan, cost_calculator=None):
+    """
+    Estimate the peak memory of a plan from the optimizer's cardinalities:
+    the output of every operator, the hash table built on the right input of
+    every join and every spool. The executor materializes most operators,
+    so all of these may be alive at once.
+
+    Args:
+        plan (dict): Plan JSON, or the common_expressions/query output of
+                     QueryTreeOptimizer
+        cost_calculator (CostCalculator): Used to estimate cardinalities; when
+                                          omitted, those the plan was
+                                          annotated with are used
+
+    Returns:
+        int: Estimated bytes, or None without a cost_calculator when an
+             operator of the plan has no cardinality
+    """
+    if cost_calculator is not None:
+        plan = copy.deepcopy(plan)
+        if "common_expressions" in plan:
+            cost_calculator.calc_subseq_cost(plan)
+        else:
+            cost_calculator.calculate_cost(plan)
+    if "common_expressions" in plan:
+        spools = sum(expr.get("cardinality", 0) for expr in plan["common_expressions"].values())
+        query = plan["query"]
+    else:
+        spools = 0
+        query = plan
+
+    if cost_calculator is None:
+        def annotated(node):
+            if isinstance(node, list):
+                return all(annotated(item) for item in node)
+            if not isinstance(node, dict):
+                return True
+            if node.get("type") in OPERATOR_TYPES and "cardinality" not in node:
+                return False
+            return all(annotated(value) for value in node.values())
+        if not annotated(query):
+            return None
+
+    def walk(node):
+        if isinstance(node, list):
+            return sum(walk(item) for item in node)
+        if not isinstance(node, dict):
+            return 0
+        total = sum(walk(value) for value in node.values())
+        if node.get("type") in OPERATOR_TYPES:
+            total += node.get("cardinality", 0) * ESTIMATED_ROW_BYTES
+        if node.get("type") == "join":
+            total += node["right"].get("cardinality", 0) * (ESTIMATED_ROW_BYTES + HASH_ENTRY_BYTES)
+        elif node.get("type") == "with":
+            total += sum(cte.get("cardinality", 0) for cte in node["ctes"]) * ESTIMATED_ROW_BYTES
+        return total
+
+    return int(walk(query) + spools * ESTIMATED_ROW_BYTES)
+
+
+class AdmissionController:
+    """
+    Global memory pool shared by concurrently running queries.
+
+    Args:
+        pool_bytes (int): Memory all admitted queries may reserve together
+        query_budget_bytes (int): Most memory one query may use
+    """
+
+    def __init__(self, pool_bytes=DEFAULT_POOL_BYTES, query_budget_bytes=DEFAULT_QUERY_BUDGET_BYTES):
+        self.pool_bytes = pool_bytes
+        self.query_budget_bytes = min(query_budget_bytes, pool_bytes)
+        self.reserved = 0
+        self.tickets = itertools.count()
+        self.serving = 0
+        self.condition = threading.Condition()
+        self.stats = {"admitted": 0, "queued": 0, "spilling": 0, "peak_reserved": 0, "wait_seconds": 0.0,
+                      "extra_reserved": 0, "extra_denied": 0}
+
+    @contextmanager
+    def admit(self, estimated_bytes):
+        """
+        Wait until the query's memory can be reserved, in arrival order, and
+        yield the MemoryTracker to run it with.
+
+        Args:
+            estimated_bytes (int): Estimated peak memory of the query
+        """
+        spilling = estimated_bytes > self.query_budget_bytes
+        grant = min(max(estimated_bytes, 1), self.query_budget_bytes)
+
+        start = time.perf_counter()
+        with self.condition:
+            ticket = next(self.tickets)
+            queued = False
+            while ticket != self.serving or self.reserved + grant > self.pool_bytes:
+                queued = True
+                self.condition.wait()
+            self.serving += 1
+            self.reserved += grant
+            self.stats["admitted"] += 1
+            self.stats["queued"] += queued
+            self.stats["spilling"] += spilling
+            self.stats["peak_reserved"] = max(self.stats["peak_reserved"], self.reserved)
+            self.stats["wait_seconds"] += time.perf_counter() - start
+            # The next query in line may fit as well
+            self.condition.notify_all()
+
+        tracker = MemoryTracker(grant, self.query_budget_bytes, pool=self)
+        try:
+            yield tracker
+        finally:
+            with tracker.lock, self.condition:
+                self.reserved -= tracker.reserved
+                tracker.reserved = 0
+                self.condition.notify_all()
+
+    def reserve_extra(self, nbytes):
+        """
+        Reserve memory for an admitted query past its grant, without waiting,
+        since the query holds memory while it asks. Returns False if the pool
+        has no room for it.
+        """
+        with self.condition:
+            if self.reserved + nbytes > self.pool_bytes:
+                self.stats["extra_denied"] += 1
+                return False
+            self.reserved += nbytes
+            self.stats["extra_reserved"] += nbytes
+            self.stats["peak_reserved"] = max(self.stats["peak_reserved"], self.reserved)
+            return True
+
+    def return_extra(self, nbytes):
+        with self.condition:
+            self.reserved -= nbytes
+            self.condition.notify_all()
+
+    def summary(self):
+        with self.condition:
+            return {**self.stats, "reserved": self.reserved, "pool_bytes": self.pool_bytes,
+                    "query_budget_bytes": self.query_budget_bytes}
+
+
+if __name__ == "__main__":
+    from cost_populator import CostCalculator
+    from executor import Executor
+
+    parser = argparse.ArgumentParser(description="Run plans concurrently under admission control")
+    parser.add_argument("plans", nargs="+", help="Plan JSON files")
+    parser.add_argument("--data-dir", default=TPCH_DIR, help="Directory containing the .tbl files")
+    parser.add_argument("--pool-mb", type=float, default=DEFAULT_POOL_BYTES / 2 ** 20)
+    parser.add_argument("--query-budget-mb", type=float, default=DEFAULT_QUERY_BUDGET_BYTES / 2 ** 20)
+    parser.add_argument("--copies", type=int, default=2, help="Concurrent runs of each plan")
+    args = parser.parse_args()
+
+    cost_calculator = CostCalculator({'dbname': 'temp', 'user': 'postgres', 'password': 'postgres',
+                                      'host': 'localhost', 'port': '5432'})
+    cost_calculator.connect()
+    controller = AdmissionController(int(args.pool_mb * 2 ** 20), int(args.query_budget_mb * 2 ** 20))
+
+    plans = []
+    for path in args.plans:
+        with open(path) as f:
+            plan = json.load(f)
+        # Annotate the plan so that the executor admits it on its cardinalities
+        if "common_expressions" in plan:
+            cost_calculator.calc_subseq_cost(plan)
+        else:
+            cost_calculator.calculate_cost(plan)
+        plans.append((path, plan, estimate_peak_memory(plan)))
+
+    report = []
+
+    def run(path, plan, estimate):
+        executor = Executor(args.data_dir, admission=controller)
+        rows = len(executor.execute(plan).rows)
+        report.append({"plan": path, "estimated_bytes": estimate, "rows": rows,
+                       **executor.stats["memory_tracker"]})
+
+    threads = [threading.Thread(target=run, args=entry) for entry in plans for _ in range(args.copies)]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    print(json.dumps({"queries": report, "admission": controller.summary()}, indent=2))
@@ -0,0 +1,191 @@
+"""
+Multi-Query Optimization
+
+Optimizes a batch of statements together. Each statement goes through
+predicate pushdown, and the plans are then combined under one batch node so
+that common subexpression elimination finds the filtered scans and joins
+they share. The result is a global plan DAG in which every shared node is
+computed once into a spool read by all the queries that need it.
+"""
+
+import argparse
+import copy
+import json
+import re
+
+from catalog import TPCH_DIR
+from executor import Executor, count_expr_references
+from materialized_views import parse_sql
+from predicate_pushdown import optimize_query_plan
+from subsequence_elim import QueryTreeOptimizer
+
+
+def split_statements(sql):
+    """
+    Split a workload into statements, on semicolons when it has any and
+    otherwise on blank lines, as in queries.sql. Comment lines are dropped.
+    """
+    lines = [line for line in sql.splitlines() if not line.strip().startswith('--')]
+    text = '\n'.join(lines)
+    parts = text.split(';') if ';' in text else re.split(r'\n\s*\n', text)
+    return [part.strip() + ';' for part in parts if part.strip()]
+
+
+def table_aliases(node, aliases):
+    if isinstance(node, list):
+        for item in node:
+            table_aliases(item, aliases)
+    elif isinstance(node, dict):
+        if node.get("type") == "base_relation":
+            for table in node["tables"]:
+                aliases.append((table.get("alias", table["name"]), table["name"]))
+        for value in node.values():
+            table_aliases(value, aliases)
+    return aliases
+
+
+def normalize_plan(plan, prefix):
+    """
+    Rewrite a query's plan so that equal subplans of different queries
+    serialize the same: tables read once are referred to by their name
+    rather than the query's alias for them. CTE names get a per-query prefix,
+    since two queries may give the same name to different CTEs.
+    """
+    aliases = table_aliases(plan, [])
+    names = [name for _, name in aliases]
+    renamed = {alias: name for alias, name in aliases if names.count(name) == 1}
+
+    def rewrite(node):
+        if isinstance(node, list):
+            return [rewrite(item) for item in node]
+        if not isinstance(node, dict):
+            return node
+        node_type = node.get("type")
+        if node_type == "base_relation":
+            return {**node, "tables": [{**table, "alias": renamed.get(table.get("alias", table["name"]),
+                                                                      table.get("alias", table["name"]))}
+                                       for table in node["tables"]]}
+        if node_type == "with":
+            return {**node,
+                    "ctes": [{**cte, "name": prefix + cte["name"], "query": rewrite(cte["query"])}
+                             for cte in node["ctes"]],
+                    "input": rewrite(node["input"])}
+        if node_type == "cte_ref":
+            return {**node, "name": prefix + node["name"]}
+        if "attr" in node and node.get("table") in renamed:
+            return {**node, "table": renamed[node["table"]]}
+        return {key: rewrite(value) for key, value in node.items()}
+
+    return rewrite(plan)
+
+
+# Node types that can be computed once into a spool
+RELATIONAL = ("select", "project", "join", "base_relation", "subquery")
+
+
+def inline_expr(node, expr_id, expr):
+    if isinstance(node, list):
+        return [inline_expr(item, expr_id, expr) for item in node]
+    if not isinstance(node, dict):
+        return node
+    if node.get("type") == "expr_ref" and node["id"] == expr_id:
+        return copy.deepcopy(expr)
+    return {key: inline_expr(value, expr_id, expr) for key, value in node.items()}
+
+
+def keep_shared_relations(global_plan):
+    """
+    Restrict a common subexpression plan to the relations worth a spool:
+    shared conditions go back inline, and expressions left without readers
+    (those only found inside a larger shared expression) are dropped.
+    """
+    query = global_plan["query"]
+    exprs = dict(global_plan["common_expressions"])
+    for expr_id, expr in list(exprs.items()):
+        if expr["type"] not in RELATIONAL:
+            del exprs[expr_id]
+            query = inline_expr(query, expr_id, expr)
+            exprs = {other: inline_expr(definition, expr_id, expr) for other, definition in exprs.items()}
+
+    while True:
+        readers = [query] + list(exprs.values())
+        unread = [expr_id for expr_id in exprs if not count_expr_references(readers, expr_id)]
+        if not unread:
+            return {**global_plan, "common_expressions": exprs, "query": query}
+        for expr_id in unread:
+            del exprs[expr_id]
+
+
+def optimize_batch(statements, cost_calculator):
+    """
+    Optimize a batch of queries into one plan that evaluates their shared
+    subexpressions once.
+
+    Args:
+        statements (list): SQL statements
+        cost_calculator (CostCalculator): Used for pushdown and costing
+
+    Returns:
+        dict: The optimized plan of each query, the global plan (common_expressions
+              and a batch query), its cost, the cost of running the queries
+              independently, and the shared expressions with their readers
+    """
+    plans = []
+    independent_costs = []
+    for i, statement in enumerate(statements):
+        pushed = optimize_query_plan(json.dumps(parse_sql(statement)), cost_calculator)["optimized_plan_json"]
+        plan = normalize_plan(pushed, f"q{i}_")
+        plans.append(plan)
+        independent_costs.append(cost_calculator.calculate_cost(copy.deepcopy(plan))[0])
+    independent_cost = sum(independent_costs)
+
+    batch = {"type": "batch", "queries": plans}
+    global_plan = keep_shared_relations(QueryTreeOptimizer().optimize_and_cleanup(batch))
+    shared = {expr_id: [i for i, query in enumerate(global_plan["query"]["queries"])
+                        if count_expr_references(query, expr_id)]
+              for expr_id in global_plan["common_expressions"]}
+
+    if global_plan["common_expressions"]:
+        batch_cost, _ = cost_calculator.calc_subseq_cost(copy.deepcopy(global_plan))
+    else:
+        batch_cost = independent_cost
+
+    # Sharing costs spool writes and reads; never do worse than running alone
+    if batch_cost >= independent_cost:
+        global_plan = {"common_expressions": {}, "query": batch}
+        shared = {}
+        batch_cost = independent_cost
+
+    return {
+        "plans": plans,
+        "global_plan": global_plan,
+        "shared_expressions": shared,
+        "query_costs": independent_costs,
+        "independent_cost": independent_cost,
+        "batch_cost": batch_cost,
+    }
+
+
+if __name__ == "__main__":
+    from cost_populator import CostCalculator
+
+    parser = argparse.ArgumentParser(description="Optimize and run a batch of SQL statements together")
+    parser.add_argument("workload", help="File of SQL statements")
+    parser.add_argument("--run", action="store_true", help="Execute the batch plan over the .tbl files")
+    parser.add_argument("--data-dir", default=TPCH_DIR, help="Directory containing the .tbl files")
+    args = parser.parse_args()
+
+    with open(args.workload) as f:
+        statements = split_statements(f.read())
+
+    cost_calculator = CostCalculator({'dbname': 'temp', 'user': 'postgres', 'password': 'postgres',
+                                      'host': 'localhost', 'port': '5432'})
+    cost_calculator.connect()
+    result = optimize_batch(statements, cost_calculator)
+    print(json.dumps({key: result[key] for key in ("shared_expressions", "query_costs",
+                                                    "independent_cost", "batch_cost")}, indent=2))
+
+    if args.run:
+        executor = Executor(args.data_dir)
+        outputs = executor.execute_batch(result["global_plan"])
+        print(json.dumps({"rows": [len(output.rows) for output in outputs], **executor.stats}, indent=2))
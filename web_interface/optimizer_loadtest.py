@@ -0,0 +1,97 @@
+"""
+Load test for optimizer_server.py: runs an increasing number of concurrent
+clients against a running server and reports latency percentiles and
+throughput at each concurrency. Each client keeps up to --pipeline requests
+in flight on its connection.
+"""
+
+import argparse
+import json
+import socket
+import statistics
+import threading
+import time
+
+from optimizer_server import DEFAULT_SOCKET
+
+
+def connect(unix_path, port):
+    if port is not None:
+        return socket.create_connection(("127.0.0.1", port))
+    connection = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    connection.connect(unix_path)
+    return connection
+
+
+def run_client(args, request, count, latencies, errors):
+    sent = {}
+    window = threading.Semaphore(args.pipeline)
+    lock = threading.Lock()
+
+    with connect(args.unix, args.port) as connection, connection.makefile('rb') as reader:
+        def receive():
+            for _ in range(count):
+                response = json.loads(reader.readline())
+                with lock:
+                    latencies.append(time.perf_counter() - sent.pop(response["id"]))
+                    if not response["ok"]:
+                        errors.append(response["error"])
+                window.release()
+
+        receiver = threading.Thread(target=receive)
+        receiver.start()
+        for i in range(count):
+            window.acquire()
+            with lock:
+                sent[i] = time.perf_counter()
+            connection.sendall((json.dumps({**request, "id": i}) + "\n").encode())
+        receiver.join()
+
+
+def percentile(values, fraction):
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(fraction * len(ordered)))]
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Measure optimizer server latency versus concurrency")
+    parser.add_argument("sql", help="File with the SQL query to send")
+    parser.add_argument("--unix", default=DEFAULT_SOCKET, help="Server Unix socket path")
+    parser.add_argument("--port", type=int, help="Server localhost TCP port, instead of the socket")
+    parser.add_argument("--op", default="optimize", choices=["parse", "optimize", "cost"])
+    parser.add_argument("--concurrency", default="1,2,4,8,16", help="Comma-separated client counts")
+    parser.add_argument("--requests", type=int, default=200, help="Requests per client")
+    parser.add_argument("--pipeline", type=int, default=1, help="Requests in flight per connection")
+    args = parser.parse_args()
+
+    with open(args.sql) as f:
+        sql = f.read()
+    request = {"op": args.op, "sql": sql}
+    if args.op == "cost":
+        # Cost the parsed plan, which the server returns for a parse request
+        with connect(args.unix, args.port) as connection, connection.makefile('rb') as reader:
+            connection.sendall((json.dumps({"id": 0, "op": "parse", "sql": sql}) + "\n").encode())
+            request = {"op": "cost", "plan": json.loads(reader.readline())["result"]}
+
+    report = []
+    for clients in [int(value) for value in args.concurrency.split(",")]:
+        latencies, errors = [], []
+        threads = [threading.Thread(target=run_client, args=(args, request, args.requests, latencies, errors))
+                   for _ in range(clients)]
+        start = time.perf_counter()
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        seconds = time.perf_counter() - start
+        report.append({
+            "clients": clients,
+            "pipeline": args.pipeline,
+            "requests": len(latencies),
+            "errors": len(errors),
+            "throughput_per_second": len(latencies) / seconds,
+            "p50_ms": percentile(latencies, 0.50) * 1000,
+            "p99_ms": percentile(latencies, 0.99) * 1000,
+            "mean_ms": statistics.mean(latencies) * 1000,
+        })
+        print(json.dumps(report[-1]))
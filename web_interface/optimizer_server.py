@@ -0,0 +1,381 @@
+"""
+Optimizer Server
+
+Standalone server for services calling the optimizer at a high rate,
+without Flask or a parser process per request. It listens on a Unix domain
+socket or a localhost TCP port and speaks NDJSON: one JSON request per
+line, each answered by one JSON response line carrying the same id.
+
+    {"id": 1, "op": "parse", "sql": "SELECT ..."}
+    {"id": 2, "op": "optimize", "sql": "SELECT ...", "passes": ["pushdown", "join", "cse"]}
+    {"id": 3, "op": "cost", "plan": {...}}
+    {"id": 4, "op": "execute", "sql": "SELECT ...", "passes": ["pushdown"], "limit": 100,
+     "priority": "interactive", "weight": 1}
+    {"id": 5, "op": "stats"}
+
+    {"id": 1, "ok": true, "result": {...}, "seconds": 0.0012}
+    {"id": 2, "ok": false, "error": "..."}
+
+Queries are parsed in process by libsql_to_ra.so, built from the
+final_parser sources with `make`. The statistics of every table are read
+once at startup and kept in memory. Requests are served by a fixed pool of
+threads, each with its own optimizer and database connections. Requests on
+one connection may be pipelined: each is handed to the pool as soon as it
+is read, and responses are written as they complete. Parsed and optimized
+plans of queries sent as SQL are kept in a plan cache shared by the
+threads, so a repeated query is answered without parsing or optimizing.
+
+Executions read the .tbl files of --data-dir. Their results are kept in a
+result cache shared by the threads and keyed by the plan and the version of
+every table it reads, so a repeated query over unchanged data is answered
+without running it again. With --shared-scans, concurrent executions reading
+the same table attach to one circular scan of its file. With --buffer-frames,
+they read pages through a buffer pool instead, and the cost model charges
+less I/O for the tables the pool holds. Otherwise table files are read with
+--read-ahead block reads in flight, O_DIRECT with --direct-io.
+
+Executions share --execution-slots morsels at a time through a fair-share
+scheduler, so a long batch query does not hold up short interactive ones:
+each takes turns in proportion to the weight and the "priority" class
+("interactive", "normal" or "batch") of its request.
+
+The optimizer passes are Python, so one process runs them on one core at a
+time; --processes forks several servers accepting on the same socket.
+"""
+
+import argparse
+import copy
+import ctypes
+import json
+import os
+import socket
+import sys
+import threading
+import time
+from concurrent.futures import ThreadPoolExecutor
+
+from catalog import TPCH_DIR, load_column_types
+from async_io import QUEUE_DEPTH, AsyncReader
+from buffer_pool import BufferPool
+from cost_populator import CostCalculator
+from executor import Executor
+from join_optimization import QueryOptimizer, SearchBudget
+from materialized_views import parse_sql
+from plan_cache import DEFAULT_CAPACITY, PlanCache, query_fingerprint
+from predicate_pushdown import optimize_query_plan
+from query_scheduler import FairShareScheduler
+from result_cache import DEFAULT_BUDGET_BYTES, ResultCache
+from shared_scan import SharedScanManager
+from subsequence_elim import QueryTreeOptimizer
+
+DB_PARAMS = {
+    'dbname': 'temp',
+    'user': 'postgres',
+    'password': 'postgres',
+    'host': 'localhost',
+    'port': '5432'
+}
+
+PARSER_LIBRARY = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'final_parser', 'libsql_to_ra.so')
+DEFAULT_SOCKET = '/tmp/sql_optimizer.sock'
+DEFAULT_THREADS = 8
+MAX_PIPELINE = 64  # Requests of one connection in flight before reading pauses
+PASSES = ["pushdown", "join", "cse"]
+
+# Planning time of the join order search per request
+JOIN_SEARCH_SECONDS = 0.05
+
+
+class NativeParser:
+    """The SQL parser called in process through libsql_to_ra.so."""
+
+    def __init__(self, path=PARSER_LIBRARY):
+        self.lib = ctypes.CDLL(path)
+        self.lib.sql_to_ra_json.restype = ctypes.c_void_p
+        self.lib.sql_to_ra_json.argtypes = [ctypes.c_char_p, ctypes.POINTER(ctypes.c_void_p)]
+        self.lib.sql_to_ra_free.argtypes = [ctypes.c_void_p]
+
+    def parse(self, sql):
+        error = ctypes.c_void_p()
+        output = self.lib.sql_to_ra_json(sql.encode(), ctypes.byref(error))
+        if not output:
+            message = ctypes.string_at(error.value).decode() if error.value else "Parsing failed"
+            self.lib.sql_to_ra_free(error)
+            raise ValueError(f"Parsing failed: {message}")
+        try:
+            return json.loads(ctypes.string_at(output).decode())
+        finally:
+            self.lib.sql_to_ra_free(output)
+
+
+def load_statistics(cost_calculator):
+    """Statistics of every table in the schema, read once and shared by all threads."""
+    return {table: cost_calculator.get_table_statistics(table) for table in load_column_types()}
+
+
+class OptimizerServer:
+    """
+    Args:
+        threads (int): Size of the request thread pool
+        db_params (dict): Database connection parameters
+        cache_capacity (int): Plans kept in the plan cache, or 0 for none
+        search_workers (int): Processes of the join order search; above one,
+                              the full search runs in parallel, on one pool
+                              shared by the threads, instead of the
+                              time-budgeted one
+        data_dir (str): Directory containing the .tbl files executions read
+        result_cache_bytes (int): Memory of the result cache, or 0 for none
+        shared_scans (bool): Share the table scans of concurrent executions
+        buffer_frames (int): Pages of the executions' buffer pool, or 0 for
+                             none; shared scans, when enabled, bypass it
+        read_ahead (int): Block reads in flight per scan not going through
+                          shared scans or the buffer pool, or 0 for plain reads
+        direct_io (bool): Open the files read ahead with O_DIRECT
+        execution_slots (int): Morsels the executions run at once, by default
+                               one per CPU
+    """
+
+    def __init__(self, threads=DEFAULT_THREADS, db_params=DB_PARAMS, cache_capacity=DEFAULT_CAPACITY,
+                 search_workers=1, data_dir=TPCH_DIR, result_cache_bytes=DEFAULT_BUDGET_BYTES,
+                 shared_scans=False, buffer_frames=0, read_ahead=QUEUE_DEPTH, direct_io=False,
+                 execution_slots=None):
+        self.db_params = db_params
+        self.search_workers = search_workers
+        self.data_dir = data_dir
+        try:
+            self.parser = NativeParser()
+        except OSError as e:
+            # Without the library, fall back to running the parser binary
+            print(f"Parser library unavailable ({e}); running sql_to_ra per request", file=sys.stderr)
+            self.parser = None
+
+        cost_calculator = CostCalculator(db_params)
+        cost_calculator.connect()
+        self.statistics = load_statistics(cost_calculator)
+
+        self.plan_cache = PlanCache(cache_capacity) if cache_capacity else None
+        self.result_cache = ResultCache(data_dir, result_cache_bytes) if result_cache_bytes else None
+        self.shared_scans = SharedScanManager() if shared_scans else None
+        self.buffer_pool = BufferPool(buffer_frames) if buffer_frames else None
+        self.io_reader = AsyncReader(read_ahead, direct=direct_io) if read_ahead else None
+        self.scheduler = FairShareScheduler(execution_slots)
+        self.local = threading.local()
+        self.pool = ThreadPoolExecutor(threads, thread_name_prefix="optimizer", initializer=self.init_thread)
+        self.stats_lock = threading.Lock()
+        self.stats = {"connections": 0, "requests": 0, "errors": 0}
+
+    def init_thread(self):
+        cost_calculator = CostCalculator(self.db_params)
+        cost_calculator.connect()
+        cost_calculator.statistics_cache = self.statistics
+        optimizer = QueryOptimizer(self.db_params)
+        optimizer.connect()
+        optimizer.statistics_cache = self.statistics
+        optimizer.cost_calculator.statistics_cache = self.statistics
+        if self.search_workers > 1:
+            optimizer.search_workers = self.search_workers
+        else:
+            optimizer.search_budget = SearchBudget(seconds=JOIN_SEARCH_SECONDS)
+        self.local.cost_calculator = cost_calculator
+        self.local.optimizer = optimizer
+
+    # ------------------ Operations ------------------ #
+    def parse(self, sql):
+        if self.parser is not None:
+            return self.parser.parse(sql)
+        return parse_sql(sql)
+
+    def cached(self, request, compute, *context):
+        # Only queries sent as SQL are cached; cached plans are shared and
+        # are not modified by the operations
+        if self.plan_cache is None or "sql" not in request:
+            return compute()
+        key = query_fingerprint(request["sql"], *context)
+        return self.plan_cache.get_or_compute(key, compute)[0]
+
+    def request_plan(self, request):
+        if "plan" in request:
+            return request["plan"]
+        return self.cached(request, lambda: self.parse(request["sql"]), "parse")
+
+    def op_parse(self, request):
+        return self.request_plan(request)
+
+    def update_residency(self):
+        # Scans of the tables the buffer pool holds now cost less I/O
+        if self.buffer_pool is not None:
+            residency = self.buffer_pool.residency()
+            for calculator in (self.local.cost_calculator, self.local.optimizer.cost_calculator):
+                calculator.cache_residency = {**calculator.cache_residency, **residency}
+
+    def op_cost(self, request):
+        self.update_residency()
+        plan = copy.deepcopy(request["plan"])
+        if "common_expressions" in plan:
+            cost, _ = self.local.cost_calculator.calc_subseq_cost(plan)
+        else:
+            cost, _ = self.local.cost_calculator.calculate_cost(plan)
+        return {"cost": cost, "plan": plan}
+
+    def op_optimize(self, request):
+        passes = request.get("passes", PASSES)
+        unknown = [name for name in passes if name not in PASSES]
+        if unknown:
+            raise ValueError(f"Unknown passes: {unknown}")
+        return self.cached(request, lambda: self.optimize(request, passes), "optimize", passes)
+
+    def optimize(self, request, passes):
+        self.update_residency()
+        plan = copy.deepcopy(self.request_plan(request))
+        cost_calculator = self.local.cost_calculator
+
+        if "pushdown" in passes:
+            plan = optimize_query_plan(json.dumps(plan), cost_calculator)["optimized_plan_json"]
+        if "join" in passes:
+            plan = self.local.optimizer.get_costs_and_plans(plan)["best_plan"]
+        if "cse" in passes:
+            plan = QueryTreeOptimizer().optimize_and_cleanup(plan)
+            cost, _ = cost_calculator.calc_subseq_cost(copy.deepcopy(plan))
+        else:
+            cost, _ = cost_calculator.calculate_cost(copy.deepcopy(plan))
+        return {"plan": plan, "cost": cost}
+
+    def op_execute(self, request):
+        plan = self.op_optimize(request)["plan"] if "passes" in request else self.request_plan(request)
+        run = lambda plan: self.run_plan(plan, request)
+        if self.result_cache is not None:
+            result = self.result_cache.execute(plan, run)
+        else:
+            result = run(plan)
+        rows = result.rows if isinstance(result.rows, list) else list(result.rows)
+        return {"columns": [column for _, column in result.columns], "row_count": len(rows),
+                "rows": [list(row) for row in rows[:request.get("limit")]]}
+
+    def run_plan(self, plan, request):
+        with self.scheduler.query(request.get("name"), weight=request.get("weight", 1.0),
+                                  priority=request.get("priority", "normal")) as share:
+            return Executor(self.data_dir, shared_scans=self.shared_scans, buffer_pool=self.buffer_pool,
+                            io_reader=self.io_reader, query_share=share).execute(plan)
+
+    def op_stats(self, request):
+        with self.stats_lock:
+            stats = dict(self.stats)
+        if self.plan_cache is not None:
+            stats["plan_cache"] = self.plan_cache.summary()
+        if self.result_cache is not None:
+            stats["result_cache"] = self.result_cache.summary()
+        if self.shared_scans is not None:
+            with self.shared_scans.lock:
+                stats["shared_scans"] = dict(self.shared_scans.stats)
+        if self.buffer_pool is not None:
+            stats["buffer_pool"] = {**self.buffer_pool.metrics(), "residency": self.buffer_pool.residency()}
+        if self.io_reader is not None:
+            with self.io_reader.lock:
+                stats["read_ahead"] = {"reader": self.io_reader.name, **self.io_reader.stats}
+        stats["scheduler"] = self.scheduler.summary()
+        return stats
+
+    def handle(self, request):
+        start = time.perf_counter()
+        response = {"id": request.get("id")}
+        try:
+            operation = getattr(self, f"op_{request.get('op')}", None)
+            if operation is None:
+                raise ValueError(f"Unknown op: {request.get('op')}")
+            response.update(ok=True, result=operation(request))
+        except Exception as e:
+            response.update(ok=False, error=f"{type(e).__name__}: {e}")
+            with self.stats_lock:
+                self.stats["errors"] += 1
+        response["seconds"] = time.perf_counter() - start
+        return response
+
+    # ------------------ Connections ------------------ #
+    def serve_connection(self, connection):
+        with self.stats_lock:
+            self.stats["connections"] += 1
+        write_lock = threading.Lock()
+        in_flight = threading.BoundedSemaphore(MAX_PIPELINE)
+
+        def respond(future):
+            line = (json.dumps(future.result()) + "\n").encode()
+            with write_lock:
+                try:
+                    connection.sendall(line)
+                except OSError:
+                    pass  # The client went away
+            in_flight.release()
+
+        with connection, connection.makefile('rb') as reader:
+            for line in reader:
+                if not line.strip():
+                    continue
+                try:
+                    request = json.loads(line)
+                except json.JSONDecodeError as e:
+                    with write_lock:
+                        connection.sendall((json.dumps({"id": None, "ok": False, "error": f"Bad request: {e}"})
+                                            + "\n").encode())
+                    continue
+                in_flight.acquire()
+                with self.stats_lock:
+                    self.stats["requests"] += 1
+                self.pool.submit(self.handle, request).add_done_callback(respond)
+            # Let the last responses go out before the socket closes
+            for _ in range(MAX_PIPELINE):
+                in_flight.acquire()
+
+    def serve(self, listener):
+        while True:
+            connection, _ = listener.accept()
+            threading.Thread(target=self.serve_connection, args=(connection,), daemon=True).start()
+
+
+def listen(unix_path=None, host='127.0.0.1', port=None):
+    if port is None:
+        unix_path = unix_path or DEFAULT_SOCKET
+        if os.path.exists(unix_path):
+            os.unlink(unix_path)
+        listener = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        listener.bind(unix_path)
+    else:
+        listener = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        listener.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        listener.bind((host, port))
+    listener.listen(1024)
+    return listener
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Serve parse/optimize/cost/execute requests over NDJSON")
+    parser.add_argument("--unix", help=f"Unix socket path (default {DEFAULT_SOCKET})")
+    parser.add_argument("--port", type=int, help="Listen on localhost TCP instead of a Unix socket")
+    parser.add_argument("--threads", type=int, default=DEFAULT_THREADS, help="Request threads per process")
+    parser.add_argument("--cache-entries", type=int, default=DEFAULT_CAPACITY, help="Plan cache size, 0 to disable")
+    parser.add_argument("--search-workers", type=int, default=1,
+                        help="Processes of each join order search, for a full parallel search")
+    parser.add_argument("--processes", type=int, default=1, help="Server processes sharing the socket")
+    parser.add_argument("--data-dir", default=TPCH_DIR, help="Directory containing the .tbl files")
+    parser.add_argument("--result-cache-mb", type=float, default=DEFAULT_BUDGET_BYTES / (1024 * 1024),
+                        help="Result cache size, 0 to disable")
+    parser.add_argument("--shared-scans", action="store_true", help="Share table scans between executions")
+    parser.add_argument("--buffer-frames", type=int, default=0, help="Buffer pool pages for executions, 0 for none")
+    parser.add_argument("--read-ahead", type=int, default=QUEUE_DEPTH, help="Block reads in flight per scan, 0 for none")
+    parser.add_argument("--direct-io", action="store_true", help="Read table files ahead with O_DIRECT")
+    parser.add_argument("--execution-slots", type=int, help="Morsels executions run at once (default: CPU count)")
+    parser.add_argument("--verbose", action="store_true", help="Keep the optimizers' trace output")
+    args = parser.parse_args()
+
+    listener = listen(args.unix, port=args.port)
+    address = f"127.0.0.1:{args.port}" if args.port is not None else args.unix or DEFAULT_SOCKET
+    print(f"Listening on {address}", file=sys.stderr)
+    for _ in range(args.processes - 1):
+        if os.fork() == 0:
+            break
+    if not args.verbose:
+        # The passes trace every step to stdout, which costs more than they do
+        sys.stdout = open(os.devnull, 'w')
+    OptimizerServer(args.threads, cache_capacity=args.cache_entries, search_workers=args.search_workers,
+                    data_dir=args.data_dir, result_cache_bytes=int(args.result_cache_mb * 1024 * 1024),
+                    shared_scans=args.shared_scans, buffer_frames=args.buffer_frames, read_ahead=args.read_ahead,
+                    direct_io=args.direct_io, execution_slots=args.execution_slots).serve(listener)
@@ -0,0 +1,118 @@
+from catalog import RANGE_PARTITIONS, list_partitions
+
+
+def partition_overlaps(partition, low=None, high=None, high_inclusive=False):
+    """
+    Check whether a partition's [low, high) range can hold a value in the
+    given interval. None stands for an unbounded side.
+    """
+    if low is not None and partition['high'] is not None and partition['high'] <= low:
+        return False
+    if high is not None and partition['low'] is not None:
+        if partition['low'] > high or (partition['low'] == high and not high_inclusive):
+            return False
+    return True
+
+
+def surviving_partitions(condition, column, partitions):
+    """
+    Find the partitions that may contain rows satisfying a condition.
+    Conditions on other columns, and anything that cannot be decided from
+    the bounds alone, keep every partition.
+
+    Args:
+        condition (dict): Condition JSON of a select above the scan
+        column (str): Lowercase partitioning column
+        partitions (list): Partitions as returned by catalog.list_partitions
+
+    Returns:
+        list: Names of the surviving partitions, in key order
+    """
+    everything = [p['name'] for p in partitions]
+    cond_type = condition.get("type") if isinstance(condition, dict) else None
+
+    if cond_type in ("AND", "OR"):
+        left = set(surviving_partitions(condition["left"], column, partitions))
+        right = set(surviving_partitions(condition["right"], column, partitions))
+        keep = left & right if cond_type == "AND" else left | right
+        return [name for name in everything if name in keep]
+
+    left = condition.get("left") if cond_type else None
+    if not isinstance(left, dict) or str(left.get("attr", "")).lower() != column \
+            or left.get("type", "column") != "column":
+        return everything
+
+    if cond_type == "IN":
+        values = [v.get("value") for v in condition["right"]["values"] if v.get("type") == "string"]
+        if len(values) != len(condition["right"]["values"]):
+            return everything
+        return [p['name'] for p in partitions
+                if any(partition_overlaps(p, v, v, high_inclusive=True) for v in values)]
+
+    if cond_type == "LIKE":
+        # Prefix patterns come with the equivalent string range
+        if "range" not in condition:
+            return everything
+        bounds = condition["range"]
+        return [p['name'] for p in partitions
+                if partition_overlaps(p, bounds["low"], bounds.get("high"))]
+
+    right = condition.get("right")
+    if not isinstance(right, dict) or right.get("type") != "string":
+        return everything
+    value = right["value"]
+
+    if cond_type == "EQ":
+        keep = [p for p in partitions if partition_overlaps(p, value, value, high_inclusive=True)]
+    elif cond_type in ("GT", "GE"):
+        keep = [p for p in partitions if partition_overlaps(p, low=value)]
+    elif cond_type == "LT":
+        keep = [p for p in partitions if partition_overlaps(p, high=value)]
+    elif cond_type == "LE":
+        keep = [p for p in partitions if partition_overlaps(p, high=value, high_inclusive=True)]
+    else:
+        return everything
+    return [p['name'] for p in keep]
+
+
+def prune_partitions(plan):
+    """
+    Annotate every scan of a partitioned table with the partitions left
+    after applying the selects stacked directly above it, which is where
+    predicate pushdown leaves them.
+
+    Args:
+        plan (dict): Plan JSON, modified in place
+
+    Returns:
+        dict: The same plan
+    """
+    def visit(node, conditions):
+        if not isinstance(node, dict):
+            return
+
+        if node.get("type") == "select":
+            visit(node["input"], conditions + [node["condition"]])
+            return
+
+        if node.get("type") == "base_relation" and len(node.get("tables", [])) == 1:
+            table_name = node["tables"][0]["name"].lower()
+            if table_name in RANGE_PARTITIONS:
+                column = RANGE_PARTITIONS[table_name]['column']
+                partitions = list_partitions(table_name)
+                keep = [p['name'] for p in partitions]
+                for condition in conditions:
+                    survivors = set(surviving_partitions(condition, column, partitions))
+                    keep = [name for name in keep if name in survivors]
+                node["partitions"] = keep
+            return
+
+        for value in node.values():
+            if isinstance(value, dict):
+                visit(value, [])
+            elif isinstance(value, list):
+                for item in value:
+                    visit(item, [])
+
+    visit(plan, [])
+    return plan
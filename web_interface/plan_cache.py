@@ -0,0 +1,240 @@
+"""
+Concurrent Plan Cache
+
+Keeps optimized plans for the optimizer server's worker threads, keyed by a
+fingerprint of the query text with its whitespace normalized and the passes
+that were run, so that a query sent again skips parsing and optimization.
+
+The cache is split into shards by key hash. Lookups take no lock: each
+shard's dictionary is only ever read by get, and a single dictionary read
+is atomic in CPython, so readers never wait on each other or on writers.
+Inserts take the lock of their shard only, so writers to different shards
+proceed together.
+
+Eviction is CLOCK, an approximation of LRU that needs no bookkeeping on a
+hit beyond setting the entry's reference bit. A shard's entries sit in a
+ring of slots; to make room, the clock hand sweeps the ring, clearing set
+bits and evicting the first entry whose bit is already clear.
+
+An evicted entry is only unlinked from its shard. A reader that fetched it
+just before keeps a reference and can still use its plan, and the entry is
+freed once the last such reader drops it, so reference counting plays the
+part of RCU's grace period. Cached plans are shared, so callers must not
+modify them.
+"""
+
+import argparse
+import hashlib
+import json
+import random
+import re
+import threading
+import time
+
+DEFAULT_CAPACITY = 4096
+DEFAULT_SHARDS = 16
+
+# String literals as sql_lexer.l reads them, which normalization leaves alone
+_LITERAL = re.compile(r"('[^']*')")
+_SPACE = re.compile(r"[ \t\n\r]+")
+
+
+# ------------------ Fingerprints ------------------ #
+def normalize_sql(sql):
+    """
+    Normalize the text of a query so that queries differing only in how
+    much whitespace separates their tokens get the same form. The lexer
+    only ever uses whitespace to separate tokens, so each run of it outside
+    string literals becomes one space; nothing else is rewritten, since
+    keywords are case sensitive, identifier case reaches the plan and
+    removing a separator can merge tokens.
+    """
+    parts = _LITERAL.split(sql)
+    for i in range(0, len(parts), 2):
+        parts[i] = _SPACE.sub(" ", parts[i])
+    return "".join(parts).strip()
+
+
+def query_fingerprint(sql, *context):
+    """SHA-256 of the normalized query and anything else its plan depends on."""
+    key = json.dumps([normalize_sql(sql), *context], separators=(",", ":"))
+    return hashlib.sha256(key.encode()).hexdigest()
+
+
+# ------------------ Cache ------------------ #
+class CacheEntry:
+    __slots__ = ("key", "value", "referenced", "slot")
+
+    def __init__(self, key, value):
+        self.key = key
+        self.value = value
+        self.referenced = False
+        self.slot = None
+
+
+class Shard:
+    def __init__(self, capacity):
+        self.capacity = capacity
+        self.entries = {}                 # key -> CacheEntry, read without the lock
+        self.slots = [None] * capacity    # the clock's ring of entries
+        self.used = 0
+        self.hand = 0
+        self.lock = threading.Lock()
+        self.evictions = 0
+
+    def victim(self):
+        # Called with the lock held and the ring full
+        while True:
+            entry = self.slots[self.hand]
+            if entry.referenced:
+                entry.referenced = False
+                self.hand = (self.hand + 1) % self.capacity
+                continue
+            return self.hand
+
+
+class PlanCache:
+    """
+    Args:
+        capacity (int): Entries the cache holds, divided among the shards
+        shards (int): Independently locked partitions of the cache
+    """
+
+    def __init__(self, capacity=DEFAULT_CAPACITY, shards=DEFAULT_SHARDS):
+        shards = max(1, min(shards, capacity))
+        self.shards = [Shard(max(1, capacity // shards)) for _ in range(shards)]
+        # Per thread, so that hits are counted without a shared counter
+        self.local = threading.local()
+        self.counters = []
+        self.counters_lock = threading.Lock()
+
+    def shard(self, key):
+        return self.shards[hash(key) % len(self.shards)]
+
+    def count(self, name):
+        counters = getattr(self.local, "counters", None)
+        if counters is None:
+            counters = self.local.counters = {"hits": 0, "misses": 0}
+            with self.counters_lock:
+                self.counters.append(counters)
+        counters[name] += 1
+
+    def get(self, key):
+        """Return the cached value of a key, or None."""
+        entry = self.shard(key).entries.get(key)
+        if entry is None:
+            self.count("misses")
+            return None
+        if not entry.referenced:
+            entry.referenced = True
+        self.count("hits")
+        return entry.value
+
+    def put(self, key, value):
+        shard = self.shard(key)
+        entry = CacheEntry(key, value)
+        with shard.lock:
+            current = shard.entries.get(key)
+            if current is not None:
+                # Replace in place; the new entry takes over the old one's slot
+                slot = current.slot
+            elif shard.used < shard.capacity:
+                slot = shard.used
+                shard.used += 1
+            else:
+                slot = shard.victim()
+                del shard.entries[shard.slots[slot].key]
+                shard.evictions += 1
+                shard.hand = (slot + 1) % shard.capacity
+            entry.slot = slot
+            shard.slots[slot] = entry
+            shard.entries[key] = entry
+
+    def get_or_compute(self, key, compute):
+        """
+        Return the cached value of a key, computing and caching it on a miss.
+        Threads missing on the same key at once each compute it.
+
+        Returns:
+            tuple: (value, whether it came from the cache)
+        """
+        value = self.get(key)
+        if value is not None:
+            return value, True
+        value = compute()
+        self.put(key, value)
+        return value, False
+
+    def clear(self):
+        for shard in self.shards:
+            with shard.lock:
+                shard.entries = {}
+                shard.slots = [None] * shard.capacity
+                shard.used = 0
+                shard.hand = 0
+
+    def summary(self):
+        with self.counters_lock:
+            hits = sum(counters["hits"] for counters in self.counters)
+            misses = sum(counters["misses"] for counters in self.counters)
+        return {"hits": hits, "misses": misses, "entries": sum(len(shard.entries) for shard in self.shards),
+                "evictions": sum(shard.evictions for shard in self.shards),
+                "capacity": sum(shard.capacity for shard in self.shards), "shards": len(self.shards)}
+
+
+class LockedPlanCache(PlanCache):
+    """A single shard whose reads take its lock too, to compare against."""
+
+    def __init__(self, capacity=DEFAULT_CAPACITY):
+        super().__init__(capacity, shards=1)
+
+    def get(self, key):
+        shard = self.shards[0]
+        with shard.lock:
+            return super().get(key)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Measure plan cache read throughput versus threads")
+    parser.add_argument("--threads", default="1,2,4,8,16", help="Comma-separated reader thread counts")
+    parser.add_argument("--keys", type=int, default=10000, help="Distinct queries looked up")
+    parser.add_argument("--capacity", type=int, default=DEFAULT_CAPACITY)
+    parser.add_argument("--shards", type=int, default=DEFAULT_SHARDS)
+    parser.add_argument("--write-percent", type=float, default=1.0, help="Lookups that miss and insert")
+    parser.add_argument("--seconds", type=float, default=1.0, help="Duration of each measurement")
+    args = parser.parse_args()
+
+    keys = [query_fingerprint(f"SELECT n.n_name FROM nation n WHERE n.n_nationkey = {i}") for i in range(args.keys)]
+    plan = {"type": "project", "columns": ["n.n_name"]}
+
+    report = []
+    for name, make_cache in [("sharded", lambda: PlanCache(args.capacity, args.shards)),
+                             ("locked", lambda: LockedPlanCache(args.capacity))]:
+        for threads in [int(value) for value in args.threads.split(",")]:
+            cache = make_cache()
+            for key in keys[:args.capacity]:
+                cache.put(key, plan)
+            operations = [0] * threads
+            stop = threading.Event()
+
+            def reader(index):
+                rng = random.Random(index)
+                done = 0
+                while not stop.is_set():
+                    for _ in range(256):
+                        key = keys[rng.randrange(len(keys))]
+                        if cache.get(key) is None and rng.random() * 100 < args.write_percent:
+                            cache.put(key, plan)
+                    done += 256
+                operations[index] = done
+
+            workers = [threading.Thread(target=reader, args=(i,)) for i in range(threads)]
+            for worker in workers:
+                worker.start()
+            time.sleep(args.seconds)
+            stop.set()
+            for worker in workers:
+                worker.join()
+            report.append({"cache": name, "threads": threads,
+                           "lookups_per_second": sum(operations) / args.seconds, **cache.summary()})
+            print(json.dumps(report[-1]))
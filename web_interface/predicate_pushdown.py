@@ -1,9 +1,13 @@
 import json
 import sys
+from partition_pruning import prune_partitions
+from cte_planner import plan_ctes
+from materialized_views import rewrite_with_views
 
 # ------------------ Logical Plan Nodes ------------------ #
 class LogicalPlanNode:
-    def __init__(self, node_type, children=None, predicate=None, table=None, alias=None, columns=None, subquery=None):
+    def __init__(self, node_type, children=None, predicate=None, table=None, alias=None, columns=None, subquery=None,
+                 references=None):
         self.node_type = node_type
         self.children = children or []
         self.predicate = predicate
@@ -11,14 +15,17 @@ class LogicalPlanNode:
         self.alias = alias
         self.columns = columns
         self.subquery = subquery  # Added for subquery nodes
+        self.references = references  # Number of readers of a materialized CTE
 
     def __str__(self, level=0):
         indent = "  " * level
         s = f"{indent}{self.node_type}"
         if self.table:
             s += f"({self.table}" + (f" AS {self.alias}" if self.alias and self.alias != self.table else "") + ")"
-        elif self.node_type == 'SUBQUERY' and self.alias:
+        elif self.node_type in ('SUBQUERY', 'CTE') and self.alias:
             s += f"(AS {self.alias})"
+            if self.references:
+                s += f" x{self.references}"
         if self.predicate:
             s += f" [{self.predicate}]"
         if self.columns:
@@ -78,6 +85,18 @@ def build_logical_plan_from_json(json_obj):
         # Create a subquery node that contains the query plan as its child
         return LogicalPlanNode('SUBQUERY', children=[query_plan], alias=alias, subquery=True)
     
+    elif json_obj['type'] == 'with':
+        # Main query first, then one CTE node per materialized CTE
+        input_plan = build_logical_plan_from_json(json_obj['input'])
+        cte_plans = [LogicalPlanNode('CTE', children=[build_logical_plan_from_json(cte['query'])],
+                                     alias=cte['name'], references=cte.get('references'))
+                     for cte in json_obj['ctes']]
+        return LogicalPlanNode('WITH', children=[input_plan] + cte_plans)
+    
+    elif json_obj['type'] == 'cte_ref':
+        # Scan of a materialized CTE's spool
+        return LogicalPlanNode('CTE_SCAN', table=json_obj['name'], alias=json_obj.get('alias'))
+    
     else:
         raise ValueError(f"Unknown node type: {json_obj['type']}")
 
@@ -90,10 +109,15 @@ def format_columns_from_json(columns):
         table = col.get('table', '')
         attr = col.get('attr', '')
         
-        if table and attr:
+        if 'expr' in col:
+            column_str = format_operand(col['expr'])
+        elif table and attr:
             column_str = f"{table}.{attr}"
         else:
             column_str = attr
+        
+        if 'alias' in col:
+            column_str += f" AS {col['alias']}"
             
         formatted.append(column_str)
     
@@ -131,6 +155,16 @@ def format_condition_from_json(condition):
         operand = format_condition_from_json(condition.get('cond', {}))
         return f"NOT ({operand})"
     
+    elif condition_type == 'IN':
+        left = format_operand(condition['left'])
+        values = ', '.join(format_operand(v) for v in condition['right'].get('values', []))
+        return f"{left} IN ({values})"
+    
+    elif condition_type == 'LIKE':
+        left = format_operand(condition['left'])
+        right = format_operand(condition['right'])
+        return f"{left} LIKE {right}"
+    
     elif condition_type in op_map:
         left = format_operand(condition['left'])
         right = format_operand(condition['right'])
@@ -141,6 +175,8 @@ def format_condition_from_json(condition):
         # If it's a custom or unknown condition type
         return str(condition)
 
+ARITH_OPERATORS = {'ADD': '+', 'SUB': '-', 'MUL': '*', 'DIV': '/'}
+
 def format_operand(operand):
     """
     Format an operand which could be a column reference or a literal
@@ -162,6 +198,12 @@ def format_operand(operand):
         elif operand.get('type') == 'string':
             # It's a string literal with explicit type
             return f"'{operand.get('value', '')}'"
+        elif operand.get('type') == 'arith':
+            # It's an arithmetic expression, always parenthesized so that
+            # it parses back with the same grouping
+            left = format_operand(operand['left'])
+            right = format_operand(operand['right'])
+            return f"({left} {ARITH_OPERATORS[operand['op']]} {right})"
         elif 'table' in operand and 'attr' in operand:
             # It's a column reference without explicit type
             table = operand['table']
@@ -210,14 +252,15 @@ def predicate_pushdown(plan):
             # Split on spaces and parentheses to better handle expressions
             parts = pred_str.replace('(', ' ').replace(')', ' ').split()
             for part in parts:
-                if '.' in part:
+                # Skip numeric and string literals such as 0.05 or 'a.b'
+                if '.' in part and part[0].isalpha():
                     table = part.split('.')[0]
                     references.append(table)
             return set(references)
         
         # Helper function to find and wrap scan nodes with filters
         def push_filter_to_scan(node, table_name, predicate):
-            if node.node_type == 'SCAN' and (node.table == table_name or node.alias == table_name):
+            if node.node_type in ('SCAN', 'CTE_SCAN') and (node.table == table_name or node.alias == table_name):
                 # We found the scan, wrap it with a filter
                 print(f"Found SCAN for {table_name}, applying filter directly")
                 return LogicalPlanNode('FILTER', children=[node], predicate=predicate)
@@ -241,7 +284,7 @@ def predicate_pushdown(plan):
         
         # Helper to find a table in a subtree
         def find_table_in_subtree(node, table_name):
-            if node.node_type == 'SCAN':
+            if node.node_type in ('SCAN', 'CTE_SCAN'):
                 return node.table == table_name or node.alias == table_name
             
             if node.node_type == 'SUBQUERY' and node.alias == table_name:
@@ -257,7 +300,7 @@ def predicate_pushdown(plan):
             if aliases is None:
                 aliases = {}
                 
-            if node.node_type == 'SCAN' and node.alias and node.alias != node.table:
+            if node.node_type in ('SCAN', 'CTE_SCAN') and node.alias and node.alias != node.table:
                 aliases[node.alias] = node.table
                 aliases[node.table] = node.table  # Also map table to itself
             
@@ -405,7 +448,7 @@ def predicate_pushdown(plan):
             if child.node_type in ['JOIN', 'FILTER']:
                 modified_child = push_filter_to_scan(child, table_name, predicate)
                 return modified_child
-            elif child.node_type == 'SCAN' and (child.table == table_name or child.alias == table_name):
+            elif child.node_type in ('SCAN', 'CTE_SCAN') and (child.table == table_name or child.alias == table_name):
                 # Direct filter on scan
                 return LogicalPlanNode('FILTER', children=[child], predicate=predicate)
             elif child.node_type == 'SUBQUERY' and child.alias == table_name:
@@ -485,6 +528,29 @@ def logical_plan_to_json(plan):
             "query": query_json
         }
     
+    elif plan.node_type == 'WITH':
+        ctes = []
+        for cte in plan.children[1:]:
+            ctes.append({
+                "name": cte.alias,
+                "materialized": True,
+                **({"references": cte.references} if cte.references else {}),
+                "query": logical_plan_to_json(cte.children[0])
+            })
+        
+        return {
+            "type": "with",
+            "ctes": ctes,
+            "input": logical_plan_to_json(plan.children[0])
+        }
+    
+    elif plan.node_type == 'CTE_SCAN':
+        return {
+            "type": "cte_ref",
+            "name": plan.table,
+            "alias": plan.alias or plan.table
+        }
+    
     else:
         raise ValueError(f"Unknown node type for JSON conversion: {plan.node_type}")
 
@@ -494,66 +560,229 @@ def parse_columns_to_json(columns_str):
     """
     result = []
     for col_str in columns_str:
-        # Check if it's a table.column reference
-        if '.' in col_str:
+        alias = None
+        pos = find_top_level(col_str, ' AS ')
+        if pos != -1:
+            col_str, alias = col_str[:pos], col_str[pos + len(' AS '):].strip()
+        
+        operand = parse_operand_to_json(col_str.strip())
+        if isinstance(operand, dict) and operand.get('type') == 'arith':
+            # It's a computed column
+            column_obj = {"expr": operand}
+        elif '.' in col_str:
+            # Check if it's a table.column reference
             table, attr = col_str.split('.')
             column_obj = {"table": table, "attr": attr}
         else:
             column_obj = {"attr": col_str}
+        
+        if alias:
+            column_obj["alias"] = alias
             
         result.append(column_obj)
     
     return result
 
+def find_top_level(condition_str, token, last=False):
+    """
+    Return the index of the first (or, with last=True, the last) occurrence
+    of token that is outside any parentheses and string literals, or -1 if
+    there is none
+    """
+    level = 0
+    in_string = False
+    found = -1
+    for i, ch in enumerate(condition_str):
+        if ch == "'":
+            in_string = not in_string
+        elif not in_string:
+            if ch == '(':
+                level += 1
+            elif ch == ')':
+                level -= 1
+            if level == 0 and condition_str.startswith(token, i):
+                if not last:
+                    return i
+                found = i
+    return found
+
+def strip_outer_parentheses(condition_str):
+    """
+    Remove parentheses that enclose the whole string, e.g. "((a = 1))" -> "a = 1"
+    """
+    condition_str = condition_str.strip()
+    while condition_str.startswith('(') and find_top_level(condition_str, ')') == len(condition_str) - 1:
+        condition_str = condition_str[1:-1].strip()
+    return condition_str
+
 def parse_condition_to_json(condition_str):
     """
     Parse a condition from string format back to JSON
     """
     # Handle parentheses
-    condition_str = condition_str.strip()
-    if condition_str.startswith('(') and condition_str.endswith(')'):
-        # Remove outer parentheses
-        condition_str = condition_str[1:-1].strip()
+    condition_str = strip_outer_parentheses(condition_str)
     
-    if ' AND ' in condition_str:
-        left_str, right_str = condition_str.split(' AND ', 1)
+    # Only split on operators at the top level, so that nested conditions
+    # and string literals containing keywords stay intact
+    for keyword, cond_type in [(' OR ', 'OR'), (' AND ', 'AND')]:
+        pos = find_top_level(condition_str, keyword)
+        if pos != -1:
+            return {
+                "type": cond_type,
+                "left": parse_condition_to_json(condition_str[:pos]),
+                "right": parse_condition_to_json(condition_str[pos + len(keyword):])
+            }
+    
+    if condition_str.startswith('NOT '):
+        operand_str = strip_outer_parentheses(condition_str[4:])
         return {
-            "type": "AND",
-            "left": parse_condition_to_json(left_str),
-            "right": parse_condition_to_json(right_str)
+            "type": "NOT",
+            "cond": parse_condition_to_json(operand_str)
         }
-    elif ' OR ' in condition_str:
-        left_str, right_str = condition_str.split(' OR ', 1)
+    
+    # Handle IN lists: "T.A IN (v1, v2, ...)"
+    pos = find_top_level(condition_str, ' IN (')
+    if pos != -1 and condition_str.endswith(')'):
+        left_str, values_str = condition_str[:pos], condition_str[pos + len(' IN ('):-1]
+        values = [parse_operand_to_json(v.strip()) for v in split_in_values(values_str)]
         return {
-            "type": "OR",
-            "left": parse_condition_to_json(left_str),
-            "right": parse_condition_to_json(right_str)
+            "type": "IN",
+            "left": parse_operand_to_json(left_str.strip()),
+            "right": {"type": "list", "values": values}
         }
-    elif condition_str.startswith('NOT '):
-        operand_str = condition_str[4:].strip()
-        if operand_str.startswith('(') and operand_str.endswith(')'):
-            operand_str = operand_str[1:-1].strip()
-        return {
-            "type": "NOT",
-            "cond": parse_condition_to_json(operand_str)
+    
+    # Handle LIKE patterns: "T.A LIKE 'pattern'"
+    pos = find_top_level(condition_str, ' LIKE ')
+    if pos != -1:
+        left_str, pattern_str = condition_str[:pos], condition_str[pos + len(' LIKE '):]
+        pattern = parse_operand_to_json(pattern_str.strip())
+        like_json = {
+            "type": "LIKE",
+            "left": parse_operand_to_json(left_str.strip()),
+            "right": pattern
         }
+        like_json.update(classify_like_pattern(pattern["value"]))
+        return like_json
     
-    # Handle basic comparisons
-    for op_str, op_type in [('=', 'EQ'), ('<', 'LT'), ('>', 'GT'), 
-                           ('<=', 'LE'), ('>=', 'GE'), ('<>', 'NE')]:
-        if op_str in condition_str:
-            left_str, right_str = condition_str.split(op_str, 1)
-            left = parse_operand_to_json(left_str.strip())
-            right = parse_operand_to_json(right_str.strip())
+    # Handle basic comparisons (two-character operators first)
+    for op_str, op_type in [('<=', 'LE'), ('>=', 'GE'), ('<>', 'NE'),
+                           ('=', 'EQ'), ('<', 'LT'), ('>', 'GT')]:
+        pos = find_top_level(condition_str, op_str)
+        if pos != -1:
+            left = parse_operand_to_json(condition_str[:pos].strip())
+            right = parse_operand_to_json(condition_str[pos + len(op_str):].strip())
             return {"type": op_type, "left": left, "right": right}
     
     # If none of the above, return the condition as is
     return condition_str
 
+def classify_like_pattern(pattern):
+    """
+    Rebuild the pattern annotations that the parser emits for LIKE:
+    the pattern shape ("prefix", "suffix", "infix" or "pattern") and,
+    for prefix patterns, the equivalent [low, high) string range
+    """
+    wildcards = pattern.count('%')
+    if '_' in pattern:
+        match = "pattern"
+    elif wildcards == 1 and len(pattern) > 1 and pattern.endswith('%'):
+        match = "prefix"
+    elif wildcards == 1 and len(pattern) > 1 and pattern.startswith('%'):
+        match = "suffix"
+    elif wildcards == 2 and len(pattern) > 2 and pattern.startswith('%') and pattern.endswith('%'):
+        match = "infix"
+    else:
+        match = "pattern"
+    
+    result = {"match": match}
+    if match == "prefix":
+        low = pattern[:-1]
+        high = like_prefix_upper_bound(low)
+        result["range"] = {"low": low}
+        if high is not None:
+            result["range"]["high"] = high
+    return result
+
+def like_prefix_upper_bound(prefix):
+    """
+    Exclusive upper bound of the strings starting with prefix under code
+    point ordering (the byte ordering of UTF-8 and PostgreSQL's "C"
+    collation): the last character that has a successor is incremented and
+    the U+10FFFF ones after it are dropped, as the parser's
+    like_prefix_upper_bound does. None when no character has a successor.
+    """
+    while prefix:
+        last = ord(prefix[-1])
+        if last < 0x10FFFF:
+            # Surrogates are not characters; skip over them
+            successor = 0xE000 if last + 1 == 0xD800 else last + 1
+            return prefix[:-1] + chr(successor)
+        prefix = prefix[:-1]
+    return None
+
+def split_in_values(values_str):
+    """
+    Split the inside of an IN list on commas that are not part of a string literal
+    """
+    values = []
+    current = ''
+    in_string = False
+    for ch in values_str:
+        if ch == "'":
+            in_string = not in_string
+        if ch == ',' and not in_string:
+            values.append(current)
+            current = ''
+        else:
+            current += ch
+    if current.strip():
+        values.append(current)
+    return values
+
+def parse_arith_to_json(operand_str):
+    """
+    Parse an arithmetic expression such as "(L.A * (1 - L.B))" back to JSON,
+    or return None if the operand has no top-level arithmetic operator.
+    The rightmost operator of the lowest precedence level is the root, which
+    keeps "a - b - c" left-associative.
+    """
+    for operators in (('+', 'ADD'), ('-', 'SUB')), (('*', 'MUL'), ('/', 'DIV')):
+        best_pos, best_op = -1, None
+        for op_str, op_type in operators:
+            pos = find_top_level(operand_str, f" {op_str} ", last=True)
+            if pos > best_pos:
+                best_pos, best_op = pos, (op_str, op_type)
+        if best_pos != -1:
+            return {
+                "type": "arith",
+                "op": best_op[1],
+                "left": parse_operand_to_json(operand_str[:best_pos].strip()),
+                "right": parse_operand_to_json(operand_str[best_pos + 3:].strip())
+            }
+    return None
+
 def parse_operand_to_json(operand_str):
     """
     Parse an operand from string format back to JSON
     """
+    operand_str = strip_outer_parentheses(operand_str)
+    arith = parse_arith_to_json(operand_str)
+    if arith is not None:
+        return arith
+    
+    # Literals are checked first, so that float values and quoted strings
+    # containing dots are not mistaken for table.column references
+    unsigned = operand_str[1:] if operand_str.startswith('-') else operand_str
+    if operand_str.startswith("'") and operand_str.endswith("'"):
+        # It's a string literal
+        return {"type": "string", "value": operand_str[1:-1]}
+    elif unsigned.isdigit():
+        # It's an integer
+        return {"type": "int", "value": int(operand_str)}
+    elif unsigned.replace('.', '', 1).isdigit():
+        # It's a float
+        return {"type": "float", "value": float(operand_str)}
+    
     if '.' in operand_str:
         # It's a table.column reference
         # Handle cases where we might have multiple dots (like tmp.a.id)
@@ -567,29 +796,28 @@ def parse_operand_to_json(operand_str):
             attr = '.'.join(parts[1:])
             return {"table": table, "attr": attr}
     
-    if operand_str.startswith("'") and operand_str.endswith("'"):
-        # It's a string literal
-        return {"type": "string", "value": operand_str[1:-1]}
-    elif operand_str.isdigit():
-        # It's an integer
-        return {"type": "int", "value": int(operand_str)}
-    elif operand_str.replace('.', '', 1).isdigit():
-        # It's a float
-        return {"type": "float", "value": float(operand_str)}
-    else:
-        # It's some other value
-        return operand_str
+    # It's some other value
+    return operand_str
 
 # ------------------ Entry Point ------------------ #
-def optimize_query_plan(json_str):
+def optimize_query_plan(json_str, cost_calculator=None):
     """
     Takes a JSON string representing a SQL query plan,
     applies predicate pushdown optimization, and returns the optimized plan.
+    CTEs are first either inlined or kept for materialization, and then
+    materialized views are substituted where they can answer the query,
+    both costed with cost_calculator when one is given.
     """
     try:
         # Parse JSON to dict
         query_json = json.loads(json_str)
         
+        # Inline the CTEs that are not worth a spool
+        query_json = plan_ctes(query_json, cost_calculator)
+
+        # Answer what we can from materialized views
+        query_json = rewrite_with_views(query_json, cost_calculator)
+        
         # Build logical plan from JSON
         logical_plan = build_logical_plan_from_json(query_json)
         
@@ -608,6 +836,10 @@ def optimize_query_plan(json_str):
         logical_json = logical_plan_to_json(logical_plan)
         optimized_json = logical_plan_to_json(optimized_plan)
         
+        # List the partitions each scan still has to read
+        prune_partitions(logical_json)
+        prune_partitions(optimized_json)
+        
         return {
             "original_plan_str": original_plan,
             "optimized_plan_str": optimized_plan.__str__(),
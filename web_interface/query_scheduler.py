@@ -0,0 +1,245 @@
+"""
+Fair-Share Query Scheduler
+
+Shares the CPU between concurrently executing queries by the morsel, so
+that a long LINEITEM join cannot hold every slot while short dashboard
+queries wait behind it. Each query registers with the scheduler and hands
+its QueryShare to its Executor, whose scans and joins then take a turn
+from the scheduler for every morsel of rows they process.
+
+Turns are given by stride scheduling. A query holds tickets, its weight
+times the share of its priority class, and a pass value that advances by
+its stride, inversely proportional to its tickets, for every CPU second
+its morsels use. A free slot goes to the waiting query with the lowest
+pass, so over time queries receive CPU in proportion to their tickets.
+The tickets of a query shrink as its CPU time grows, so the longer a query
+runs the lower its priority, and a query arriving starts at the pass of
+the most recently scheduled morsel rather than catching up from zero.
+
+Every query's CPU time, time spent waiting for a turn and CPU share, its
+fraction of the CPU used by all queries while it was running, are
+exported, live and for recently finished queries.
+"""
+
+import argparse
+import heapq
+import itertools
+import json
+import os
+import statistics
+import threading
+import time
+from collections import deque
+from contextlib import contextmanager
+
+from cancellation import MORSEL_ROWS
+from catalog import TPCH_DIR
+
+# Share of each priority class, multiplied by the query's weight
+PRIORITY_TICKETS = {"interactive": 4.0, "normal": 1.0, "batch": 0.25}
+STRIDE_SCALE = 1.0
+# CPU seconds after which a query's tickets are halved, then thirded and so on
+DECAY_CPU_SECONDS = 1.0
+# Least CPU charged for a morsel, so that cheap morsels still advance the pass
+MIN_MORSEL_SECONDS = 1e-5
+FINISHED_HISTORY = 256
+
+
+class QueryShare:
+    """A query registered with the scheduler, handed to its Executor."""
+
+    def __init__(self, scheduler, query_id, name, weight, priority, pass_value):
+        if priority not in PRIORITY_TICKETS:
+            raise ValueError(f"Unknown priority: {priority}")
+        self.scheduler = scheduler
+        self.id = query_id
+        self.name = name
+        self.weight = weight
+        self.priority = priority
+        self.pass_value = pass_value
+        self.cpu_seconds = 0.0
+        self.wait_seconds = 0.0
+        self.morsels = 0
+        self.started = time.monotonic()
+        self.finished = None
+        self.cpu_at_start = scheduler.total_cpu
+        self.cpu_at_finish = None
+        self.local = threading.local()
+
+    def tickets(self):
+        return self.weight * PRIORITY_TICKETS[self.priority] / (1 + self.cpu_seconds / DECAY_CPU_SECONDS)
+
+    def stride(self):
+        return STRIDE_SCALE / self.tickets()
+
+    def scheduled(self, items, every=MORSEL_ROWS):
+        """Iterate over items, taking a turn from the scheduler for every `every` items."""
+        if getattr(self.local, "holding", False):
+            # A morsel loop nested in one already holding a turn on this thread
+            yield from items
+            return
+        self.local.holding = True
+        holding = False
+        try:
+            for i, item in enumerate(items):
+                if i % every == 0:
+                    if holding:
+                        self.scheduler.release(self, time.thread_time() - start)
+                        holding = False
+                    self.scheduler.acquire(self)
+                    holding = True
+                    start = time.thread_time()
+                yield item
+        finally:
+            if holding:
+                self.scheduler.release(self, time.thread_time() - start)
+            self.local.holding = False
+
+    def summary(self):
+        end = self.finished if self.finished is not None else time.monotonic()
+        total_cpu = self.cpu_at_finish if self.cpu_at_finish is not None else self.scheduler.total_cpu
+        concurrent_cpu = total_cpu - self.cpu_at_start
+        return {"query_id": self.id, "name": self.name, "priority": self.priority, "weight": self.weight,
+                "tickets": self.tickets(), "morsels": self.morsels, "cpu_seconds": self.cpu_seconds,
+                "wait_seconds": self.wait_seconds, "elapsed_seconds": end - self.started,
+                "cpu_share": self.cpu_seconds / concurrent_cpu if concurrent_cpu > 0 else 1.0}
+
+
+class FairShareScheduler:
+    """
+    Args:
+        slots (int): Morsels that may run at once, across all queries
+    """
+
+    def __init__(self, slots=None):
+        self.slots = slots or os.cpu_count() or 1
+        self.running = 0
+        self.waiting = []  # heap of (pass, sequence, QueryShare)
+        self.sequence = itertools.count()
+        self.query_ids = itertools.count(1)
+        self.virtual_time = 0.0
+        self.total_cpu = 0.0
+        self.active = {}
+        self.finished = deque(maxlen=FINISHED_HISTORY)
+        self.condition = threading.Condition()
+
+    @contextmanager
+    def query(self, name=None, weight=1.0, priority="normal"):
+        """
+        Register a query for as long as it executes and yield its QueryShare.
+
+        Args:
+            name (str): Label of the query in the exported metrics
+            weight (float): Relative share among queries of the same priority
+            priority (str): "interactive", "normal" or "batch"
+        """
+        with self.condition:
+            query_id = next(self.query_ids)
+            share = QueryShare(self, query_id, name or f"query-{query_id}", weight, priority, self.virtual_time)
+            self.active[query_id] = share
+        try:
+            yield share
+        finally:
+            with self.condition:
+                share.finished = time.monotonic()
+                share.cpu_at_finish = self.total_cpu
+                del self.active[query_id]
+                self.finished.append(share.summary())
+
+    def acquire(self, share):
+        start = time.perf_counter()
+        with self.condition:
+            entry = (share.pass_value, next(self.sequence), share)
+            heapq.heappush(self.waiting, entry)
+            while self.running >= self.slots or self.waiting[0] is not entry:
+                self.condition.wait()
+            heapq.heappop(self.waiting)
+            self.running += 1
+            self.virtual_time = max(self.virtual_time, share.pass_value)
+            share.wait_seconds += time.perf_counter() - start
+            # Another slot may be free for the next query in line
+            self.condition.notify_all()
+
+    def release(self, share, cpu_seconds):
+        with self.condition:
+            self.running -= 1
+            share.pass_value += share.stride() * max(cpu_seconds, MIN_MORSEL_SECONDS)
+            share.cpu_seconds += cpu_seconds
+            share.morsels += 1
+            self.total_cpu += cpu_seconds
+            self.condition.notify_all()
+
+    def summary(self):
+        with self.condition:
+            return {"slots": self.slots, "running": self.running, "waiting": len(self.waiting),
+                    "active": [share.summary() for share in self.active.values()],
+                    "finished": list(self.finished)}
+
+
+if __name__ == "__main__":
+    from executor import Executor
+
+    parser = argparse.ArgumentParser(description="Run a heavy plan alongside short ones, with and without the scheduler")
+    parser.add_argument("heavy", help="Plan JSON file of the long-running query")
+    parser.add_argument("light", help="Plan JSON file of the short, interactive query")
+    parser.add_argument("data_dir", nargs="?", default=TPCH_DIR, help="Directory containing the .tbl files")
+    parser.add_argument("--heavy-copies", type=int, default=2, help="Concurrent runs of the heavy plan")
+    parser.add_argument("--light-clients", type=int, default=4, help="Clients issuing the light plan")
+    parser.add_argument("--light-rounds", type=int, default=5, help="Times each client issues it")
+    parser.add_argument("--slots", type=int, help="Morsels running at once (default: CPU count)")
+    args = parser.parse_args()
+
+    with open(args.heavy) as f:
+        heavy = json.load(f)
+    with open(args.light) as f:
+        light = json.load(f)
+
+    report = {}
+    for mode in ["unscheduled", "fair_share"]:
+        scheduler = FairShareScheduler(args.slots) if mode == "fair_share" else None
+        latencies, heavy_seconds = [], []
+        lock = threading.Lock()
+
+        def run(plan, name, priority):
+            start = time.perf_counter()
+            if scheduler is None:
+                Executor(args.data_dir).execute(plan)
+            else:
+                with scheduler.query(name, priority=priority) as share:
+                    Executor(args.data_dir, query_share=share).execute(plan)
+            return time.perf_counter() - start
+
+        def heavy_client(i):
+            seconds = run(heavy, f"heavy-{i}", "batch")
+            with lock:
+                heavy_seconds.append(seconds)
+
+        def light_client(i):
+            for round_number in range(args.light_rounds):
+                seconds = run(light, f"light-{i}-{round_number}", "interactive")
+                with lock:
+                    latencies.append(seconds)
+
+        threads = [threading.Thread(target=heavy_client, args=(i,)) for i in range(args.heavy_copies)]
+        for thread in threads:
+            thread.start()
+        # Let the heavy queries take hold before the interactive ones arrive
+        time.sleep(0.2)
+        light_threads = [threading.Thread(target=light_client, args=(i,)) for i in range(args.light_clients)]
+        for thread in light_threads:
+            thread.start()
+        for thread in threads + light_threads:
+            thread.join()
+
+        latencies.sort()
+        report[mode] = {
+            "light_p50_seconds": statistics.median(latencies),
+            "light_p99_seconds": latencies[min(len(latencies) - 1, int(0.99 * len(latencies)))],
+            "heavy_seconds": max(heavy_seconds),
+        }
+        if scheduler is not None:
+            finished = scheduler.summary()["finished"]
+            for prefix in ("heavy", "light"):
+                shares = [query["cpu_share"] for query in finished if query["name"].startswith(prefix)]
+                report[mode][f"{prefix}_mean_cpu_share"] = statistics.mean(shares)
+    print(json.dumps(report, indent=2))
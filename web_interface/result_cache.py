@@ -0,0 +1,295 @@
+"""
+Query Result Cache
+
+Keeps the results of executed plans so that repeated queries, like those of
+many dashboards refreshing together, are answered without running them again.
+
+Entries are keyed by a canonical fingerprint of the plan and the data
+version of every table it reads, so reloading a table makes its entries
+unreachable. Memory is bounded by a byte budget, and eviction follows
+GreedyDual-Size: results that took long to compute per byte they occupy
+stay longest. Identical queries arriving while one is running wait for its
+result instead of executing again.
+"""
+
+import argparse
+import hashlib
+import heapq
+import json
+import os
+import sys
+import threading
+import time
+from concurrent.futures import ThreadPoolExecutor
+
+from catalog import TPCH_DIR
+from executor import Executor, Relation
+
+DEFAULT_BUDGET_BYTES = 256 * 1024 * 1024
+
+# Comparisons whose operands can be swapped by reversing the operator
+SWAPPED = {"EQ": "EQ", "NE": "NE", "LT": "GT", "GT": "LT", "LE": "GE", "GE": "LE"}
+
+
+# ------------------ Fingerprints ------------------ #
+def flatten(condition, connective):
+    if condition.get("type") == connective:
+        return flatten(condition["left"], connective) + flatten(condition["right"], connective)
+    return [condition]
+
+
+def canonicalize(node):
+    """
+    Rewrite a plan so that queries differing only in how their conditions
+    are written get the same form: AND/OR chains become sorted operand lists
+    and comparisons put the smaller operand on the left.
+    """
+    if isinstance(node, list):
+        return [canonicalize(item) for item in node]
+    if not isinstance(node, dict):
+        return node
+
+    node_type = node.get("type")
+    if node_type in ("AND", "OR"):
+        operands = [canonicalize(operand) for operand in flatten(node, node_type)]
+        return {"type": node_type, "operands": sorted(operands, key=lambda o: json.dumps(o, sort_keys=True))}
+    if node_type in SWAPPED and "left" in node and "right" in node:
+        left, right = canonicalize(node["left"]), canonicalize(node["right"])
+        if json.dumps(right, sort_keys=True) < json.dumps(left, sort_keys=True):
+            return {"type": SWAPPED[node_type], "left": right, "right": left}
+        return {"type": node_type, "left": left, "right": right}
+    return {key: canonicalize(value) for key, value in node.items()}
+
+
+def plan_fingerprint(plan):
+    """SHA-256 of the canonical plan JSON."""
+    canonical = json.dumps(canonicalize(plan), sort_keys=True, separators=(",", ":"))
+    return hashlib.sha256(canonical.encode()).hexdigest()
+
+
+def referenced_tables(node):
+    """Lowercase names of the tables and views a plan reads."""
+    if isinstance(node, list):
+        return set().union(*[referenced_tables(item) for item in node]) if node else set()
+    if not isinstance(node, dict):
+        return set()
+    if node.get("type") == "base_relation":
+        return {table["name"].lower() for table in node["tables"]}
+    return set().union(*[referenced_tables(value) for value in node.values()]) if node else set()
+
+
+def result_size(relation):
+    """Approximate memory held by a result, in bytes."""
+    size = sys.getsizeof(relation.rows)
+    for row in relation.rows:
+        size += sys.getsizeof(row) + sum(sys.getsizeof(value) for value in row)
+    return size
+
+
+# ------------------ Cache ------------------ #
+class CacheEntry:
+    def __init__(self, key, tables, result, size, cost):
+        self.key = key
+        self.tables = tables
+        self.result = result
+        self.size = size
+        self.cost = cost
+        self.priority = 0.0
+
+
+class InFlight:
+    """A query being executed, which identical queries wait on."""
+
+    def __init__(self):
+        self.done = threading.Event()
+        self.result = None
+        self.error = None
+
+
+class ResultCache:
+    """
+    Thread-safe result cache in front of the plan executor.
+
+    Args:
+        data_dir (str): Directory containing the .tbl files
+        budget_bytes (int): Memory the cached results may take
+    """
+
+    def __init__(self, data_dir=TPCH_DIR, budget_bytes=DEFAULT_BUDGET_BYTES):
+        self.data_dir = data_dir
+        self.budget_bytes = budget_bytes
+        self.entries = {}
+        self.heap = []
+        self.inflation = 0.0
+        self.used_bytes = 0
+        self.epochs = {}
+        self.in_flight = {}
+        self.lock = threading.Lock()
+        self.stats = {"hits": 0, "misses": 0, "coalesced": 0, "evictions": 0,
+                      "invalidations": 0, "uncacheable": 0}
+
+    def table_version(self, table):
+        """
+        Version of a table's data: its invalidation epoch and the size and
+        modification time of its .tbl file, which change when it is reloaded.
+        """
+        try:
+            stat = os.stat(os.path.join(self.data_dir, f"{table}.tbl"))
+            file_version = (stat.st_mtime_ns, stat.st_size)
+        except FileNotFoundError:
+            file_version = None
+        return (self.epochs.get(table, 0), file_version)
+
+    def cache_key(self, plan):
+        tables = referenced_tables(plan)
+        versions = json.dumps({table: self.table_version(table) for table in sorted(tables)})
+        return f"{plan_fingerprint(plan)}:{hashlib.sha256(versions.encode()).hexdigest()}", tables
+
+    def execute(self, plan, run=None):
+        """
+        Return the result of a plan, from the cache when its tables have not
+        changed since it was computed.
+
+        Args:
+            plan (dict): Plan JSON accepted by Executor.execute
+            run (function): Computes the plan's Relation on a miss, such as
+                            an Executor configured by the caller; by default
+                            a plain Executor over data_dir
+
+        Returns:
+            Relation: Result columns and rows, shared between callers and
+                      not to be modified
+        """
+        key, tables = self.cache_key(plan)
+
+        with self.lock:
+            entry = self.entries.get(key)
+            if entry is not None:
+                self.stats["hits"] += 1
+                self._push(entry)
+                return entry.result
+            waiting = self.in_flight.get(key)
+            if waiting is None:
+                self.stats["misses"] += 1
+                waiting = self.in_flight[key] = InFlight()
+                leader = True
+            else:
+                self.stats["coalesced"] += 1
+                leader = False
+
+        if not leader:
+            waiting.done.wait()
+            if waiting.error is not None:
+                raise waiting.error
+            return waiting.result
+
+        try:
+            start = time.perf_counter()
+            result = run(plan) if run is not None else Executor(self.data_dir).execute(plan)
+            result = Relation(result.columns, [tuple(row) for row in result.rows])
+            cost = time.perf_counter() - start
+            waiting.result = result
+            # Cached before the query stops being in flight, so that no
+            # identical query misses in between
+            self.insert(plan, CacheEntry(key, tables, result, result_size(result), cost))
+        except Exception as e:
+            waiting.error = e
+            raise
+        finally:
+            with self.lock:
+                del self.in_flight[key]
+            waiting.done.set()
+        return result
+
+    def insert(self, plan, entry):
+        with self.lock:
+            # A table may have changed while the query ran
+            if entry.size > self.budget_bytes or self.cache_key(plan)[0] != entry.key:
+                self.stats["uncacheable"] += 1
+                return
+            if entry.key in self.entries:
+                return
+            # Results of the same plan over older data can never be hit again
+            fingerprint = entry.key.split(":")[0]
+            for stale in [e for e in self.entries.values() if e.key.split(":")[0] == fingerprint]:
+                self._remove(stale)
+                self.stats["invalidations"] += 1
+            while self.used_bytes + entry.size > self.budget_bytes:
+                self._evict()
+            self.entries[entry.key] = entry
+            self.used_bytes += entry.size
+            self._push(entry)
+
+    def _push(self, entry):
+        # GreedyDual-Size: an entry's priority is the inflation value when it
+        # was last used plus its recomputation cost per byte
+        entry.priority = self.inflation + entry.cost / max(entry.size, 1)
+        heapq.heappush(self.heap, (entry.priority, id(entry), entry))
+        if len(self.heap) > 4 * len(self.entries) + 64:
+            self._compact()
+
+    def _compact(self):
+        self.heap = [item for item in self.heap
+                     if self.entries.get(item[2].key) is item[2] and item[0] == item[2].priority]
+        heapq.heapify(self.heap)
+
+    def _evict(self):
+        while self.heap:
+            priority, _, entry = heapq.heappop(self.heap)
+            # Skip heap items left behind by hits, invalidations and evictions
+            if self.entries.get(entry.key) is not entry or priority != entry.priority:
+                continue
+            self.inflation = priority
+            self._remove(entry)
+            self.stats["evictions"] += 1
+            return
+
+    def _remove(self, entry):
+        del self.entries[entry.key]
+        self.used_bytes -= entry.size
+
+    def invalidate(self, table):
+        """
+        Drop every result that read a table, when it is reloaded or appended
+        to outside of this process' view of its .tbl file.
+        """
+        table = table.lower()
+        with self.lock:
+            self.epochs[table] = self.epochs.get(table, 0) + 1
+            for entry in [entry for entry in self.entries.values() if table in entry.tables]:
+                self._remove(entry)
+                self.stats["invalidations"] += 1
+            self._compact()
+
+    def summary(self):
+        with self.lock:
+            return {**self.stats, "entries": len(self.entries), "used_bytes": self.used_bytes,
+                    "budget_bytes": self.budget_bytes}
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Run the same plan from many clients through the result cache")
+    parser.add_argument("plan", help="Plan JSON file")
+    parser.add_argument("data_dir", nargs="?", default=TPCH_DIR, help="Directory containing the .tbl files")
+    parser.add_argument("--clients", type=int, default=8, help="Concurrent clients issuing the plan")
+    parser.add_argument("--rounds", type=int, default=3, help="Times each client issues it")
+    parser.add_argument("--budget-mb", type=float, default=DEFAULT_BUDGET_BYTES / (1024 * 1024))
+    args = parser.parse_args()
+
+    with open(args.plan) as f:
+        plan = json.load(f)
+
+    cache = ResultCache(args.data_dir, int(args.budget_mb * 1024 * 1024))
+
+    def client(_):
+        latencies = []
+        for _ in range(args.rounds):
+            start = time.perf_counter()
+            cache.execute(plan)
+            latencies.append(time.perf_counter() - start)
+        return latencies
+
+    with ThreadPoolExecutor(max_workers=args.clients) as pool:
+        latencies = sorted(l for client_latencies in pool.map(client, range(args.clients)) for l in client_latencies)
+    print(json.dumps({"requests": len(latencies), "max_seconds": latencies[-1],
+                      "median_seconds": latencies[len(latencies) // 2], **cache.summary()}, indent=2))
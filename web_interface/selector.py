@@ -1,6 +1,10 @@
 import json
 import copy
 
+def relation_key(node):
+    """Key a base relation by its tables only, ignoring plan annotations such as pruned partitions"""
+    return json.dumps({k: v for k, v in node.items() if k not in ('cost', 'cardinality', 'partitions')})
+
 def add_selects(original_json_inp, joined_json_inp):
     mapping = {}
 
@@ -15,7 +19,7 @@ def add_selects(original_json_inp, joined_json_inp):
             if node['input']['type'] == 'base_relation':
                 if 'alias' in node['input']["tables"][0]:
                     del node['input']["tables"][0]['alias']
-                mapping[json.dumps(node['input'])] = node
+                mapping[relation_key(node['input'])] = node
                 return
             else:
                 find_base_relations(node['input'])
@@ -23,7 +27,7 @@ def add_selects(original_json_inp, joined_json_inp):
         elif node['type'] == 'base_relation':
             if 'alias' in node["tables"][0]:
                 del node["tables"][0]['alias']
-            mapping[json.dumps(node)] = node
+            mapping[relation_key(node)] = node
             return
         elif node['type'] == 'join':
             find_base_relations(node['left'])
@@ -51,9 +55,9 @@ def add_selects(original_json_inp, joined_json_inp):
                     del left_node["tables"][0]['alias']
                 print("Checking:")
                 print(json.dumps(left_node, indent=4))
-                if json.dumps(left_node) in mapping:
+                if relation_key(left_node) in mapping:
                     # get the corresponding select node
-                    select_node = mapping[json.dumps(left_node)]
+                    select_node = mapping[relation_key(left_node)]
                     # add the select node to the left node
                     node['left'] = copy.deepcopy(select_node)
             else:
@@ -66,9 +70,9 @@ def add_selects(original_json_inp, joined_json_inp):
                     del right_node["tables"][0]['alias']
                 print("Checking:")
                 print(json.dumps(right_node, indent=4))
-                if json.dumps(right_node) in mapping:
+                if relation_key(right_node) in mapping:
                     # get the corresponding select node
-                    select_node = mapping[json.dumps(right_node)]
+                    select_node = mapping[relation_key(right_node)]
                     # add the select node to the right node
                     node['right'] = copy.deepcopy(select_node)
         else:
@@ -0,0 +1,197 @@
+"""
+Shared Scans
+
+Lets concurrent queries reading the same table share one pass over its .tbl
+file. Each table has at most one circular scan running: a query attaches
+at the scan's current batch, receives every batch from there to the end of
+the file, and then the batches before its starting point once the scan
+wraps around. Batches are parsed once for all attached queries, and each
+query only keeps the rows passing its own pushed-down filter.
+"""
+
+import argparse
+import json
+import os
+import threading
+import time
+
+from catalog import TPCH_DIR
+
+BATCH_ROWS = 4096
+
+
+class ScanConsumer:
+    """A query attached to a circular scan."""
+
+    def __init__(self, keep, start):
+        self.keep = keep
+        self.start = start
+        self.batches = 0
+        self.rows_seen = 0
+        self.rows = []
+        self.done = threading.Event()
+
+
+class CircularScan:
+    """
+    Scan of one file that loops over it for as long as queries are attached.
+    The thread reading it stops when the last query detaches, and the next
+    query resumes from where it stopped.
+    """
+
+    def __init__(self, path, parse, manager):
+        self.path = path
+        self.parse = parse
+        self.manager = manager
+        self.consumers = []
+        self.index = 0       # Batch the scan delivers next
+        self.offset = 0      # Byte offset of that batch
+        self.thread = None
+        self.lock = threading.Lock()
+
+    def attach(self, keep):
+        with self.lock:
+            consumer = ScanConsumer(keep, self.index)
+            self.consumers.append(consumer)
+            if self.thread is None:
+                self.thread = threading.Thread(target=self.run, daemon=True)
+                self.thread.start()
+        consumer.done.wait()
+        return consumer
+
+    def finish(self, consumer):
+        # Called with the lock held
+        self.consumers.remove(consumer)
+        consumer.done.set()
+
+    def run(self):
+        with open(self.path, 'rb') as f:
+            f.seek(self.offset)
+            while True:
+                lines = []
+                while len(lines) < self.manager.batch_rows:
+                    line = f.readline()
+                    if not line:
+                        break
+                    lines.append(line)
+
+                if not lines:
+                    with self.lock:
+                        if self.index == 0:
+                            # Empty file: nothing to wait for
+                            for consumer in list(self.consumers):
+                                self.finish(consumer)
+                        else:
+                            # Wrap around; queries that attached at the end
+                            # of the file start with the first batch
+                            for consumer in list(self.consumers):
+                                if consumer.start == self.index:
+                                    consumer.start = 0
+                                elif consumer.start == 0 and consumer.batches:
+                                    self.finish(consumer)
+                            self.index = 0
+                            self.offset = 0
+                            f.seek(0)
+                        if not self.consumers:
+                            self.thread = None
+                            return
+                    continue
+
+                rows = [self.parse(line.decode()) for line in lines]
+                self.manager.count("batches_read")
+                self.manager.count("rows_read", len(rows))
+
+                # Everyone attached by now gets this batch, the others start
+                # with the next one
+                with self.lock:
+                    consumers = list(self.consumers)
+                    self.index += 1
+                    self.offset = f.tell()
+
+                for consumer in consumers:
+                    consumer.rows.extend(rows if consumer.keep is None else filter(consumer.keep, rows))
+                    consumer.batches += 1
+                    consumer.rows_seen += len(rows)
+                self.manager.count("batch_deliveries", len(consumers))
+
+                with self.lock:
+                    for consumer in consumers:
+                        if consumer.start == self.index:
+                            self.finish(consumer)
+                    if not self.consumers:
+                        self.thread = None
+                        return
+
+
+class SharedScanManager:
+    """
+    Hands out the circular scans of a data directory to executors.
+
+    Args:
+        batch_rows (int): Rows read and parsed at a time
+    """
+
+    def __init__(self, batch_rows=BATCH_ROWS):
+        self.batch_rows = batch_rows
+        self.scans = {}
+        self.lock = threading.Lock()
+        self.stats = {"scans_attached": 0, "batches_read": 0, "rows_read": 0, "batch_deliveries": 0}
+
+    def count(self, key, amount=1):
+        with self.lock:
+            self.stats[key] += amount
+
+    def scan(self, path, parse, keep=None):
+        """
+        Read every row of a file through its shared scan.
+
+        Args:
+            path (str): .tbl file
+            parse (function): Turns a line of the file into a row tuple
+            keep (function): Filter on the parsed rows, optional
+
+        Returns:
+            tuple: (rows passing keep, rows read for this query)
+        """
+        path = os.path.abspath(path)
+        with self.lock:
+            scan = self.scans.get(path)
+            if scan is None:
+                scan = self.scans[path] = CircularScan(path, parse, self)
+            self.stats["scans_attached"] += 1
+        consumer = scan.attach(keep)
+        return consumer.rows, consumer.rows_seen
+
+
+if __name__ == "__main__":
+    from executor import Executor
+
+    parser = argparse.ArgumentParser(description="Run a plan from concurrent clients with and without shared scans")
+    parser.add_argument("plan", help="Plan JSON file")
+    parser.add_argument("data_dir", nargs="?", default=TPCH_DIR, help="Directory containing the .tbl files")
+    parser.add_argument("--clients", type=int, default=4, help="Concurrent queries")
+    args = parser.parse_args()
+
+    with open(args.plan) as f:
+        plan = json.load(f)
+
+    report = {}
+    outputs = {}
+    for mode in ("independent", "shared"):
+        manager = SharedScanManager() if mode == "shared" else None
+        results = [None] * args.clients
+
+        def client(i):
+            results[i] = Executor(args.data_dir, shared_scans=manager).execute(plan)
+
+        threads = [threading.Thread(target=client, args=(i,)) for i in range(args.clients)]
+        start = time.perf_counter()
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        report[mode] = {"seconds": time.perf_counter() - start, **(manager.stats if manager else {})}
+        outputs[mode] = [sorted(result.rows) for result in results]
+
+    report["same_result"] = outputs["independent"] == outputs["shared"]
+    print(json.dumps(report, indent=2))
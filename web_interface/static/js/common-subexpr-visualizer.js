@@ -167,7 +167,7 @@ class CommonSubexprVisualizer {
                     switch (expr.type) {
                         case 'project':
                             exprDesc.textContent = `Projection of columns: ${expr.columns.map(col => 
-                                col.table ? `${col.table}.${col.attr}` : col.attr).join(', ')}`;
+                                col.expr ? (col.alias || 'expr') : col.table ? `${col.table}.${col.attr}` : col.attr).join(', ')}`;
                             break;
                         case 'base_relation':
                             exprDesc.textContent = `Base relation: ${expr.tables.map(t => t.name).join(', ')}`;
@@ -17,6 +17,8 @@ class RelationalAlgebraGraph {
             "join": { className: "graph-node-join", label: "JOIN", size: 80 },
             "base_relation": { className: "graph-node-base", label: "TABLE", size: 70 },
             "subquery": { className: "graph-node-subquery", label: "SUBQUERY", size: 90 },
+            "with": { className: "graph-node-subquery", label: "WITH", size: 80 },
+            "cte_ref": { className: "graph-node-base", label: "CTE", size: 70 },
             "default": { className: "", label: "OP", size: 70 }
         };
         
@@ -90,6 +92,8 @@ class RelationalAlgebraGraph {
             // For subqueries, extract more meaningful information
             nodeType = 'subquery';
             nodeLabel = node.alias ? `SUBQUERY (${node.alias})` : 'SUBQUERY';
+        } else if (nodeType === 'cte_ref') {
+            nodeLabel = `CTE (${node.name})`;
         } else {
             // Get node configuration based on type
             const nodeConfig = this.nodeTypes[node.type] || this.nodeTypes.default;
@@ -137,6 +141,11 @@ class RelationalAlgebraGraph {
             this.processData(node.query, nodeId, depth + 1);
         }
         
+        // Each common table expression hangs below the WITH node
+        if (node.type === 'with' && node.ctes) {
+            node.ctes.forEach(cte => this.processData(cte.query, nodeId, depth + 1));
+        }
+        
         return nodeId;
     }
     
@@ -149,7 +158,9 @@ class RelationalAlgebraGraph {
             "project": "graph-node-project",
             "join": "graph-node-join",
             "base_relation": "graph-node-base",
-            "subquery": "graph-node-subquery"
+            "subquery": "graph-node-subquery",
+            "with": "graph-node-subquery",
+            "cte_ref": "graph-node-base"
         };
         
         return classMap[type] || "";
@@ -450,7 +461,7 @@ class RelationalAlgebraGraph {
             case 'project':
                 if (node.data.columns && node.data.columns.length > 0) {
                     tooltipContent += node.data.columns.map(c => 
-                        c.table ? `${c.table}.${c.attr}` : c.attr).join(', ');
+                        c.expr ? (c.alias || 'expr') : c.table ? `${c.table}.${c.attr}` : c.attr).join(', ');
                 }
                 break;
                 
@@ -468,6 +479,16 @@ class RelationalAlgebraGraph {
                 }
                 break;
                 
+            case 'with':
+                tooltipContent += node.data.ctes.map(cte => 
+                    cte.materialized ? `${cte.name} (materialized)` : cte.name).join(', ');
+                break;
+                
+            case 'cte_ref':
+                tooltipContent += node.data.alias && node.data.alias !== node.data.name ?
+                    `${node.data.name} AS ${node.data.alias}` : node.data.name;
+                break;
+                
             default:
                 // For other node types, just show the type
                 tooltipContent += node.type.toUpperCase();
@@ -553,6 +574,12 @@ class RelationalAlgebraGraph {
             case 'subquery':
                 return `SUBQUERY: ${node.data.alias || 'unnamed'}`;
                 
+            case 'with':
+                return `WITH: ${node.data.ctes.map(cte => cte.name).join(', ')}`;
+                
+            case 'cte_ref':
+                return `CTE: ${node.data.name}${node.data.alias !== node.data.name ? ` (${node.data.alias})` : ''}`;
+                
             default:
                 return node.label || node.type.toUpperCase();
         }
@@ -586,11 +613,15 @@ class RelationalAlgebraGraph {
             "LTE": "≤",
             "AND": "AND",
             "OR": "OR",
-            "NOT": "NOT"
+            "NOT": "NOT",
+            "ADD": "+",
+            "SUB": "-",
+            "MUL": "*",
+            "DIV": "/"
         };
         
         if (condition.left && condition.right) {
-            const operator = operators[condition.type] || condition.type;
+            const operator = operators[condition.op || condition.type] || condition.type;
             return `${this.formatCondition(condition.left)} ${operator} ${this.formatCondition(condition.right)}`;
         }
         
@@ -393,7 +393,7 @@ class JoinOptimizationVisualizer {
                     case 'project':
                         if (node.data.columns && node.data.columns.length > 0) {
                             tooltipContent = `COLUMNS: ${node.data.columns.map(col => 
-                                col.table ? `${col.table}.${col.attr}` : col.attr).join(', ')}`;
+                                col.expr ? (col.alias || 'expr') : col.table ? `${col.table}.${col.attr}` : col.attr).join(', ')}`;
                         }
                         break;
                     case 'join':
@@ -466,11 +466,15 @@ class JoinOptimizationVisualizer {
                     "LTE": "≤",
                     "AND": "AND",
                     "OR": "OR",
-                    "NOT": "NOT"
+                    "NOT": "NOT",
+                    "ADD": "+",
+                    "SUB": "-",
+                    "MUL": "*",
+                    "DIV": "/"
                 };
                 
                 if (condition.left && condition.right) {
-                    const operator = operators[condition.type] || condition.type;
+                    const operator = operators[condition.op || condition.type] || condition.type;
                     return `${this.formatCondition(condition.left)} ${operator} ${this.formatCondition(condition.right)}`;
                 }
                 
@@ -440,7 +440,7 @@ class QueryOptimizationVisualizer {
                     case 'project':
                         if (node.data.columns && node.data.columns.length > 0) {
                             tooltipContent = `COLUMNS: ${node.data.columns.map(col => 
-                                col.table ? `${col.table}.${col.attr}` : col.attr).join(', ')}`;
+                                col.expr ? (col.alias || 'expr') : col.table ? `${col.table}.${col.attr}` : col.attr).join(', ')}`;
                         }
                         break;
                     case 'join':
@@ -505,11 +505,15 @@ class QueryOptimizationVisualizer {
                     "LTE": "≤",
                     "AND": "AND",
                     "OR": "OR",
-                    "NOT": "NOT"
+                    "NOT": "NOT",
+                    "ADD": "+",
+                    "SUB": "-",
+                    "MUL": "*",
+                    "DIV": "/"
                 };
                 
                 if (condition.left && condition.right) {
-                    const operator = operators[condition.type] || condition.type;
+                    const operator = operators[condition.op || condition.type] || condition.type;
                     return `${this.formatCondition(condition.left)} ${operator} ${this.formatCondition(condition.right)}`;
                 }
                 
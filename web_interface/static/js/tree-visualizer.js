@@ -25,6 +25,8 @@ class RelationalAlgebraTree {
             "limit": { label: "LIMIT", icon: "🔢" },
             "group": { label: "GROUP", icon: "📊" },
             "distinct": { label: "DISTINCT", icon: "🎯" },
+            "with": { label: "WITH", icon: "📦" },
+            "cte_ref": { label: "CTE SCAN", icon: "📋" },
             // Default for any unrecognized types
             "default": { label: "OPERATION", icon: "⚙️" }
         };
@@ -43,7 +45,11 @@ class RelationalAlgebraTree {
             "IN": "IN",
             "LIKE": "LIKE",
             "IS": "IS",
-            "BETWEEN": "BETWEEN"
+            "BETWEEN": "BETWEEN",
+            "ADD": "+",
+            "SUB": "-",
+            "MUL": "*",
+            "DIV": "/"
         };
     }
     
@@ -111,6 +117,7 @@ class RelationalAlgebraTree {
         // Check for common child patterns in relational algebra operations
         return node.input || 
                node.left || 
+               (node.ctes && node.ctes.length > 0) ||
                (node.tables && node.tables.length > 0) ||
                (node.columns && node.columns.length > 0);
     }
@@ -153,6 +160,10 @@ class RelationalAlgebraTree {
                 if (node.columns && node.columns.length > 0) {
                     detailSpan.innerHTML = ': ' + node.columns.map(col => {
                         let colStr = '';
+                        if (col.expr) {
+                            colStr = this.formatCondition(col.expr);
+                            return col.alias ? `${colStr} AS ${this.escapeHtml(col.alias)}` : colStr;
+                        }
                         if (col.table) {
                             colStr += `<span class="tree-table">${this.escapeHtml(col.table)}</span>.`;
                         }
@@ -162,6 +173,20 @@ class RelationalAlgebraTree {
                 }
                 break;
                 
+            case 'with':
+                detailSpan.innerHTML = ': ' + node.ctes.map(cte => {
+                    let name = `<span class="tree-table">${this.escapeHtml(cte.name)}</span>`;
+                    return cte.materialized ? `${name} (materialized)` : name;
+                }).join(', ');
+                break;
+                
+            case 'cte_ref':
+                detailSpan.innerHTML = `: <span class="tree-table">${this.escapeHtml(node.name)}</span>`;
+                if (node.alias && node.alias !== node.name) {
+                    detailSpan.innerHTML += ` AS <span class="tree-table">${this.escapeHtml(node.alias)}</span>`;
+                }
+                break;
+                
             case 'join':
             case 'left_join':
             case 'right_join':
@@ -230,6 +255,11 @@ class RelationalAlgebraTree {
             parentUl.appendChild(this.createTreeNodeElement(node.right));
         }
         
+        // Common table expressions follow the main query of a WITH node
+        if (node.ctes) {
+            node.ctes.forEach(cte => parentUl.appendChild(this.createTreeNodeElement(cte.query)));
+        }
+        
         // For base_relation with tables
         if (node.tables && node.tables.length > 0 && node.type === 'base_relation') {
             // Tables are already displayed in the node details, not as children
@@ -273,7 +303,7 @@ class RelationalAlgebraTree {
         
         // Handle binary operations
         if (condition.left && condition.right) {
-            const operator = this.operators[condition.type] || condition.type;
+            const operator = this.operators[condition.op || condition.type] || condition.type;
             
             // Special handling for AND/OR to add parentheses
             if (condition.type === 'AND' || condition.type === 'OR') {
@@ -58,7 +58,12 @@ class QueryTreeOptimizer:
             if isinstance(node, dict) and 'table' in node and 'attr' in node:
                 # Only consider column references significant if they're part of a larger expression
                 return False  # We're skipping column_refs in this version
-            
+
+            # Literals (including constants folded by the parser) are cheaper
+            # to repeat than to reference
+            if isinstance(node, dict) and node.get('type') in ('int', 'float', 'string'):
+                return False
+
             return (isinstance(node, dict) and 
                     'type' in node and 
                     len(node) >= 2)  # Consider any expression with at least 2 attributes
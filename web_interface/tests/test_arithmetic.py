@@ -0,0 +1,119 @@
+"""
+Arithmetic expressions: constant folding in the parser, which must leave
+alone what it cannot compute exactly, the string form predicate pushdown
+round-trips them through, and their cost.
+
+Run from web_interface with: python -m unittest discover tests
+"""
+
+import os
+import unittest
+
+from cost_populator import CostCalculator, count_arith_operators
+from materialized_views import PARSER, parse_sql
+from predicate_pushdown import format_condition_from_json, parse_condition_to_json
+
+STATISTICS = {"lineitem": {"row_count": 6000, "page_count": 100, "columns": {}},
+              "orders": {"row_count": 1500, "page_count": 30, "columns": {}}}
+
+
+class StatisticsCalculator(CostCalculator):
+    """CostCalculator reading fixed statistics instead of PostgreSQL's."""
+
+    def get_table_statistics(self, table_name):
+        return STATISTICS[table_name.lower()]
+
+    def get_partition_statistics(self, table_name, partitions):
+        return STATISTICS[table_name.lower()]
+
+
+def column(table, attr):
+    return {"table": table, "attr": attr}
+
+
+def arith(op, left, right):
+    return {"type": "arith", "op": op, "left": left, "right": right}
+
+
+def scan(name, alias):
+    return {"type": "base_relation", "tables": [{"name": name, "alias": alias}]}
+
+
+# L_EXTENDEDPRICE * (1 - L_DISCOUNT)
+REVENUE = arith("MUL", column("L", "L_EXTENDEDPRICE"), arith("SUB", {"type": "int", "value": 1},
+                                                               column("L", "L_DISCOUNT")))
+
+
+class ArithmeticCostTest(unittest.TestCase):
+    def setUp(self):
+        self.calculator = StatisticsCalculator({})
+
+    def test_operators_are_counted(self):
+        self.assertEqual(count_arith_operators(REVENUE), 2)
+        self.assertEqual(count_arith_operators({"type": "GT", "left": REVENUE, "right": column("L", "L_TAX")}), 2)
+        self.assertEqual(count_arith_operators(column("L", "L_TAX")), 0)
+
+    def test_computed_columns_are_charged_to_the_parent(self):
+        project = {"type": "project", "columns": [column("L", "L_ORDERKEY"), {"expr": REVENUE, "alias": "REV"}],
+                   "input": scan("LINEITEM", "L")}
+        plan = {"type": "join", "condition": None, "left": project, "right": scan("ORDERS", "O")}
+        self.calculator.calculate_cost(plan)
+        scan_cost = plan["left"]["input"]["cost"]
+        self.assertAlmostEqual(project["cost"], scan_cost + 6000 * self.calculator.cpu_operator_cost * 2)
+        self.assertEqual(project["cardinality"], 6000)
+        self.assertAlmostEqual(plan["cost"], project["cost"] + plan["right"]["cost"] + 1500)
+
+    def test_select_charges_a_comparison_plus_each_operation(self):
+        select = {"type": "select", "condition": {"type": "GT", "left": REVENUE, "right": {"type": "int", "value": 100}},
+                  "input": scan("LINEITEM", "L")}
+        self.calculator.calculate_cost(select)
+        self.assertAlmostEqual(select["cost"], select["input"]["cost"] + 6000 * self.calculator.cpu_operator_cost * 3)
+
+
+class ArithmeticRoundTripTest(unittest.TestCase):
+    def round_trip(self, condition):
+        return parse_condition_to_json(format_condition_from_json(condition))
+
+    def test_nested_expression(self):
+        condition = {"type": "GT", "left": REVENUE, "right": {"type": "float", "value": 100.5}}
+        self.assertEqual(self.round_trip(condition), condition)
+
+    def test_subtraction_stays_left_associative(self):
+        left_nested = arith("SUB", arith("SUB", column("O", "A"), column("O", "B")), column("O", "C"))
+        right_nested = arith("SUB", column("O", "A"), arith("SUB", column("O", "B"), column("O", "C")))
+        for expr in (left_nested, right_nested):
+            condition = {"type": "LT", "left": expr, "right": {"type": "int", "value": 0}}
+            self.assertEqual(self.round_trip(condition), condition)
+        self.assertEqual(parse_condition_to_json("O.A - O.B - O.C < 0")["left"], left_nested)
+
+
+@unittest.skipUnless(os.path.exists(PARSER), "the SQL parser is not built")
+class ConstantFoldingTest(unittest.TestCase):
+    def folded(self, expr_sql):
+        plan = parse_sql(f"SELECT {expr_sql} AS X FROM LINEITEM L")
+        return plan["columns"][0]["expr"]
+
+    def test_literals_are_folded(self):
+        self.assertEqual(self.folded("3 * 4 - 2"), {"type": "int", "value": 10})
+        self.assertEqual(self.folded("7 / 2"), {"type": "int", "value": 3})
+        self.assertEqual(self.folded("-5 + 2"), {"type": "int", "value": -3})
+        self.assertEqual(self.folded("1.5 * 2"), {"type": "float", "value": 3.0})
+        self.assertEqual(self.folded("0 - 2147483647 - 1"), {"type": "int", "value": -2147483648})
+
+    def test_columns_are_not_folded(self):
+        self.assertEqual(self.folded("L.L_TAX * (1 + 1)"),
+                         arith("MUL", {"type": "column", **column("L", "L_TAX")}, {"type": "int", "value": 2}))
+
+    def test_int_overflow_is_left_unfolded(self):
+        for expr_sql, op in [("2147483647 + 1", "ADD"), ("0 - 2147483647 - 2", "SUB"), ("65536 * 65536", "MUL"),
+                             ("(0 - 2147483647 - 1) / (0 - 1)", "DIV")]:
+            expr = self.folded(expr_sql)
+            self.assertEqual(expr["type"], "arith", expr_sql)
+            self.assertEqual(expr["op"], op, expr_sql)
+
+    def test_division_by_zero_is_left_unfolded(self):
+        self.assertEqual(self.folded("1 / 0")["type"], "arith")
+
+
+if __name__ == "__main__":
+    unittest.main()
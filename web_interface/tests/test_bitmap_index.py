@@ -0,0 +1,105 @@
+"""
+Roaring bitmap algebra across array and bitmap containers, and when a
+condition can be answered from bitmap indexes and whether exactly.
+
+Run from web_interface with: python -m unittest discover tests
+"""
+
+import unittest
+
+from bitmap_index import ARRAY_MAX, CHUNK_SIZE, BitmapIndex, RoaringBitmap, evaluate_bitmap_condition
+
+ROWS = 3 * CHUNK_SIZE + 100
+
+
+def bitmap(row_ids):
+    return RoaringBitmap.from_sorted(sorted(row_ids))
+
+
+class RoaringBitmapTest(unittest.TestCase):
+    def setUp(self):
+        # Dense in the first chunk (a bitmap container), sparse elsewhere
+        self.evens = set(range(0, CHUNK_SIZE, 2)) | {CHUNK_SIZE + 7, 3 * CHUNK_SIZE + 99}
+        self.threes = set(range(0, ROWS, 3))
+
+    def test_containers_switch_representation(self):
+        dense = bitmap(self.evens)
+        self.assertIsInstance(dense.containers[0], int)
+        self.assertIsInstance(dense.containers[1], list)
+        self.assertEqual(len(bitmap(range(ARRAY_MAX)).containers[0]), ARRAY_MAX)
+        self.assertIsInstance(bitmap(range(ARRAY_MAX + 1)).containers[0], int)
+
+    def test_set_operations(self):
+        a, b = bitmap(self.evens), bitmap(self.threes)
+        self.assertEqual(set(a & b), self.evens & self.threes)
+        self.assertEqual(set(a | b), self.evens | self.threes)
+        self.assertEqual(set(a - b), self.evens - self.threes)
+        self.assertEqual(set(b - a), self.threes - self.evens)
+        self.assertEqual(len(a | b), len(self.evens | self.threes))
+
+    def test_complement_stops_at_row_count(self):
+        a = bitmap(self.evens)
+        complement = a.complement(ROWS)
+        self.assertEqual(set(complement), set(range(ROWS)) - self.evens)
+        self.assertNotIn(ROWS, complement)
+        self.assertEqual(len(bitmap([]).complement(ROWS)), ROWS)
+
+    def test_empty_results_drop_their_container(self):
+        result = bitmap([1, 2]) & bitmap([CHUNK_SIZE + 1])
+        self.assertEqual(result.container_count(), 0)
+        self.assertEqual(len(result), 0)
+
+
+class EvaluateBitmapConditionTest(unittest.TestCase):
+    def setUp(self):
+        modes = ["AIR", "MAIL", "SHIP"]
+        self.indexes = {"l_shipmode": BitmapIndex("lineitem", "l_shipmode", 30, {
+            mode: bitmap(range(i, 30, 3)) for i, mode in enumerate(modes)})}
+
+    def evaluate(self, condition):
+        return evaluate_bitmap_condition(condition, self.indexes, 30)
+
+    @staticmethod
+    def eq(attr, value, op="EQ"):
+        return {"type": op, "left": {"table": "L", "attr": attr}, "right": {"type": "string", "value": value}}
+
+    def test_equality_and_in_are_exact(self):
+        rows, exact, columns = self.evaluate(self.eq("L_SHIPMODE", "AIR"))
+        self.assertEqual(set(rows), set(range(0, 30, 3)))
+        self.assertTrue(exact)
+        self.assertEqual(columns, {"l_shipmode"})
+        in_list = {"type": "IN", "left": {"table": "L", "attr": "L_SHIPMODE"},
+                   "right": {"type": "list", "values": [{"type": "string", "value": "AIR"},
+                                                        {"type": "string", "value": "SHIP"}]}}
+        self.assertEqual(len(self.evaluate(in_list)[0]), 20)
+
+    def test_ne_complements_within_the_table(self):
+        rows, exact, _ = self.evaluate(self.eq("L_SHIPMODE", "AIR", "NE"))
+        self.assertEqual(set(rows), {row for row in range(30) if row % 3})
+        self.assertTrue(exact)
+
+    def test_unindexed_side_of_and_needs_a_recheck(self):
+        condition = {"type": "AND", "left": self.eq("L_SHIPMODE", "MAIL"), "right": self.eq("L_COMMENT", "x")}
+        rows, exact, _ = self.evaluate(condition)
+        self.assertEqual(set(rows), set(range(1, 30, 3)))
+        self.assertFalse(exact)
+
+    def test_unindexed_side_of_or_cannot_use_the_index(self):
+        condition = {"type": "OR", "left": self.eq("L_SHIPMODE", "MAIL"), "right": self.eq("L_COMMENT", "x")}
+        self.assertIsNone(self.evaluate(condition))
+
+    def test_not_of_a_candidate_superset_cannot_use_the_index(self):
+        inexact = {"type": "AND", "left": self.eq("L_SHIPMODE", "MAIL"), "right": self.eq("L_COMMENT", "x")}
+        self.assertIsNone(self.evaluate({"type": "NOT", "cond": inexact}))
+        rows, exact, _ = self.evaluate({"type": "NOT", "cond": self.eq("L_SHIPMODE", "MAIL")})
+        self.assertEqual(len(rows), 20)
+        self.assertTrue(exact)
+
+    def test_unknown_value_matches_nothing(self):
+        rows, exact, _ = self.evaluate(self.eq("L_SHIPMODE", "RAIL"))
+        self.assertEqual(len(rows), 0)
+        self.assertTrue(exact)
+
+
+if __name__ == "__main__":
+    unittest.main()
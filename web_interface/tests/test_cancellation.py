@@ -0,0 +1,151 @@
+"""
+Cancellation: tokens cancelled explicitly or by their deadline, and the
+parser, the join order search and the executor stopping at their next
+check with the progress they reported.
+
+Run from web_interface with: python -m unittest discover tests
+"""
+
+import contextlib
+import io
+import json
+import os
+import shutil
+import subprocess
+import tempfile
+import time
+import unittest
+from unittest import mock
+
+import join_optimization
+from cancellation import CancellationToken, QueryCancelled
+from cost_populator import CostCalculator
+from executor import Executor
+from join_optimization import QueryOptimizer
+
+STATISTICS = {"customer": 15000, "orders": 150000, "lineitem": 600000, "supplier": 1000,
+              "nation": 25, "region": 5, "part": 20000, "partsupp": 80000}
+
+
+class StatisticsCalculator(CostCalculator):
+    """CostCalculator reading fixed statistics instead of PostgreSQL's."""
+
+    def connect(self):
+        pass
+
+    def get_table_statistics(self, table_name):
+        rows = STATISTICS[table_name.lower()]
+        return {"row_count": rows, "page_count": max(1, rows // 50), "table_size": max(1, rows // 50) * 8192,
+                "columns": {}}
+
+
+def scan(name, alias):
+    return {"type": "base_relation", "tables": [{"name": name, "alias": alias}]}
+
+
+def joined(tables, edges):
+    """Plan joining tables in the order given, on (left alias, column, right alias, column) edges."""
+    current = scan(*tables[0])
+    for table, (a, a_attr, b, b_attr) in zip(tables[1:], edges):
+        current = {"type": "join", "left": current, "right": scan(*table),
+                   "condition": {"type": "EQ", "left": {"table": a, "attr": a_attr},
+                                 "right": {"type": "column", "table": b, "attr": b_attr}}}
+    return {"type": "project", "columns": [{"table": "C", "attr": "C_NAME"}], "input": current}
+
+
+EIGHT_TABLES = joined(
+    [("CUSTOMER", "C"), ("ORDERS", "O"), ("LINEITEM", "L"), ("SUPPLIER", "S"), ("NATION", "N"),
+     ("REGION", "R"), ("PART", "P"), ("PARTSUPP", "PS")],
+    [("C", "C_CUSTKEY", "O", "O_CUSTKEY"), ("O", "O_ORDERKEY", "L", "L_ORDERKEY"),
+     ("L", "L_SUPPKEY", "S", "S_SUPPKEY"), ("S", "S_NATIONKEY", "N", "N_NATIONKEY"),
+     ("N", "N_REGIONKEY", "R", "R_REGIONKEY"), ("L", "L_PARTKEY", "P", "P_PARTKEY"),
+     ("PS", "PS_PARTKEY", "P", "P_PARTKEY")])
+
+
+class CancellationTokenTest(unittest.TestCase):
+    def test_first_reason_is_kept(self):
+        token = CancellationToken()
+        self.assertFalse(token.is_cancelled())
+        self.assertIsNone(token.remaining())
+        token.cancel()
+        token.cancel("timed out")
+        self.assertEqual(token.reason, "cancelled")
+
+    def test_deadline_cancels(self):
+        token = CancellationToken(0.01)
+        time.sleep(0.02)
+        self.assertEqual(token.remaining(), 0.0)
+        with self.assertRaises(QueryCancelled) as raised:
+            token.check("planning")
+        self.assertEqual((raised.exception.reason, raised.exception.stage), ("timed out", "planning"))
+
+    def test_checked_stops_at_the_next_morsel(self):
+        token = CancellationToken()
+        token.report(rows=5)
+        seen = []
+        with self.assertRaises(QueryCancelled) as raised:
+            for item in token.checked(range(20), "scan", every=4):
+                seen.append(item)
+                if item == 5:
+                    token.cancel()
+        self.assertEqual(seen, list(range(8)))
+        self.assertEqual(raised.exception.diagnostics["rows"], 5)
+        self.assertIn("elapsed_seconds", raised.exception.diagnostics)
+
+
+class ChildProcessTest(unittest.TestCase):
+    def test_child_is_killed_once_cancelled(self):
+        token = CancellationToken(0.1)
+        start = time.monotonic()
+        with self.assertRaises(QueryCancelled) as raised:
+            token.run(["sleep", "10"], "parsing")
+        self.assertLess(time.monotonic() - start, 5)
+        self.assertTrue(raised.exception.diagnostics["parsing_killed"])
+
+    def test_failures_are_reported_as_for_subprocess_run(self):
+        with self.assertRaises(subprocess.CalledProcessError):
+            CancellationToken().run(["false"], "parsing")
+        self.assertEqual(CancellationToken().run(["echo", "ok"], "parsing").stdout, "ok\n")
+
+
+class ExecutorCancellationTest(unittest.TestCase):
+    def setUp(self):
+        self.data_dir = tempfile.mkdtemp(prefix="cancellation_test_")
+        with open(os.path.join(self.data_dir, "nation.tbl"), "w") as f:
+            f.write("".join(f"{i}|NATION{i}|0|c|\n" for i in range(10000)))
+
+    def tearDown(self):
+        shutil.rmtree(self.data_dir)
+
+    def test_scan_stops_with_the_rows_scanned_so_far(self):
+        token = CancellationToken()
+        plan = {"type": "select", "input": scan("NATION", "N"),
+                "condition": {"type": "GE", "left": {"table": "N", "attr": "N_NATIONKEY"},
+                              "right": {"type": "int", "value": 0}}}
+        self.assertEqual(len(Executor(self.data_dir, cancellation=token).execute(plan).rows), 10000)
+        token.cancel()
+        with self.assertRaises(QueryCancelled) as raised:
+            Executor(self.data_dir, cancellation=token).execute(plan)
+        self.assertEqual(raised.exception.stage, "scan of nation")
+        self.assertIn("rows_scanned", raised.exception.diagnostics["executor"])
+
+
+class JoinSearchCancellationTest(unittest.TestCase):
+    def optimizer(self, token):
+        with mock.patch.object(join_optimization, "CostCalculator", StatisticsCalculator):
+            optimizer = QueryOptimizer({})
+        optimizer.conn = object()
+        optimizer.cancellation = token
+        return optimizer
+
+    def test_enumeration_stops_with_the_orders_generated(self):
+        optimizer = self.optimizer(CancellationToken(0))
+        with self.assertRaises(QueryCancelled) as raised, contextlib.redirect_stdout(io.StringIO()):
+            optimizer.optimize_join_query(json.dumps(EIGHT_TABLES))
+        self.assertEqual(raised.exception.reason, "timed out")
+        self.assertIn("join order", raised.exception.stage)
+        self.assertGreater(raised.exception.diagnostics["join_orders_generated"], 0)
+
+
+if __name__ == "__main__":
+    unittest.main()
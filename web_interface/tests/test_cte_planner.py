@@ -0,0 +1,96 @@
+"""
+Choosing between inlining a CTE into its readers and materializing it
+once: explicit AS [NOT] MATERIALIZED, single readers, CTEs reading other
+CTEs and the cost comparison.
+
+Run from web_interface with: python -m unittest discover tests
+"""
+
+import contextlib
+import io
+import unittest
+
+from cost_populator import CostCalculator
+from cte_planner import count_cte_references, plan_ctes
+
+STATISTICS = {"wide": {"row_count": 1000, "page_count": 100, "columns": {}},
+              "narrow": {"row_count": 1000, "page_count": 1, "columns": {}}}
+
+
+class StatisticsCalculator(CostCalculator):
+    """CostCalculator reading fixed statistics instead of PostgreSQL's."""
+
+    def __init__(self):
+        super().__init__({})
+        self.cache_residency = {}
+
+    def get_table_statistics(self, table_name):
+        return STATISTICS[table_name.lower()]
+
+
+def scan(name, alias=None):
+    return {"type": "base_relation", "tables": [{"name": name, "alias": alias or name}]}
+
+
+def ref(name, alias):
+    return {"type": "cte_ref", "name": name, "alias": alias}
+
+
+def cte(name, query, materialized=None):
+    entry = {"name": name, "query": query}
+    if materialized is not None:
+        entry["materialized"] = materialized
+    return entry
+
+
+def join(left, right):
+    return {"type": "join", "condition": None, "left": left, "right": right}
+
+
+def plan(ctes, query, calculator=None):
+    with contextlib.redirect_stdout(io.StringIO()):
+        return plan_ctes({"type": "with", "ctes": ctes, "input": query}, calculator)
+
+
+class PlanCtesTest(unittest.TestCase):
+    def test_single_reader_is_inlined_under_its_alias(self):
+        result = plan([cte("A", scan("WIDE"))], {"type": "project", "columns": [], "input": ref("A", "X")})
+        self.assertEqual(result, {"type": "project", "columns": [],
+                                  "input": {"type": "subquery", "alias": "X", "query": scan("WIDE")}})
+
+    def test_unread_cte_is_dropped(self):
+        self.assertEqual(plan([cte("A", scan("WIDE"))], scan("NARROW")), scan("NARROW"))
+
+    def test_shared_cte_is_materialized_without_costs(self):
+        result = plan([cte("A", scan("NARROW"))], join(ref("A", "X"), ref("A", "Y")))
+        self.assertEqual(result["type"], "with")
+        self.assertEqual(result["ctes"], [{"name": "A", "query": scan("NARROW"), "materialized": True,
+                                           "references": 2}])
+        self.assertEqual(count_cte_references(result["input"], "A"), 2)
+
+    def test_explicit_choice_wins(self):
+        inlined = plan([cte("A", scan("WIDE"), materialized=False)], join(ref("A", "X"), ref("A", "Y")))
+        self.assertEqual(inlined["type"], "join")
+        self.assertEqual(count_cte_references(inlined, "A"), 0)
+        kept = plan([cte("A", scan("WIDE"), materialized=True)], ref("A", "X"))
+        self.assertEqual(kept["type"], "with")
+        self.assertEqual(kept["ctes"][0]["references"], 1)
+
+    def test_cte_read_by_a_shared_cte(self):
+        # A is read once, by B, and goes into B; B is shared and stays
+        result = plan([cte("A", scan("WIDE")), cte("B", {"type": "select", "condition": None, "input": ref("A", "Z")})],
+                      join(ref("B", "X"), ref("B", "Y")))
+        self.assertEqual([entry["name"] for entry in result["ctes"]], ["B"])
+        self.assertEqual(result["ctes"][0]["query"]["input"], {"type": "subquery", "alias": "Z", "query": scan("WIDE")})
+
+    def test_cost_decides_shared_ctes(self):
+        calculator = StatisticsCalculator()
+        # Reading the spool back costs a tuple per row per reader, which
+        # only pays off when computing the query costs more than that
+        shared = join(ref("A", "X"), ref("A", "Y"))
+        self.assertEqual(plan([cte("A", scan("WIDE"))], shared, calculator)["type"], "with")
+        self.assertEqual(plan([cte("A", scan("NARROW"))], shared, calculator)["type"], "join")
+
+
+if __name__ == "__main__":
+    unittest.main()
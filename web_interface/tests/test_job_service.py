@@ -0,0 +1,118 @@
+"""
+Job service: cancelling a job stops the stage it is running through the
+job's flag, drops the stages still queued and frees the flag for the next
+job.
+
+The stages run on a thread pool of this process in place of the worker
+processes, which need a database.
+
+Run from web_interface with: python -m unittest discover tests
+"""
+
+import os
+import shutil
+import tempfile
+import time
+import unittest
+from concurrent.futures import ThreadPoolExecutor
+from unittest import mock
+
+import job_service
+import materialized_views
+from job_service import CANCEL_SLOTS, JobService, stage_token
+
+
+def wait_for(predicate, timeout=10):
+    deadline = time.monotonic() + timeout
+    while not predicate():
+        if time.monotonic() > deadline:
+            raise AssertionError("timed out waiting")
+        time.sleep(0.01)
+
+
+class JobCancellationTest(unittest.TestCase):
+    def setUp(self):
+        # A parser that never finishes on its own
+        self.temp_dir = tempfile.mkdtemp(prefix="job_service_test_")
+        parser = os.path.join(self.temp_dir, "slow_parser")
+        with open(parser, "w") as f:
+            f.write("#!/bin/sh\nexec sleep 30\n")
+        os.chmod(parser, 0o755)
+        patch = mock.patch.object(materialized_views, "PARSER", parser)
+        patch.start()
+        self.addCleanup(patch.stop)
+
+        self.service = JobService(workers=1)
+        self.service.pool = ThreadPoolExecutor(1)
+        worker = mock.patch.dict(job_service._WORKER, cancel_flags=self.service.cancel_flags)
+        worker.start()
+        self.addCleanup(worker.stop)
+
+    def tearDown(self):
+        for job_id in list(self.service.jobs):
+            self.service.cancel(job_id)
+        self.service.pool.shutdown(wait=True)
+        shutil.rmtree(self.temp_dir)
+
+    def job(self, job_id):
+        return self.service.jobs[job_id]
+
+    def test_running_stage_stops_on_the_flag(self):
+        job_id = self.service.submit("SELECT 1;")
+        job = self.job(job_id)
+        slot = job.slot
+        wait_for(lambda: job.future.running())
+        time.sleep(0.2)  # Let the parser start
+
+        start = time.monotonic()
+        self.assertTrue(self.service.cancel(job_id))
+        self.assertEqual(self.service.status(job_id)["status"], "cancelled")
+        self.assertEqual(self.service.cancel_flags[slot], 1)
+        updates, response = job.future.result(timeout=10)
+        self.assertLess(time.monotonic() - start, 5)
+        self.assertFalse(response["success"])
+        self.assertIn("Parsing stopped", response["error"])
+
+        # The flag is cleared and free once the stage is past it
+        wait_for(lambda: job.slot is None)
+        self.assertEqual(self.service.cancel_flags[slot], 0)
+        self.assertEqual(len(self.service.free_slots), CANCEL_SLOTS)
+        self.assertEqual(self.service.status(job_id)["results"], {})
+
+    def test_queued_job_never_runs(self):
+        running = self.service.submit("SELECT 1;")
+        queued = self.service.submit("SELECT 2;")
+        wait_for(lambda: self.job(running).future.running())
+        future = self.job(queued).future
+        self.service.cancel(queued)
+        self.assertTrue(future.cancelled())
+        self.assertIsNone(self.job(queued).slot)
+        self.assertEqual(len(self.service.free_slots), CANCEL_SLOTS - 1)
+
+    def test_cancelling_a_finished_job_changes_nothing(self):
+        job_id = self.service.submit("SELECT 1;")
+        self.service.cancel(job_id)
+        finished = self.service.status(job_id)["finished"]
+        self.assertTrue(self.service.cancel(job_id))
+        self.assertEqual(self.service.status(job_id)["finished"], finished)
+        self.assertFalse(self.service.cancel("no such job"))
+
+
+class StageTokenTest(unittest.TestCase):
+    def test_flag_cancels_the_token(self):
+        flags = [0, 0]
+        with mock.patch.dict(job_service._WORKER, cancel_flags=flags):
+            token = stage_token({"cancel_slot": 1})
+            self.assertFalse(token.is_cancelled())
+            flags[1] = 1
+            self.assertTrue(token.is_cancelled())
+            self.assertEqual(token.reason, "cancelled")
+
+    def test_stages_without_a_job_only_have_the_deadline(self):
+        token = stage_token({})
+        self.assertIsNone(token.flag)
+        self.assertIsNotNone(token.deadline)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,115 @@
+"""
+Join order search under a budget: the full search space when it allows,
+and otherwise the best of the orders it could cost, starting with the
+greedy one, with how much of the space was explored. The parallel search
+over table sets must find the plans of the full sequential one.
+
+Run from web_interface with: python -m unittest discover tests
+"""
+
+import contextlib
+import io
+import json
+import unittest
+from unittest import mock
+
+import join_optimization
+from cost_populator import CostCalculator
+from join_optimization import QueryOptimizer, SearchBudget, search_pool
+
+STATISTICS = {"customer": 15000, "orders": 150000, "lineitem": 600000, "supplier": 1000, "nation": 25}
+TABLES = ["CUSTOMER", "ORDERS", "LINEITEM", "SUPPLIER", "NATION"]
+
+
+class StatisticsCalculator(CostCalculator):
+    """CostCalculator reading fixed statistics instead of PostgreSQL's."""
+
+    def connect(self):
+        pass
+
+    def get_table_statistics(self, table_name):
+        rows = STATISTICS[table_name.lower()]
+        return {"row_count": rows, "page_count": max(1, rows // 50), "table_size": max(1, rows // 50) * 8192,
+                "columns": {}}
+
+
+def scan(name, alias):
+    return {"type": "base_relation", "tables": [{"name": name, "alias": alias}]}
+
+
+def joined(tables, edges):
+    """Plan joining tables in the order given, on (left alias, column, right alias, column) edges."""
+    current = scan(*tables[0])
+    for table, (a, a_attr, b, b_attr) in zip(tables[1:], edges):
+        current = {"type": "join", "left": current, "right": scan(*table),
+                   "condition": {"type": "EQ", "left": {"table": a, "attr": a_attr},
+                                 "right": {"type": "column", "table": b, "attr": b_attr}}}
+    return {"type": "project", "columns": [{"table": "C", "attr": "C_NAME"}], "input": current}
+
+
+# A chain of five tables, with 16 valid join orders
+CHAIN = json.dumps(joined(
+    [("CUSTOMER", "C"), ("ORDERS", "O"), ("LINEITEM", "L"), ("SUPPLIER", "S"), ("NATION", "N")],
+    [("C", "C_CUSTKEY", "O", "O_CUSTKEY"), ("O", "O_ORDERKEY", "L", "L_ORDERKEY"),
+     ("L", "L_SUPPKEY", "S", "S_SUPPKEY"), ("S", "S_NATIONKEY", "N", "N_NATIONKEY")]))
+
+
+def search(budget=None, workers=1):
+    with mock.patch.object(join_optimization, "CostCalculator", StatisticsCalculator):
+        optimizer = QueryOptimizer({})
+    optimizer.conn = object()
+    optimizer.search_budget = budget
+    optimizer.search_workers = workers
+    with contextlib.redirect_stdout(io.StringIO()):
+        return optimizer.optimize_join_query(CHAIN)
+
+
+class BudgetedJoinSearchTest(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls.full = search()
+
+    def test_ample_budget_searches_everything(self):
+        plans = search(SearchBudget(evaluations=10 ** 6))
+        for method, plan in plans.items():
+            self.assertAlmostEqual(plan["cost"], self.full[method]["cost"])
+            self.assertEqual(plan["search"]["evaluated"], 16)
+            self.assertTrue(plan["search"]["exhaustive"])
+            self.assertEqual(plan["search"]["explored_fraction"], 1.0)
+
+    def test_exhausted_budget_keeps_the_greedy_order(self):
+        # Three evaluations shared by three selectivity methods
+        plans = search(SearchBudget(evaluations=3))
+        for method, plan in plans.items():
+            self.assertEqual(sorted(plan["order"]), sorted(TABLES))
+            self.assertGreaterEqual(plan["cost"], self.full[method]["cost"] * (1 - 1e-9))
+            self.assertEqual(plan["search"]["evaluated"], 1)
+            self.assertFalse(plan["search"]["exhaustive"])
+            self.assertEqual(plan["search"]["search_space"], 16)
+            self.assertAlmostEqual(plan["search"]["explored_fraction"], 1 / 16)
+
+    def test_expired_time_budget_still_returns_a_plan(self):
+        for plan in search(SearchBudget(seconds=0)).values():
+            self.assertEqual(sorted(plan["order"]), sorted(TABLES))
+            self.assertEqual(plan["search"]["evaluated"], 1)
+
+
+class ParallelJoinSearchTest(unittest.TestCase):
+    def test_finds_the_sequential_plans(self):
+        # The workers have no database: the statistics are sent with the query
+        full = search()
+        for _ in range(2):
+            plans = search(workers=2)
+            for method, plan in plans.items():
+                self.assertAlmostEqual(plan["cost"], full[method]["cost"])
+                self.assertEqual(sorted(plan["order"]), sorted(TABLES))
+
+    def test_pool_is_shared_by_searches(self):
+        search(workers=2)
+        pool = search_pool(2)
+        search(workers=2)
+        self.assertIs(search_pool(2), pool)
+
+
+if __name__ == "__main__":
+    unittest.main()
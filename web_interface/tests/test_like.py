@@ -0,0 +1,105 @@
+"""
+LIKE patterns: their classification, the [low, high) range of prefix
+patterns, which the parser and predicate pushdown must compute alike, and
+selectivity from the MCVs and the histogram.
+
+Run from web_interface with: python -m unittest discover tests
+"""
+
+import os
+import unittest
+
+from cost_populator import CostCalculator, like_to_regex
+from materialized_views import PARSER, parse_sql
+from predicate_pushdown import classify_like_pattern, like_prefix_upper_bound
+
+STATISTICS = {"part": {"row_count": 20000, "page_count": 400, "columns": {
+    "p_name": {"ndv": 20000, "nullfrac": 0.0, "avg_width": 33, "mcv": {},
+               "histogram": ["almond", "blush", "chiffon", "forest", "ivory", "powder"]},
+    "p_type": {"ndv": 150, "nullfrac": 0.0, "avg_width": 21,
+               "mcv": {"ECONOMY BRUSHED BRASS": 0.01, "STANDARD POLISHED TIN": 0.02}}}}}
+PART = {"type": "base_relation", "tables": [{"name": "PART", "alias": "P"}]}
+
+
+class StatisticsCalculator(CostCalculator):
+    """CostCalculator reading fixed statistics instead of PostgreSQL's."""
+
+    def get_table_statistics(self, table_name):
+        return STATISTICS[table_name.lower()]
+
+
+def like(attr, pattern):
+    return {"type": "LIKE", "left": {"table": "P", "attr": attr}, "right": {"type": "string", "value": pattern},
+            **classify_like_pattern(pattern)}
+
+
+class ClassifyLikePatternTest(unittest.TestCase):
+    def test_pattern_shapes(self):
+        self.assertEqual(classify_like_pattern("forest%")["match"], "prefix")
+        self.assertEqual(classify_like_pattern("%BRASS")["match"], "suffix")
+        self.assertEqual(classify_like_pattern("%green%")["match"], "infix")
+        self.assertEqual(classify_like_pattern("a%b%")["match"], "pattern")
+        self.assertEqual(classify_like_pattern("fo_est%")["match"], "pattern")
+        self.assertNotIn("range", classify_like_pattern("%BRASS"))
+
+    def test_prefix_range(self):
+        self.assertEqual(classify_like_pattern("forest%")["range"], {"low": "forest", "high": "foresu"})
+
+    def test_upper_bound_increments_code_points(self):
+        self.assertEqual(like_prefix_upper_bound("café"), "cafê")
+        self.assertEqual(like_prefix_upper_bound("aÿ"), "aĀ")
+        self.assertEqual(like_prefix_upper_bound("x\u007f"), "x\u0080")
+        # The surrogates are skipped
+        self.assertEqual(like_prefix_upper_bound("\ud7ff"), "\ue000")
+
+    def test_characters_without_successor_are_dropped(self):
+        self.assertEqual(like_prefix_upper_bound("q\U0010ffff\U0010ffff"), "r")
+        self.assertIsNone(like_prefix_upper_bound("\U0010ffff"))
+        self.assertNotIn("high", classify_like_pattern("\U0010ffff%")["range"])
+
+
+class LikeToRegexTest(unittest.TestCase):
+    def test_wildcards_and_metacharacters(self):
+        self.assertTrue(like_to_regex("a_c%").match("abcdef"))
+        self.assertFalse(like_to_regex("a_c%").match("ac"))
+        self.assertTrue(like_to_regex("1.5%").match("1.5 inch"))
+        self.assertFalse(like_to_regex("1.5%").match("105 inch"))
+        self.assertFalse(like_to_regex("%BRASS").match("BRASS PLATED"))
+        self.assertTrue(like_to_regex("%BRASS").match("line\nBRASS"))
+
+
+class LikeSelectivityTest(unittest.TestCase):
+    def setUp(self):
+        self.calculator = StatisticsCalculator({})
+
+    def selectivity(self, condition):
+        return self.calculator.estimate_predicate_selectivity(condition, PART)
+
+    def test_prefix_uses_the_histogram_range(self):
+        # ["forest", "foresu") starts on a bound and ends in the next bucket,
+        # whose middle stands for any string inside it
+        self.assertAlmostEqual(self.selectivity(like("P_NAME", "forest%")), 0.2)
+        self.assertAlmostEqual(self.selectivity(like("P_NAME", "zzz%")), 0.0)
+
+    def test_mcvs_are_matched_directly(self):
+        other = 1.0 - 0.03
+        self.assertAlmostEqual(self.selectivity(like("P_TYPE", "%BRASS")), 0.01 + 0.2 ** 5 * other)
+        self.assertAlmostEqual(self.selectivity({"type": "NOT", "cond": like("P_TYPE", "%BRASS")}),
+                               1.0 - (0.01 + 0.2 ** 5 * other))
+
+
+@unittest.skipUnless(os.path.exists(PARSER), "the SQL parser is not built")
+class LikeParserTest(unittest.TestCase):
+    def test_parser_and_pushdown_agree_on_the_range(self):
+        for prefix in ["forest", "café", "aÿ", "x\u007f", "q\U0010ffff", "\ud7ff", "\U0010ffff"]:
+            plan = parse_sql(f"SELECT P.P_NAME FROM PART P WHERE P.P_NAME LIKE '{prefix}%'")
+            self.assertEqual(plan["condition"]["match"], "prefix")
+            self.assertEqual(plan["condition"]["range"], classify_like_pattern(prefix + "%")["range"], prefix)
+
+    def test_exact_pattern_is_an_equality(self):
+        plan = parse_sql("SELECT P.P_NAME FROM PART P WHERE P.P_NAME LIKE 'forest'")
+        self.assertEqual(plan["condition"]["type"], "EQ")
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,174 @@
+"""
+Soundness of view matching: a view may only answer a query whose rows it
+holds all of, and what the view did not filter must be compensated.
+
+Run from web_interface with: python -m unittest discover tests
+"""
+
+import unittest
+
+from materialized_views import describe_spj, implies, match_view
+
+
+def column(table, attr):
+    return {"table": table, "attr": attr}
+
+
+def compare(op, table, attr, value):
+    value_type = "string" if isinstance(value, str) else "int"
+    return {"type": op, "left": column(table, attr), "right": {"type": value_type, "value": value}}
+
+
+def join_on(left, right):
+    return {"type": "EQ", "left": column(*left), "right": {"type": "column", **column(*right)}}
+
+
+def scan(name, alias):
+    return {"type": "base_relation", "tables": [{"name": name, "alias": alias}]}
+
+
+def spj(columns, tables, joins, filters=()):
+    """Plan of SELECT columns FROM tables[0] JOIN ... WHERE filters, as the parser builds it."""
+    current = scan(*tables[0])
+    for table, condition in zip(tables[1:], joins):
+        current = {"type": "join", "condition": condition, "left": current, "right": scan(*table)}
+    plan = {"type": "project", "columns": [column(*c) for c in columns], "input": current}
+    if filters:
+        condition = filters[0]
+        for conjunct in filters[1:]:
+            condition = {"type": "AND", "left": condition, "right": conjunct}
+        plan = {"type": "select", "condition": condition, "input": plan}
+    return plan
+
+
+# SUPPLIER joined with NATION, for the first 20 nations
+SUPPLIER_NATION = {"plan": spj(
+    [("S", "S_SUPPKEY"), ("S", "S_NAME"), ("S", "S_NATIONKEY"), ("N", "N_NAME"), ("N", "N_REGIONKEY")],
+    [("SUPPLIER", "S"), ("NATION", "N")],
+    [join_on(("S", "S_NATIONKEY"), ("N", "N_NATIONKEY"))],
+    [compare("LT", "N", "N_NATIONKEY", 20)])}
+
+
+def query(columns, filters=(), extra_tables=(), extra_joins=(), aliases=("S", "N")):
+    s, n = aliases
+    return describe_spj(spj(
+        columns, [("SUPPLIER", s), ("NATION", n), *extra_tables],
+        [join_on((s, "S_NATIONKEY"), (n, "N_NATIONKEY")), *extra_joins], list(filters)))
+
+
+def conjuncts(plan):
+    """Conditions of the selects stacked at the top of a plan."""
+    found = []
+    while plan["type"] == "select":
+        stack = [plan["condition"]]
+        while stack:
+            condition = stack.pop()
+            if condition["type"] == "AND":
+                stack += [condition["left"], condition["right"]]
+            else:
+                found.append(condition)
+        plan = plan["input"]
+    return found
+
+
+class ImpliesTest(unittest.TestCase):
+    def test_identical_conjuncts(self):
+        self.assertTrue(implies(compare("EQ", "N", "N_NAME", "PERU"), compare("EQ", "N", "N_NAME", "PERU")))
+
+    def test_narrower_range_implies_wider(self):
+        self.assertTrue(implies(compare("EQ", "N", "N_NATIONKEY", 5), compare("GE", "N", "N_NATIONKEY", 3)))
+        self.assertTrue(implies(compare("LT", "N", "N_NATIONKEY", 10), compare("LE", "N", "N_NATIONKEY", 10)))
+        self.assertTrue(implies(compare("GT", "N", "N_NATIONKEY", 5), compare("GE", "N", "N_NATIONKEY", 5)))
+
+    def test_inclusive_bound_does_not_imply_exclusive(self):
+        self.assertFalse(implies(compare("LE", "N", "N_NATIONKEY", 10), compare("LT", "N", "N_NATIONKEY", 10)))
+        self.assertFalse(implies(compare("GE", "N", "N_NATIONKEY", 5), compare("GT", "N", "N_NATIONKEY", 5)))
+        self.assertFalse(implies(compare("EQ", "N", "N_NATIONKEY", 10), compare("LT", "N", "N_NATIONKEY", 10)))
+
+    def test_wider_or_unbounded_range_does_not_imply(self):
+        self.assertFalse(implies(compare("LT", "N", "N_NATIONKEY", 25), compare("LT", "N", "N_NATIONKEY", 20)))
+        self.assertFalse(implies(compare("GE", "N", "N_NATIONKEY", 3), compare("LE", "N", "N_NATIONKEY", 10)))
+
+    def test_other_column_or_kind_does_not_imply(self):
+        self.assertFalse(implies(compare("EQ", "S", "S_NATIONKEY", 5), compare("GE", "N", "N_NATIONKEY", 3)))
+        self.assertFalse(implies(compare("EQ", "N", "N_NATIONKEY", "5"), compare("GE", "N", "N_NATIONKEY", 3)))
+
+    def test_in_list(self):
+        view = {"type": "IN", "left": column("L", "L_SHIPMODE"),
+                "right": {"type": "list", "values": [{"type": "string", "value": "AIR"},
+                                                     {"type": "string", "value": "MAIL"}]}}
+        subset = {**view, "right": {"type": "list", "values": view["right"]["values"][:1]}}
+        superset = {**view, "right": {"type": "list",
+                                      "values": view["right"]["values"] + [{"type": "string", "value": "SHIP"}]}}
+        self.assertTrue(implies(compare("EQ", "L", "L_SHIPMODE", "AIR"), view))
+        self.assertFalse(implies(compare("EQ", "L", "L_SHIPMODE", "SHIP"), view))
+        self.assertTrue(implies(subset, view))
+        self.assertFalse(implies(superset, view))
+        self.assertFalse(implies(compare("GE", "L", "L_SHIPMODE", "AIR"), view))
+
+
+class MatchViewTest(unittest.TestCase):
+    def test_same_filter_needs_no_compensation(self):
+        plan = match_view(query([("S", "S_NAME")], [compare("LT", "N", "N_NATIONKEY", 20)]),
+                          "supplier_nation", SUPPLIER_NATION)
+        self.assertEqual(plan["type"], "project")
+        self.assertEqual(plan["columns"], [column("SUPPLIER_NATION", "S_NAME")])
+        self.assertEqual(plan["input"], scan("SUPPLIER_NATION", "SUPPLIER_NATION"))
+
+    def test_narrower_filter_is_compensated_on_the_view(self):
+        plan = match_view(query([("S", "S_NAME")], [compare("LT", "N", "N_NATIONKEY", 10)]),
+                          "supplier_nation", SUPPLIER_NATION)
+        # N_NATIONKEY is not an output, but the view equated it with S_NATIONKEY
+        self.assertEqual(conjuncts(plan), [compare("LT", "SUPPLIER_NATION", "S_NATIONKEY", 10)])
+
+    def test_filter_on_other_view_column_is_compensated(self):
+        plan = match_view(query([("S", "S_NAME")], [compare("LT", "N", "N_NATIONKEY", 20),
+                                                    compare("EQ", "N", "N_NAME", "PERU")]),
+                          "supplier_nation", SUPPLIER_NATION)
+        self.assertEqual(conjuncts(plan), [compare("EQ", "SUPPLIER_NATION", "N_NAME", "PERU")])
+
+    def test_view_filter_not_implied_by_query(self):
+        self.assertIsNone(match_view(query([("S", "S_NAME")]), "supplier_nation", SUPPLIER_NATION))
+        self.assertIsNone(match_view(query([("S", "S_NAME")], [compare("LT", "N", "N_NATIONKEY", 25)]),
+                                     "supplier_nation", SUPPLIER_NATION))
+
+    def test_view_join_not_implied_by_query(self):
+        spj_plan = spj([("S", "S_NAME")], [("SUPPLIER", "S"), ("NATION", "N")],
+                       [join_on(("S", "S_SUPPKEY"), ("N", "N_NATIONKEY"))],
+                       [compare("LT", "N", "N_NATIONKEY", 20)])
+        self.assertIsNone(match_view(describe_spj(spj_plan), "supplier_nation", SUPPLIER_NATION))
+
+    def test_column_missing_from_view(self):
+        self.assertIsNone(match_view(query([("S", "S_ACCTBAL")], [compare("LT", "N", "N_NATIONKEY", 20)]),
+                                     "supplier_nation", SUPPLIER_NATION))
+
+    def test_columns_map_through_view_join(self):
+        plan = match_view(query([("N", "N_NATIONKEY"), ("N", "N_NAME")], [compare("LT", "N", "N_NATIONKEY", 20)]),
+                          "supplier_nation", SUPPLIER_NATION)
+        self.assertEqual(plan["columns"], [{"table": "SUPPLIER_NATION", "attr": "S_NATIONKEY",
+                                            "alias": "N_NATIONKEY"},
+                                           column("SUPPLIER_NATION", "N_NAME")])
+
+    def test_query_aliases_differ_from_view(self):
+        plan = match_view(query([("SU", "S_NAME")], [compare("LT", "NA", "N_NATIONKEY", 20)], aliases=("SU", "NA")),
+                          "supplier_nation", SUPPLIER_NATION)
+        self.assertEqual(plan["columns"], [column("SUPPLIER_NATION", "S_NAME")])
+
+    def test_remaining_table_is_joined_to_the_view(self):
+        plan = match_view(query([("S", "S_NAME"), ("R", "R_NAME")], [compare("LT", "N", "N_NATIONKEY", 20)],
+                                extra_tables=[("REGION", "R")],
+                                extra_joins=[join_on(("N", "N_REGIONKEY"), ("R", "R_REGIONKEY"))]),
+                          "supplier_nation", SUPPLIER_NATION)
+        self.assertEqual(plan["type"], "project")
+        join = plan["input"]
+        self.assertEqual(join["type"], "join")
+        self.assertEqual(join["condition"], join_on(("SUPPLIER_NATION", "N_REGIONKEY"), ("R", "R_REGIONKEY")))
+        self.assertEqual(join["right"], scan("REGION", "R"))
+
+    def test_view_table_missing_from_query(self):
+        spj_plan = spj([("S", "S_NAME")], [("SUPPLIER", "S")], [], [compare("LT", "S", "S_NATIONKEY", 20)])
+        self.assertIsNone(match_view(describe_spj(spj_plan), "supplier_nation", SUPPLIER_NATION))
+
+
+if __name__ == "__main__":
+    unittest.main()
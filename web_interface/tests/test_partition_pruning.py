@@ -0,0 +1,112 @@
+"""
+Edge cases of partition pruning: boundaries of the monthly [low, high)
+ranges, the open-ended first and last partitions, and conditions that
+cannot be decided from the bounds and must keep every partition.
+
+Run from web_interface with: python -m unittest discover tests
+"""
+
+import unittest
+
+from catalog import list_partitions
+from partition_pruning import prune_partitions, surviving_partitions
+
+ORDERS = list_partitions("orders")
+EVERYTHING = [p["name"] for p in ORDERS]
+
+
+def compare(op, value, attr="O_ORDERDATE"):
+    return {"type": op, "left": {"table": "O", "attr": attr}, "right": {"type": "string", "value": value}}
+
+
+def survivors(condition):
+    return surviving_partitions(condition, "o_orderdate", ORDERS)
+
+
+class SurvivingPartitionsTest(unittest.TestCase):
+    def test_bounds_are_open_ended(self):
+        self.assertIsNone(ORDERS[0]["low"])
+        self.assertIsNone(ORDERS[-1]["high"])
+
+    def test_upper_bound_on_partition_boundary(self):
+        self.assertEqual(survivors(compare("LT", "1992-02-01")), ["orders_1992_01"])
+        self.assertEqual(survivors(compare("LE", "1992-02-01")), ["orders_1992_01", "orders_1992_02"])
+
+    def test_lower_bound_on_partition_boundary(self):
+        self.assertEqual(survivors(compare("GE", "1998-12-01")), ["orders_1998_12"])
+        self.assertEqual(survivors(compare("GE", "1998-11-30")), ["orders_1998_11", "orders_1998_12"])
+        # Values just after the boundary are still in the partition it starts
+        self.assertEqual(survivors(compare("GT", "1998-12-01")), ["orders_1998_12"])
+
+    def test_values_outside_the_declared_range(self):
+        self.assertEqual(survivors(compare("EQ", "1900-01-01")), ["orders_1992_01"])
+        self.assertEqual(survivors(compare("EQ", "2005-06-30")), ["orders_1998_12"])
+        self.assertEqual(survivors(compare("LT", "1900-01-01")), ["orders_1992_01"])
+
+    def test_equality_on_boundary(self):
+        self.assertEqual(survivors(compare("EQ", "1995-03-01")), ["orders_1995_03"])
+
+    def test_contradiction_keeps_nothing(self):
+        condition = {"type": "AND", "left": compare("GE", "1995-01-01"), "right": compare("LT", "1994-01-01")}
+        self.assertEqual(survivors(condition), [])
+
+    def test_or_keeps_both_sides_in_key_order(self):
+        condition = {"type": "OR", "left": compare("EQ", "1996-05-10"), "right": compare("EQ", "1993-02-10")}
+        self.assertEqual(survivors(condition), ["orders_1993_02", "orders_1996_05"])
+
+    def test_undecidable_conditions_keep_everything(self):
+        self.assertEqual(survivors({"type": "NOT", "cond": compare("EQ", "1995-03-15")}), EVERYTHING)
+        self.assertEqual(survivors(compare("NE", "1995-03-15")), EVERYTHING)
+        self.assertEqual(survivors(compare("EQ", "1995-03-15", attr="O_COMMENT")), EVERYTHING)
+        self.assertEqual(survivors({"type": "LIKE", "left": {"table": "O", "attr": "O_ORDERDATE"},
+                                    "right": {"type": "string", "value": "%-03-%"}}), EVERYTHING)
+        # Only string literals are compared with the date bounds
+        self.assertEqual(survivors({"type": "EQ", "left": {"table": "O", "attr": "O_ORDERDATE"},
+                                    "right": {"type": "int", "value": 1995}}), EVERYTHING)
+        self.assertEqual(survivors({"type": "EQ", "left": {"type": "arith", "op": "ADD"},
+                                    "right": {"type": "string", "value": "1995-03-15"}}), EVERYTHING)
+
+    def test_or_with_undecidable_side_keeps_everything(self):
+        condition = {"type": "OR", "left": compare("EQ", "1996-05-10"),
+                     "right": compare("EQ", "x", attr="O_COMMENT")}
+        self.assertEqual(survivors(condition), EVERYTHING)
+
+    def test_in_list(self):
+        condition = {"type": "IN", "left": {"table": "O", "attr": "O_ORDERDATE"},
+                     "right": {"type": "list", "values": [{"type": "string", "value": "1997-07-01"},
+                                                          {"type": "string", "value": "1992-01-05"}]}}
+        self.assertEqual(survivors(condition), ["orders_1992_01", "orders_1997_07"])
+        mixed = {**condition, "right": {"type": "list", "values": condition["right"]["values"] +
+                                        [{"type": "int", "value": 1}]}}
+        self.assertEqual(survivors(mixed), EVERYTHING)
+
+    def test_like_prefix_range(self):
+        condition = {"type": "LIKE", "left": {"table": "O", "attr": "O_ORDERDATE"},
+                     "right": {"type": "string", "value": "1994-0%"},
+                     "match": "prefix", "range": {"low": "1994-0", "high": "1994-1"}}
+        kept = survivors(condition)
+        self.assertIn("orders_1994_01", kept)
+        self.assertIn("orders_1994_09", kept)
+        self.assertNotIn("orders_1994_10", kept)
+        self.assertNotIn("orders_1993_11", kept)
+
+
+class PrunePartitionsTest(unittest.TestCase):
+    def test_stacked_selects_are_intersected(self):
+        plan = {"type": "select", "condition": compare("GE", "1994-01-01"),
+                "input": {"type": "select", "condition": compare("LT", "1994-03-01"),
+                          "input": {"type": "base_relation", "tables": [{"name": "ORDERS", "alias": "O"}]}}}
+        prune_partitions(plan)
+        self.assertEqual(plan["input"]["input"]["partitions"], ["orders_1994_01", "orders_1994_02"])
+
+    def test_select_above_a_join_does_not_prune(self):
+        scan = {"type": "base_relation", "tables": [{"name": "ORDERS", "alias": "O"}]}
+        plan = {"type": "select", "condition": compare("EQ", "1994-01-01"),
+                "input": {"type": "join", "condition": None, "left": scan,
+                          "right": {"type": "base_relation", "tables": [{"name": "CUSTOMER", "alias": "C"}]}}}
+        prune_partitions(plan)
+        self.assertEqual(scan["partitions"], EVERYTHING)
+
+
+if __name__ == "__main__":
+    unittest.main()
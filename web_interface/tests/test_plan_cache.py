@@ -0,0 +1,63 @@
+"""
+Plan cache fingerprints, which must only merge queries the parser cannot
+tell apart, and CLOCK eviction.
+
+Run from web_interface with: python -m unittest discover tests
+"""
+
+import unittest
+
+from plan_cache import PlanCache, normalize_sql, query_fingerprint
+
+
+class FingerprintTest(unittest.TestCase):
+    def test_whitespace_between_tokens_is_collapsed(self):
+        self.assertEqual(normalize_sql("  SELECT\tN.N_NAME\n FROM   NATION N "), "SELECT N.N_NAME FROM NATION N")
+
+    def test_string_literals_are_kept(self):
+        self.assertEqual(normalize_sql("SELECT N.N_NAME FROM NATION N WHERE N.N_NAME = 'UNITED  STATES'"),
+                         "SELECT N.N_NAME FROM NATION N WHERE N.N_NAME = 'UNITED  STATES'")
+        self.assertNotEqual(query_fingerprint("SELECT A.X FROM T A WHERE A.X = 'a  b'"),
+                            query_fingerprint("SELECT A.X FROM T A WHERE A.X = 'a b'"))
+
+    def test_case_and_separators_are_kept(self):
+        self.assertNotEqual(query_fingerprint("SELECT A.X FROM T A"), query_fingerprint("select A.X FROM T A"))
+        self.assertNotEqual(query_fingerprint("SELECT A.X FROM T A"), query_fingerprint("SELECT A.x FROM T A"))
+        self.assertNotEqual(query_fingerprint("SELECT A.X - 1 FROM T A"), query_fingerprint("SELECT A.X -1 FROM T A"))
+
+    def test_context_is_part_of_the_fingerprint(self):
+        self.assertNotEqual(query_fingerprint("SELECT A.X FROM T A", ["pushdown"]),
+                            query_fingerprint("SELECT A.X FROM T A", ["pushdown", "joins"]))
+
+
+class ClockEvictionTest(unittest.TestCase):
+    def test_referenced_entry_gets_a_second_chance(self):
+        cache = PlanCache(capacity=2, shards=1)
+        cache.put("a", 1)
+        cache.put("b", 2)
+        self.assertEqual(cache.get("a"), 1)
+        cache.put("c", 3)
+        self.assertEqual(cache.get("a"), 1)
+        self.assertIsNone(cache.get("b"))
+        self.assertEqual(cache.get("c"), 3)
+        self.assertEqual(cache.summary()["evictions"], 1)
+
+    def test_replacing_a_key_does_not_evict(self):
+        cache = PlanCache(capacity=2, shards=1)
+        cache.put("a", 1)
+        cache.put("b", 2)
+        cache.put("a", 3)
+        self.assertEqual(cache.get("a"), 3)
+        self.assertEqual(cache.get("b"), 2)
+        self.assertEqual(cache.summary()["evictions"], 0)
+
+    def test_get_or_compute_counts_hits_and_misses(self):
+        cache = PlanCache(capacity=4, shards=2)
+        self.assertEqual(cache.get_or_compute("q", lambda: "plan"), ("plan", False))
+        self.assertEqual(cache.get_or_compute("q", lambda: "other"), ("plan", True))
+        summary = cache.summary()
+        self.assertEqual((summary["hits"], summary["misses"]), (1, 1))
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,135 @@
+"""
+Fair-share query scheduler: a free slot goes to the waiting query with the
+lowest pass, passes advance by CPU time over tickets that shrink as a query
+runs, arriving queries start at the current pass, and finished queries are
+reported with their share of the CPU.
+
+Run from web_interface with: python -m unittest discover tests
+"""
+
+import os
+import shutil
+import tempfile
+import threading
+import time
+import unittest
+
+from executor import Executor
+from query_scheduler import DECAY_CPU_SECONDS, PRIORITY_TICKETS, FairShareScheduler
+
+
+def wait_for(predicate, timeout=10):
+    deadline = time.monotonic() + timeout
+    while not predicate():
+        if time.monotonic() > deadline:
+            raise AssertionError("timed out waiting")
+        time.sleep(0.001)
+
+
+class StrideTest(unittest.TestCase):
+    def test_pass_advances_inversely_to_tickets(self):
+        scheduler = FairShareScheduler(slots=2)
+        with scheduler.query(priority="interactive") as fast, scheduler.query(priority="batch", weight=2) as slow:
+            self.assertEqual(fast.tickets(), PRIORITY_TICKETS["interactive"])
+            self.assertEqual(slow.tickets(), 2 * PRIORITY_TICKETS["batch"])
+            for share in (fast, slow):
+                scheduler.acquire(share)
+                scheduler.release(share, 0.1)
+            self.assertAlmostEqual(fast.pass_value, 0.1 / 4.0)
+            self.assertAlmostEqual(slow.pass_value, 0.1 / 0.5)
+
+    def test_tickets_decay_with_cpu_time(self):
+        scheduler = FairShareScheduler(slots=1)
+        with scheduler.query() as share:
+            scheduler.acquire(share)
+            scheduler.release(share, DECAY_CPU_SECONDS)
+            self.assertAlmostEqual(share.tickets(), PRIORITY_TICKETS["normal"] / 2)
+
+    def test_arriving_query_starts_at_the_current_pass(self):
+        scheduler = FairShareScheduler(slots=1)
+        with scheduler.query() as first:
+            first.pass_value = 3.0
+            scheduler.acquire(first)
+            scheduler.release(first, 0)
+            with scheduler.query() as second:
+                self.assertEqual(second.pass_value, 3.0)
+
+    def test_lowest_pass_is_served_first(self):
+        scheduler = FairShareScheduler(slots=1)
+        order = []
+
+        def take_turn(share):
+            scheduler.acquire(share)
+            order.append(share.name)
+            scheduler.release(share, 0)
+
+        with scheduler.query("holder") as holder, scheduler.query("ahead") as ahead, \
+                scheduler.query("behind") as behind:
+            ahead.pass_value, behind.pass_value = 0.1, 0.5
+            scheduler.acquire(holder)
+            threads = [threading.Thread(target=take_turn, args=(share,)) for share in (behind, ahead)]
+            for thread in threads:
+                thread.start()
+            wait_for(lambda: scheduler.summary()["waiting"] == 2)
+            scheduler.release(holder, 0)
+            for thread in threads:
+                thread.join()
+        self.assertEqual(order, ["ahead", "behind"])
+
+
+class QueryShareTest(unittest.TestCase):
+    def test_nested_loops_take_one_turn(self):
+        # With one slot, a nested loop taking its own turn would wait forever
+        scheduler = FairShareScheduler(slots=1)
+        with scheduler.query() as share:
+            seen = [(i, j) for i in share.scheduled(range(4), every=2) for j in share.scheduled(range(3), every=1)]
+        self.assertEqual(len(seen), 12)
+        self.assertEqual(scheduler.finished[-1]["morsels"], 2)
+        self.assertEqual(scheduler.summary()["running"], 0)
+
+    def test_finished_queries_report_their_cpu_share(self):
+        scheduler = FairShareScheduler(slots=2)
+        with scheduler.query("a") as a:
+            with scheduler.query("b") as b:
+                for share, seconds in ((a, 0.3), (b, 0.1)):
+                    scheduler.acquire(share)
+                    scheduler.release(share, seconds)
+            self.assertEqual([query["name"] for query in scheduler.summary()["active"]], ["a"])
+        summary = scheduler.summary()
+        self.assertEqual(summary["active"], [])
+        finished = {query["name"]: query for query in summary["finished"]}
+        self.assertAlmostEqual(finished["a"]["cpu_share"], 0.75)
+        self.assertAlmostEqual(finished["b"]["cpu_share"], 0.25)
+        self.assertEqual(finished["a"]["morsels"], 1)
+
+    def test_unknown_priority_is_refused(self):
+        scheduler = FairShareScheduler(slots=1)
+        with self.assertRaises(ValueError):
+            with scheduler.query(priority="urgent"):
+                pass
+        self.assertEqual(scheduler.summary()["active"], [])
+
+
+class ScheduledExecutorTest(unittest.TestCase):
+    def setUp(self):
+        self.data_dir = tempfile.mkdtemp(prefix="query_scheduler_test_")
+        with open(os.path.join(self.data_dir, "nation.tbl"), "w") as f:
+            f.write("".join(f"{i}|NATION{i}|{i % 5}|c|\n" for i in range(10000)))
+
+    def tearDown(self):
+        shutil.rmtree(self.data_dir)
+
+    def test_scan_takes_a_turn_per_morsel(self):
+        plan = {"type": "select", "input": {"type": "base_relation", "tables": [{"name": "NATION", "alias": "N"}]},
+                "condition": {"type": "EQ", "left": {"table": "N", "attr": "N_REGIONKEY"},
+                              "right": {"type": "int", "value": 0}}}
+        scheduler = FairShareScheduler(slots=1)
+        with scheduler.query(priority="batch") as share:
+            rows = Executor(self.data_dir, query_share=share).execute(plan).rows
+        self.assertEqual(len(rows), 2000)
+        self.assertGreaterEqual(scheduler.finished[-1]["morsels"], 3)
+        self.assertEqual(scheduler.summary()["running"], 0)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,167 @@
+"""
+Result cache: plans written differently share an entry, results are reused
+only while the tables they read are unchanged, the byte budget is kept and
+identical queries in flight run once.
+
+Run from web_interface with: python -m unittest discover tests
+"""
+
+import os
+import shutil
+import tempfile
+import threading
+import time
+import unittest
+
+from executor import Relation
+from result_cache import ResultCache, plan_fingerprint, referenced_tables
+
+
+def column(table, attr):
+    return {"type": "column", "table": table, "attr": attr}
+
+
+def compare(op, left, value):
+    return {"type": op, "left": left, "right": {"type": "int", "value": value}}
+
+
+def select(condition, name="NATION", alias="N"):
+    return {"type": "select", "condition": condition,
+            "input": {"type": "base_relation", "tables": [{"name": name, "alias": alias}]}}
+
+
+KEY = column("N", "N_NATIONKEY")
+REGION = column("N", "N_REGIONKEY")
+
+
+class CountingRunner:
+    """Stands in for the executor, counting the plans it runs."""
+
+    def __init__(self, rows=((1,),), started=None, release=None):
+        self.rows = rows
+        self.runs = 0
+        self.started = started
+        self.release = release
+
+    def __call__(self, plan):
+        self.runs += 1
+        if self.started is not None:
+            self.started.set()
+            self.release.wait()
+        return Relation([("N", "N_NATIONKEY")], list(self.rows))
+
+
+class FingerprintTest(unittest.TestCase):
+    def test_conjunct_order_and_operand_sides_do_not_matter(self):
+        a = select({"type": "AND", "left": compare("LT", KEY, 5), "right": compare("EQ", REGION, 1)})
+        b = select({"type": "AND", "left": {"type": "EQ", "left": {"type": "int", "value": 1}, "right": REGION},
+                    "right": {"type": "GT", "left": {"type": "int", "value": 5}, "right": KEY}})
+        self.assertEqual(plan_fingerprint(a), plan_fingerprint(b))
+
+    def test_different_queries_differ(self):
+        self.assertNotEqual(plan_fingerprint(select(compare("LT", KEY, 5))),
+                            plan_fingerprint(select(compare("LE", KEY, 5))))
+
+    def test_referenced_tables(self):
+        plan = {"type": "join", "condition": None, "left": select(None),
+                "right": select(None, "REGION", "R")}
+        self.assertEqual(referenced_tables(plan), {"nation", "region"})
+
+
+class ResultCacheTest(unittest.TestCase):
+    def setUp(self):
+        self.data_dir = tempfile.mkdtemp(prefix="result_cache_test_")
+        for table in ("nation", "region"):
+            self.write(table, "0|x|\n")
+
+    def tearDown(self):
+        shutil.rmtree(self.data_dir)
+
+    def write(self, table, text):
+        path = os.path.join(self.data_dir, f"{table}.tbl")
+        with open(path, "a") as f:
+            f.write(text)
+        # Make the change visible even within the file system's timestamp granularity
+        stat = os.stat(path)
+        os.utime(path, ns=(stat.st_atime_ns, stat.st_mtime_ns + 1_000_000_000))
+
+    def test_repeated_plan_is_a_hit(self):
+        cache, run = ResultCache(self.data_dir), CountingRunner()
+        plan = select(compare("LT", KEY, 5))
+        first = cache.execute(plan, run)
+        self.assertIs(cache.execute(plan, run), first)
+        self.assertEqual(run.runs, 1)
+        self.assertEqual((cache.stats["hits"], cache.stats["misses"]), (1, 1))
+
+    def test_changed_table_is_recomputed(self):
+        cache, run = ResultCache(self.data_dir), CountingRunner()
+        nation, region = select(None), select(None, "REGION", "R")
+        cache.execute(nation, run)
+        cache.execute(region, run)
+        self.write("nation", "1|y|\n")
+        cache.execute(nation, run)
+        cache.execute(region, run)
+        self.assertEqual(run.runs, 3)
+        # The result over the old NATION is replaced, the REGION one kept
+        self.assertEqual(cache.summary()["entries"], 2)
+        self.assertEqual(cache.stats["invalidations"], 1)
+
+    def test_invalidate_drops_readers_of_the_table(self):
+        cache, run = ResultCache(self.data_dir), CountingRunner()
+        cache.execute(select(None), run)
+        cache.execute(select(None, "REGION", "R"), run)
+        cache.invalidate("NATION")
+        self.assertEqual(cache.summary()["entries"], 1)
+        cache.execute(select(None), run)
+        self.assertEqual(run.runs, 3)
+
+    def test_budget_is_kept(self):
+        run = CountingRunner(rows=[(i,) for i in range(100)])
+        probe = ResultCache(self.data_dir)
+        probe.execute(select(None), run)
+        size = probe.used_bytes
+
+        cache = ResultCache(self.data_dir, budget_bytes=int(size * 2.5))
+        for bound in range(5):
+            cache.execute(select(compare("LT", KEY, bound)), run)
+            self.assertLessEqual(cache.used_bytes, cache.budget_bytes)
+        self.assertEqual(cache.summary()["entries"], 2)
+        self.assertEqual(cache.stats["evictions"], 3)
+
+        too_large = ResultCache(self.data_dir, budget_bytes=size - 1)
+        too_large.execute(select(None), run)
+        self.assertEqual((too_large.summary()["entries"], too_large.stats["uncacheable"]), (0, 1))
+
+    def test_identical_queries_in_flight_run_once(self):
+        started, release = threading.Event(), threading.Event()
+        cache, run = ResultCache(self.data_dir), CountingRunner(started=started, release=release)
+        plan = select(None)
+        results = []
+        leader = threading.Thread(target=lambda: results.append(cache.execute(plan, run)))
+        leader.start()
+        started.wait()
+        followers = [threading.Thread(target=lambda: results.append(cache.execute(plan, run))) for _ in range(3)]
+        for thread in followers:
+            thread.start()
+        while cache.stats["coalesced"] < 3:
+            time.sleep(0.001)
+        release.set()
+        for thread in [leader] + followers:
+            thread.join()
+        self.assertEqual(run.runs, 1)
+        self.assertTrue(all(result is results[0] for result in results))
+
+    def test_failures_are_not_cached(self):
+        cache = ResultCache(self.data_dir)
+
+        def fail(plan):
+            raise ValueError("boom")
+
+        with self.assertRaises(ValueError):
+            cache.execute(select(None), fail)
+        self.assertEqual(cache.summary()["entries"], 0)
+        self.assertEqual(cache.in_flight, {})
+
+
+if __name__ == "__main__":
+    unittest.main()
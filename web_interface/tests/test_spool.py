@@ -0,0 +1,107 @@
+"""
+Spools of common expressions and materialized CTEs: evaluated once, read
+by every reference, released after the last one, and the same results as
+evaluating each reference on its own.
+
+Run from web_interface with: python -m unittest discover tests
+"""
+
+import gc
+import os
+import shutil
+import tempfile
+import unittest
+
+from executor import Executor, Spool
+from memory_accounting import MemoryTracker
+
+NATION = ["0|ALGERIA|0|a", "1|ARGENTINA|1|b", "2|BRAZIL|1|c", "3|CANADA|1|d", "4|EGYPT|4|e"]
+REGION = ["0|AFRICA|a", "1|AMERICA|b", "4|MIDDLE EAST|c"]
+
+
+def scan(name, alias=None):
+    return {"type": "base_relation", "tables": [{"name": name, "alias": alias or name}]}
+
+
+def column(table, attr):
+    return {"type": "column", "table": table, "attr": attr}
+
+
+# Nations of region 1, joined with their region and paired with the others
+AMERICAS = {"type": "select", "condition": {"type": "EQ", "left": column("N", "N_REGIONKEY"),
+                                            "right": {"type": "int", "value": 1}},
+            "input": scan("NATION", "N")}
+
+
+def query(reader):
+    with_region = {"type": "join", "left": reader("A"), "right": scan("REGION", "R"),
+                   "condition": {"type": "EQ", "left": column("A", "N_REGIONKEY"), "right": column("R", "R_REGIONKEY")}}
+    return {"type": "project", "columns": [column("A", "N_NAME"), column("R", "R_NAME"), column("B", "N_NAME")],
+            "input": {"type": "join", "left": with_region, "right": reader("B"),
+                      "condition": {"type": "NE", "left": column("A", "N_NATIONKEY"), "right": column("B", "N_NATIONKEY")}}}
+
+
+def spooled(alias):
+    return {"type": "subquery", "alias": alias, "query": {"type": "expr_ref", "id": "expr_0"}}
+
+
+def inlined(alias):
+    return {"type": "subquery", "alias": alias, "query": AMERICAS}
+
+
+class SpoolTest(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls.data_dir = tempfile.mkdtemp(prefix="spool_test_")
+        for name, lines in (("nation", NATION), ("region", REGION)):
+            with open(os.path.join(cls.data_dir, f"{name}.tbl"), "w") as f:
+                f.write("".join(line + "|\n" for line in lines))
+
+    @classmethod
+    def tearDownClass(cls):
+        shutil.rmtree(cls.data_dir)
+
+    def expected(self):
+        return sorted(Executor(self.data_dir).execute(query(inlined)).rows)
+
+    def test_common_expression_is_evaluated_once(self):
+        for parallel in (False, True):
+            executor = Executor(self.data_dir, parallel=parallel)
+            result = executor.execute({"common_expressions": {"expr_0": AMERICAS}, "query": query(spooled)})
+            self.assertEqual(sorted(result.rows), self.expected())
+            self.assertEqual(len(result.rows), 6)
+            stats = executor.stats
+            self.assertEqual((stats["spools_built"], stats["spool_reads"], stats["spools_released"]), (1, 2, 1))
+            self.assertEqual(stats["spooled_rows"], 3)
+            # NATION once for the spool, REGION once
+            self.assertEqual(stats["rows_scanned"], len(NATION) + len(REGION))
+
+    def test_materialized_cte_is_evaluated_once(self):
+        plan = {"type": "with", "ctes": [{"name": "AM", "query": AMERICAS, "materialized": True}],
+                "input": query(lambda alias: {"type": "cte_ref", "name": "AM", "alias": alias})}
+        executor = Executor(self.data_dir)
+        self.assertEqual(sorted(executor.execute(plan).rows), self.expected())
+        self.assertEqual(executor.stats["spools_built"], 1)
+        self.assertEqual(executor.stats["spool_reads"], 2)
+
+    def test_spool_memory_is_released_after_the_last_reader(self):
+        tracker = MemoryTracker(10 ** 8, 10 ** 8)
+        executor = Executor(self.data_dir, memory_tracker=tracker)
+        result = executor.execute({"common_expressions": {"expr_0": AMERICAS}, "query": query(spooled)})
+        self.assertGreater(executor.stats["memory_tracker"]["peak"], 0)
+        del result
+        gc.collect()
+        self.assertEqual(tracker.by_operator.get("spool", 0), 0)
+        self.assertEqual(tracker.current, 0)
+
+    def test_reading_past_the_references_fails(self):
+        executor = Executor(self.data_dir)
+        executor.prepare({}, {})
+        spool = Spool("expr_0", AMERICAS, 1)
+        self.assertEqual(len(spool.read(executor).rows), 3)
+        with self.assertRaises(RuntimeError):
+            spool.read(executor)
+
+
+if __name__ == "__main__":
+    unittest.main()
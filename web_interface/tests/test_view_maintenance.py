@@ -0,0 +1,96 @@
+"""
+Incremental maintenance of materialized views: appending rows to a base
+table adds to each view over it the rows a recomputation would, and leaves
+the other views alone.
+
+Run from web_interface with: python -m unittest discover tests
+"""
+
+import contextlib
+import io
+import os
+import shutil
+import tempfile
+import unittest
+
+from materialized_views import PARSER, append_rows, create_view, load_views
+
+CUSTOMER = ["1|Customer#1|addr|0|10-000|100.00|BUILDING|c", "2|Customer#2|addr|1|11-000|200.00|MACHINERY|c"]
+ORDERS = ["1|1|O|150.00|1995-01-01|1-URGENT|Clerk#1|0|c", "2|2|F|50.00|1995-02-01|2-HIGH|Clerk#2|0|c",
+          "3|2|O|300.00|1995-03-01|3-MEDIUM|Clerk#3|0|c"]
+NEW_CUSTOMERS = ["3|Customer#3|addr|2|12-000|300.00|HOUSEHOLD|c"]
+# One for an old customer, one for the new one, one filtered out
+NEW_ORDERS = ["4|1|O|400.00|1995-04-01|1-URGENT|Clerk#1|0|c", "5|3|O|500.00|1995-05-01|2-HIGH|Clerk#2|0|c",
+              "6|3|F|20.00|1995-06-01|5-LOW|Clerk#3|0|c"]
+
+BIG_ORDERS = ("SELECT O.O_ORDERKEY, O.O_TOTALPRICE, C.C_NAME FROM ORDERS O JOIN CUSTOMER C "
+              "ON O.O_CUSTKEY = C.C_CUSTKEY WHERE O.O_TOTALPRICE > 100;")
+URGENT = "SELECT O.O_ORDERKEY FROM ORDERS O WHERE O.O_ORDERPRIORITY = '1-URGENT';"
+BUILDING = "SELECT C.C_CUSTKEY, C.C_NAME FROM CUSTOMER C WHERE C.C_MKTSEGMENT = 'BUILDING';"
+
+
+def write_tbl(path, lines):
+    with open(path, "w") as f:
+        f.write("".join(line + "|\n" for line in lines))
+
+
+@unittest.skipUnless(os.path.exists(PARSER), "the SQL parser is not built")
+class AppendRowsTest(unittest.TestCase):
+    def setUp(self):
+        self.data_dir = tempfile.mkdtemp(prefix="view_maintenance_test_")
+        self.registry = os.path.join(self.data_dir, "materialized_views.json")
+        write_tbl(self.path("customer.tbl"), CUSTOMER)
+        write_tbl(self.path("orders.tbl"), ORDERS)
+        write_tbl(self.path("customer.u1"), NEW_CUSTOMERS)
+        write_tbl(self.path("orders.u1"), NEW_ORDERS)
+        with contextlib.redirect_stdout(io.StringIO()):
+            for name, sql in (("big_orders", BIG_ORDERS), ("urgent", URGENT), ("building", BUILDING)):
+                create_view(name, sql, self.data_dir, self.registry)
+
+    def tearDown(self):
+        shutil.rmtree(self.data_dir)
+
+    def path(self, name):
+        return os.path.join(self.data_dir, name)
+
+    def rows(self, view):
+        with open(self.path(f"{view}.tbl")) as f:
+            return sorted(f.read().splitlines())
+
+    def append(self, table):
+        with contextlib.redirect_stdout(io.StringIO()):
+            return append_rows(table, self.path(f"{table}.u1"), self.data_dir, self.registry)
+
+    def test_appends_match_recomputation(self):
+        self.assertEqual(self.append("customer"), {"big_orders": 0, "building": 0})
+        # The new customer's order joins the customer appended before it
+        self.assertEqual(self.append("orders"), {"big_orders": 2, "urgent": 1})
+
+        incremental = {name: self.rows(name) for name in ("big_orders", "urgent", "building")}
+        counts = {name: view["row_count"] for name, view in load_views(self.registry).items()}
+        with contextlib.redirect_stdout(io.StringIO()):
+            for name, sql in (("big_orders", BIG_ORDERS), ("urgent", URGENT), ("building", BUILDING)):
+                create_view(name, sql, self.data_dir, self.registry)
+        for name, rows in incremental.items():
+            self.assertEqual(rows, self.rows(name), name)
+            self.assertEqual(counts[name], len(rows), name)
+        self.assertEqual(len(incremental["big_orders"]), 4)
+
+    def test_base_table_is_extended(self):
+        self.append("orders")
+        with open(self.path("orders.tbl")) as f:
+            self.assertEqual(len(f.read().splitlines()), len(ORDERS) + len(NEW_ORDERS))
+
+    def test_failed_delta_leaves_table_and_views_alone(self):
+        write_tbl(self.path("orders.u1"), ["7|1|O|not a price|1995-07-01|1-URGENT|Clerk#1|0|c"])
+        before = self.rows("big_orders")
+        with self.assertRaises(ValueError):
+            self.append("orders")
+        with open(self.path("orders.tbl")) as f:
+            self.assertEqual(len(f.read().splitlines()), len(ORDERS))
+        self.assertEqual(self.rows("big_orders"), before)
+        self.assertEqual(load_views(self.registry)["big_orders"]["row_count"], len(before))
+
+
+if __name__ == "__main__":
+    unittest.main()